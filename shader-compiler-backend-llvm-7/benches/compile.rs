@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright 2018 Jacob Lifshay
+
+// `LLVM7Compiler::run` latency, from building the IR to loading the machine code,
+// for generated modules at each `OptimizationMode`
+
+extern crate shader_compiler_backend;
+extern crate shader_compiler_backend_llvm_7;
+
+use shader_compiler_backend::benchmark::{Runner, Throughput};
+use shader_compiler_backend::types::TypeBuilder;
+use shader_compiler_backend::*;
+use shader_compiler_backend_llvm_7::{LLVM7CompilerConfig, LLVM_7_SHADER_COMPILER};
+
+type GeneratedFunctionType = unsafe extern "C" fn() -> u32;
+
+/// a module with `function_count` functions that each return their index, and a constant
+/// array of `constant_count` words
+#[derive(Copy, Clone)]
+struct GeneratedModule {
+    function_count: usize,
+    constant_count: usize,
+}
+
+impl CompilerUser for GeneratedModule {
+    type FunctionKey = usize;
+    type Error = String;
+    fn create_error(message: String) -> String {
+        message
+    }
+    fn run<'a, C: Context<'a>>(
+        self,
+        context: &'a C,
+    ) -> Result<CompileInputs<'a, C, usize>, String> {
+        let type_builder = context.create_type_builder();
+        let u32_type = type_builder.build::<u32>();
+        let mut module = context.create_module("benchmark_module");
+        let constants: Vec<_> = (0..self.constant_count)
+            .map(|index| context.create_int_constant(u32_type.clone(), index as u64))
+            .collect();
+        module.add_constant_global(
+            "constants",
+            context.create_array_constant(u32_type.clone(), &constants),
+        );
+        let mut functions = Vec::new();
+        let mut detached_builder = context.create_builder();
+        for index in 0..self.function_count {
+            let mut function = module.add_function(
+                &format!("function_{}", index),
+                type_builder.build::<GeneratedFunctionType>(),
+            );
+            let builder = detached_builder.attach(function.append_new_basic_block(None));
+            detached_builder = builder.build_return(Some(
+                context.create_int_constant(u32_type.clone(), index as u64),
+            ));
+            functions.push((index, function));
+        }
+        Ok(CompileInputs {
+            module: module.verify().map_err(|error| error.to_string())?,
+            callable_functions: functions.into_iter().collect(),
+        })
+    }
+}
+
+fn main() {
+    let mut runner = Runner::from_args();
+    let modules = [
+        (
+            "small",
+            GeneratedModule {
+                function_count: 1,
+                constant_count: 16,
+            },
+        ),
+        (
+            "large",
+            GeneratedModule {
+                function_count: 2000,
+                constant_count: 65536,
+            },
+        ),
+    ];
+    let optimization_modes = [
+        OptimizationMode::NoOptimizations,
+        OptimizationMode::Normal,
+        OptimizationMode::Aggressive,
+    ];
+    for &(module_name, module) in &modules {
+        for &optimization_mode in &optimization_modes {
+            let config = LLVM7CompilerConfig::from(CompilerIndependentConfig { optimization_mode });
+            runner.run(
+                &format!("compile {} module {:?}", module_name, optimization_mode),
+                Throughput::Elements("functions", module.function_count as u64),
+                || {
+                    LLVM_7_SHADER_COMPILER.run(module, config.clone()).unwrap();
+                },
+            );
+        }
+    }
+}
@@ -230,6 +230,7 @@ fn main() {
 #include "llvm-c/OrcBindings.h"
 #include "llvm-c/Target.h"
 #include "llvm-c/Analysis.h"
+#include "llvm-c/Support.h"
 #include <stdbool.h>
 
 #ifdef __cplusplus
@@ -2,19 +2,25 @@
 // Copyright 2018 Jacob Lifshay
 use llvm;
 use shader_compiler_backend as backend;
+use shader_compiler_backend::intrinsics;
+use shader_compiler_backend::trace;
 use std::cell::RefCell;
+use std::collections::hash_map;
 use std::collections::HashMap;
 use std::collections::HashSet;
 use std::ffi::{CStr, CString};
 use std::fmt;
 use std::hash::Hash;
+use std::io;
 use std::mem;
 use std::mem::ManuallyDrop;
 use std::ops::Deref;
 use std::os::raw::{c_char, c_uint};
+use std::ptr::null;
 use std::ptr::null_mut;
 use std::ptr::NonNull;
-use std::sync::{Once, ONCE_INIT};
+use std::slice;
+use std::sync::{Arc, Mutex, Once};
 
 fn to_bool(v: llvm::LLVMBool) -> bool {
     v != 0
@@ -22,8 +28,12 @@ fn to_bool(v: llvm::LLVMBool) -> bool {
 
 #[derive(Clone)]
 pub struct LLVM7CompilerConfig {
+    /// the number of shader invocations run together in SIMD lanes.
+    /// defaults to the width of the host's vector registers in 32-bit lanes
     pub variable_vector_length_multiplier: u32,
     pub optimization_mode: backend::OptimizationMode,
+    /// if `Some`, compiled code is added to the session's JIT instance instead of a new one
+    pub session: Option<Arc<LLVM7CompilerSession>>,
 }
 
 impl Default for LLVM7CompilerConfig {
@@ -36,8 +46,9 @@ impl From<backend::CompilerIndependentConfig> for LLVM7CompilerConfig {
     fn from(v: backend::CompilerIndependentConfig) -> Self {
         let backend::CompilerIndependentConfig { optimization_mode } = v;
         Self {
-            variable_vector_length_multiplier: 1,
+            variable_vector_length_multiplier: unsafe { HostTarget::get().simd_lane_count },
             optimization_mode,
+            session: None,
         }
     }
 }
@@ -314,6 +325,37 @@ impl<'a> backend::Context<'a> for LLVM7Context {
             variable_vector_length_multiplier: self.config.variable_vector_length_multiplier,
         }
     }
+    fn create_int_constant(&self, ty: LLVM7Type, value: u64) -> LLVM7Value {
+        unsafe { LLVM7Value(llvm::LLVMConstInt(ty.0, value, false as llvm::LLVMBool)) }
+    }
+    fn create_float_constant(&self, ty: LLVM7Type, value: f64) -> LLVM7Value {
+        unsafe { LLVM7Value(llvm::LLVMConstReal(ty.0, value)) }
+    }
+    fn create_struct_constant(&self, members: &[LLVM7Value]) -> LLVM7Value {
+        assert_eq!(members.len() as c_uint as usize, members.len());
+        unsafe {
+            LLVM7Value(llvm::LLVMConstStructInContext(
+                self.context.as_ref().unwrap().0,
+                members.as_ptr() as *mut llvm::LLVMValueRef,
+                members.len() as c_uint,
+                false as llvm::LLVMBool,
+            ))
+        }
+    }
+    fn create_array_constant(
+        &self,
+        element_type: LLVM7Type,
+        elements: &[LLVM7Value],
+    ) -> LLVM7Value {
+        assert_eq!(elements.len() as c_uint as usize, elements.len());
+        unsafe {
+            LLVM7Value(llvm::LLVMConstArray(
+                element_type.0,
+                elements.as_ptr() as *mut llvm::LLVMValueRef,
+                elements.len() as c_uint,
+            ))
+        }
+    }
 }
 
 #[repr(transparent)]
@@ -398,18 +440,9 @@ impl fmt::Debug for LLVM7Module {
     }
 }
 
-impl<'a> backend::Module<'a> for LLVM7Module {
-    type Context = LLVM7Context;
-    fn set_source_file_name(&mut self, source_file_name: &str) {
-        unsafe {
-            llvm::LLVMSetSourceFileName(
-                self.module,
-                source_file_name.as_ptr() as *const c_char,
-                source_file_name.len(),
-            )
-        }
-    }
-    fn add_function(&mut self, name: &str, ty: LLVM7Type) -> LLVM7Function {
+impl LLVM7Module {
+    /// checks that `name` is a valid symbol name that's not already used in `self`
+    fn add_name(&mut self, name: &str) -> CString {
         fn is_start_char(c: char) -> bool {
             if c.is_ascii_alphabetic() {
                 true
@@ -426,7 +459,23 @@ impl<'a> backend::Module<'a> for LLVM7Module {
         assert!(is_start_char(name.chars().next().unwrap()));
         assert!(name.chars().all(is_continue_char));
         assert!(self.name_set.insert(name.into()));
-        let name = CString::new(name).unwrap();
+        CString::new(name).unwrap()
+    }
+}
+
+impl<'a> backend::Module<'a> for LLVM7Module {
+    type Context = LLVM7Context;
+    fn set_source_file_name(&mut self, source_file_name: &str) {
+        unsafe {
+            llvm::LLVMSetSourceFileName(
+                self.module,
+                source_file_name.as_ptr() as *const c_char,
+                source_file_name.len(),
+            )
+        }
+    }
+    fn add_function(&mut self, name: &str, ty: LLVM7Type) -> LLVM7Function {
+        let name = self.add_name(name);
         unsafe {
             let function = llvm::LLVMAddFunction(self.module, name.as_ptr(), ty.0);
             let mut parameters = Vec::new();
@@ -440,7 +489,18 @@ impl<'a> backend::Module<'a> for LLVM7Module {
             }
         }
     }
+    fn add_constant_global(&mut self, name: &str, value: LLVM7Value) -> LLVM7Value {
+        let name = self.add_name(name);
+        unsafe {
+            let global = llvm::LLVMAddGlobal(self.module, llvm::LLVMTypeOf(value.0), name.as_ptr());
+            llvm::LLVMSetInitializer(global, value.0);
+            llvm::LLVMSetGlobalConstant(global, true as llvm::LLVMBool);
+            llvm::LLVMSetLinkage(global, llvm::LLVMPrivateLinkage);
+            LLVM7Value(global)
+        }
+    }
     fn verify(self) -> Result<LLVM7Module, backend::VerificationFailure<'a, LLVM7Module>> {
+        let _span = trace::span("shader compiler", "verify");
         unsafe {
             let mut message = null_mut();
             let broken = to_bool(llvm::LLVMVerifyModule(
@@ -492,28 +552,350 @@ struct LLVM7OrcJITStack(llvm::LLVMOrcJITStackRef);
 impl Drop for LLVM7OrcJITStack {
     fn drop(&mut self) {
         unsafe {
-            match llvm::LLVMOrcDisposeInstance(self.0) {
-                llvm::LLVMOrcErrSuccess => {}
-                _ => {
-                    panic!("LLVMOrcDisposeInstance failed");
-                }
+            // panicking in drop could abort, so the error is only reported
+            if llvm::LLVMOrcErrSuccess != llvm::LLVMOrcDisposeInstance(self.0) {
+                eprintln!("LLVMOrcDisposeInstance failed");
             }
         }
     }
 }
 
 fn initialize_native_target() {
-    static ONCE: Once = ONCE_INIT;
+    static ONCE: Once = Once::new();
     ONCE.call_once(|| unsafe {
         llvm::LLVM_InitializeNativeTarget();
         llvm::LLVM_InitializeNativeAsmPrinter();
         llvm::LLVM_InitializeNativeAsmParser();
+        // make the process's symbols visible to `LLVMSearchForAddressOfSymbol`
+        llvm::LLVMLoadLibraryPermanently(null());
     });
 }
 
+/// resolves the external symbols of compiled code: kazan's intrinsics first, then the
+/// process's symbols for the library functions LLVM generates calls to, like `memcpy`.
+/// returns 0 for unknown symbols, which makes loading the code fail
 extern "C" fn symbol_resolver_fn<Void>(name: *const c_char, _lookup_context: *mut Void) -> u64 {
-    let name = unsafe { CStr::from_ptr(name) };
-    panic!("symbol_resolver_fn is unimplemented: name = {:?}", name)
+    let c_name = unsafe { CStr::from_ptr(name) };
+    let name = c_name.to_str().unwrap_or("");
+    // Mach-O prefixes symbol names with an underscore
+    #[cfg(target_os = "macos")]
+    let name = if name.starts_with('_') {
+        &name[1..]
+    } else {
+        name
+    };
+    if let Some(address) = intrinsics::find_intrinsic(name) {
+        return address as u64;
+    }
+    unsafe { llvm::LLVMSearchForAddressOfSymbol(c_name.as_ptr()) as usize as u64 }
+}
+
+struct LLVM7MemoryBuffer(llvm::LLVMMemoryBufferRef);
+
+impl Drop for LLVM7MemoryBuffer {
+    fn drop(&mut self) {
+        if !self.0.is_null() {
+            unsafe {
+                llvm::LLVMDisposeMemoryBuffer(self.0);
+            }
+        }
+    }
+}
+
+impl LLVM7MemoryBuffer {
+    fn take(mut self) -> llvm::LLVMMemoryBufferRef {
+        let retval = self.0;
+        self.0 = null_mut();
+        retval
+    }
+    fn as_bytes(&self) -> &[u8] {
+        unsafe {
+            slice::from_raw_parts(
+                llvm::LLVMGetBufferStart(self.0) as *const u8,
+                llvm::LLVMGetBufferSize(self.0),
+            )
+        }
+    }
+}
+
+/// get the width of the widest vector registers in 32-bit lanes from a
+/// `LLVMGetHostCPUFeatures` string, like `"+sse2,+avx2,-avx512f"`
+pub fn get_simd_lane_count(cpu_features: &str) -> u32 {
+    let has_feature = |feature: &str| {
+        cpu_features
+            .split(',')
+            .any(|v| v.starts_with('+') && &v[1..] == feature)
+    };
+    if has_feature("avx512f") {
+        16
+    } else if has_feature("avx2") {
+        8
+    } else if has_feature("sse2") || has_feature("neon") || has_feature("altivec") {
+        4
+    } else {
+        1
+    }
+}
+
+struct HostTarget {
+    target_triple: LLVM7String,
+    cpu_name: LLVM7String,
+    cpu_features: LLVM7String,
+    simd_lane_count: u32,
+}
+
+// never modified after initialization
+unsafe impl Sync for HostTarget {}
+
+impl HostTarget {
+    /// the host target doesn't change, so it's only retrieved once
+    unsafe fn get() -> &'static Self {
+        static ONCE: Once = Once::new();
+        static mut HOST_TARGET: Option<HostTarget> = None;
+        ONCE.call_once(|| {
+            let cpu_features = LLVM7String::from_ptr(llvm::LLVMGetHostCPUFeatures()).unwrap();
+            HOST_TARGET = Some(HostTarget {
+                target_triple: LLVM7String::from_ptr(llvm::LLVMGetDefaultTargetTriple()).unwrap(),
+                cpu_name: LLVM7String::from_ptr(llvm::LLVMGetHostCPUName()).unwrap(),
+                simd_lane_count: get_simd_lane_count(&cpu_features.to_string_lossy()),
+                cpu_features,
+            });
+        });
+        HOST_TARGET.as_ref().unwrap()
+    }
+    unsafe fn create_target_machine(
+        &self,
+        optimization_mode: backend::OptimizationMode,
+    ) -> Result<LLVM7TargetMachine, String> {
+        let mut target = null_mut();
+        let mut error = null_mut();
+        let success = !to_bool(llvm::LLVMGetTargetFromTriple(
+            self.target_triple.as_ptr(),
+            &mut target,
+            &mut error,
+        ));
+        if !success {
+            let error = LLVM7String::from_ptr(error).unwrap();
+            return Err(error.to_string_lossy().into());
+        }
+        if !to_bool(llvm::LLVMTargetHasJIT(target)) {
+            return Err(format!(
+                "target {:?} doesn't support JIT",
+                self.target_triple
+            ));
+        }
+        let target_machine = LLVM7TargetMachine(llvm::LLVMCreateTargetMachine(
+            target,
+            self.target_triple.as_ptr(),
+            self.cpu_name.as_ptr(),
+            self.cpu_features.as_ptr(),
+            match optimization_mode {
+                backend::OptimizationMode::NoOptimizations => llvm::LLVMCodeGenLevelNone,
+                backend::OptimizationMode::Normal => llvm::LLVMCodeGenLevelDefault,
+                backend::OptimizationMode::Aggressive => llvm::LLVMCodeGenLevelAggressive,
+            },
+            llvm::LLVMRelocDefault,
+            llvm::LLVMCodeModelJITDefault,
+        ));
+        assert!(!target_machine.0.is_null());
+        Ok(target_machine)
+    }
+}
+
+thread_local! {
+    /// target machines aren't thread-safe, so each thread has its own
+    static TARGET_MACHINES: RefCell<HashMap<backend::OptimizationMode, LLVM7TargetMachine>> =
+        RefCell::new(HashMap::new());
+}
+
+/// call `f` with the current thread's target machine for `optimization_mode`
+unsafe fn with_target_machine<R, F: FnOnce(&LLVM7TargetMachine) -> R>(
+    optimization_mode: backend::OptimizationMode,
+    f: F,
+) -> Result<R, String> {
+    TARGET_MACHINES.with(|target_machines| {
+        let mut target_machines = target_machines.borrow_mut();
+        let target_machine = match target_machines.entry(optimization_mode) {
+            hash_map::Entry::Occupied(entry) => entry.into_mut(),
+            hash_map::Entry::Vacant(entry) => {
+                entry.insert(HostTarget::get().create_target_machine(optimization_mode)?)
+            }
+        };
+        Ok(f(target_machine))
+    })
+}
+
+/// a JIT instance shared between compilations, so compiled code only has to add its object file
+/// to the JIT instance instead of creating a new one
+pub struct LLVM7CompilerSession {
+    orc_jit_stack: Mutex<LLVM7OrcJITStack>,
+}
+
+// orc_jit_stack is only used while locked
+unsafe impl Send for LLVM7CompilerSession {}
+unsafe impl Sync for LLVM7CompilerSession {}
+
+impl LLVM7CompilerSession {
+    pub fn new() -> Result<Self, String> {
+        initialize_native_target();
+        unsafe {
+            // the target machine is only used for compiling IR, which the session never does
+            let target_machine =
+                HostTarget::get().create_target_machine(backend::OptimizationMode::default())?;
+            Ok(Self {
+                orc_jit_stack: Mutex::new(LLVM7OrcJITStack(llvm::LLVMOrcCreateInstance(
+                    target_machine.take(),
+                ))),
+            })
+        }
+    }
+}
+
+/// an object file added to a `LLVM7CompilerSession`, removed when dropped
+struct LLVM7SessionModule {
+    session: Arc<LLVM7CompilerSession>,
+    module_handle: llvm::LLVMOrcModuleHandle,
+}
+
+impl Drop for LLVM7SessionModule {
+    fn drop(&mut self) {
+        // a panic while the lock was held doesn't stop the module from being removed
+        let orc_jit_stack = self
+            .session
+            .orc_jit_stack
+            .lock()
+            .unwrap_or_else(|error| error.into_inner());
+        unsafe {
+            // the module's code is leaked if it can't be removed, rather than panicking in drop
+            if llvm::LLVMOrcErrSuccess
+                != llvm::LLVMOrcRemoveModule(orc_jit_stack.0, self.module_handle)
+            {
+                eprintln!("LLVMOrcRemoveModule failed");
+            }
+        }
+    }
+}
+
+enum LLVM7JIT {
+    Owned(LLVM7OrcJITStack),
+    Session(LLVM7SessionModule),
+}
+
+struct LLVM7CompiledCode<K: Hash + Eq + Send + Sync + 'static> {
+    functions: HashMap<String, unsafe extern "C" fn()>,
+    object_code: backend::ObjectCode<K>,
+    jit: LLVM7JIT,
+}
+
+unsafe impl<K: Hash + Eq + Send + Sync + 'static> Send for LLVM7CompiledCode<K> {}
+unsafe impl<K: Hash + Eq + Send + Sync + 'static> Sync for LLVM7CompiledCode<K> {}
+
+impl<K: Hash + Eq + Send + Sync + 'static> backend::CompiledCode<K> for LLVM7CompiledCode<K> {
+    fn get(&self, key: &K) -> Option<unsafe extern "C" fn()> {
+        Some(*self.functions.get(self.object_code.symbols.get(key)?)?)
+    }
+    fn object_code(&self) -> &backend::ObjectCode<K> {
+        &self.object_code
+    }
+}
+
+unsafe fn get_function_addresses<'a, I: IntoIterator<Item = &'a String>>(
+    orc_jit_stack: &LLVM7OrcJITStack,
+    module_handle: llvm::LLVMOrcModuleHandle,
+    names: I,
+) -> Result<HashMap<String, unsafe extern "C" fn()>, String> {
+    let mut functions: HashMap<_, _> = HashMap::new();
+    for name in names {
+        if functions.contains_key(name) {
+            return Err(format!("duplicate function: {:?}", name));
+        }
+        let c_name = match CString::new(name.as_str()) {
+            Ok(c_name) => c_name,
+            Err(_) => return Err(format!("invalid function name: {:?}", name)),
+        };
+        let mut address: llvm::LLVMOrcTargetAddress = mem::zeroed();
+        if llvm::LLVMOrcErrSuccess != llvm::LLVMOrcGetSymbolAddressIn(
+            orc_jit_stack.0,
+            &mut address,
+            module_handle,
+            c_name.as_ptr(),
+        ) {
+            return Err(format!("function not found in compiled module: {:?}", name));
+        }
+        let address: Option<unsafe extern "C" fn()> = mem::transmute(address as usize);
+        match address {
+            Some(address) => {
+                functions.insert(name.clone(), address);
+            }
+            None => return Err(format!("function not found in compiled module: {:?}", name)),
+        }
+    }
+    Ok(functions)
+}
+
+unsafe fn add_object_file(
+    orc_jit_stack: &LLVM7OrcJITStack,
+    object_file: &[u8],
+) -> Result<llvm::LLVMOrcModuleHandle, String> {
+    let memory_buffer = LLVM7MemoryBuffer(llvm::LLVMCreateMemoryBufferWithMemoryRangeCopy(
+        object_file.as_ptr() as *const c_char,
+        object_file.len(),
+        b"kazan-object-code\0".as_ptr() as *const c_char,
+    ));
+    let mut module_handle = 0;
+    // LLVMOrcAddObjectFile takes ownership of memory_buffer
+    if llvm::LLVMOrcErrSuccess != llvm::LLVMOrcAddObjectFile(
+        orc_jit_stack.0,
+        &mut module_handle,
+        memory_buffer.take(),
+        Some(symbol_resolver_fn),
+        null_mut(),
+    ) {
+        return Err("loading object code failed".into());
+    }
+    Ok(module_handle)
+}
+
+unsafe fn load_object_code<K: Hash + Eq + Send + Sync + 'static>(
+    object_code: backend::ObjectCode<K>,
+    config: &LLVM7CompilerConfig,
+) -> Result<LLVM7CompiledCode<K>, String> {
+    let _span = trace::span("shader compiler", "load object code")
+        .arg("size", object_code.object_file.len() as u64);
+    initialize_native_target();
+    let (jit, functions) = match &config.session {
+        Some(session) => {
+            let orc_jit_stack = session.orc_jit_stack.lock().unwrap();
+            let module_handle = add_object_file(&orc_jit_stack, &object_code.object_file)?;
+            let functions =
+                get_function_addresses(&orc_jit_stack, module_handle, object_code.symbols.values());
+            mem::drop(orc_jit_stack);
+            // created before checking functions for errors so the module is removed on failure
+            let module = LLVM7SessionModule {
+                session: session.clone(),
+                module_handle,
+            };
+            (LLVM7JIT::Session(module), functions?)
+        }
+        None => {
+            let target_machine =
+                HostTarget::get().create_target_machine(config.optimization_mode)?;
+            let orc_jit_stack =
+                LLVM7OrcJITStack(llvm::LLVMOrcCreateInstance(target_machine.take()));
+            let module_handle = add_object_file(&orc_jit_stack, &object_code.object_file)?;
+            let functions = get_function_addresses(
+                &orc_jit_stack,
+                module_handle,
+                object_code.symbols.values(),
+            )?;
+            (LLVM7JIT::Owned(orc_jit_stack), functions)
+        }
+    };
+    Ok(LLVM7CompiledCode {
+        functions,
+        object_code,
+        jit,
+    })
 }
 
 #[derive(Copy, Clone)]
@@ -529,6 +911,7 @@ impl backend::Compiler for LLVM7Compiler {
         user: U,
         config: LLVM7CompilerConfig,
     ) -> Result<Box<dyn backend::CompiledCode<U::FunctionKey>>, U::Error> {
+        let _span = trace::span("shader compiler", "compile");
         unsafe {
             initialize_native_target();
             let context = OwnedContext(llvm::LLVMContextCreate());
@@ -541,17 +924,23 @@ impl backend::Compiler for LLVM7Compiler {
             let backend::CompileInputs {
                 module,
                 callable_functions,
-            } = user.run(&context)?;
-            let callable_functions: Vec<_> = callable_functions
+            } = {
+                let _span = trace::span("shader compiler", "build IR");
+                user.run(&context)?
+            };
+            let symbols: HashMap<_, _> = callable_functions
                 .into_iter()
                 .map(|(key, callable_function)| {
                     assert_eq!(
                         llvm::LLVMGetGlobalParent(callable_function.function),
                         module.module
                     );
-                    let name: CString =
-                        CStr::from_ptr(llvm::LLVMGetValueName(callable_function.function)).into();
-                    assert_ne!(name.to_bytes().len(), 0);
+                    let name: String =
+                        CStr::from_ptr(llvm::LLVMGetValueName(callable_function.function))
+                            .to_str()
+                            .unwrap()
+                            .into();
+                    assert_ne!(name.len(), 0);
                     (key, name)
                 })
                 .collect();
@@ -561,95 +950,65 @@ impl backend::Compiler for LLVM7Compiler {
                 .drain(..)
                 .find(|v| v.0 == module.module)
                 .unwrap();
-            let target_triple = LLVM7String::from_ptr(llvm::LLVMGetDefaultTargetTriple()).unwrap();
-            let mut target = null_mut();
             let mut error = null_mut();
-            let success = !to_bool(llvm::LLVMGetTargetFromTriple(
-                target_triple.as_ptr(),
-                &mut target,
-                &mut error,
-            ));
-            if !success {
+            let mut memory_buffer = null_mut();
+            let failed = with_target_machine(config.optimization_mode, |target_machine| {
+                let _span = trace::span("shader compiler", "codegen");
+                to_bool(llvm::LLVMTargetMachineEmitToMemoryBuffer(
+                    target_machine.0,
+                    module.0,
+                    llvm::LLVMObjectFile,
+                    &mut error,
+                    &mut memory_buffer,
+                ))
+            })
+            .map_err(U::create_error)?;
+            if failed {
                 let error = LLVM7String::from_ptr(error).unwrap();
                 return Err(U::create_error(error.to_string_lossy().into()));
             }
-            if !to_bool(llvm::LLVMTargetHasJIT(target)) {
-                return Err(U::create_error(format!(
-                    "target {:?} doesn't support JIT",
-                    target_triple
-                )));
-            }
-            let host_cpu_name = LLVM7String::from_ptr(llvm::LLVMGetHostCPUName()).unwrap();
-            let host_cpu_features = LLVM7String::from_ptr(llvm::LLVMGetHostCPUFeatures()).unwrap();
-            let target_machine = LLVM7TargetMachine(llvm::LLVMCreateTargetMachine(
-                target,
-                target_triple.as_ptr(),
-                host_cpu_name.as_ptr(),
-                host_cpu_features.as_ptr(),
-                match config.optimization_mode {
-                    backend::OptimizationMode::NoOptimizations => llvm::LLVMCodeGenLevelNone,
-                    backend::OptimizationMode::Normal => llvm::LLVMCodeGenLevelDefault,
-                },
-                llvm::LLVMRelocDefault,
-                llvm::LLVMCodeModelJITDefault,
-            ));
-            assert!(!target_machine.0.is_null());
-            let orc_jit_stack =
-                LLVM7OrcJITStack(llvm::LLVMOrcCreateInstance(target_machine.take()));
-            let mut module_handle = 0;
-            if llvm::LLVMOrcErrSuccess != llvm::LLVMOrcAddEagerlyCompiledIR(
-                orc_jit_stack.0,
-                &mut module_handle,
-                module.take(),
-                Some(symbol_resolver_fn),
-                null_mut(),
-            ) {
-                return Err(U::create_error("compilation failed".into()));
-            }
-            let mut functions: HashMap<_, _> = HashMap::new();
-            for (key, name) in callable_functions {
-                let mut address: llvm::LLVMOrcTargetAddress = mem::zeroed();
-                if llvm::LLVMOrcErrSuccess != llvm::LLVMOrcGetSymbolAddressIn(
-                    orc_jit_stack.0,
-                    &mut address,
-                    module_handle,
-                    name.as_ptr(),
-                ) {
-                    return Err(U::create_error(format!(
-                        "function not found in compiled module: {:?}",
-                        name
-                    )));
-                }
-                let address: Option<unsafe extern "C" fn()> = mem::transmute(address as usize);
-                if functions.insert(key, address.unwrap()).is_some() {
-                    return Err(U::create_error(format!("duplicate function: {:?}", name)));
-                }
-            }
-            struct CompiledCode<K: Hash + Eq + Send + Sync + 'static> {
-                functions: HashMap<K, unsafe extern "C" fn()>,
-                orc_jit_stack: ManuallyDrop<LLVM7OrcJITStack>,
-                context: ManuallyDrop<OwnedContext>,
-            }
-            unsafe impl<K: Hash + Eq + Send + Sync + 'static> Send for CompiledCode<K> {}
-            unsafe impl<K: Hash + Eq + Send + Sync + 'static> Sync for CompiledCode<K> {}
-            impl<K: Hash + Eq + Send + Sync + 'static> Drop for CompiledCode<K> {
-                fn drop(&mut self) {
-                    unsafe {
-                        ManuallyDrop::drop(&mut self.orc_jit_stack);
-                        ManuallyDrop::drop(&mut self.context);
-                    }
-                }
-            }
-            impl<K: Hash + Eq + Send + Sync + 'static> backend::CompiledCode<K> for CompiledCode<K> {
-                fn get(&self, key: &K) -> Option<unsafe extern "C" fn()> {
-                    Some(*self.functions.get(key)?)
-                }
-            }
-            Ok(Box::new(CompiledCode {
-                functions,
-                orc_jit_stack: ManuallyDrop::new(orc_jit_stack),
-                context: context.context.take().unwrap(),
-            }))
+            let memory_buffer = LLVM7MemoryBuffer(memory_buffer);
+            let object_code = backend::ObjectCode {
+                object_file: memory_buffer.as_bytes().into(),
+                symbols,
+            };
+            // the generated machine code doesn't depend on the LLVM module or context,
+            // so free them before loading
+            mem::drop(memory_buffer);
+            mem::drop(module);
+            mem::drop(context);
+            Ok(Box::new(
+                load_object_code(object_code, &config).map_err(U::create_error)?,
+            ))
+        }
+    }
+    fn get_code_fingerprint(self, config: &LLVM7CompilerConfig) -> String {
+        let LLVM7CompilerConfig {
+            variable_vector_length_multiplier,
+            optimization_mode,
+            session: _,
+        } = *config;
+        let host_target = unsafe { HostTarget::get() };
+        format!(
+            "{} (shader-compiler-backend-llvm-7 {}): target={} cpu={} features={} \
+             variable_vector_length_multiplier={} optimization_mode={:?}",
+            self.name(),
+            env!("CARGO_PKG_VERSION"),
+            host_target.target_triple.to_string_lossy(),
+            host_target.cpu_name.to_string_lossy(),
+            host_target.cpu_features.to_string_lossy(),
+            variable_vector_length_multiplier,
+            optimization_mode,
+        )
+    }
+    fn load_object_code<K: Hash + Eq + Send + Sync + 'static>(
+        self,
+        object_code: backend::ObjectCode<K>,
+        config: LLVM7CompilerConfig,
+    ) -> io::Result<Box<dyn backend::CompiledCode<K>>> {
+        match unsafe { load_object_code(object_code, &config) } {
+            Ok(compiled_code) => Ok(Box::new(compiled_code)),
+            Err(error) => Err(io::Error::new(io::ErrorKind::InvalidData, error)),
         }
     }
 }
@@ -17,5 +17,6 @@ mod backend;
 mod tests;
 
 pub use backend::LLVM7CompilerConfig;
+pub use backend::LLVM7CompilerSession;
 
 pub const LLVM_7_SHADER_COMPILER: backend::LLVM7Compiler = backend::LLVM7Compiler;
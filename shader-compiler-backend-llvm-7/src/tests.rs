@@ -7,6 +7,7 @@ mod tests {
     use shader_compiler_backend::types::TypeBuilder;
     use shader_compiler_backend::*;
     use std::mem;
+    use std::sync::Arc;
 
     fn make_compiler() -> impl Compiler {
         ::LLVM_7_SHADER_COMPILER
@@ -97,4 +98,154 @@ mod tests {
             function(0);
         }
     }
+
+    #[test]
+    fn test_load_object_code() {
+        type GeneratedFunctionType = unsafe extern "C" fn(u32);
+        struct Test;
+        impl CompilerUser for Test {
+            type FunctionKey = u32;
+            type Error = String;
+            fn create_error(message: String) -> String {
+                message
+            }
+            fn run<'a, C: Context<'a>>(
+                self,
+                context: &'a C,
+            ) -> Result<CompileInputs<'a, C, u32>, String> {
+                let type_builder = context.create_type_builder();
+                let mut module = context.create_module("test_module");
+                let mut function = module.add_function(
+                    "test_function",
+                    type_builder.build::<GeneratedFunctionType>(),
+                );
+                let builder = context.create_builder();
+                let builder = builder.attach(function.append_new_basic_block(None));
+                builder.build_return(None);
+                let module = module.verify().unwrap();
+                Ok(CompileInputs {
+                    module,
+                    callable_functions: vec![(0, function)].into_iter().collect(),
+                })
+            }
+        }
+        let compiler = make_compiler();
+        let compiled_code = compiler.run(Test, Default::default()).unwrap();
+        let object_code = compiled_code.object_code().clone();
+        assert_ne!(object_code.object_file.len(), 0);
+        drop(compiled_code);
+        let session = Arc::new(::LLVM7CompilerSession::new().unwrap());
+        let session_config = ::LLVM7CompilerConfig {
+            session: Some(session),
+            ..Default::default()
+        };
+        let loaded_code = compiler
+            .load_object_code(object_code.clone(), Default::default())
+            .unwrap();
+        // load twice into the same session to check that the modules don't conflict
+        let session_loaded_code: Vec<_> = (0..2)
+            .map(|_| {
+                ::LLVM_7_SHADER_COMPILER
+                    .load_object_code(object_code.clone(), session_config.clone())
+                    .unwrap()
+            })
+            .collect();
+        for loaded_code in Some(&loaded_code).into_iter().chain(&session_loaded_code) {
+            let function = loaded_code.get(&0).unwrap();
+            unsafe {
+                let function: GeneratedFunctionType = mem::transmute(function);
+                function(0);
+            }
+        }
+    }
+
+    #[test]
+    fn test_constants() {
+        #[repr(C)]
+        #[derive(Debug, PartialEq)]
+        struct Table {
+            flag: bool,
+            value: f32,
+            elements: [u16; 4],
+        }
+        // returns a pointer to the constant global, so the test reads the table the compiled
+        // code sees
+        type GeneratedFunctionType = unsafe extern "C" fn() -> *const Table;
+        struct Test;
+        impl CompilerUser for Test {
+            type FunctionKey = u32;
+            type Error = String;
+            fn create_error(message: String) -> String {
+                message
+            }
+            fn run<'a, C: Context<'a>>(
+                self,
+                context: &'a C,
+            ) -> Result<CompileInputs<'a, C, u32>, String> {
+                let type_builder = context.create_type_builder();
+                let mut module = context.create_module("test_module");
+                let elements: Vec<_> = (0..4)
+                    .map(|v| context.create_int_constant(type_builder.build::<u16>(), v * 3))
+                    .collect();
+                let table = context.create_struct_constant(&[
+                    context.create_int_constant(type_builder.build::<bool>(), 1),
+                    context.create_float_constant(type_builder.build::<f32>(), 0.5),
+                    context.create_array_constant(type_builder.build::<u16>(), &elements),
+                ]);
+                let table = module.add_constant_global("table", table);
+                let table_type = type_builder.build_struct(&[
+                    type_builder.build::<bool>(),
+                    type_builder.build::<f32>(),
+                    type_builder.build::<[u16; 4]>(),
+                ]);
+                let mut function = module.add_function(
+                    "test_function",
+                    type_builder.build_function(&[], Some(type_builder.build_pointer(table_type))),
+                );
+                let builder = context.create_builder();
+                let builder = builder.attach(function.append_new_basic_block(None));
+                builder.build_return(Some(table));
+                let module = module.verify().unwrap();
+                Ok(CompileInputs {
+                    module,
+                    callable_functions: vec![(0, function)].into_iter().collect(),
+                })
+            }
+        }
+        for &optimization_mode in &[OptimizationMode::NoOptimizations, OptimizationMode::Normal] {
+            let config =
+                ::LLVM7CompilerConfig::from(CompilerIndependentConfig { optimization_mode });
+            let compiled_code = ::LLVM_7_SHADER_COMPILER.run(Test, config).unwrap();
+            let function = compiled_code.get(&0).unwrap();
+            unsafe {
+                let function: GeneratedFunctionType = mem::transmute(function);
+                assert_eq!(
+                    *function(),
+                    Table {
+                        flag: true,
+                        value: 0.5,
+                        elements: [0, 3, 6, 9],
+                    }
+                );
+            }
+        }
+    }
+
+    #[test]
+    fn test_get_simd_lane_count() {
+        assert_eq!(
+            ::backend::get_simd_lane_count("+sse2,+avx,-avx2,-avx512f"),
+            4
+        );
+        assert_eq!(
+            ::backend::get_simd_lane_count("+sse2,+avx,+avx2,-avx512f"),
+            8
+        );
+        assert_eq!(
+            ::backend::get_simd_lane_count("+avx2,+avx512f,+avx512vl"),
+            16
+        );
+        assert_eq!(::backend::get_simd_lane_count("+neon"), 4);
+        assert_eq!(::backend::get_simd_lane_count(""), 1);
+    }
 }
@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright 2018 Jacob Lifshay
+
+//! a small benchmark runner for Kazan's `cargo bench` targets, which use `harness = false`
+//!
+//! Each benchmark prints one line of JSON to stdout, so results can be saved and compared
+//! between revisions by scripts; a readable summary goes to stderr. Times are per iteration.
+//! The command line arguments are substrings of the names of the benchmarks to run, and no
+//! arguments run all of them, so `cargo bench --features benchmarks -- copy` only runs the copy
+//! benchmarks. The module is only built with the `benchmarks` feature.
+
+use std::env;
+use std::time::{Duration, Instant};
+
+/// the minimum length of a sample in nanoseconds, which is as many iterations as fit
+const MIN_SAMPLE_TIME: u64 = 10_000_000;
+/// the number of samples taken, unless they take longer than `MAX_BENCHMARK_TIME`
+const SAMPLE_COUNT: usize = 20;
+/// the time in nanoseconds after which no more samples are taken, once there are
+/// `MIN_SAMPLE_COUNT`
+const MAX_BENCHMARK_TIME: u64 = 3_000_000_000;
+/// the minimum number of samples taken
+const MIN_SAMPLE_COUNT: usize = 5;
+
+/// the amount of work done by each iteration of a benchmark
+#[derive(Copy, Clone, Debug)]
+pub enum Throughput {
+    /// the number of bytes processed
+    Bytes(u64),
+    /// the number of elements processed, with the plural name of an element
+    Elements(&'static str, u64),
+}
+
+/// runs the benchmarks selected by the command line arguments
+pub struct Runner {
+    filters: Vec<String>,
+}
+
+fn to_nanoseconds(duration: Duration) -> u64 {
+    duration.as_secs() * 1_000_000_000 + u64::from(duration.subsec_nanos())
+}
+
+impl Runner {
+    /// create a `Runner` from the command line arguments, ignoring the flags cargo passes
+    pub fn from_args() -> Self {
+        Self {
+            filters: env::args()
+                .skip(1)
+                .filter(|arg| !arg.starts_with("--"))
+                .collect(),
+        }
+    }
+    /// returns true if the benchmark `name` is selected
+    pub fn is_selected(&self, name: &str) -> bool {
+        self.filters.is_empty() || self.filters.iter().any(|filter| name.contains(&**filter))
+    }
+    /// time `f` and print the results, if the benchmark `name` is selected.
+    /// `name` is written into the JSON as is, so it must not need escaping
+    pub fn run<F: FnMut()>(&mut self, name: &str, throughput: Throughput, mut f: F) {
+        if !self.is_selected(name) {
+            return;
+        }
+        // the first iteration also warms up caches and allocations
+        let start_time = Instant::now();
+        f();
+        let first_iteration_time = to_nanoseconds(start_time.elapsed()).max(1);
+        let iterations = (MIN_SAMPLE_TIME / first_iteration_time).max(1);
+        let mut samples = Vec::with_capacity(SAMPLE_COUNT);
+        let start_time = Instant::now();
+        while samples.len() < SAMPLE_COUNT
+            && (samples.len() < MIN_SAMPLE_COUNT
+                || to_nanoseconds(start_time.elapsed()) < MAX_BENCHMARK_TIME)
+        {
+            let sample_start_time = Instant::now();
+            for _ in 0..iterations {
+                f();
+            }
+            samples.push(to_nanoseconds(sample_start_time.elapsed()) as f64 / iterations as f64);
+        }
+        samples.sort_by(|a, b| a.partial_cmp(b).unwrap());
+        let min = samples[0];
+        let median = samples[samples.len() / 2];
+        let mean = samples.iter().sum::<f64>() / samples.len() as f64;
+        let (amount, unit) = match throughput {
+            Throughput::Bytes(bytes) => (bytes, "bytes"),
+            Throughput::Elements(unit, count) => (count, unit),
+        };
+        let throughput = amount as f64 * 1e9 / median;
+        println!(
+            "{{\"name\":\"{}\",\"samples\":{},\"iterations_per_sample\":{},\"min_ns\":{:.0},\
+             \"median_ns\":{:.0},\"mean_ns\":{:.0},\"throughput\":{},\"unit\":\"{}/s\"}}",
+            name,
+            samples.len(),
+            iterations,
+            min,
+            median,
+            mean,
+            throughput,
+            unit,
+        );
+        eprintln!(
+            "{}: {:.3} ms, {:.4e} {}/s",
+            name,
+            median / 1e6,
+            throughput,
+            unit
+        );
+    }
+}
@@ -0,0 +1,547 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright 2018 Jacob Lifshay
+
+//! runtime library of intrinsics that compiled shaders call instead of inlining them
+//!
+//! Every intrinsic works on a whole SIMD group at once: arguments and results are passed as
+//! pointers to arrays with one element per lane, followed by the lane count. Compiled code
+//! spills its vectors to the stack, calls the intrinsic, and loads the results back, so one
+//! copy of each intrinsic serves every vector length. Result arrays must not overlap argument
+//! arrays.
+//!
+//! The kernels are branchless per lane, so the loops compile to the host's SIMD instructions.
+
+use std::f32;
+use std::slice;
+
+/// `VkSamplerAddressMode::VK_SAMPLER_ADDRESS_MODE_REPEAT`
+pub const ADDRESS_MODE_REPEAT: u32 = 0;
+/// `VkSamplerAddressMode::VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT`
+pub const ADDRESS_MODE_MIRRORED_REPEAT: u32 = 1;
+/// `VkSamplerAddressMode::VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE`
+pub const ADDRESS_MODE_CLAMP_TO_EDGE: u32 = 2;
+/// `VkSamplerAddressMode::VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER`, the border is transparent black
+pub const ADDRESS_MODE_CLAMP_TO_BORDER: u32 = 3;
+/// `VkSamplerAddressMode::VK_SAMPLER_ADDRESS_MODE_MIRROR_CLAMP_TO_EDGE`
+pub const ADDRESS_MODE_MIRROR_CLAMP_TO_EDGE: u32 = 4;
+
+/// a 2D image with `R32G32B32A32_SFLOAT` texels, as read by the sampling intrinsics
+#[repr(C)]
+#[derive(Copy, Clone, Debug)]
+pub struct Image2D {
+    /// the texels in row-major order
+    pub texels: *const [f32; 4],
+    /// the width in texels, must not be zero
+    pub width: u32,
+    /// the height in texels, must not be zero
+    pub height: u32,
+    /// the distance between the starts of consecutive rows, in texels
+    pub row_pitch: u32,
+    /// one of the `ADDRESS_MODE_*` constants
+    pub address_mode_u: u32,
+    /// one of the `ADDRESS_MODE_*` constants
+    pub address_mode_v: u32,
+}
+
+unsafe fn map_lanes<A: Copy, R, F: Fn(A) -> R>(
+    results: *mut R,
+    arguments: *const A,
+    lane_count: usize,
+    f: F,
+) {
+    let results = slice::from_raw_parts_mut(results, lane_count);
+    let arguments = slice::from_raw_parts(arguments, lane_count);
+    for (result, &argument) in results.iter_mut().zip(arguments) {
+        *result = f(argument);
+    }
+}
+
+unsafe fn map_lanes2<A: Copy, B: Copy, R, F: Fn(A, B) -> R>(
+    results: *mut R,
+    arguments_a: *const A,
+    arguments_b: *const B,
+    lane_count: usize,
+    f: F,
+) {
+    let results = slice::from_raw_parts_mut(results, lane_count);
+    let arguments_a = slice::from_raw_parts(arguments_a, lane_count);
+    let arguments_b = slice::from_raw_parts(arguments_b, lane_count);
+    for ((result, &a), &b) in results.iter_mut().zip(arguments_a).zip(arguments_b) {
+        *result = f(a, b);
+    }
+}
+
+fn select(condition: bool, true_value: f32, false_value: f32) -> f32 {
+    if condition {
+        true_value
+    } else {
+        false_value
+    }
+}
+
+/// reduces `x_abs` to `r` in `[-pi/4, pi/4]` and the quadrant `k` where
+/// `x_abs == k * pi / 2 + r` modulo `2 * pi`
+fn reduce_angle(x_abs: f32) -> (f32, u32) {
+    const DP1: f32 = 0.785_156_25;
+    const DP2: f32 = 2.418_756_5e-4;
+    const DP3: f32 = 3.774_895e-8;
+    let j = ((x_abs * (4.0 / f32::consts::PI)) as u32).wrapping_add(1) & !1;
+    let y = j as f32;
+    let r = ((x_abs - y * DP1) - y * DP2) - y * DP3;
+    (r, (j >> 1) & 3)
+}
+
+/// sine for `r` in `[-pi/4, pi/4]`
+fn sin_polynomial(r: f32) -> f32 {
+    let z = r * r;
+    r + r * z * ((-1.951_529_6e-4 * z + 8.332_161e-3) * z - 1.666_665_5e-1)
+}
+
+/// cosine for `r` in `[-pi/4, pi/4]`
+fn cos_polynomial(r: f32) -> f32 {
+    let z = r * r;
+    1.0 - 0.5 * z + z * z * ((2.443_315_7e-5 * z - 1.388_731_6e-3) * z + 4.166_664_6e-2)
+}
+
+/// `sin(k * pi / 2 + r)`, with the sign flipped if `negate`
+fn sin_quadrant(r: f32, k: u32, negate: bool) -> f32 {
+    let v = select(k & 1 != 0, cos_polynomial(r), sin_polynomial(r));
+    let sign = ((k & 2) << 30) ^ ((negate as u32) << 31);
+    f32::from_bits(v.to_bits() ^ sign)
+}
+
+fn sin(x: f32) -> f32 {
+    let (r, k) = reduce_angle(x.abs());
+    select(x.is_finite(), sin_quadrant(r, k, x < 0.0), f32::NAN)
+}
+
+fn cos(x: f32) -> f32 {
+    let (r, k) = reduce_angle(x.abs());
+    select(x.is_finite(), sin_quadrant(r, k + 1, false), f32::NAN)
+}
+
+fn tan(x: f32) -> f32 {
+    let (r, k) = reduce_angle(x.abs());
+    let v = sin_quadrant(r, k, x < 0.0) / sin_quadrant(r, k + 1, false);
+    select(x.is_finite(), v, f32::NAN)
+}
+
+fn exp2(x: f32) -> f32 {
+    // the clamped range still overflows to infinity and underflows through the denormals
+    let clamped_x = x.max(-150.0).min(129.0);
+    let i = (clamped_x + 0.5).floor();
+    let f = clamped_x - i;
+    let p = 1.0
+        + f * (((((1.535_336_2e-4 * f + 1.339_887_4e-3) * f + 9.618_437e-3) * f + 5.550_332_5e-2)
+            * f
+            + 2.402_264_8e-1)
+            * f
+            + 6.931_472e-1);
+    // scale in two steps so every exponent in the clamped range is representable
+    let i = i as i32;
+    let i_low = i >> 1;
+    let scale_low = f32::from_bits(((i_low + 127) as u32) << 23);
+    let scale_high = f32::from_bits(((i - i_low + 127) as u32) << 23);
+    select(x.is_nan(), x, p * scale_low * scale_high)
+}
+
+fn exp(x: f32) -> f32 {
+    exp2(x * f32::consts::LOG2_E)
+}
+
+/// splits `x` into `(e, ln(m))` where `x == 2^e * m` and `m` is in `[sqrt(1/2), sqrt(2))`.
+/// only valid for positive normal `x`
+fn log_parts(x: f32) -> (f32, f32) {
+    let bits = x.to_bits();
+    let m = f32::from_bits((bits & 0x007F_FFFF) | 0x3F80_0000);
+    let is_big = m > f32::consts::SQRT_2;
+    let m = select(is_big, m * 0.5, m);
+    let e = ((bits >> 23) & 0xFF) as i32 - 127 + is_big as i32;
+    let f = m - 1.0;
+    let z = f * f;
+    let p = (((((((7.037_683_6e-2 * f - 1.151_461e-1) * f + 1.167_699_9e-1) * f
+        - 1.242_014_1e-1)
+        * f
+        + 1.424_932_3e-1)
+        * f
+        - 1.666_805_8e-1)
+        * f
+        + 2.000_071_5e-1)
+        * f
+        - 2.499_999_4e-1)
+        * f
+        + 3.333_333e-1;
+    (e as f32, f + (f * z * p - 0.5 * z))
+}
+
+/// handles the inputs `log_parts` isn't valid for; denormals are flushed to zero
+fn log_special_cases(x: f32, v: f32) -> f32 {
+    let v = select(x == f32::INFINITY, x, v);
+    let v = select(x < f32::MIN_POSITIVE, f32::NEG_INFINITY, v);
+    select(x.is_nan() || x < 0.0, f32::NAN, v)
+}
+
+fn log2(x: f32) -> f32 {
+    let (e, ln_m) = log_parts(x);
+    log_special_cases(x, e + ln_m * f32::consts::LOG2_E)
+}
+
+fn log(x: f32) -> f32 {
+    let (e, ln_m) = log_parts(x);
+    log_special_cases(x, e * f32::consts::LN_2 + ln_m)
+}
+
+fn pow(x: f32, y: f32) -> f32 {
+    exp2(y * log2(x))
+}
+
+fn inverse_sqrt(x: f32) -> f32 {
+    1.0 / x.sqrt()
+}
+
+/// decodes an 8-bit `UNORM` channel. the texel conversions are shared with the driver's blits
+/// and clears
+pub fn unorm8_to_f32(v: u8) -> f32 {
+    f32::from(v) * (1.0 / 255.0)
+}
+
+/// encodes an 8-bit `UNORM` channel, clamping to `0.0..=1.0`
+pub fn f32_to_unorm8(v: f32) -> u8 {
+    // `max` returns 0 for NaN
+    (v.max(0.0).min(1.0) * 255.0 + 0.5) as u8
+}
+
+/// decodes an sRGB-encoded channel
+pub fn srgb8_to_linear_f32(v: u8) -> f32 {
+    let v = unorm8_to_f32(v);
+    select(
+        v <= 0.040_45,
+        v * (1.0 / 12.92),
+        pow((v + 0.055) * (1.0 / 1.055), 2.4),
+    )
+}
+
+/// encodes a linear channel as sRGB
+pub fn linear_f32_to_srgb8(v: f32) -> u8 {
+    let v = v.max(0.0).min(1.0);
+    f32_to_unorm8(select(
+        v <= 0.003_130_8,
+        v * 12.92,
+        1.055 * pow(v, 1.0 / 2.4) - 0.055,
+    ))
+}
+
+/// converts the bits of a half-precision float
+pub fn f16_to_f32(v: u16) -> f32 {
+    const SHIFTED_EXPONENT: u32 = 0x7C00 << 13;
+    let magic = f32::from_bits(113 << 23);
+    let sign = u32::from(v & 0x8000) << 16;
+    let bits = u32::from(v & 0x7FFF) << 13;
+    let exponent = bits & SHIFTED_EXPONENT;
+    let bits = bits + ((127 - 15) << 23);
+    let bits = if exponent == SHIFTED_EXPONENT {
+        // infinity or NaN
+        bits + ((128 - 16) << 23)
+    } else if exponent == 0 {
+        // zero or denormal, renormalized by the subtraction
+        (f32::from_bits(bits + (1 << 23)) - magic).to_bits()
+    } else {
+        bits
+    };
+    f32::from_bits(bits | sign)
+}
+
+/// converts to the bits of a half-precision float, rounding to nearest even
+pub fn f32_to_f16(v: f32) -> u16 {
+    const F32_INFINITY: u32 = 0xFF << 23;
+    const F16_OVERFLOW: u32 = (127 + 16) << 23;
+    const F16_MIN_NORMAL: u32 = (127 - 14) << 23;
+    const DENORMAL_MAGIC: u32 = ((127 - 15) + (23 - 10) + 1) << 23;
+    let bits = v.to_bits();
+    let sign = bits & 0x8000_0000;
+    let bits = bits ^ sign;
+    let retval = if bits >= F16_OVERFLOW {
+        if bits > F32_INFINITY {
+            0x7E00
+        } else {
+            0x7C00
+        }
+    } else if bits < F16_MIN_NORMAL {
+        // adding the magic number shifts the mantissa into place, rounding it
+        (f32::from_bits(bits) + f32::from_bits(DENORMAL_MAGIC)).to_bits() - DENORMAL_MAGIC
+    } else {
+        let mantissa_odd = (bits >> 13) & 1;
+        // rebias the exponent and round
+        bits.wrapping_add(((15 - 127) << 23) as u32)
+            .wrapping_add(0xFFF + mantissa_odd)
+            >> 13
+    };
+    (retval | (sign >> 16)) as u16
+}
+
+/// `mirror` from the Vulkan specification's texel coordinate wrapping
+fn mirror(v: i32) -> i32 {
+    if v >= 0 {
+        v
+    } else {
+        -(1 + v)
+    }
+}
+
+/// applies the address mode to a texel coordinate, returns -1 for the border
+fn wrap_texel_coordinate(v: i32, size: u32, address_mode: u32) -> i32 {
+    let size = size as i32;
+    match address_mode {
+        ADDRESS_MODE_REPEAT => ((v % size) + size) % size,
+        ADDRESS_MODE_MIRRORED_REPEAT => {
+            let period = 2 * size;
+            (size - 1) - mirror((((v % period) + period) % period) - size)
+        }
+        ADDRESS_MODE_CLAMP_TO_BORDER => {
+            if v >= 0 && v < size {
+                v
+            } else {
+                -1
+            }
+        }
+        ADDRESS_MODE_MIRROR_CLAMP_TO_EDGE => mirror(v).min(size - 1),
+        _ => v.max(0).min(size - 1),
+    }
+}
+
+unsafe fn fetch_texel(image: &Image2D, x: i32, y: i32) -> [f32; 4] {
+    let x = wrap_texel_coordinate(x, image.width, image.address_mode_u);
+    let y = wrap_texel_coordinate(y, image.height, image.address_mode_v);
+    if x < 0 || y < 0 {
+        [0.0; 4]
+    } else {
+        *image
+            .texels
+            .add(y as usize * image.row_pitch as usize + x as usize)
+    }
+}
+
+unsafe fn sample_nearest(image: &Image2D, u: f32, v: f32) -> [f32; 4] {
+    let x = (u * image.width as f32).floor() as i32;
+    let y = (v * image.height as f32).floor() as i32;
+    fetch_texel(image, x, y)
+}
+
+unsafe fn sample_linear(image: &Image2D, u: f32, v: f32) -> [f32; 4] {
+    let x = u * image.width as f32 - 0.5;
+    let y = v * image.height as f32 - 0.5;
+    let x0 = x.floor();
+    let y0 = y.floor();
+    let (a, b) = (x - x0, y - y0);
+    let (x0, y0) = (x0 as i32, y0 as i32);
+    let t00 = fetch_texel(image, x0, y0);
+    let t10 = fetch_texel(image, x0.wrapping_add(1), y0);
+    let t01 = fetch_texel(image, x0, y0.wrapping_add(1));
+    let t11 = fetch_texel(image, x0.wrapping_add(1), y0.wrapping_add(1));
+    let mut retval = [0.0; 4];
+    for i in 0..4 {
+        let top = t00[i] + (t10[i] - t00[i]) * a;
+        let bottom = t01[i] + (t11[i] - t01[i]) * a;
+        retval[i] = top + (bottom - top) * b;
+    }
+    retval
+}
+
+macro_rules! unary_intrinsic {
+    ($name:ident, $argument:ty, $result:ty, $f:expr) => {
+        unsafe extern "C" fn $name(
+            results: *mut $result,
+            arguments: *const $argument,
+            lane_count: usize,
+        ) {
+            map_lanes(results, arguments, lane_count, $f)
+        }
+    };
+}
+
+unary_intrinsic!(glsl_std_450_sin_f32, f32, f32, sin);
+unary_intrinsic!(glsl_std_450_cos_f32, f32, f32, cos);
+unary_intrinsic!(glsl_std_450_tan_f32, f32, f32, tan);
+unary_intrinsic!(glsl_std_450_exp_f32, f32, f32, exp);
+unary_intrinsic!(glsl_std_450_exp2_f32, f32, f32, exp2);
+unary_intrinsic!(glsl_std_450_log_f32, f32, f32, log);
+unary_intrinsic!(glsl_std_450_log2_f32, f32, f32, log2);
+unary_intrinsic!(glsl_std_450_inverse_sqrt_f32, f32, f32, inverse_sqrt);
+unary_intrinsic!(convert_unorm8_to_f32, u8, f32, unorm8_to_f32);
+unary_intrinsic!(convert_f32_to_unorm8, f32, u8, f32_to_unorm8);
+unary_intrinsic!(convert_srgb8_to_linear_f32, u8, f32, srgb8_to_linear_f32);
+unary_intrinsic!(convert_linear_f32_to_srgb8, f32, u8, linear_f32_to_srgb8);
+unary_intrinsic!(convert_f16_to_f32, u16, f32, f16_to_f32);
+unary_intrinsic!(convert_f32_to_f16, f32, u16, f32_to_f16);
+
+unsafe extern "C" fn glsl_std_450_pow_f32(
+    results: *mut f32,
+    x: *const f32,
+    y: *const f32,
+    lane_count: usize,
+) {
+    map_lanes2(results, x, y, lane_count, pow)
+}
+
+unsafe extern "C" fn image_2d_sample_nearest_rgba32f(
+    results: *mut [f32; 4],
+    image: *const Image2D,
+    u: *const f32,
+    v: *const f32,
+    lane_count: usize,
+) {
+    let image = &*image;
+    map_lanes2(results, u, v, lane_count, |u, v| {
+        sample_nearest(image, u, v)
+    })
+}
+
+unsafe extern "C" fn image_2d_sample_linear_rgba32f(
+    results: *mut [f32; 4],
+    image: *const Image2D,
+    u: *const f32,
+    v: *const f32,
+    lane_count: usize,
+) {
+    let image = &*image;
+    map_lanes2(results, u, v, lane_count, |u, v| sample_linear(image, u, v))
+}
+
+macro_rules! intrinsics {
+    ($($name:ident,)*) => {
+        /// the symbol names of all intrinsics
+        pub const INTRINSIC_NAMES: &[&str] = &[$(concat!("kazan_", stringify!($name)),)*];
+
+        /// get the address of the intrinsic with the symbol name `name`
+        pub fn find_intrinsic(name: &str) -> Option<usize> {
+            match name {
+                $(concat!("kazan_", stringify!($name)) => Some($name as usize),)*
+                _ => None,
+            }
+        }
+    };
+}
+
+intrinsics! {
+    glsl_std_450_sin_f32,
+    glsl_std_450_cos_f32,
+    glsl_std_450_tan_f32,
+    glsl_std_450_pow_f32,
+    glsl_std_450_exp_f32,
+    glsl_std_450_exp2_f32,
+    glsl_std_450_log_f32,
+    glsl_std_450_log2_f32,
+    glsl_std_450_inverse_sqrt_f32,
+    convert_unorm8_to_f32,
+    convert_f32_to_unorm8,
+    convert_srgb8_to_linear_f32,
+    convert_linear_f32_to_srgb8,
+    convert_f16_to_f32,
+    convert_f32_to_f16,
+    image_2d_sample_nearest_rgba32f,
+    image_2d_sample_linear_rgba32f,
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn assert_close(actual: f32, expected: f32, tolerance: f32) {
+        let error = (actual - expected).abs() / expected.abs().max(1.0);
+        assert!(
+            error <= tolerance,
+            "actual = {}, expected = {}",
+            actual,
+            expected
+        );
+    }
+
+    #[test]
+    fn test_math() {
+        for i in -2000..=2000 {
+            let x = i as f32 * 0.01;
+            assert_close(sin(x), x.sin(), 1e-6);
+            assert_close(cos(x), x.cos(), 1e-6);
+            assert_close(exp2(x), x.exp2(), 1e-6);
+            assert_close(exp(x * 0.1), (x * 0.1).exp(), 1e-6);
+            if x > 0.0 {
+                assert_close(log2(x), x.log2(), 1e-6);
+                assert_close(log(x), x.ln(), 1e-6);
+                assert_close(pow(x, 1.5), x.powf(1.5), 1e-5);
+            }
+        }
+        assert!(sin(f32::INFINITY).is_nan());
+        assert_eq!(exp2(200.0), f32::INFINITY);
+        assert_eq!(exp2(-200.0), 0.0);
+        // denormal
+        assert_eq!(exp2(-140.0), f32::from_bits(1 << 9));
+        assert_eq!(log2(0.0), f32::NEG_INFINITY);
+        assert!(log2(-1.0).is_nan());
+        assert_eq!(pow(1.0, 7.0), 1.0);
+    }
+
+    #[test]
+    fn test_conversions() {
+        for v in 0..=255u8 {
+            assert_eq!(f32_to_unorm8(unorm8_to_f32(v)), v);
+            assert_eq!(linear_f32_to_srgb8(srgb8_to_linear_f32(v)), v);
+        }
+        for v in 0..=0xFFFFu16 {
+            let f = f16_to_f32(v);
+            if f.is_nan() {
+                assert_eq!(f32_to_f16(f) & 0x7E00, 0x7E00);
+            } else {
+                assert_eq!(f32_to_f16(f), v);
+            }
+        }
+        assert_eq!(f16_to_f32(0x3C00), 1.0);
+        // halfway between 1 and the next f16 rounds to even
+        assert_eq!(f32_to_f16(1.0 + 1.0 / 2048.0), 0x3C00);
+        assert_eq!(f32_to_f16(65520.0), 0x7C00);
+    }
+
+    #[test]
+    fn test_intrinsics() {
+        for name in INTRINSIC_NAMES {
+            assert!(find_intrinsic(name).is_some(), "{}", name);
+        }
+        assert_eq!(find_intrinsic("sinf"), None);
+        let texels = [[0.0, 0.0, 0.0, 1.0], [1.0, 0.0, 0.0, 1.0]];
+        let image = Image2D {
+            texels: texels.as_ptr(),
+            width: 2,
+            height: 1,
+            row_pitch: 2,
+            address_mode_u: ADDRESS_MODE_CLAMP_TO_EDGE,
+            address_mode_v: ADDRESS_MODE_REPEAT,
+        };
+        let u = [0.25, 0.5, 0.75, 2.0];
+        let v = [0.5; 4];
+        let mut results = [[0.0; 4]; 4];
+        unsafe {
+            image_2d_sample_linear_rgba32f(
+                results.as_mut_ptr(),
+                &image,
+                u.as_ptr(),
+                v.as_ptr(),
+                u.len(),
+            );
+        }
+        let red: Vec<f32> = results.iter().map(|v| v[0]).collect();
+        assert_eq!(red, [0.0, 0.5, 1.0, 1.0]);
+        let image = Image2D {
+            address_mode_u: ADDRESS_MODE_CLAMP_TO_BORDER,
+            ..image
+        };
+        unsafe {
+            image_2d_sample_nearest_rgba32f(
+                results.as_mut_ptr(),
+                &image,
+                u.as_ptr(),
+                v.as_ptr(),
+                u.len(),
+            );
+        }
+        assert_eq!(results, [texels[0], texels[1], texels[1], [0.0; 4]]);
+    }
+}
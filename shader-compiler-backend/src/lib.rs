@@ -14,6 +14,10 @@ use std::marker::PhantomData;
 
 #[macro_use]
 pub mod types;
+#[cfg(feature = "benchmarks")]
+pub mod benchmark;
+pub mod intrinsics;
+pub mod trace;
 
 /// equivalent to LLVM's 'IRBuilder'
 pub trait AttachedBuilder<'a>: Sized {
@@ -137,6 +141,14 @@ pub trait Module<'a>: Debug + Sized {
         name: &str,
         ty: <Self::Context as Context<'a>>::Type,
     ) -> <Self::Context as Context<'a>>::Function;
+    /// add a new constant global variable initialized to `value`, private to `Self`; returns a
+    /// pointer to the variable. IR generation can use it for values fixed at compile time that
+    /// need memory, such as specialized lookup tables.
+    fn add_constant_global(
+        &mut self,
+        name: &str,
+        value: <Self::Context as Context<'a>>::Value,
+    ) -> <Self::Context as Context<'a>>::Value;
     /// verify `Self`, converting into a `VerifiedModule`
     fn verify(
         self,
@@ -181,6 +193,18 @@ pub trait Context<'a>: Sized {
     fn create_builder(&self) -> Self::DetachedBuilder;
     /// create a new `TypeBuilder`
     fn create_type_builder(&self) -> Self::TypeBuilder;
+    /// create a constant of the integer or `bool` type `ty` from the low bits of `value`
+    fn create_int_constant(&self, ty: Self::Type, value: u64) -> Self::Value;
+    /// create a constant of the floating-point type `ty`
+    fn create_float_constant(&self, ty: Self::Type, value: f64) -> Self::Value;
+    /// create a constant struct with the members `members`
+    fn create_struct_constant(&self, members: &[Self::Value]) -> Self::Value;
+    /// create a constant array of `element_type` with the elements `elements`
+    fn create_array_constant(
+        &self,
+        element_type: Self::Type,
+        elements: &[Self::Value],
+    ) -> Self::Value;
 }
 
 /// inputs to the final compilation
@@ -191,12 +215,24 @@ pub struct CompileInputs<'a, C: Context<'a>, K: Hash + Eq + Send + Sync + 'stati
     pub callable_functions: HashMap<K, C::Function>,
 }
 
+/// relocatable machine code for the compiled functions;
+/// can be saved (in a pipeline cache, for example) and loaded again using `Compiler::load_object_code`
+#[derive(Clone, Debug)]
+pub struct ObjectCode<K: Hash + Eq + Send + Sync + 'static> {
+    /// the contents of the object file
+    pub object_file: Vec<u8>,
+    /// the symbol names of the functions that can be called from the loaded `CompiledCode`
+    pub symbols: HashMap<K, String>,
+}
+
 /// the final compiled code
 pub trait CompiledCode<K: Hash + Eq + Send + Sync + 'static>: Send + Sync {
     /// get a function in the final compiled code.
     /// the returned function needs to be cast to the correct type and
     /// `Self` needs to still exist while the returned function exists
     fn get(&self, which: &K) -> Option<unsafe extern "C" fn()>;
+    /// get the relocatable machine code that `Self` was loaded from
+    fn object_code(&self) -> &ObjectCode<K>;
 }
 
 /// trait that the user of `Compiler` implements
@@ -221,6 +257,8 @@ pub enum OptimizationMode {
     NoOptimizations,
     /// default optimizations are enabled
     Normal,
+    /// all optimizations are enabled, trading longer compile times for faster code
+    Aggressive,
 }
 
 impl Default for OptimizationMode {
@@ -249,6 +287,16 @@ pub trait Compiler: Copy + Send + Sync + 'static {
         user: U,
         config: Self::Config,
     ) -> Result<Box<dyn CompiledCode<U::FunctionKey>>, U::Error>;
+    /// get a string identifying everything other than the input module that affects the
+    /// generated machine code, such as the compiler version, the target CPU, and `config`.
+    /// `ObjectCode` must only be loaded using a compiler and config with the same fingerprint
+    fn get_code_fingerprint(self, config: &Self::Config) -> String;
+    /// load `ObjectCode` previously retrieved using `CompiledCode::object_code`
+    fn load_object_code<K: Hash + Eq + Send + Sync + 'static>(
+        self,
+        object_code: ObjectCode<K>,
+        config: Self::Config,
+    ) -> io::Result<Box<dyn CompiledCode<K>>>;
 }
 
 #[cfg(test)]
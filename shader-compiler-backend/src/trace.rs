@@ -0,0 +1,263 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright 2018 Jacob Lifshay
+
+//! opt-in tracing of where Kazan spends its time
+//!
+//! Setting the `KAZAN_TRACE` environment variable to a file name writes every `Span` to that
+//! file in the Chrome trace event format, which `chrome://tracing` and the Perfetto UI can open.
+//! The file is left without its closing `]`, which both accept, so it can be opened while the
+//! program is still running.
+//!
+//! Each thread records its spans into its own fixed-size buffer, so recording a span costs
+//! reading the clock twice and an uncontended lock. A buffer is only formatted and written out
+//! when it fills up, when its thread exits, or on `flush`. When tracing is disabled, a span is
+//! a single check of a flag.
+
+use std::cell::UnsafeCell;
+use std::env;
+use std::fmt::Write as FmtWrite;
+use std::fs::File;
+use std::io::{BufWriter, Write};
+use std::process;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex, Once};
+use std::thread;
+use std::time::Instant;
+
+/// the number of spans a thread buffers before writing them out
+const THREAD_BUFFER_SIZE: usize = 4096;
+
+struct Event {
+    category: &'static str,
+    name: &'static str,
+    /// nanoseconds since `Tracer::start_time`
+    start: u64,
+    duration: u64,
+    arg: Option<(&'static str, u64)>,
+}
+
+struct ThreadBuffer {
+    thread_id: usize,
+    events: Vec<Event>,
+}
+
+struct Tracer {
+    start_time: Instant,
+    process_id: u32,
+    output: Mutex<BufWriter<File>>,
+    thread_buffers: Mutex<Vec<Arc<Mutex<ThreadBuffer>>>>,
+    next_thread_id: AtomicUsize,
+}
+
+/// writes `value` as a JSON string
+fn write_json_string(output: &mut String, value: &str) {
+    output.push('"');
+    for c in value.chars() {
+        match c {
+            '"' => output.push_str("\\\""),
+            '\\' => output.push_str("\\\\"),
+            c if c < ' ' => write!(output, "\\u{:04x}", c as u32).unwrap(),
+            c => output.push(c),
+        }
+    }
+    output.push('"');
+}
+
+impl Tracer {
+    fn new() -> Option<Self> {
+        let path = env::var_os("KAZAN_TRACE")?;
+        let file = match File::create(&path) {
+            Ok(file) => file,
+            Err(error) => {
+                eprintln!("can't create KAZAN_TRACE file {:?}: {}", path, error);
+                return None;
+            }
+        };
+        let mut output = BufWriter::new(file);
+        let process_id = process::id();
+        writeln!(
+            output,
+            "[{{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":{},\"args\":{{\"name\":\"kazan\"}}}},",
+            process_id
+        )
+        .ok()?;
+        Some(Self {
+            start_time: Instant::now(),
+            process_id,
+            output: Mutex::new(output),
+            thread_buffers: Mutex::new(Vec::new()),
+            next_thread_id: AtomicUsize::new(1),
+        })
+    }
+    fn get_time(&self) -> u64 {
+        let time = Instant::now().duration_since(self.start_time);
+        time.as_secs() * 1_000_000_000 + u64::from(time.subsec_nanos())
+    }
+    fn add_thread(&'static self) -> CurrentThreadBuffer {
+        let thread_id = self.next_thread_id.fetch_add(1, Ordering::Relaxed);
+        let mut text = format!(
+            "{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":{},\"tid\":{},\"args\":{{\"name\":",
+            self.process_id, thread_id
+        );
+        match thread::current().name() {
+            Some(name) => write_json_string(&mut text, name),
+            None => write_json_string(&mut text, &format!("thread {}", thread_id)),
+        }
+        text.push_str("}},\n");
+        self.write_text(&text);
+        let buffer = Arc::new(Mutex::new(ThreadBuffer {
+            thread_id,
+            events: Vec::with_capacity(THREAD_BUFFER_SIZE),
+        }));
+        self.thread_buffers.lock().unwrap().push(buffer.clone());
+        CurrentThreadBuffer {
+            tracer: self,
+            buffer,
+        }
+    }
+    fn write_text(&self, text: &str) {
+        let mut output = self.output.lock().unwrap();
+        // tracing is best-effort, so a failing write doesn't disturb the program
+        let _ = output
+            .write_all(text.as_bytes())
+            .and_then(|()| output.flush());
+    }
+    fn write_buffer(&self, buffer: &mut ThreadBuffer) {
+        if buffer.events.is_empty() {
+            return;
+        }
+        let mut text = String::with_capacity(buffer.events.len() * 128);
+        for event in buffer.events.drain(..) {
+            // timestamps are in microseconds
+            write!(
+                text,
+                "{{\"name\":\"{}\",\"cat\":\"{}\",\"ph\":\"X\",\"pid\":{},\"tid\":{},\
+                 \"ts\":{}.{:03},\"dur\":{}.{:03}",
+                event.name,
+                event.category,
+                self.process_id,
+                buffer.thread_id,
+                event.start / 1000,
+                event.start % 1000,
+                event.duration / 1000,
+                event.duration % 1000,
+            )
+            .unwrap();
+            if let Some((name, value)) = event.arg {
+                write!(text, ",\"args\":{{\"{}\":{}}}", name, value).unwrap();
+            }
+            text.push_str("},\n");
+        }
+        self.write_text(&text);
+    }
+}
+
+/// the current thread's buffer, written out when the thread exits
+struct CurrentThreadBuffer {
+    tracer: &'static Tracer,
+    buffer: Arc<Mutex<ThreadBuffer>>,
+}
+
+impl Drop for CurrentThreadBuffer {
+    fn drop(&mut self) {
+        self.tracer.write_buffer(&mut self.buffer.lock().unwrap());
+        self.tracer
+            .thread_buffers
+            .lock()
+            .unwrap()
+            .retain(|buffer| !Arc::ptr_eq(buffer, &self.buffer));
+    }
+}
+
+thread_local! {
+    static CURRENT_THREAD_BUFFER: Option<CurrentThreadBuffer> =
+        get_tracer().map(Tracer::add_thread);
+}
+
+/// only written once, inside `TRACER_ONCE`
+struct TracerCell(UnsafeCell<Option<Tracer>>);
+
+unsafe impl Sync for TracerCell {}
+
+static TRACER_ONCE: Once = Once::new();
+
+static TRACER: TracerCell = TracerCell(UnsafeCell::new(None));
+
+fn get_tracer() -> Option<&'static Tracer> {
+    unsafe {
+        TRACER_ONCE.call_once(|| *TRACER.0.get() = Tracer::new());
+        (*TRACER.0.get()).as_ref()
+    }
+}
+
+/// returns true if `KAZAN_TRACE` enabled tracing
+#[inline]
+pub fn is_enabled() -> bool {
+    get_tracer().is_some()
+}
+
+/// writes out the spans every thread has buffered so far
+pub fn flush() {
+    if let Some(tracer) = get_tracer() {
+        for buffer in tracer.thread_buffers.lock().unwrap().iter() {
+            tracer.write_buffer(&mut buffer.lock().unwrap());
+        }
+    }
+}
+
+/// a span of time on the current thread, from `span` until it's dropped.
+/// `category` and `name` are written into the trace as is, so they must not need escaping
+#[must_use]
+pub struct Span {
+    category: &'static str,
+    name: &'static str,
+    /// `None` when tracing is disabled
+    start: Option<u64>,
+    arg: Option<(&'static str, u64)>,
+}
+
+/// start a `Span`
+#[inline]
+pub fn span(category: &'static str, name: &'static str) -> Span {
+    Span {
+        category,
+        name,
+        start: get_tracer().map(Tracer::get_time),
+        arg: None,
+    }
+}
+
+impl Span {
+    /// attach a number, like a size or an index, that's shown with the span
+    #[inline]
+    pub fn arg(mut self, name: &'static str, value: u64) -> Self {
+        self.arg = Some((name, value));
+        self
+    }
+}
+
+impl Drop for Span {
+    fn drop(&mut self) {
+        let start = match self.start {
+            Some(start) => start,
+            None => return,
+        };
+        let tracer = get_tracer().unwrap();
+        let event = Event {
+            category: self.category,
+            name: self.name,
+            start,
+            duration: tracer.get_time() - start,
+            arg: self.arg,
+        };
+        // spans recorded while the thread is exiting are dropped
+        let _ = CURRENT_THREAD_BUFFER.try_with(|current| {
+            let current = current.as_ref().unwrap();
+            let mut buffer = current.buffer.lock().unwrap();
+            buffer.events.push(event);
+            if buffer.events.len() >= THREAD_BUFFER_SIZE {
+                tracer.write_buffer(&mut buffer);
+            }
+        });
+    }
+}
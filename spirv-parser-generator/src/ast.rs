@@ -21,6 +21,15 @@ impl fmt::Display for QuotedInteger {
     }
 }
 
+impl From<QuotedInteger> for u32 {
+    fn from(v: QuotedInteger) -> u32 {
+        match v {
+            QuotedInteger::U16Hex(v) => v.into(),
+            QuotedInteger::U32Hex(v) => v,
+        }
+    }
+}
+
 impl fmt::Debug for QuotedInteger {
     fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
         struct DisplayQuotedInteger(self::QuotedInteger);
@@ -124,9 +133,9 @@ pub enum Quantifier {
 #[derive(Deserialize, Debug)]
 #[serde(deny_unknown_fields)]
 pub struct InstructionOperand {
-    kind: String,
-    name: Option<String>,
-    quantifier: Option<Quantifier>,
+    pub kind: String,
+    pub name: Option<String>,
+    pub quantifier: Option<Quantifier>,
 }
 
 impl InstructionOperand {
@@ -145,16 +154,16 @@ impl InstructionOperand {
 #[derive(Deserialize, Debug)]
 #[serde(deny_unknown_fields)]
 pub struct Instruction {
-    opname: String,
-    opcode: u16,
+    pub opname: String,
+    pub opcode: u16,
     #[serde(default)]
-    operands: Vec<InstructionOperand>,
+    pub operands: Vec<InstructionOperand>,
     #[serde(default)]
-    capabilities: Vec<String>,
+    pub capabilities: Vec<String>,
     #[serde(default)]
-    extensions: Vec<String>,
+    pub extensions: Vec<String>,
     #[serde(default)]
-    version: SPIRVVersion,
+    pub version: SPIRVVersion,
 }
 
 impl Instruction {
@@ -169,12 +178,12 @@ impl Instruction {
 #[derive(Deserialize, Debug)]
 #[serde(deny_unknown_fields)]
 pub struct ExtensionInstruction {
-    opname: String,
-    opcode: u16,
+    pub opname: String,
+    pub opcode: u16,
     #[serde(default)]
-    operands: Vec<InstructionOperand>,
+    pub operands: Vec<InstructionOperand>,
     #[serde(default)]
-    capabilities: Vec<String>,
+    pub capabilities: Vec<String>,
 }
 
 impl ExtensionInstruction {
@@ -189,8 +198,8 @@ impl ExtensionInstruction {
 #[derive(Deserialize, Debug)]
 #[serde(deny_unknown_fields)]
 pub struct EnumerantParameter {
-    kind: String,
-    name: Option<String>,
+    pub kind: String,
+    pub name: Option<String>,
 }
 
 impl EnumerantParameter {
@@ -209,16 +218,16 @@ impl EnumerantParameter {
 #[derive(Deserialize, Debug)]
 #[serde(deny_unknown_fields)]
 pub struct Enumerant<Value> {
-    enumerant: String,
-    value: Value,
+    pub enumerant: String,
+    pub value: Value,
     #[serde(default)]
-    capabilities: Vec<String>,
+    pub capabilities: Vec<String>,
     #[serde(default)]
-    parameters: Vec<EnumerantParameter>,
+    pub parameters: Vec<EnumerantParameter>,
     #[serde(default)]
-    extensions: Vec<String>,
+    pub extensions: Vec<String>,
     #[serde(default)]
-    version: SPIRVVersion,
+    pub version: SPIRVVersion,
 }
 
 impl<Value> Enumerant<Value> {
@@ -280,13 +289,13 @@ impl OperandKind {
 #[derive(Deserialize, Debug)]
 #[serde(deny_unknown_fields)]
 pub struct CoreGrammar {
-    copyright: Vec<String>,
-    magic_number: QuotedInteger,
-    major_version: u16,
-    minor_version: u16,
-    revision: u32,
-    instructions: Vec<Instruction>,
-    operand_kinds: Vec<OperandKind>,
+    pub copyright: Vec<String>,
+    pub magic_number: QuotedInteger,
+    pub major_version: u16,
+    pub minor_version: u16,
+    pub revision: u32,
+    pub instructions: Vec<Instruction>,
+    pub operand_kinds: Vec<OperandKind>,
 }
 
 impl CoreGrammar {
@@ -304,10 +313,10 @@ impl CoreGrammar {
 #[derive(Deserialize, Debug)]
 #[serde(deny_unknown_fields)]
 pub struct ExtensionInstructionSet {
-    copyright: Vec<String>,
-    version: u32,
-    revision: u32,
-    instructions: Vec<ExtensionInstruction>,
+    pub copyright: Vec<String>,
+    pub version: u32,
+    pub revision: u32,
+    pub instructions: Vec<ExtensionInstruction>,
 }
 
 impl ExtensionInstructionSet {
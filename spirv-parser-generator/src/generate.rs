@@ -0,0 +1,776 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright 2018 Jacob Lifshay
+
+// Generates the decoder that `spirv-parser` includes.
+// Every operand kind becomes a type implementing `Operand`, which decodes it in place from the
+// instruction's words, so decoding never allocates and strings borrow from the module.
+// Each instruction has its own decode function, found through a table indexed by opcode for the
+// densely numbered core opcodes and through a `match` for the sparse vendor ranges.
+
+use ast;
+use std::collections::{HashMap, HashSet};
+use std::fmt::{self, Write};
+use util::NameFormat::*;
+use util::WordIterator;
+use Error;
+use ExtensionInstructionSet;
+
+/// the types in `spirv-parser` that literal operand kinds decode to
+fn get_literal_type(kind: &str) -> Option<&'static str> {
+    match kind {
+        "LiteralInteger" | "LiteralExtInstInteger" => Some("u32"),
+        "LiteralString" => Some("&'a str"),
+        "LiteralContextDependentNumber" => Some("&'a [u32]"),
+        "LiteralSpecConstantOpInteger" => Some("SpecConstantOperation<'a>"),
+        _ => None,
+    }
+}
+
+fn get_field_name(name: &str) -> String {
+    let retval = SnakeCase
+        .name_from_words(WordIterator::new(name))
+        .unwrap_or_else(|| "operand".into());
+    if retval.starts_with(|c: char| c.is_ascii_digit()) {
+        format!("operand_{}", retval)
+    } else {
+        retval
+    }
+}
+
+/// keeps the grammar's name where it's a valid Rust identifier
+fn get_enumerant_name(kind: &str, enumerant: &str) -> String {
+    if enumerant.starts_with(|c: char| c.is_ascii_digit()) {
+        format!("{}{}", kind, enumerant)
+    } else if enumerant != "" && enumerant.chars().all(|c| c.is_ascii_alphanumeric()) {
+        let mut retval = enumerant.to_string();
+        retval[0..1].make_ascii_uppercase();
+        retval
+    } else {
+        CamelCase
+            .name_from_words(WordIterator::new(enumerant))
+            .unwrap_or_else(|| format!("{}Enumerant", kind))
+    }
+}
+
+/// makes names unique by appending a number
+#[derive(Default)]
+struct UniqueNames(HashSet<String>);
+
+impl UniqueNames {
+    fn add(&mut self, name: String, separator: &str) -> String {
+        let mut retval = name.clone();
+        let mut index = 2;
+        while !self.0.insert(retval.clone()) {
+            retval = format!("{}{}{}", name, separator, index);
+            index += 1;
+        }
+        retval
+    }
+}
+
+impl From<fmt::Error> for Error {
+    fn from(_: fmt::Error) -> Error {
+        unreachable!("writing to a String can't fail")
+    }
+}
+
+struct Field {
+    name: String,
+    kind: String,
+    type_name: String,
+}
+
+struct Variant {
+    name: String,
+    value: u32,
+    fields: Vec<Field>,
+}
+
+struct OperandKinds<'a> {
+    kinds: HashMap<&'a str, &'a ast::OperandKind>,
+}
+
+impl<'a> OperandKinds<'a> {
+    fn new(operand_kinds: &'a [ast::OperandKind]) -> Self {
+        let kinds = operand_kinds
+            .iter()
+            .map(|operand_kind| {
+                let kind = match operand_kind {
+                    ast::OperandKind::BitEnum { kind, .. }
+                    | ast::OperandKind::ValueEnum { kind, .. }
+                    | ast::OperandKind::Id { kind, .. }
+                    | ast::OperandKind::Literal { kind, .. }
+                    | ast::OperandKind::Composite { kind, .. } => kind,
+                };
+                (&**kind, operand_kind)
+            })
+            .collect();
+        OperandKinds { kinds }
+    }
+    fn get(&self, kind: &str) -> Result<&'a ast::OperandKind, Error> {
+        self.kinds
+            .get(kind)
+            .cloned()
+            .ok_or_else(|| Error::UnknownOperandKind(kind.into()))
+    }
+    fn parameters_need_lifetime<T>(&self, enumerants: &[ast::Enumerant<T>]) -> Result<bool, Error> {
+        for enumerant in enumerants {
+            for parameter in &enumerant.parameters {
+                if self.needs_lifetime(&parameter.kind)? {
+                    return Ok(true);
+                }
+            }
+        }
+        Ok(false)
+    }
+    /// true if the type `kind` decodes to borrows from the module
+    fn needs_lifetime(&self, kind: &str) -> Result<bool, Error> {
+        Ok(match self.get(kind)? {
+            ast::OperandKind::Id { .. } => false,
+            ast::OperandKind::Literal { .. } => get_literal_type(kind)
+                .ok_or_else(|| Error::UnknownOperandKind(kind.into()))?
+                .contains("'a"),
+            ast::OperandKind::ValueEnum { enumerants, .. } => {
+                self.parameters_need_lifetime(enumerants)?
+            }
+            ast::OperandKind::BitEnum { enumerants, .. } => {
+                self.parameters_need_lifetime(enumerants)?
+            }
+            ast::OperandKind::Composite { bases, .. } => {
+                for base in bases {
+                    if self.needs_lifetime(base)? {
+                        return Ok(true);
+                    }
+                }
+                false
+            }
+        })
+    }
+    fn get_type_name(&self, kind: &str) -> Result<String, Error> {
+        if self.needs_lifetime(kind)? {
+            Ok(format!("{}<'a>", kind))
+        } else {
+            Ok(kind.into())
+        }
+    }
+    fn get_instruction_fields(
+        &self,
+        operands: &[ast::InstructionOperand],
+    ) -> Result<Vec<Field>, Error> {
+        let mut names = UniqueNames::default();
+        let mut retval = Vec::new();
+        for operand in operands {
+            let type_name = self.get_type_name(&operand.kind)?;
+            let type_name = match operand.quantifier {
+                None => type_name,
+                Some(ast::Quantifier::Optional) => format!("Option<{}>", type_name),
+                Some(ast::Quantifier::Variadic) => format!("Repeated<'a, {}>", type_name),
+            };
+            let name = &**operand.name.as_ref().unwrap_or(&operand.kind);
+            let name = if operand.quantifier == Some(ast::Quantifier::Variadic) {
+                // variadic operands are named like "'Member 0 type', +\n'member 1 type', +\n..."
+                let first_name = name.split(',').next().unwrap();
+                let words: Vec<_> = WordIterator::new(first_name)
+                    .filter(|word| !word.chars().all(|c| c.is_ascii_digit()))
+                    .collect();
+                SnakeCase
+                    .name_from_words(words.into_iter())
+                    .unwrap_or_else(|| get_field_name(name))
+            } else {
+                get_field_name(name)
+            };
+            retval.push(Field {
+                name: names.add(name, "_"),
+                kind: operand.kind.clone(),
+                type_name,
+            });
+        }
+        Ok(retval)
+    }
+    fn get_parameter_fields(
+        &self,
+        parameters: &[ast::EnumerantParameter],
+    ) -> Result<Vec<Field>, Error> {
+        let mut names = UniqueNames::default();
+        let mut retval = Vec::new();
+        for parameter in parameters {
+            retval.push(Field {
+                name: names.add(
+                    get_field_name(parameter.name.as_ref().unwrap_or(&parameter.kind)),
+                    "_",
+                ),
+                kind: parameter.kind.clone(),
+                type_name: self.get_type_name(&parameter.kind)?,
+            });
+        }
+        Ok(retval)
+    }
+    /// skips aliases, which have the same value as an earlier enumerant
+    fn get_variants<T: Copy + Into<u32>>(
+        &self,
+        kind: &str,
+        enumerants: &[ast::Enumerant<T>],
+    ) -> Result<Vec<Variant>, Error> {
+        let mut names = UniqueNames::default();
+        let mut values = HashSet::new();
+        let mut retval = Vec::new();
+        for enumerant in enumerants {
+            let value = enumerant.value.into();
+            if !values.insert(value) {
+                continue;
+            }
+            retval.push(Variant {
+                name: names.add(get_enumerant_name(kind, &enumerant.enumerant), ""),
+                value,
+                fields: self.get_parameter_fields(&enumerant.parameters)?,
+            });
+        }
+        Ok(retval)
+    }
+}
+
+fn fields_need_lifetime<'a, I: IntoIterator<Item = &'a Field>>(fields: I) -> bool {
+    fields
+        .into_iter()
+        .any(|field| field.type_name.contains("'a"))
+}
+
+fn get_lifetime_parameter(needs_lifetime: bool) -> &'static str {
+    if needs_lifetime {
+        "<'a>"
+    } else {
+        ""
+    }
+}
+
+const DERIVES: &str = "#[derive(Copy, Clone, Eq, PartialEq, Hash, Debug)]";
+
+fn write_doc_comment(out: &mut String, indent: &str, doc: &str) -> fmt::Result {
+    for line in doc.lines() {
+        writeln!(out, "{}/// {}", indent, line.trim())?;
+    }
+    Ok(())
+}
+
+fn write_variant_definition(out: &mut String, name: &str, fields: &[Field]) -> fmt::Result {
+    if fields.is_empty() {
+        return writeln!(out, "    {},", name);
+    }
+    writeln!(out, "    {} {{", name)?;
+    for field in fields {
+        writeln!(out, "        {}: {},", field.name, field.type_name)?;
+    }
+    writeln!(out, "    }},")
+}
+
+/// writes an expression that decodes `fields` in order from `words` into the variant at `path`
+fn write_variant_decode(
+    out: &mut String,
+    indent: &str,
+    path: &str,
+    fields: &[Field],
+    words: &str,
+) -> fmt::Result {
+    if fields.is_empty() {
+        return write!(out, "{}", path);
+    }
+    writeln!(out, "{} {{", path)?;
+    for field in fields {
+        writeln!(
+            out,
+            "{}    {}: Operand::decode({})?,",
+            indent, field.name, words
+        )?;
+    }
+    write!(out, "{}}}", indent)
+}
+
+fn write_operand_impl_header(out: &mut String, kind: &str, needs_lifetime: bool) -> fmt::Result {
+    writeln!(
+        out,
+        "impl<'a> Operand<'a> for {}{} {{",
+        kind,
+        get_lifetime_parameter(needs_lifetime)
+    )?;
+    writeln!(
+        out,
+        "    fn decode(words: &mut &'a [u32]) -> Result<Self, Error> {{"
+    )
+}
+
+fn write_value_enum(
+    out: &mut String,
+    operand_kinds: &OperandKinds,
+    kind: &str,
+    enumerants: &[ast::Enumerant<u32>],
+) -> Result<(), Error> {
+    let variants = operand_kinds.get_variants(kind, enumerants)?;
+    let needs_lifetime = operand_kinds.needs_lifetime(kind)?;
+    let lifetime = get_lifetime_parameter(needs_lifetime);
+    writeln!(out, "{}", DERIVES)?;
+    writeln!(out, "pub enum {}{} {{", kind, lifetime)?;
+    for variant in &variants {
+        write_variant_definition(out, &variant.name, &variant.fields)?;
+    }
+    writeln!(out, "}}")?;
+    writeln!(out)?;
+    write_operand_impl_header(out, kind, needs_lifetime)?;
+    writeln!(out, "        match decode_word(words)? {{")?;
+    for variant in &variants {
+        write!(out, "            {} => Ok(", variant.value)?;
+        write_variant_decode(
+            out,
+            "            ",
+            &format!("{}::{}", kind, variant.name),
+            &variant.fields,
+            "words",
+        )?;
+        writeln!(out, "),")?;
+    }
+    writeln!(
+        out,
+        "            value => Err(Error::UnknownEnumerant {{ kind: {:?}, value }}),",
+        kind
+    )?;
+    writeln!(out, "        }}")?;
+    writeln!(out, "    }}")?;
+    writeln!(out, "}}")?;
+    Ok(())
+}
+
+/// bit enums decode to a struct with a field per bit, which holds the bit's parameters if it has any
+fn write_bit_enum(
+    out: &mut String,
+    operand_kinds: &OperandKinds,
+    kind: &str,
+    enumerants: &[ast::Enumerant<ast::QuotedInteger>],
+) -> Result<(), Error> {
+    let mut bits = operand_kinds.get_variants(kind, enumerants)?;
+    bits.retain(|bit| bit.value != 0);
+    // parameters follow in order of increasing bit value
+    bits.sort_by_key(|bit| bit.value);
+    let mask = bits.iter().fold(0, |mask, bit| mask | bit.value);
+    let needs_lifetime = operand_kinds.needs_lifetime(kind)?;
+    let mut names = UniqueNames::default();
+    let field_names: Vec<_> = bits
+        .iter()
+        .map(|bit| names.add(get_field_name(&bit.name), "_"))
+        .collect();
+    writeln!(out, "{}", DERIVES)?;
+    writeln!(
+        out,
+        "pub struct {}{} {{",
+        kind,
+        get_lifetime_parameter(needs_lifetime)
+    )?;
+    for (bit, field_name) in bits.iter().zip(&field_names) {
+        let type_name = match bit.fields.len() {
+            0 => "bool".to_string(),
+            1 => format!("Option<{}>", bit.fields[0].type_name),
+            _ => format!(
+                "Option<({})>",
+                bit.fields
+                    .iter()
+                    .map(|field| &*field.type_name)
+                    .collect::<Vec<_>>()
+                    .join(", ")
+            ),
+        };
+        writeln!(out, "    pub {}: {},", field_name, type_name)?;
+    }
+    writeln!(out, "}}")?;
+    writeln!(out)?;
+    write_operand_impl_header(out, kind, needs_lifetime)?;
+    writeln!(out, "        let value = decode_word(words)?;")?;
+    writeln!(out, "        if value & !{:#010X} != 0 {{", mask)?;
+    writeln!(
+        out,
+        "            return Err(Error::UnknownEnumerant {{ kind: {:?}, value }});",
+        kind
+    )?;
+    writeln!(out, "        }}")?;
+    writeln!(out, "        Ok({} {{", kind)?;
+    for (bit, field_name) in bits.iter().zip(&field_names) {
+        if bit.fields.is_empty() {
+            writeln!(
+                out,
+                "            {}: value & {:#010X} != 0,",
+                field_name, bit.value
+            )?;
+            continue;
+        }
+        let parameters = vec!["Operand::decode(words)?"; bit.fields.len()].join(", ");
+        let parameters = if bit.fields.len() == 1 {
+            parameters
+        } else {
+            format!("({})", parameters)
+        };
+        writeln!(
+            out,
+            "            {}: if value & {:#010X} != 0 {{ Some({}) }} else {{ None }},",
+            field_name, bit.value, parameters
+        )?;
+    }
+    writeln!(out, "        }})")?;
+    writeln!(out, "    }}")?;
+    writeln!(out, "}}")?;
+    Ok(())
+}
+
+fn write_operand_kind(
+    out: &mut String,
+    operand_kinds: &OperandKinds,
+    operand_kind: &ast::OperandKind,
+) -> Result<(), Error> {
+    match operand_kind {
+        ast::OperandKind::Id { kind, doc } => {
+            if let Some(doc) = doc {
+                write_doc_comment(out, "", doc)?;
+            }
+            writeln!(out, "{}", DERIVES)?;
+            writeln!(out, "pub struct {}(pub u32);", kind)?;
+            writeln!(out)?;
+            write_operand_impl_header(out, kind, false)?;
+            writeln!(out, "        decode_word(words).map({})", kind)?;
+            writeln!(out, "    }}")?;
+            writeln!(out, "}}")?;
+        }
+        ast::OperandKind::Literal { kind, doc } => {
+            if let Some(doc) = doc {
+                write_doc_comment(out, "", doc)?;
+            }
+            let type_name =
+                get_literal_type(kind).ok_or_else(|| Error::UnknownOperandKind(kind.clone()))?;
+            writeln!(
+                out,
+                "pub type {}{} = {};",
+                kind,
+                get_lifetime_parameter(type_name.contains("'a")),
+                type_name
+            )?;
+        }
+        ast::OperandKind::Composite { kind, bases } => {
+            let needs_lifetime = operand_kinds.needs_lifetime(kind)?;
+            let base_types = bases
+                .iter()
+                .map(|base| Ok(format!("pub {}", operand_kinds.get_type_name(base)?)))
+                .collect::<Result<Vec<_>, Error>>()?;
+            writeln!(out, "{}", DERIVES)?;
+            writeln!(
+                out,
+                "pub struct {}{}({});",
+                kind,
+                get_lifetime_parameter(needs_lifetime),
+                base_types.join(", ")
+            )?;
+            writeln!(out)?;
+            write_operand_impl_header(out, kind, needs_lifetime)?;
+            writeln!(
+                out,
+                "        Ok({}({}))",
+                kind,
+                vec!["Operand::decode(words)?"; bases.len()].join(", ")
+            )?;
+            writeln!(out, "    }}")?;
+            writeln!(out, "}}")?;
+        }
+        ast::OperandKind::ValueEnum { kind, enumerants } => {
+            write_value_enum(out, operand_kinds, kind, enumerants)?;
+        }
+        ast::OperandKind::BitEnum { kind, enumerants } => {
+            write_bit_enum(out, operand_kinds, kind, enumerants)?;
+        }
+    }
+    writeln!(out)?;
+    Ok(())
+}
+
+/// writes a method that returns the field of kind `kind` of the variants that have one
+fn write_field_accessor(
+    out: &mut String,
+    instructions: &[Variant],
+    method_name: &str,
+    kind: &str,
+) -> fmt::Result {
+    writeln!(
+        out,
+        "    pub fn {}(&self) -> Option<{}> {{",
+        method_name, kind
+    )?;
+    writeln!(out, "        match *self {{")?;
+    for instruction in instructions {
+        if let Some(field) = instruction.fields.iter().find(|field| field.kind == kind) {
+            writeln!(
+                out,
+                "            Instruction::{} {{ {}: retval, .. }} => Some(retval),",
+                instruction.name, field.name
+            )?;
+        }
+    }
+    writeln!(out, "            _ => None,")?;
+    writeln!(out, "        }}")?;
+    writeln!(out, "    }}")
+}
+
+/// the core opcodes are dense, so index the decoder table with opcodes below the first big gap
+fn get_decoder_table_length(instructions: &[Variant]) -> usize {
+    let mut retval = 0;
+    for (index, instruction) in instructions.iter().enumerate() {
+        let length = instruction.value as usize + 1;
+        if (index + 1) * 2 >= length {
+            retval = length;
+        }
+    }
+    retval
+}
+
+fn write_instructions(
+    out: &mut String,
+    operand_kinds: &OperandKinds,
+    instructions: &[ast::Instruction],
+) -> Result<(), Error> {
+    let mut opcodes = HashSet::new();
+    let mut variants = Vec::new();
+    for instruction in instructions {
+        // skip aliases
+        if opcodes.insert(instruction.opcode) {
+            variants.push(Variant {
+                name: instruction.opname.clone(),
+                value: instruction.opcode.into(),
+                fields: operand_kinds.get_instruction_fields(&instruction.operands)?,
+            });
+        }
+    }
+    variants.sort_by_key(|variant| variant.value);
+    writeln!(out, "{}", DERIVES)?;
+    writeln!(out, "pub enum Instruction<'a> {{")?;
+    for variant in &variants {
+        write_variant_definition(out, &variant.name, &variant.fields)?;
+    }
+    writeln!(out, "}}")?;
+    writeln!(out)?;
+    writeln!(out, "impl<'a> Instruction<'a> {{")?;
+    writeln!(out, "    pub fn opcode(&self) -> u16 {{")?;
+    writeln!(out, "        match *self {{")?;
+    for variant in &variants {
+        if variant.fields.is_empty() {
+            writeln!(
+                out,
+                "            Instruction::{} => {},",
+                variant.name, variant.value
+            )?;
+        } else {
+            writeln!(
+                out,
+                "            Instruction::{} {{ .. }} => {},",
+                variant.name, variant.value
+            )?;
+        }
+    }
+    writeln!(out, "        }}")?;
+    writeln!(out, "    }}")?;
+    write_field_accessor(out, &variants, "result_type", "IdResultType")?;
+    write_field_accessor(out, &variants, "result_id", "IdResult")?;
+    writeln!(out, "}}")?;
+    writeln!(out)?;
+    writeln!(
+        out,
+        "type InstructionDecoder = for<'a> fn(&'a [u32]) -> Result<Instruction<'a>, Error>;"
+    )?;
+    for variant in &variants {
+        writeln!(out)?;
+        writeln!(out, "#[allow(non_snake_case)]")?;
+        if variant.fields.is_empty() {
+            writeln!(
+                out,
+                "fn decode_{}<'a>(words: &'a [u32]) -> Result<Instruction<'a>, Error> {{",
+                variant.name
+            )?;
+            writeln!(out, "    finish_decode(words)?;")?;
+            writeln!(out, "    Ok(Instruction::{})", variant.name)?;
+        } else {
+            writeln!(
+                out,
+                "fn decode_{}<'a>(mut words: &'a [u32]) -> Result<Instruction<'a>, Error> {{",
+                variant.name
+            )?;
+            write!(out, "    let retval = ")?;
+            write_variant_decode(
+                out,
+                "    ",
+                &format!("Instruction::{}", variant.name),
+                &variant.fields,
+                "&mut words",
+            )?;
+            writeln!(out, ";")?;
+            writeln!(out, "    finish_decode(words)?;")?;
+            writeln!(out, "    Ok(retval)")?;
+        }
+        writeln!(out, "}}")?;
+    }
+    writeln!(out)?;
+    let table_length = get_decoder_table_length(&variants);
+    let mut table = vec![None; table_length];
+    for variant in &variants {
+        if let Some(entry) = table.get_mut(variant.value as usize) {
+            *entry = Some(&variant.name);
+        }
+    }
+    writeln!(
+        out,
+        "static INSTRUCTION_DECODERS: [Option<InstructionDecoder>; {}] = [",
+        table_length
+    )?;
+    for entry in table {
+        match entry {
+            Some(name) => writeln!(out, "    Some(decode_{} as InstructionDecoder),", name)?,
+            None => writeln!(out, "    None,")?,
+        }
+    }
+    writeln!(out, "];")?;
+    writeln!(out)?;
+    writeln!(
+        out,
+        "fn get_instruction_decoder(opcode: u16) -> Option<InstructionDecoder> {{"
+    )?;
+    writeln!(
+        out,
+        "    if let Some(&decoder) = INSTRUCTION_DECODERS.get(opcode as usize) {{"
+    )?;
+    writeln!(out, "        return decoder;")?;
+    writeln!(out, "    }}")?;
+    writeln!(out, "    match opcode {{")?;
+    for variant in &variants {
+        if variant.value as usize >= table_length {
+            writeln!(
+                out,
+                "        {} => Some(decode_{} as InstructionDecoder),",
+                variant.value, variant.name
+            )?;
+        }
+    }
+    writeln!(out, "        _ => None,")?;
+    writeln!(out, "    }}")?;
+    writeln!(out, "}}")?;
+    Ok(())
+}
+
+fn write_extension_instruction_set(
+    out: &mut String,
+    operand_kinds: &OperandKinds,
+    extension_instruction_set: ExtensionInstructionSet,
+    instructions: &[ast::ExtensionInstruction],
+) -> Result<(), Error> {
+    let enum_name = format!("{:?}Instruction", extension_instruction_set);
+    let mut names = UniqueNames::default();
+    let mut opcodes = HashSet::new();
+    let mut variants = Vec::new();
+    for instruction in instructions {
+        if opcodes.insert(instruction.opcode) {
+            variants.push(Variant {
+                name: names.add(
+                    CamelCase
+                        .name_from_words(WordIterator::new(&instruction.opname))
+                        .unwrap_or_else(|| format!("Instruction{}", instruction.opcode)),
+                    "",
+                ),
+                value: instruction.opcode.into(),
+                fields: operand_kinds.get_instruction_fields(&instruction.operands)?,
+            });
+        }
+    }
+    let lifetime = get_lifetime_parameter(fields_need_lifetime(
+        variants.iter().flat_map(|v| &v.fields),
+    ));
+    writeln!(out)?;
+    writeln!(out, "{}", DERIVES)?;
+    writeln!(out, "pub enum {}{} {{", enum_name, lifetime)?;
+    for variant in &variants {
+        write_variant_definition(out, &variant.name, &variant.fields)?;
+    }
+    writeln!(out, "}}")?;
+    writeln!(out)?;
+    writeln!(out, "impl<'a> {}{} {{", enum_name, lifetime)?;
+    writeln!(
+        out,
+        "    pub const IMPORT_NAME: &'static str = {:?};",
+        extension_instruction_set.get_import_name()
+    )?;
+    writeln!(
+        out,
+        "    /// decodes the `instruction` and `operands` of an `OpExtInst` that uses this set"
+    )?;
+    writeln!(
+        out,
+        "    pub fn decode(instruction: u32, mut operands: &'a [u32]) -> Result<Self, Error> {{"
+    )?;
+    writeln!(out, "        let retval = match instruction {{")?;
+    for variant in &variants {
+        write!(out, "            {} => ", variant.value)?;
+        write_variant_decode(
+            out,
+            "            ",
+            &format!("{}::{}", enum_name, variant.name),
+            &variant.fields,
+            "&mut operands",
+        )?;
+        writeln!(out, ",")?;
+    }
+    writeln!(
+        out,
+        "            instruction => return Err(Error::UnknownExtensionInstruction {{ instruction }}),"
+    )?;
+    writeln!(out, "        }};")?;
+    writeln!(out, "        finish_decode(operands)?;")?;
+    writeln!(out, "        Ok(retval)")?;
+    writeln!(out, "    }}")?;
+    writeln!(out, "}}")?;
+    Ok(())
+}
+
+pub fn generate(
+    core_grammar: &ast::CoreGrammar,
+    extension_instruction_sets: &[(ExtensionInstructionSet, &ast::ExtensionInstructionSet)],
+) -> Result<String, Error> {
+    let mut out = String::new();
+    writeln!(
+        out,
+        "// generated by spirv-parser-generator from the SPIR-V grammar, do not edit"
+    )?;
+    writeln!(out, "//")?;
+    for line in &core_grammar.copyright {
+        writeln!(out, "// {}", line)?;
+    }
+    writeln!(out)?;
+    writeln!(
+        out,
+        "pub const MAGIC_NUMBER: u32 = {};",
+        core_grammar.magic_number
+    )?;
+    writeln!(
+        out,
+        "pub const MAJOR_VERSION: u32 = {};",
+        core_grammar.major_version
+    )?;
+    writeln!(
+        out,
+        "pub const MINOR_VERSION: u32 = {};",
+        core_grammar.minor_version
+    )?;
+    writeln!(out, "pub const REVISION: u32 = {};", core_grammar.revision)?;
+    writeln!(out)?;
+    let operand_kinds = OperandKinds::new(&core_grammar.operand_kinds);
+    for operand_kind in &core_grammar.operand_kinds {
+        write_operand_kind(&mut out, &operand_kinds, operand_kind)?;
+    }
+    write_instructions(&mut out, &operand_kinds, &core_grammar.instructions)?;
+    for &(extension_instruction_set, instructions) in extension_instruction_sets {
+        write_extension_instruction_set(
+            &mut out,
+            &operand_kinds,
+            extension_instruction_set,
+            &instructions.instructions,
+        )?;
+    }
+    Ok(out)
+}
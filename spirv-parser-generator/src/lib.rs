@@ -11,15 +11,17 @@ use std::error;
 use std::fmt;
 use std::fs::File;
 use std::io;
+use std::io::Write;
 use std::path::Path;
 use std::path::PathBuf;
 
 mod ast;
+mod generate;
 mod util;
 
 pub const SPIRV_CORE_GRAMMAR_JSON_FILE_NAME: &str = "spirv.core.grammar.json";
 
-#[derive(Copy, Clone, Eq, PartialEq, Hash, Debug)]
+#[derive(Copy, Clone, Eq, PartialEq, Ord, PartialOrd, Hash, Debug)]
 pub enum ExtensionInstructionSet {
     GLSLStd450,
     OpenCLStd,
@@ -32,6 +34,13 @@ impl ExtensionInstructionSet {
             ExtensionInstructionSet::OpenCLStd => "extinst.opencl.std.100.grammar.json",
         }
     }
+    /// the name `OpExtInstImport` uses for the instruction set
+    pub fn get_import_name(self) -> &'static str {
+        match self {
+            ExtensionInstructionSet::GLSLStd450 => "GLSL.std.450",
+            ExtensionInstructionSet::OpenCLStd => "OpenCL.std",
+        }
+    }
 }
 
 #[derive(Debug)]
@@ -40,6 +49,7 @@ pub enum Error {
     JSONError(serde_json::Error),
     DeducingNameForInstructionOperandFailed,
     DeducingNameForEnumerantParameterFailed,
+    UnknownOperandKind(String),
 }
 
 impl From<io::Error> for Error {
@@ -69,6 +79,7 @@ impl fmt::Display for Error {
             Error::DeducingNameForEnumerantParameterFailed => {
                 write!(f, "deducing name for EnumerantParameter failed")
             }
+            Error::UnknownOperandKind(kind) => write!(f, "unknown operand kind: {}", kind),
         }
     }
 }
@@ -81,14 +92,27 @@ impl From<Error> for io::Error {
             Error::IOError(v) => v,
             Error::JSONError(v) => v.into(),
             error @ Error::DeducingNameForInstructionOperandFailed
-            | error @ Error::DeducingNameForEnumerantParameterFailed => {
+            | error @ Error::DeducingNameForEnumerantParameterFailed
+            | error @ Error::UnknownOperandKind(_) => {
                 io::Error::new(io::ErrorKind::Other, format!("{}", error))
             }
         }
     }
 }
 
-pub struct Output {}
+/// the generated parser code
+pub struct Output {
+    code: String,
+}
+
+impl Output {
+    pub fn write<T: Write>(&self, mut writer: T) -> Result<(), io::Error> {
+        writer.write_all(self.code.as_bytes())
+    }
+    pub fn write_to_file<T: AsRef<Path>>(&self, path: T) -> Result<(), io::Error> {
+        self.write(File::create(path)?)
+    }
+}
 
 pub struct Input {
     spirv_core_grammar_json_path: PathBuf,
@@ -138,7 +162,14 @@ impl Input {
                     .is_none()
             );
         }
-        unimplemented!()
+        let mut sorted_extension_instruction_sets: Vec<_> = parsed_extension_instruction_sets
+            .iter()
+            .map(|(&k, v)| (k, v))
+            .collect();
+        sorted_extension_instruction_sets.sort_by_key(|&(k, _)| k);
+        Ok(Output {
+            code: generate::generate(&core_grammar, &sorted_extension_instruction_sets)?,
+        })
     }
 }
 
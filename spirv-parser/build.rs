@@ -0,0 +1,28 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright 2018 Jacob Lifshay
+extern crate spirv_parser_generator;
+use spirv_parser_generator::*;
+use std::env;
+use std::io;
+use std::path::{Path, PathBuf};
+
+const SPIRV_GRAMMAR_PATH: &str = "../external/SPIRV-Headers/include/spirv/unified1";
+
+fn main() -> io::Result<()> {
+    println!("cargo:rerun-if-changed={}", SPIRV_GRAMMAR_PATH);
+    let spirv_grammar_path = Path::new(SPIRV_GRAMMAR_PATH);
+    let mut input = Input::new(spirv_grammar_path.join(SPIRV_CORE_GRAMMAR_JSON_FILE_NAME));
+    for &extension_instruction_set in &[
+        ExtensionInstructionSet::GLSLStd450,
+        ExtensionInstructionSet::OpenCLStd,
+    ] {
+        input = input.add_extension_instruction_set(
+            extension_instruction_set,
+            spirv_grammar_path.join(extension_instruction_set.get_grammar_json_file_name()),
+        );
+    }
+    let out_dir = PathBuf::from(env::var_os("OUT_DIR").unwrap());
+    input
+        .generate()?
+        .write_to_file(out_dir.join("generated_parser.rs"))
+}
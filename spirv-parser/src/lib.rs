@@ -1,2 +1,350 @@
 // SPDX-License-Identifier: LGPL-2.1-or-later
 // Copyright 2018 Jacob Lifshay
+
+// Streaming SPIR-V decoder, the grammar-specific parts are generated by `spirv-parser-generator`.
+// Instructions are decoded one at a time straight from the module's words: IDs are plain
+// integers, strings borrow from the module, and variable-length operands are views over the
+// words, so parsing never allocates.
+
+use std::error;
+use std::fmt;
+use std::marker::PhantomData;
+use std::slice;
+use std::str;
+
+#[cfg(not(target_endian = "little"))]
+compile_error!("strings are borrowed from the module's words, which requires a little-endian host");
+
+#[derive(Copy, Clone, Eq, PartialEq, Hash, Debug)]
+pub enum Error {
+    MissingHeader,
+    InvalidMagicNumber(u32),
+    ZeroWordCount,
+    InstructionPastEnd,
+    UnknownOpcode(u16),
+    MissingOperand,
+    TooManyOperands,
+    InvalidString,
+    UnknownEnumerant { kind: &'static str, value: u32 },
+    UnknownExtensionInstruction { instruction: u32 },
+}
+
+impl fmt::Display for Error {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        match *self {
+            Error::MissingHeader => write!(f, "missing SPIR-V header"),
+            Error::InvalidMagicNumber(v) => write!(f, "invalid SPIR-V magic number: {:#010X}", v),
+            Error::ZeroWordCount => write!(f, "instruction word count is zero"),
+            Error::InstructionPastEnd => {
+                write!(f, "instruction extends past the end of the module")
+            }
+            Error::UnknownOpcode(opcode) => write!(f, "unknown opcode: {}", opcode),
+            Error::MissingOperand => write!(f, "instruction is missing an operand"),
+            Error::TooManyOperands => write!(f, "instruction has too many operands"),
+            Error::InvalidString => write!(f, "invalid string operand"),
+            Error::UnknownEnumerant { kind, value } => {
+                write!(f, "unknown {} enumerant: {:#X}", kind, value)
+            }
+            Error::UnknownExtensionInstruction { instruction } => {
+                write!(f, "unknown extension instruction: {}", instruction)
+            }
+        }
+    }
+}
+
+impl error::Error for Error {}
+
+/// an operand that's decoded from the front of `words`, advancing `words` past it
+pub trait Operand<'a>: Sized {
+    fn decode(words: &mut &'a [u32]) -> Result<Self, Error>;
+}
+
+fn decode_word(words: &mut &[u32]) -> Result<u32, Error> {
+    let (&retval, rest) = words.split_first().ok_or(Error::MissingOperand)?;
+    *words = rest;
+    Ok(retval)
+}
+
+fn finish_decode(words: &[u32]) -> Result<(), Error> {
+    if words.is_empty() {
+        Ok(())
+    } else {
+        Err(Error::TooManyOperands)
+    }
+}
+
+impl<'a> Operand<'a> for u32 {
+    fn decode(words: &mut &'a [u32]) -> Result<Self, Error> {
+        decode_word(words)
+    }
+}
+
+impl<'a> Operand<'a> for &'a str {
+    fn decode(words: &mut &'a [u32]) -> Result<Self, Error> {
+        let bytes = unsafe { slice::from_raw_parts(words.as_ptr() as *const u8, words.len() * 4) };
+        let length = bytes
+            .iter()
+            .position(|&byte| byte == 0)
+            .ok_or(Error::InvalidString)?;
+        let retval = str::from_utf8(&bytes[..length]).map_err(|_| Error::InvalidString)?;
+        *words = &words[length / 4 + 1..];
+        Ok(retval)
+    }
+}
+
+/// context-dependent numbers take the rest of the instruction, their width depends on their type
+impl<'a> Operand<'a> for &'a [u32] {
+    fn decode(words: &mut &'a [u32]) -> Result<Self, Error> {
+        if words.is_empty() {
+            return Err(Error::MissingOperand);
+        }
+        let retval = *words;
+        *words = &[];
+        Ok(retval)
+    }
+}
+
+/// optional operands are only at the end of instructions
+impl<'a, T: Operand<'a>> Operand<'a> for Option<T> {
+    fn decode(words: &mut &'a [u32]) -> Result<Self, Error> {
+        if words.is_empty() {
+            Ok(None)
+        } else {
+            T::decode(words).map(Some)
+        }
+    }
+}
+
+/// the operation of `OpSpecConstantOp`, `operands` depend on `opcode`
+#[derive(Copy, Clone, Eq, PartialEq, Hash, Debug)]
+pub struct SpecConstantOperation<'a> {
+    pub opcode: u32,
+    pub operands: &'a [u32],
+}
+
+impl<'a> Operand<'a> for SpecConstantOperation<'a> {
+    fn decode(words: &mut &'a [u32]) -> Result<Self, Error> {
+        let opcode = decode_word(words)?;
+        let operands = *words;
+        *words = &[];
+        Ok(SpecConstantOperation { opcode, operands })
+    }
+}
+
+/// the rest of an instruction's operands, all of type `T`.
+/// they are checked when the instruction is decoded and decoded again while iterating
+#[derive(Copy, Clone, Eq, PartialEq, Hash)]
+pub struct Repeated<'a, T> {
+    words: &'a [u32],
+    _phantom: PhantomData<T>,
+}
+
+impl<'a, T: Operand<'a>> Repeated<'a, T> {
+    pub fn words(&self) -> &'a [u32] {
+        self.words
+    }
+    pub fn is_empty(&self) -> bool {
+        self.words.is_empty()
+    }
+    pub fn iter(&self) -> RepeatedIter<'a, T> {
+        RepeatedIter {
+            words: self.words,
+            _phantom: PhantomData,
+        }
+    }
+}
+
+impl<'a, T: Operand<'a>> Operand<'a> for Repeated<'a, T> {
+    fn decode(words: &mut &'a [u32]) -> Result<Self, Error> {
+        let retval = Repeated {
+            words: *words,
+            _phantom: PhantomData,
+        };
+        while !words.is_empty() {
+            T::decode(words)?;
+        }
+        Ok(retval)
+    }
+}
+
+impl<'a, T: Operand<'a> + fmt::Debug> fmt::Debug for Repeated<'a, T> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_list().entries(self.iter()).finish()
+    }
+}
+
+impl<'a, T: Operand<'a>> IntoIterator for Repeated<'a, T> {
+    type Item = T;
+    type IntoIter = RepeatedIter<'a, T>;
+    fn into_iter(self) -> RepeatedIter<'a, T> {
+        self.iter()
+    }
+}
+
+#[derive(Clone)]
+pub struct RepeatedIter<'a, T> {
+    words: &'a [u32],
+    _phantom: PhantomData<T>,
+}
+
+impl<'a, T: Operand<'a>> Iterator for RepeatedIter<'a, T> {
+    type Item = T;
+    fn next(&mut self) -> Option<T> {
+        if self.words.is_empty() {
+            None
+        } else {
+            Some(T::decode(&mut self.words).expect("already checked when decoding"))
+        }
+    }
+}
+
+include!(concat!(env!("OUT_DIR"), "/generated_parser.rs"));
+
+pub const HEADER_WORD_COUNT: usize = 5;
+
+#[derive(Copy, Clone, Eq, PartialEq, Hash, Debug)]
+pub struct Header {
+    pub major_version: u32,
+    pub minor_version: u32,
+    pub generator: u32,
+    /// all IDs are less than `bound`
+    pub bound: u32,
+    pub instruction_schema: u32,
+}
+
+/// decodes the instruction at the start of `words`, returns it with its length in words
+pub fn decode_instruction<'a>(words: &'a [u32]) -> Result<(Instruction<'a>, usize), Error> {
+    let first_word = *words.first().ok_or(Error::InstructionPastEnd)?;
+    let word_count = (first_word >> 16) as usize;
+    let opcode = first_word as u16;
+    if word_count == 0 {
+        return Err(Error::ZeroWordCount);
+    }
+    if word_count > words.len() {
+        return Err(Error::InstructionPastEnd);
+    }
+    let decoder = get_instruction_decoder(opcode).ok_or(Error::UnknownOpcode(opcode))?;
+    Ok((decoder(&words[1..word_count])?, word_count))
+}
+
+/// iterates over the instructions of a module, stopping after the first error
+#[derive(Clone, Debug)]
+pub struct Parser<'a> {
+    words: &'a [u32],
+    word_offset: usize,
+}
+
+impl<'a> Parser<'a> {
+    pub fn new(words: &'a [u32]) -> Result<(Header, Self), Error> {
+        if words.len() < HEADER_WORD_COUNT {
+            return Err(Error::MissingHeader);
+        }
+        if words[0] != MAGIC_NUMBER {
+            return Err(Error::InvalidMagicNumber(words[0]));
+        }
+        let header = Header {
+            major_version: (words[1] >> 16) & 0xFF,
+            minor_version: (words[1] >> 8) & 0xFF,
+            generator: words[2],
+            bound: words[3],
+            instruction_schema: words[4],
+        };
+        Ok((
+            header,
+            Parser {
+                words,
+                word_offset: HEADER_WORD_COUNT,
+            },
+        ))
+    }
+    /// the offset from the start of the module of the next instruction, in words
+    pub fn word_offset(&self) -> usize {
+        self.word_offset
+    }
+}
+
+impl<'a> Iterator for Parser<'a> {
+    type Item = Result<Instruction<'a>, Error>;
+    fn next(&mut self) -> Option<Self::Item> {
+        if self.word_offset >= self.words.len() {
+            return None;
+        }
+        match decode_instruction(&self.words[self.word_offset..]) {
+            Ok((instruction, word_count)) => {
+                self.word_offset += word_count;
+                Some(Ok(instruction))
+            }
+            Err(error) => {
+                // leave `word_offset` at the bad instruction
+                self.words = &self.words[..self.word_offset];
+                Some(Err(error))
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn encode_string(string: &str) -> Vec<u32> {
+        let mut bytes = string.as_bytes().to_vec();
+        bytes.resize(string.len() / 4 * 4 + 4, 0);
+        bytes
+            .chunks(4)
+            .map(|v| {
+                u32::from(v[0])
+                    | u32::from(v[1]) << 8
+                    | u32::from(v[2]) << 16
+                    | u32::from(v[3]) << 24
+            })
+            .collect()
+    }
+
+    #[test]
+    fn test_parse() {
+        let mut words = vec![MAGIC_NUMBER, 0x0001_0000, 0, 4, 0];
+        // OpCapability Shader
+        words.extend_from_slice(&[2 << 16 | 17, 1]);
+        // OpName %1 "main"
+        let name = encode_string("main");
+        words.push((2 + name.len() as u32) << 16 | 5);
+        words.push(1);
+        words.extend(name);
+        // OpTypeStruct %2 %3 %3
+        words.extend_from_slice(&[4 << 16 | 30, 2, 3, 3]);
+        let (header, mut parser) = Parser::new(&words).unwrap();
+        assert_eq!((header.major_version, header.minor_version), (1, 0));
+        assert_eq!(header.bound, 4);
+        match parser.next() {
+            Some(Ok(Instruction::OpCapability {
+                capability: Capability::Shader,
+            })) => {}
+            instruction => panic!("unexpected instruction: {:?}", instruction),
+        }
+        match parser.next() {
+            Some(Ok(Instruction::OpName { target, name })) => {
+                assert_eq!(target, IdRef(1));
+                assert_eq!(name, "main");
+            }
+            instruction => panic!("unexpected instruction: {:?}", instruction),
+        }
+        let instruction = parser.next().unwrap().unwrap();
+        assert_eq!(instruction.result_id(), Some(IdResult(2)));
+        match instruction {
+            Instruction::OpTypeStruct { member_type, .. } => {
+                assert_eq!(member_type.iter().collect::<Vec<_>>(), [IdRef(3), IdRef(3)]);
+            }
+            instruction => panic!("unexpected instruction: {:?}", instruction),
+        }
+        assert!(parser.next().is_none());
+        assert_eq!(parser.word_offset(), words.len());
+        // truncated instruction
+        let word_offset = words.len();
+        words.extend_from_slice(&[3 << 16 | 17, 1]);
+        let mut parser = Parser::new(&words).unwrap().1;
+        assert_eq!(parser.nth(3), Some(Err(Error::InstructionPastEnd)));
+        assert_eq!(parser.word_offset(), word_offset);
+        assert!(parser.next().is_none());
+    }
+}
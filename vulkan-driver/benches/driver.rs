@@ -0,0 +1,14 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright 2018 Jacob Lifshay
+
+// memory allocation, transfer bandwidth, and binning and rasterization throughput;
+// the benchmarks are in `src/benchmarks.rs` since they need the driver's internals
+
+extern crate kazan_driver;
+extern crate shader_compiler_backend;
+
+use shader_compiler_backend::benchmark::Runner;
+
+fn main() {
+    kazan_driver::benchmarks::run(&mut Runner::from_args());
+}
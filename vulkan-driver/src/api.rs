@@ -51,3 +51,35 @@ pub struct VkAllocationCallbacks {
     pub pfnInternalAllocation: PFN_vkInternalAllocationNotification,
     pub pfnInternalFree: PFN_vkInternalFreeNotification,
 }
+
+// VK_EXT_headless_surface is newer than our Vulkan headers
+
+pub const VK_EXT_headless_surface: u32 = 1;
+pub const VK_EXT_HEADLESS_SURFACE_SPEC_VERSION: u32 = 1;
+pub const VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT: VkStructureType = 1000256000;
+pub const VK_ICD_WSI_PLATFORM_HEADLESS: VkIcdWsiPlatform = 9;
+
+pub type VkHeadlessSurfaceCreateFlagsEXT = VkFlags;
+
+#[repr(C)]
+#[derive(Copy, Clone)]
+pub struct VkHeadlessSurfaceCreateInfoEXT {
+    pub sType: VkStructureType,
+    pub pNext: *const ::std::os::raw::c_void,
+    pub flags: VkHeadlessSurfaceCreateFlagsEXT,
+}
+
+#[repr(C)]
+#[derive(Copy, Clone)]
+pub struct VkIcdSurfaceHeadless {
+    pub base: VkIcdSurfaceBase,
+}
+
+pub type PFN_vkCreateHeadlessSurfaceEXT = Option<
+    unsafe extern "system" fn(
+        instance: VkInstance,
+        pCreateInfo: *const VkHeadlessSurfaceCreateInfoEXT,
+        pAllocator: *const VkAllocationCallbacks,
+        pSurface: *mut VkSurfaceKHR,
+    ) -> VkResult,
+>;
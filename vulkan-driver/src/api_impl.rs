@@ -9,17 +9,35 @@
 
 use api;
 use buffer::{Buffer, BufferMemory};
+use clear::ClearAttachment;
+use command_buffer::{commands, CommandPool};
 use constants::*;
+use descriptor::{DescriptorPool, DescriptorSetLayout, DescriptorUpdateTemplate, PipelineLayout};
 use device_memory::{
     DeviceMemory, DeviceMemoryAllocation, DeviceMemoryHeap, DeviceMemoryHeaps, DeviceMemoryLayout,
-    DeviceMemoryType, DeviceMemoryTypes,
+    DeviceMemoryPool, DeviceMemoryType, DeviceMemoryTypes,
 };
 use enum_map::EnumMap;
 use handle::{Handle, MutHandle, OwnedHandle, SharedHandle};
-use image::{Image, ImageMemory, ImageMultisampleCount, ImageProperties, SupportedTilings};
+use image::{
+    self, Image, ImageMemory, ImageMultisampleCount, ImageProperties, ImageView, SupportedTilings,
+};
+use pipeline::{
+    ColorBlendState, DepthStencilState, GraphicsPipelineState, Pipeline, PipelineCreateInfo,
+    PipelineFunction, PipelineState, RasterizationState, ShaderStage, SpecializationInfo,
+    VertexInputState,
+};
+use pipeline_cache::{PipelineCache, PipelineCacheHeader};
+use query::{self, QueryPool};
+use queue::{Batch, Queue};
+use rasterizer;
+use render_pass::{Framebuffer, RenderPass, Subpass};
 use sampler;
 use sampler::Sampler;
+use shader_compiler_backend::trace;
+use shader_compiler_backend_llvm_7::{LLVM7CompilerConfig, LLVM7CompilerSession};
 use shader_module::ShaderModule;
+use std::env;
 use std::ffi::CStr;
 use std::iter;
 use std::iter::FromIterator;
@@ -32,8 +50,11 @@ use std::ptr::null_mut;
 use std::ptr::NonNull;
 use std::slice;
 use std::str::FromStr;
+use std::sync::Arc;
 use swapchain::SurfacePlatform;
+use sync::{self, Fence, Semaphore, SemaphoreType, SyncGroup};
 use sys_info;
+use thread_pool::ThreadPool;
 use uuid;
 #[cfg(unix)]
 use xcb;
@@ -304,9 +325,12 @@ pub enum Extension {
     VK_KHR_relaxed_block_layout,
     VK_KHR_shader_draw_parameters,
     VK_KHR_variable_pointers,
+    VK_KHR_draw_indirect_count,
     VK_KHR_swapchain,
     #[cfg(unix)]
     VK_KHR_xcb_surface,
+    #[cfg(target_os = "linux")]
+    VK_EXT_headless_surface,
 }
 
 #[derive(Copy, Clone, Eq, PartialEq, Hash, Debug)]
@@ -337,7 +361,8 @@ impl Extension {
             | Extension::VK_KHR_maintenance2
             | Extension::VK_KHR_storage_buffer_storage_class
             | Extension::VK_KHR_relaxed_block_layout
-            | Extension::VK_KHR_shader_draw_parameters => extensions![],
+            | Extension::VK_KHR_shader_draw_parameters
+            | Extension::VK_KHR_draw_indirect_count => extensions![],
             Extension::VK_KHR_device_group => extensions![Extension::VK_KHR_device_group_creation],
             Extension::VK_KHR_sampler_ycbcr_conversion => extensions![
                 Extension::VK_KHR_maintenance1,
@@ -371,6 +396,8 @@ impl Extension {
             Extension::VK_KHR_swapchain => extensions![Extension::VK_KHR_surface],
             #[cfg(unix)]
             Extension::VK_KHR_xcb_surface => extensions![Extension::VK_KHR_surface],
+            #[cfg(target_os = "linux")]
+            Extension::VK_EXT_headless_surface => extensions![Extension::VK_KHR_surface],
         }
     }
     pub fn get_recursively_required_extensions(self) -> Extensions {
@@ -424,9 +451,12 @@ impl Extension {
             VK_KHR_relaxed_block_layout,
             VK_KHR_shader_draw_parameters,
             VK_KHR_variable_pointers,
+            VK_KHR_draw_indirect_count,
             VK_KHR_swapchain,
             #[cfg(unix)]
             VK_KHR_xcb_surface,
+            #[cfg(target_os = "linux")]
+            VK_EXT_headless_surface,
         )
     }
     pub fn get_spec_version(self) -> u32 {
@@ -475,9 +505,12 @@ impl Extension {
                 api::VK_KHR_SHADER_DRAW_PARAMETERS_SPEC_VERSION
             }
             Extension::VK_KHR_variable_pointers => api::VK_KHR_VARIABLE_POINTERS_SPEC_VERSION,
+            Extension::VK_KHR_draw_indirect_count => api::VK_KHR_DRAW_INDIRECT_COUNT_SPEC_VERSION,
             Extension::VK_KHR_swapchain => api::VK_KHR_SWAPCHAIN_SPEC_VERSION,
             #[cfg(unix)]
             Extension::VK_KHR_xcb_surface => api::VK_KHR_XCB_SURFACE_SPEC_VERSION,
+            #[cfg(target_os = "linux")]
+            Extension::VK_EXT_headless_surface => api::VK_EXT_HEADLESS_SURFACE_SPEC_VERSION,
         }
     }
     pub fn get_properties(self) -> api::VkExtensionProperties {
@@ -514,9 +547,12 @@ impl Extension {
             | Extension::VK_KHR_relaxed_block_layout
             | Extension::VK_KHR_shader_draw_parameters
             | Extension::VK_KHR_variable_pointers
+            | Extension::VK_KHR_draw_indirect_count
             | Extension::VK_KHR_swapchain => ExtensionScope::Device,
             #[cfg(unix)]
             Extension::VK_KHR_xcb_surface => ExtensionScope::Instance,
+            #[cfg(target_os = "linux")]
+            Extension::VK_EXT_headless_surface => ExtensionScope::Instance,
         }
     }
 }
@@ -985,10 +1021,15 @@ fn get_proc_address(
         proc_address!(vkGetPhysicalDevicePresentRectanglesKHR, PFN_vkGetPhysicalDevicePresentRectanglesKHR, device, extensions[Extension::VK_KHR_swapchain]);
         proc_address!(vkAcquireNextImage2KHR, PFN_vkAcquireNextImage2KHR, device, extensions[Extension::VK_KHR_swapchain]);
 
+        proc_address!(vkCmdDrawIndirectCountKHR, PFN_vkCmdDrawIndirectCountKHR, device, extensions[Extension::VK_KHR_draw_indirect_count]);
+        proc_address!(vkCmdDrawIndexedIndirectCountKHR, PFN_vkCmdDrawIndexedIndirectCountKHR, device, extensions[Extension::VK_KHR_draw_indirect_count]);
+
         #[cfg(unix)]
         proc_address!(vkCreateXcbSurfaceKHR, PFN_vkCreateXcbSurfaceKHR, device, extensions[Extension::VK_KHR_xcb_surface]);
         #[cfg(unix)]
         proc_address!(vkGetPhysicalDeviceXcbPresentationSupportKHR, PFN_vkGetPhysicalDeviceXcbPresentationSupportKHR, device, extensions[Extension::VK_KHR_xcb_surface]);
+        #[cfg(target_os = "linux")]
+        proc_address!(vkCreateHeadlessSurfaceEXT, PFN_vkCreateHeadlessSurfaceEXT, device, extensions[Extension::VK_EXT_headless_surface]);
         /*
         proc_address!(vkCmdBeginConditionalRenderingEXT, PFN_vkCmdBeginConditionalRenderingEXT, device, unknown);
         proc_address!(vkCmdBeginDebugUtilsLabelEXT, PFN_vkCmdBeginDebugUtilsLabelEXT, device, unknown);
@@ -998,9 +1039,7 @@ fn get_proc_address(
         proc_address!(vkCmdDebugMarkerEndEXT, PFN_vkCmdDebugMarkerEndEXT, device, unknown);
         proc_address!(vkCmdDebugMarkerInsertEXT, PFN_vkCmdDebugMarkerInsertEXT, device, unknown);
         proc_address!(vkCmdDrawIndexedIndirectCountAMD, PFN_vkCmdDrawIndexedIndirectCountAMD, device, unknown);
-        proc_address!(vkCmdDrawIndexedIndirectCountKHR, PFN_vkCmdDrawIndexedIndirectCountKHR, device, unknown);
         proc_address!(vkCmdDrawIndirectCountAMD, PFN_vkCmdDrawIndirectCountAMD, device, unknown);
-        proc_address!(vkCmdDrawIndirectCountKHR, PFN_vkCmdDrawIndirectCountKHR, device, unknown);
         proc_address!(vkCmdDrawMeshTasksIndirectCountNV, PFN_vkCmdDrawMeshTasksIndirectCountNV, device, unknown);
         proc_address!(vkCmdDrawMeshTasksIndirectNV, PFN_vkCmdDrawMeshTasksIndirectNV, device, unknown);
         proc_address!(vkCmdDrawMeshTasksNV, PFN_vkCmdDrawMeshTasksNV, device, unknown);
@@ -1119,7 +1158,7 @@ impl Features {
                 textureCompressionASTC_LDR: api::VK_FALSE, // FIXME: enable texture compression
                 textureCompressionBC: api::VK_FALSE,   // FIXME: enable texture compression
                 occlusionQueryPrecise: api::VK_FALSE,
-                pipelineStatisticsQuery: api::VK_FALSE,
+                pipelineStatisticsQuery: api::VK_TRUE,
                 vertexPipelineStoresAndAtomics: api::VK_TRUE,
                 fragmentStoresAndAtomics: api::VK_TRUE,
                 shaderTessellationAndGeometryPointSize: api::VK_FALSE,
@@ -1529,15 +1568,21 @@ impl Not for Features {
     }
 }
 
-pub struct Queue {}
-
 pub struct Device {
-    #[allow(dead_code)]
     physical_device: SharedHandle<api::VkPhysicalDevice>,
     extensions: Extensions,
     #[allow(dead_code)]
     features: Features,
     queues: Vec<Vec<OwnedHandle<api::VkQueue>>>,
+    shader_compiler_config: LLVM7CompilerConfig,
+    /// used to compile pipelines in parallel, to recompile them with optimizations in the
+    /// background, and by the queues to run the workgroups of compute dispatches
+    thread_pool: Arc<ThreadPool>,
+    memory_pool: Arc<DeviceMemoryPool>,
+    /// shared by all fences and semaphores so `vkWaitForFences` can wait for any of them
+    sync_group: Arc<SyncGroup>,
+    /// defer indexing shader modules until the first pipeline that uses them
+    lazy_shader_module_index: bool,
 }
 
 impl Device {
@@ -1648,7 +1693,8 @@ impl Device {
         );
         assert!(queue_create_infos.len() <= QUEUE_FAMILY_COUNT as usize);
         let mut total_queue_count = 0;
-        let mut queue_counts: Vec<_> = Vec::new();
+        let thread_pool = Arc::new(ThreadPool::with_thread_per_core("kazan worker"));
+        let mut queues: Vec<Vec<_>> = (0..QUEUE_FAMILY_COUNT).map(|_| Vec::new()).collect();
         for queue_create_info in queue_create_infos {
             parse_next_chain_const!{
                 queue_create_info as *const api::VkDeviceQueueCreateInfo,
@@ -1669,28 +1715,40 @@ impl Device {
             for &queue_priority in queue_priorities {
                 assert!(queue_priority >= 0.0 && queue_priority <= 1.0);
             }
-            assert_eq!(QUEUE_FAMILY_COUNT, 1, "multiple queues are not implemented");
-            assert_eq!(
-                QUEUE_COUNTS, [1; QUEUE_FAMILY_COUNT as usize],
-                "multiple queues are not implemented"
+            let queue_family_queues = &mut queues[queue_family_index as usize];
+            assert!(
+                queue_family_queues.is_empty(),
+                "queue family specified more than once"
             );
-            queue_counts.push(queue_count as usize);
+            for queue_index in 0..queue_count {
+                queue_family_queues.push(OwnedHandle::<api::VkQueue>::new(Queue::new(
+                    queue_family_index,
+                    queue_index,
+                    thread_pool.clone(),
+                )));
+            }
             total_queue_count += queue_count as usize;
         }
         assert!(total_queue_count <= TOTAL_QUEUE_COUNT);
-        let mut queues = Vec::new();
-        for queue_count in queue_counts {
-            let mut queue_family_queues = Vec::new();
-            for _queue_index in 0..queue_count {
-                queue_family_queues.push(OwnedHandle::<api::VkQueue>::new(Queue {}));
-            }
-            queues.push(queue_family_queues);
-        }
+        let shader_compiler_session = LLVM7CompilerSession::new().map_err(|error| {
+            eprintln!("creating shader compiler session failed: {}", error);
+            api::VK_ERROR_INITIALIZATION_FAILED
+        })?;
         Ok(OwnedHandle::<api::VkDevice>::new(Device {
             physical_device,
             extensions: enabled_extensions,
             features: selected_features,
             queues,
+            shader_compiler_config: LLVM7CompilerConfig {
+                session: Some(Arc::new(shader_compiler_session)),
+                ..Default::default()
+            },
+            thread_pool,
+            memory_pool: Arc::new(DeviceMemoryPool::new(
+                env::var_os("KAZAN_PREFAULT_DEVICE_MEMORY").is_some(),
+            )),
+            sync_group: SyncGroup::new(),
+            lazy_shader_module_index: env::var_os("KAZAN_LAZY_SHADER_MODULE_INDEX").is_some(),
         }))
     }
 }
@@ -1711,8 +1769,25 @@ pub struct PhysicalDevice {
 
 impl PhysicalDevice {
     pub fn get_pipeline_cache_uuid() -> uuid::Uuid {
-        // FIXME: return real uuid
-        uuid::Uuid::nil()
+        // the serialized pipeline cache format can change with every driver version;
+        // the shader compiler and target CPU are part of each entry's key
+        uuid::Uuid::new_v5(
+            &uuid::Uuid::nil(),
+            concat!("kazan pipeline cache ", env!("CARGO_PKG_VERSION")).as_bytes(),
+        )
+    }
+    pub fn get_pipeline_cache_header(&self) -> PipelineCacheHeader {
+        PipelineCacheHeader {
+            vendor_id: self.properties.vendorID,
+            device_id: self.properties.deviceID,
+            pipeline_cache_uuid: self.properties.pipelineCacheUUID,
+        }
+    }
+    /// `properties` with the measured `timestampPeriod`
+    pub fn get_properties(&self) -> api::VkPhysicalDeviceProperties {
+        let mut properties = self.properties;
+        properties.limits.timestampPeriod = query::get_timestamp_period();
+        properties
     }
     pub fn get_device_uuid() -> uuid::Uuid {
         // FIXME: return real uuid
@@ -1780,7 +1855,7 @@ impl PhysicalDevice {
             maxComputeWorkGroupCount: [!0; 3],
             maxComputeWorkGroupInvocations: !0,
             maxComputeWorkGroupSize: [!0; 3],
-            subPixelPrecisionBits: 4, // FIXME: update to correct value
+            subPixelPrecisionBits: rasterizer::SUBPIXEL_BITS,
             subTexelPrecisionBits: 4, // FIXME: update to correct value
             mipmapPrecisionBits: 4,   // FIXME: update to correct value
             maxDrawIndexedIndexValue: !0,
@@ -1819,7 +1894,8 @@ impl PhysicalDevice {
                 | api::VK_SAMPLE_COUNT_4_BIT, // FIXME: update to correct value
             storageImageSampleCounts: api::VK_SAMPLE_COUNT_1_BIT, // FIXME: update to correct value
             maxSampleMaskWords: 1,
-            timestampComputeAndGraphics: api::VK_FALSE,
+            timestampComputeAndGraphics: api::VK_TRUE,
+            // measured by `query::get_timestamp_period` when the properties are first queried
             timestampPeriod: 0.0,
             maxClipDistances: 0,
             maxCullDistances: 0,
@@ -3212,6 +3288,7 @@ impl Instance {
             }
             Ok(info) => system_memory_size = info.total * 1024,
         }
+        query::start_timestamp_calibration();
         let mut device_name = [0; api::VK_MAX_PHYSICAL_DEVICE_NAME_SIZE as usize];
         copy_str_to_char_array(&mut device_name, KAZAN_DEVICE_NAME);
         #[cfg_attr(feature = "cargo-clippy", allow(clippy::needless_update))]
@@ -3278,7 +3355,10 @@ impl Instance {
                 subgroup_properties: api::VkPhysicalDeviceSubgroupProperties {
                     sType: api::VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES,
                     pNext: null_mut(),
-                    subgroupSize: 1, // FIXME fill in correct value
+                    // FIXME: report `LLVM7CompilerConfig::variable_vector_length_multiplier` once
+                    // the shader translator runs invocations in SIMD lanes; until then every
+                    // invocation runs on its own
+                    subgroupSize: 1,
                     supportedStages: api::VK_SHADER_STAGE_COMPUTE_BIT,
                     supportedOperations: api::VK_SUBGROUP_FEATURE_BASIC_BIT,
                     quadOperationsInAllStages: api::VK_FALSE,
@@ -3467,24 +3547,23 @@ pub unsafe extern "system" fn vkGetPhysicalDeviceProperties(
     properties: *mut api::VkPhysicalDeviceProperties,
 ) {
     let physical_device = SharedHandle::from(physical_device).unwrap();
-    *properties = physical_device.properties;
+    *properties = physical_device.get_properties();
 }
 
 unsafe fn get_physical_device_queue_family_properties(
     _physical_device: &SharedHandle<api::VkPhysicalDevice>,
     queue_family_properties: &mut api::VkQueueFamilyProperties2,
     queue_count: u32,
+    queue_flags: api::VkQueueFlags,
 ) {
     parse_next_chain_mut!{
         queue_family_properties as *mut api::VkQueueFamilyProperties2,
         root = api::VK_STRUCTURE_TYPE_QUEUE_FAMILY_PROPERTIES_2,
     }
     queue_family_properties.queueFamilyProperties = api::VkQueueFamilyProperties {
-        queueFlags: api::VK_QUEUE_GRAPHICS_BIT
-            | api::VK_QUEUE_COMPUTE_BIT
-            | api::VK_QUEUE_TRANSFER_BIT,
+        queueFlags: queue_flags,
         queueCount: queue_count,
-        timestampValidBits: 0,
+        timestampValidBits: 64,
         minImageTransferGranularity: api::VkExtent3D {
             width: 1,
             height: 1,
@@ -3502,8 +3581,8 @@ pub unsafe extern "system" fn vkGetPhysicalDeviceQueueFamilyProperties(
     enumerate_helper(
         queue_family_property_count,
         queue_family_properties,
-        QUEUE_COUNTS.iter(),
-        |queue_family_properties, &count| {
+        QUEUE_COUNTS.iter().zip(QUEUE_FAMILY_FLAGS.iter()),
+        |queue_family_properties, (&count, &flags)| {
             let mut queue_family_properties2 = api::VkQueueFamilyProperties2 {
                 sType: api::VK_STRUCTURE_TYPE_QUEUE_FAMILY_PROPERTIES_2,
                 pNext: null_mut(),
@@ -3513,6 +3592,7 @@ pub unsafe extern "system" fn vkGetPhysicalDeviceQueueFamilyProperties(
                 &SharedHandle::from(physical_device).unwrap(),
                 &mut queue_family_properties2,
                 count,
+                flags,
             );
             *queue_family_properties = queue_family_properties2.queueFamilyProperties;
         },
@@ -3568,6 +3648,7 @@ pub unsafe extern "system" fn vkDestroyDevice(
     _allocator: *const api::VkAllocationCallbacks,
 ) {
     OwnedHandle::from(device);
+    trace::flush();
 }
 
 unsafe fn enumerate_extension_properties(
@@ -3641,27 +3722,81 @@ pub unsafe extern "system" fn vkGetDeviceQueue(
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkQueueSubmit(
-    _queue: api::VkQueue,
-    _submitCount: u32,
-    _pSubmits: *const api::VkSubmitInfo,
-    _fence: api::VkFence,
+    queue: api::VkQueue,
+    submit_count: u32,
+    submits: *const api::VkSubmitInfo,
+    fence: api::VkFence,
 ) -> api::VkResult {
-    unimplemented!()
+    let mut batches = Vec::with_capacity(submit_count as usize);
+    for submit in slice_or_empty(submits, submit_count as usize) {
+        parse_next_chain_const!{
+            submit as *const api::VkSubmitInfo,
+            root = api::VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            device_group_submit_info: api::VkDeviceGroupSubmitInfo = api::VK_STRUCTURE_TYPE_DEVICE_GROUP_SUBMIT_INFO,
+            protected_submit_info: api::VkProtectedSubmitInfo = api::VK_STRUCTURE_TYPE_PROTECTED_SUBMIT_INFO,
+        }
+        // there is only one device in the group
+        let _ = device_group_submit_info;
+        if !protected_submit_info.is_null() {
+            assert_eq!((*protected_submit_info).protectedSubmit, api::VK_FALSE);
+        }
+        // commands are executed in order, so the wait stages don't matter
+        batches.push(Batch {
+            wait_semaphores: slice_or_empty(
+                submit.pWaitSemaphores,
+                submit.waitSemaphoreCount as usize,
+            )
+            .iter()
+            .map(|&semaphore| (semaphore, 0))
+            .collect(),
+            command_buffers: slice_or_empty(
+                submit.pCommandBuffers,
+                submit.commandBufferCount as usize,
+            )
+            .to_vec(),
+            presents: Vec::new(),
+            signal_semaphores: slice_or_empty(
+                submit.pSignalSemaphores,
+                submit.signalSemaphoreCount as usize,
+            )
+            .iter()
+            .map(|&semaphore| (semaphore, 0))
+            .collect(),
+        });
+    }
+    match SharedHandle::from(queue).unwrap().submit(batches, fence) {
+        Ok(()) => api::VK_SUCCESS,
+        Err(_) => api::VK_ERROR_DEVICE_LOST,
+    }
 }
 
 #[allow(non_snake_case)]
-pub unsafe extern "system" fn vkQueueWaitIdle(_queue: api::VkQueue) -> api::VkResult {
-    unimplemented!()
+pub unsafe extern "system" fn vkQueueWaitIdle(queue: api::VkQueue) -> api::VkResult {
+    let result = SharedHandle::from(queue).unwrap().wait_idle();
+    trace::flush();
+    match result {
+        Ok(()) => api::VK_SUCCESS,
+        Err(_) => api::VK_ERROR_DEVICE_LOST,
+    }
 }
 
 #[allow(non_snake_case)]
-pub unsafe extern "system" fn vkDeviceWaitIdle(_device: api::VkDevice) -> api::VkResult {
-    unimplemented!()
+pub unsafe extern "system" fn vkDeviceWaitIdle(device: api::VkDevice) -> api::VkResult {
+    let device = SharedHandle::from(device).unwrap();
+    let mut retval = api::VK_SUCCESS;
+    for queue in device.queues.iter().flat_map(|queues| queues.iter()) {
+        if queue.wait_idle().is_err() {
+            retval = api::VK_ERROR_DEVICE_LOST;
+        }
+    }
+    // everything the queues traced is finished, so this is a good point to write it out
+    trace::flush();
+    retval
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkAllocateMemory(
-    _device: api::VkDevice,
+    device: api::VkDevice,
     allocate_info: *const api::VkMemoryAllocateInfo,
     _allocator: *const api::VkAllocationCallbacks,
     memory: *mut api::VkDeviceMemory,
@@ -3683,15 +3818,20 @@ pub unsafe extern "system" fn vkAllocateMemory(
     if !memory_dedicated_allocate_info.is_null() {
         unimplemented!()
     }
+    let _span = trace::span("memory", "allocate memory").arg("size", allocate_info.allocationSize);
     match DeviceMemoryType::from_index(allocate_info.memoryTypeIndex).unwrap() {
         DeviceMemoryType::Main => {
             if allocate_info.allocationSize > isize::max_value() as u64 {
                 return api::VK_ERROR_OUT_OF_DEVICE_MEMORY;
             }
-            match DeviceMemory::allocate_from_default_heap(DeviceMemoryLayout::calculate(
-                allocate_info.allocationSize as usize,
-                MIN_MEMORY_MAP_ALIGNMENT,
-            )) {
+            let device = SharedHandle::from(device).unwrap();
+            match DeviceMemory::allocate_from_pool(
+                &device.memory_pool,
+                DeviceMemoryLayout::calculate(
+                    allocate_info.allocationSize as usize,
+                    MIN_MEMORY_MAP_ALIGNMENT,
+                ),
+            ) {
                 Ok(new_memory) => {
                     *memory = OwnedHandle::<api::VkDeviceMemory>::new(new_memory).take();
                     api::VK_SUCCESS
@@ -3880,68 +4020,117 @@ pub unsafe extern "system" fn vkQueueBindSparse(
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCreateFence(
-    _device: api::VkDevice,
-    _pCreateInfo: *const api::VkFenceCreateInfo,
-    _pAllocator: *const api::VkAllocationCallbacks,
-    _pFence: *mut api::VkFence,
+    device: api::VkDevice,
+    create_info: *const api::VkFenceCreateInfo,
+    _allocator: *const api::VkAllocationCallbacks,
+    fence: *mut api::VkFence,
 ) -> api::VkResult {
-    unimplemented!()
+    parse_next_chain_const!{
+        create_info,
+        root = api::VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    }
+    let create_info = &*create_info;
+    let device = SharedHandle::from(device).unwrap();
+    *fence = OwnedHandle::<api::VkFence>::new(Fence::new(
+        device.sync_group.clone(),
+        create_info.flags & api::VK_FENCE_CREATE_SIGNALED_BIT != 0,
+    ))
+    .take();
+    api::VK_SUCCESS
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkDestroyFence(
     _device: api::VkDevice,
-    _fence: api::VkFence,
-    _pAllocator: *const api::VkAllocationCallbacks,
+    fence: api::VkFence,
+    _allocator: *const api::VkAllocationCallbacks,
 ) {
-    unimplemented!()
+    OwnedHandle::from(fence);
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkResetFences(
     _device: api::VkDevice,
-    _fenceCount: u32,
-    _pFences: *const api::VkFence,
+    fence_count: u32,
+    fences: *const api::VkFence,
 ) -> api::VkResult {
-    unimplemented!()
+    for &fence in slice_or_empty(fences, fence_count as usize) {
+        SharedHandle::from(fence).unwrap().reset();
+    }
+    api::VK_SUCCESS
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkGetFenceStatus(
     _device: api::VkDevice,
-    _fence: api::VkFence,
+    fence: api::VkFence,
 ) -> api::VkResult {
-    unimplemented!()
+    if SharedHandle::from(fence).unwrap().is_signaled() {
+        api::VK_SUCCESS
+    } else {
+        api::VK_NOT_READY
+    }
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkWaitForFences(
-    _device: api::VkDevice,
-    _fenceCount: u32,
-    _pFences: *const api::VkFence,
-    _waitAll: api::VkBool32,
-    _timeout: u64,
+    device: api::VkDevice,
+    fence_count: u32,
+    fences: *const api::VkFence,
+    wait_all: api::VkBool32,
+    timeout: u64,
 ) -> api::VkResult {
-    unimplemented!()
+    let device = SharedHandle::from(device).unwrap();
+    let fences: Vec<_> = slice_or_empty(fences, fence_count as usize)
+        .iter()
+        .map(|&fence| SharedHandle::from(fence).unwrap())
+        .collect();
+    let done = device
+        .sync_group
+        .wait_until(sync::get_deadline(timeout), || {
+            if wait_all != api::VK_FALSE {
+                fences.iter().all(|fence| fence.is_signaled())
+            } else {
+                fences.iter().any(|fence| fence.is_signaled())
+            }
+        });
+    if done {
+        api::VK_SUCCESS
+    } else {
+        api::VK_TIMEOUT
+    }
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCreateSemaphore(
-    _device: api::VkDevice,
-    _pCreateInfo: *const api::VkSemaphoreCreateInfo,
-    _pAllocator: *const api::VkAllocationCallbacks,
-    _pSemaphore: *mut api::VkSemaphore,
+    device: api::VkDevice,
+    create_info: *const api::VkSemaphoreCreateInfo,
+    _allocator: *const api::VkAllocationCallbacks,
+    semaphore: *mut api::VkSemaphore,
 ) -> api::VkResult {
-    unimplemented!()
+    parse_next_chain_const!{
+        create_info,
+        root = api::VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+    }
+    let create_info = &*create_info;
+    assert_eq!(create_info.flags, 0);
+    let device = SharedHandle::from(device).unwrap();
+    *semaphore = OwnedHandle::<api::VkSemaphore>::new(Semaphore::new(
+        device.sync_group.clone(),
+        SemaphoreType::Binary,
+        0,
+    ))
+    .take();
+    api::VK_SUCCESS
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkDestroySemaphore(
     _device: api::VkDevice,
-    _semaphore: api::VkSemaphore,
-    _pAllocator: *const api::VkAllocationCallbacks,
+    semaphore: api::VkSemaphore,
+    _allocator: *const api::VkAllocationCallbacks,
 ) {
-    unimplemented!()
+    OwnedHandle::from(semaphore);
 }
 
 #[allow(non_snake_case)]
@@ -3989,35 +4178,58 @@ pub unsafe extern "system" fn vkResetEvent(
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCreateQueryPool(
-    _device: api::VkDevice,
-    _pCreateInfo: *const api::VkQueryPoolCreateInfo,
-    _pAllocator: *const api::VkAllocationCallbacks,
-    _pQueryPool: *mut api::VkQueryPool,
+    device: api::VkDevice,
+    create_info: *const api::VkQueryPoolCreateInfo,
+    _allocator: *const api::VkAllocationCallbacks,
+    query_pool: *mut api::VkQueryPool,
 ) -> api::VkResult {
-    unimplemented!()
+    parse_next_chain_const!{
+        create_info,
+        root = api::VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+    }
+    let create_info = &*create_info;
+    let device = SharedHandle::from(device).unwrap();
+    *query_pool = OwnedHandle::<api::VkQueryPool>::new(QueryPool::new(
+        device.sync_group.clone(),
+        create_info.queryType,
+        create_info.queryCount,
+        create_info.pipelineStatistics,
+    ))
+    .take();
+    api::VK_SUCCESS
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkDestroyQueryPool(
     _device: api::VkDevice,
-    _queryPool: api::VkQueryPool,
-    _pAllocator: *const api::VkAllocationCallbacks,
+    query_pool: api::VkQueryPool,
+    _allocator: *const api::VkAllocationCallbacks,
 ) {
-    unimplemented!()
+    OwnedHandle::from(query_pool);
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkGetQueryPoolResults(
     _device: api::VkDevice,
-    _queryPool: api::VkQueryPool,
-    _firstQuery: u32,
-    _queryCount: u32,
-    _dataSize: usize,
-    _pData: *mut c_void,
-    _stride: api::VkDeviceSize,
-    _flags: api::VkQueryResultFlags,
+    query_pool: api::VkQueryPool,
+    first_query: u32,
+    query_count: u32,
+    _data_size: usize,
+    data: *mut c_void,
+    stride: api::VkDeviceSize,
+    flags: api::VkQueryResultFlags,
 ) -> api::VkResult {
-    unimplemented!()
+    if SharedHandle::from(query_pool).unwrap().get_results(
+        first_query,
+        query_count,
+        data as *mut u8,
+        stride as usize,
+        flags,
+    ) {
+        api::VK_SUCCESS
+    } else {
+        api::VK_NOT_READY
+    }
 }
 
 #[allow(non_snake_case)]
@@ -4132,35 +4344,69 @@ pub unsafe extern "system" fn vkDestroyImage(
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkGetImageSubresourceLayout(
     _device: api::VkDevice,
-    _image: api::VkImage,
-    _pSubresource: *const api::VkImageSubresource,
-    _pLayout: *mut api::VkSubresourceLayout,
-) {
-    unimplemented!()
+    image: api::VkImage,
+    subresource: *const api::VkImageSubresource,
+    layout: *mut api::VkSubresourceLayout,
+) {
+    let image = SharedHandle::from(image).unwrap();
+    let api::VkImageSubresource {
+        aspectMask: _,
+        mipLevel: mip_level,
+        arrayLayer: array_layer,
+    } = *subresource;
+    let computed_properties = image.properties.computed_properties();
+    let subresource_layout = computed_properties.get_subresource_layout(mip_level, array_layer);
+    *layout = api::VkSubresourceLayout {
+        offset: subresource_layout.offset as u64,
+        size: subresource_layout.size as u64,
+        rowPitch: subresource_layout.row_pitch as u64,
+        arrayPitch: computed_properties.array_pitch as u64,
+        depthPitch: subresource_layout.depth_pitch as u64,
+    };
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCreateImageView(
     _device: api::VkDevice,
-    _pCreateInfo: *const api::VkImageViewCreateInfo,
-    _pAllocator: *const api::VkAllocationCallbacks,
-    _pView: *mut api::VkImageView,
+    create_info: *const api::VkImageViewCreateInfo,
+    _allocator: *const api::VkAllocationCallbacks,
+    view: *mut api::VkImageView,
 ) -> api::VkResult {
-    unimplemented!()
+    parse_next_chain_const!{
+        create_info,
+        root = api::VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+    }
+    let create_info = &*create_info;
+    let image = SharedHandle::from(create_info.image).unwrap();
+    let (level_count, layer_count) =
+        image.get_level_and_layer_counts(&create_info.subresourceRange);
+    *view = OwnedHandle::<api::VkImageView>::new(ImageView {
+        image,
+        view_type: create_info.viewType,
+        format: create_info.format,
+        component_mapping: create_info.components,
+        subresource_range: api::VkImageSubresourceRange {
+            levelCount: level_count,
+            layerCount: layer_count,
+            ..create_info.subresourceRange
+        },
+    })
+    .take();
+    api::VK_SUCCESS
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkDestroyImageView(
     _device: api::VkDevice,
-    _imageView: api::VkImageView,
-    _pAllocator: *const api::VkAllocationCallbacks,
+    image_view: api::VkImageView,
+    _allocator: *const api::VkAllocationCallbacks,
 ) {
-    unimplemented!()
+    OwnedHandle::from(image_view);
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCreateShaderModule(
-    _device: api::VkDevice,
+    device: api::VkDevice,
     create_info: *const api::VkShaderModuleCreateInfo,
     _allocator: *const api::VkAllocationCallbacks,
     shader_module: *mut api::VkShaderModule,
@@ -4175,9 +4421,10 @@ pub unsafe extern "system" fn vkCreateShaderModule(
     assert_eq!(create_info.codeSize % U32_BYTE_COUNT, 0);
     assert_ne!(create_info.codeSize, 0);
     let code = slice::from_raw_parts(create_info.pCode, create_info.codeSize / U32_BYTE_COUNT);
-    *shader_module = OwnedHandle::<api::VkShaderModule>::new(ShaderModule {
-        code: code.to_owned(),
-    })
+    *shader_module = OwnedHandle::<api::VkShaderModule>::new(ShaderModule::new(
+        code.into(),
+        !SharedHandle::from(device).unwrap().lazy_shader_module_index,
+    ))
     .take();
     api::VK_SUCCESS
 }
@@ -4193,93 +4440,455 @@ pub unsafe extern "system" fn vkDestroyShaderModule(
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCreatePipelineCache(
-    _device: api::VkDevice,
-    _pCreateInfo: *const api::VkPipelineCacheCreateInfo,
-    _pAllocator: *const api::VkAllocationCallbacks,
-    _pPipelineCache: *mut api::VkPipelineCache,
+    device: api::VkDevice,
+    create_info: *const api::VkPipelineCacheCreateInfo,
+    _allocator: *const api::VkAllocationCallbacks,
+    pipeline_cache: *mut api::VkPipelineCache,
 ) -> api::VkResult {
-    unimplemented!()
+    parse_next_chain_const!{
+        create_info,
+        root = api::VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+    }
+    let create_info = &*create_info;
+    let device = SharedHandle::from(device).unwrap();
+    let initial_data = if create_info.initialDataSize == 0 {
+        &[]
+    } else {
+        slice::from_raw_parts(
+            create_info.pInitialData as *const u8,
+            create_info.initialDataSize,
+        )
+    };
+    *pipeline_cache = OwnedHandle::<api::VkPipelineCache>::new(PipelineCache::new(
+        device.physical_device.get_pipeline_cache_header(),
+        initial_data,
+    ))
+    .take();
+    api::VK_SUCCESS
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkDestroyPipelineCache(
     _device: api::VkDevice,
-    _pipelineCache: api::VkPipelineCache,
-    _pAllocator: *const api::VkAllocationCallbacks,
+    pipeline_cache: api::VkPipelineCache,
+    _allocator: *const api::VkAllocationCallbacks,
 ) {
-    unimplemented!()
+    OwnedHandle::from(pipeline_cache);
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkGetPipelineCacheData(
     _device: api::VkDevice,
-    _pipelineCache: api::VkPipelineCache,
-    _pDataSize: *mut usize,
-    _pData: *mut c_void,
+    pipeline_cache: api::VkPipelineCache,
+    data_size: *mut usize,
+    data: *mut c_void,
 ) -> api::VkResult {
-    unimplemented!()
+    let pipeline_cache = SharedHandle::from(pipeline_cache).unwrap();
+    if data.is_null() {
+        *data_size = pipeline_cache.serialize(usize::max_value()).0.len();
+        return api::VK_SUCCESS;
+    }
+    let (serialized, complete) = pipeline_cache.serialize(*data_size);
+    slice::from_raw_parts_mut(data as *mut u8, serialized.len()).copy_from_slice(&serialized);
+    *data_size = serialized.len();
+    if complete {
+        api::VK_SUCCESS
+    } else {
+        api::VK_INCOMPLETE
+    }
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkMergePipelineCaches(
     _device: api::VkDevice,
-    _dstCache: api::VkPipelineCache,
-    _srcCacheCount: u32,
-    _pSrcCaches: *const api::VkPipelineCache,
+    dst_cache: api::VkPipelineCache,
+    src_cache_count: u32,
+    src_caches: *const api::VkPipelineCache,
 ) -> api::VkResult {
-    unimplemented!()
+    let dst_cache = SharedHandle::from(dst_cache).unwrap();
+    for &src_cache in slice::from_raw_parts(src_caches, src_cache_count as usize) {
+        let src_cache = SharedHandle::from(src_cache).unwrap();
+        dst_cache.merge_from(&src_cache);
+    }
+    api::VK_SUCCESS
+}
+
+unsafe fn slice_or_empty<'a, T>(ptr: *const T, len: usize) -> &'a [T] {
+    if len != 0 {
+        slice::from_raw_parts(ptr, len)
+    } else {
+        &[]
+    }
+}
+
+unsafe fn parse_pipeline_shader_stage(
+    create_info: &api::VkPipelineShaderStageCreateInfo,
+) -> ShaderStage {
+    parse_next_chain_const!{
+        create_info as *const api::VkPipelineShaderStageCreateInfo,
+        root = api::VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+    }
+    let api::VkPipelineShaderStageCreateInfo {
+        sType: _,
+        pNext: _,
+        flags,
+        stage,
+        module,
+        pName: name,
+        pSpecializationInfo: specialization_info,
+    } = *create_info;
+    assert_eq!(flags, 0);
+    let function = match stage {
+        api::VK_SHADER_STAGE_VERTEX_BIT => PipelineFunction::VertexShader,
+        api::VK_SHADER_STAGE_FRAGMENT_BIT => PipelineFunction::FragmentShader,
+        api::VK_SHADER_STAGE_COMPUTE_BIT => PipelineFunction::ComputeShader,
+        _ => unimplemented!("shader stage: {:#x}", stage),
+    };
+    let specialization_info = if specialization_info.is_null() {
+        None
+    } else {
+        let specialization_info = &*specialization_info;
+        Some(SpecializationInfo {
+            map_entries: slice_or_empty(
+                specialization_info.pMapEntries,
+                specialization_info.mapEntryCount as usize,
+            )
+            .into(),
+            data: slice_or_empty(
+                specialization_info.pData as *const u8,
+                specialization_info.dataSize,
+            )
+            .into(),
+        })
+    };
+    let module = SharedHandle::from(module).unwrap();
+    ShaderStage {
+        function,
+        code: module.code.clone(),
+        index: module.get_index(),
+        entry_point_name: CStr::from_ptr(name).to_str().unwrap().into(),
+        specialization_info,
+    }
+}
+
+unsafe fn parse_graphics_pipeline_create_info(
+    create_info: &api::VkGraphicsPipelineCreateInfo,
+) -> PipelineCreateInfo {
+    parse_next_chain_const!{
+        create_info as *const api::VkGraphicsPipelineCreateInfo,
+        root = api::VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+    }
+    let api::VkGraphicsPipelineCreateInfo {
+        sType: _,
+        pNext: _,
+        flags,
+        stageCount: stage_count,
+        pStages: stages,
+        pVertexInputState: vertex_input_state,
+        pInputAssemblyState: input_assembly_state,
+        pTessellationState: _,
+        pViewportState: viewport_state,
+        pRasterizationState: rasterization_state,
+        pMultisampleState: multisample_state,
+        pDepthStencilState: depth_stencil_state,
+        pColorBlendState: color_blend_state,
+        pDynamicState: dynamic_state,
+        layout,
+        renderPass: _,
+        subpass: _,
+        basePipelineHandle: _,
+        basePipelineIndex: _,
+    } = *create_info;
+    let stages = slice_or_empty(stages, stage_count as usize)
+        .iter()
+        .map(|stage| parse_pipeline_shader_stage(stage))
+        .collect();
+    let dynamic_states: Vec<_> = if dynamic_state.is_null() {
+        Vec::new()
+    } else {
+        parse_next_chain_const!{
+            dynamic_state,
+            root = api::VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+        }
+        let dynamic_state = &*dynamic_state;
+        slice_or_empty(
+            dynamic_state.pDynamicStates,
+            dynamic_state.dynamicStateCount as usize,
+        )
+        .into()
+    };
+    parse_next_chain_const!{
+        vertex_input_state,
+        root = api::VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+    }
+    let vertex_input_state = &*vertex_input_state;
+    let vertex_input = VertexInputState {
+        bindings: slice_or_empty(
+            vertex_input_state.pVertexBindingDescriptions,
+            vertex_input_state.vertexBindingDescriptionCount as usize,
+        )
+        .into(),
+        attributes: slice_or_empty(
+            vertex_input_state.pVertexAttributeDescriptions,
+            vertex_input_state.vertexAttributeDescriptionCount as usize,
+        )
+        .into(),
+    };
+    parse_next_chain_const!{
+        input_assembly_state,
+        root = api::VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+    }
+    let input_assembly_state = &*input_assembly_state;
+    parse_next_chain_const!{
+        rasterization_state,
+        root = api::VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+    }
+    let rasterization_state = &*rasterization_state;
+    let rasterization = RasterizationState {
+        depth_clamp_enable: rasterization_state.depthClampEnable != api::VK_FALSE,
+        rasterizer_discard_enable: rasterization_state.rasterizerDiscardEnable != api::VK_FALSE,
+        polygon_mode: rasterization_state.polygonMode,
+        cull_mode: rasterization_state.cullMode,
+        front_face: rasterization_state.frontFace,
+        depth_bias_enable: rasterization_state.depthBiasEnable != api::VK_FALSE,
+        depth_bias_constant_factor: rasterization_state.depthBiasConstantFactor,
+        depth_bias_clamp: rasterization_state.depthBiasClamp,
+        depth_bias_slope_factor: rasterization_state.depthBiasSlopeFactor,
+        line_width: rasterization_state.lineWidth,
+    };
+    let mut viewports = Vec::new();
+    let mut scissors = Vec::new();
+    let mut rasterization_samples = api::VK_SAMPLE_COUNT_1_BIT;
+    let mut depth_stencil = None;
+    let mut color_blend = None;
+    // the rest of the state is ignored, and the pointers may be invalid, when rasterization is disabled
+    if !rasterization.rasterizer_discard_enable {
+        parse_next_chain_const!{
+            viewport_state,
+            root = api::VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+        }
+        let viewport_state = &*viewport_state;
+        if !dynamic_states.contains(&api::VK_DYNAMIC_STATE_VIEWPORT) {
+            viewports = slice_or_empty(
+                viewport_state.pViewports,
+                viewport_state.viewportCount as usize,
+            )
+            .into();
+        }
+        if !dynamic_states.contains(&api::VK_DYNAMIC_STATE_SCISSOR) {
+            scissors = slice_or_empty(
+                viewport_state.pScissors,
+                viewport_state.scissorCount as usize,
+            )
+            .into();
+        }
+        parse_next_chain_const!{
+            multisample_state,
+            root = api::VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+        }
+        rasterization_samples = (*multisample_state).rasterizationSamples;
+        if !depth_stencil_state.is_null() {
+            parse_next_chain_const!{
+                depth_stencil_state,
+                root = api::VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+            }
+            let depth_stencil_state = &*depth_stencil_state;
+            depth_stencil = Some(DepthStencilState {
+                depth_test_enable: depth_stencil_state.depthTestEnable != api::VK_FALSE,
+                depth_write_enable: depth_stencil_state.depthWriteEnable != api::VK_FALSE,
+                depth_compare_op: depth_stencil_state.depthCompareOp,
+                depth_bounds_test_enable: depth_stencil_state.depthBoundsTestEnable
+                    != api::VK_FALSE,
+                stencil_test_enable: depth_stencil_state.stencilTestEnable != api::VK_FALSE,
+                front: depth_stencil_state.front,
+                back: depth_stencil_state.back,
+                min_depth_bounds: depth_stencil_state.minDepthBounds,
+                max_depth_bounds: depth_stencil_state.maxDepthBounds,
+            });
+        }
+        if !color_blend_state.is_null() {
+            parse_next_chain_const!{
+                color_blend_state,
+                root = api::VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+            }
+            let color_blend_state = &*color_blend_state;
+            color_blend = Some(ColorBlendState {
+                logic_op: if color_blend_state.logicOpEnable != api::VK_FALSE {
+                    Some(color_blend_state.logicOp)
+                } else {
+                    None
+                },
+                attachments: slice_or_empty(
+                    color_blend_state.pAttachments,
+                    color_blend_state.attachmentCount as usize,
+                )
+                .into(),
+                blend_constants: color_blend_state.blendConstants,
+            });
+        }
+    }
+    PipelineCreateInfo {
+        stages,
+        state: PipelineState::Graphics(GraphicsPipelineState {
+            vertex_input,
+            topology: input_assembly_state.topology,
+            primitive_restart_enable: input_assembly_state.primitiveRestartEnable
+                != api::VK_FALSE,
+            viewports,
+            scissors,
+            rasterization,
+            rasterization_samples,
+            depth_stencil,
+            color_blend,
+            dynamic_states,
+        }),
+        disable_optimization: flags & api::VK_PIPELINE_CREATE_DISABLE_OPTIMIZATION_BIT != 0,
+        set_layouts: SharedHandle::from(layout).unwrap().set_layouts.clone(),
+    }
+}
+
+unsafe fn parse_compute_pipeline_create_info(
+    create_info: &api::VkComputePipelineCreateInfo,
+) -> PipelineCreateInfo {
+    parse_next_chain_const!{
+        create_info as *const api::VkComputePipelineCreateInfo,
+        root = api::VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+    }
+    let api::VkComputePipelineCreateInfo {
+        sType: _,
+        pNext: _,
+        flags,
+        stage,
+        layout,
+        basePipelineHandle: _,
+        basePipelineIndex: _,
+    } = *create_info;
+    let stage = parse_pipeline_shader_stage(&stage);
+    assert_eq!(stage.function, PipelineFunction::ComputeShader);
+    PipelineCreateInfo {
+        stages: vec![stage],
+        state: PipelineState::Compute,
+        disable_optimization: flags & api::VK_PIPELINE_CREATE_DISABLE_OPTIMIZATION_BIT != 0,
+        set_layouts: SharedHandle::from(layout).unwrap().set_layouts.clone(),
+    }
+}
+
+/// compile the pipelines in parallel on the device's thread pool.
+/// the optimized code is compiled in the background, see `Pipeline::new`.
+/// the pipelines that fail to compile are set to the null handle, as required by the Vulkan spec
+unsafe fn create_pipelines(
+    device: api::VkDevice,
+    pipeline_cache: api::VkPipelineCache,
+    create_infos: Vec<PipelineCreateInfo>,
+    pipelines: *mut api::VkPipeline,
+) -> api::VkResult {
+    let device = SharedHandle::from(device).unwrap();
+    let pipeline_cache = SharedHandle::from(pipeline_cache);
+    let pipeline_cache = pipeline_cache.as_ref().map(|pipeline_cache| &**pipeline_cache);
+    let shader_compiler_config = &device.shader_compiler_config;
+    let thread_pool = &*device.thread_pool;
+    let results = thread_pool.map(create_infos, |create_info| {
+        Pipeline::new(
+            create_info,
+            shader_compiler_config,
+            pipeline_cache,
+            Some(thread_pool),
+        )
+    });
+    let pipelines = slice::from_raw_parts_mut(pipelines, results.len());
+    let mut retval = api::VK_SUCCESS;
+    for (pipeline, result) in pipelines.iter_mut().zip(results) {
+        *pipeline = match result {
+            Ok(result) => OwnedHandle::<api::VkPipeline>::new(result).take(),
+            Err(error) => {
+                eprintln!("pipeline compilation failed: {}", error);
+                retval = api::VK_ERROR_OUT_OF_HOST_MEMORY;
+                Handle::null()
+            }
+        };
+    }
+    retval
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCreateGraphicsPipelines(
-    _device: api::VkDevice,
-    _pipelineCache: api::VkPipelineCache,
-    _createInfoCount: u32,
-    _pCreateInfos: *const api::VkGraphicsPipelineCreateInfo,
-    _pAllocator: *const api::VkAllocationCallbacks,
-    _pPipelines: *mut api::VkPipeline,
+    device: api::VkDevice,
+    pipeline_cache: api::VkPipelineCache,
+    create_info_count: u32,
+    create_infos: *const api::VkGraphicsPipelineCreateInfo,
+    _allocator: *const api::VkAllocationCallbacks,
+    pipelines: *mut api::VkPipeline,
 ) -> api::VkResult {
-    unimplemented!()
+    assert_ne!(create_info_count, 0);
+    let create_infos = slice::from_raw_parts(create_infos, create_info_count as usize)
+        .iter()
+        .map(|create_info| parse_graphics_pipeline_create_info(create_info))
+        .collect();
+    create_pipelines(device, pipeline_cache, create_infos, pipelines)
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCreateComputePipelines(
-    _device: api::VkDevice,
-    _pipelineCache: api::VkPipelineCache,
-    _createInfoCount: u32,
-    _pCreateInfos: *const api::VkComputePipelineCreateInfo,
-    _pAllocator: *const api::VkAllocationCallbacks,
-    _pPipelines: *mut api::VkPipeline,
+    device: api::VkDevice,
+    pipeline_cache: api::VkPipelineCache,
+    create_info_count: u32,
+    create_infos: *const api::VkComputePipelineCreateInfo,
+    _allocator: *const api::VkAllocationCallbacks,
+    pipelines: *mut api::VkPipeline,
 ) -> api::VkResult {
-    unimplemented!()
+    assert_ne!(create_info_count, 0);
+    let create_infos = slice::from_raw_parts(create_infos, create_info_count as usize)
+        .iter()
+        .map(|create_info| parse_compute_pipeline_create_info(create_info))
+        .collect();
+    create_pipelines(device, pipeline_cache, create_infos, pipelines)
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkDestroyPipeline(
     _device: api::VkDevice,
-    _pipeline: api::VkPipeline,
-    _pAllocator: *const api::VkAllocationCallbacks,
+    pipeline: api::VkPipeline,
+    _allocator: *const api::VkAllocationCallbacks,
 ) {
-    unimplemented!()
+    OwnedHandle::from(pipeline);
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCreatePipelineLayout(
     _device: api::VkDevice,
-    _pCreateInfo: *const api::VkPipelineLayoutCreateInfo,
-    _pAllocator: *const api::VkAllocationCallbacks,
-    _pPipelineLayout: *mut api::VkPipelineLayout,
+    create_info: *const api::VkPipelineLayoutCreateInfo,
+    _allocator: *const api::VkAllocationCallbacks,
+    pipeline_layout: *mut api::VkPipelineLayout,
 ) -> api::VkResult {
-    unimplemented!()
+    parse_next_chain_const!{
+        create_info,
+        root = api::VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+    }
+    let create_info = &*create_info;
+    let set_layouts = slice_or_empty(create_info.pSetLayouts, create_info.setLayoutCount as usize)
+        .iter()
+        .map(|&set_layout| (*SharedHandle::from(set_layout).unwrap()).clone())
+        .collect();
+    let push_constant_ranges = slice_or_empty(
+        create_info.pPushConstantRanges,
+        create_info.pushConstantRangeCount as usize,
+    )
+    .into();
+    *pipeline_layout = OwnedHandle::<api::VkPipelineLayout>::new(PipelineLayout::new(
+        set_layouts,
+        push_constant_ranges,
+    ))
+    .take();
+    api::VK_SUCCESS
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkDestroyPipelineLayout(
     _device: api::VkDevice,
-    _pipelineLayout: api::VkPipelineLayout,
-    _pAllocator: *const api::VkAllocationCallbacks,
+    pipeline_layout: api::VkPipelineLayout,
+    _allocator: *const api::VkAllocationCallbacks,
 ) {
-    unimplemented!()
+    OwnedHandle::from(pipeline_layout);
 }
 
 #[allow(non_snake_case)]
@@ -4338,224 +4947,413 @@ pub unsafe extern "system" fn vkDestroySampler(
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCreateDescriptorSetLayout(
     _device: api::VkDevice,
-    _pCreateInfo: *const api::VkDescriptorSetLayoutCreateInfo,
-    _pAllocator: *const api::VkAllocationCallbacks,
-    _pSetLayout: *mut api::VkDescriptorSetLayout,
+    create_info: *const api::VkDescriptorSetLayoutCreateInfo,
+    _allocator: *const api::VkAllocationCallbacks,
+    set_layout: *mut api::VkDescriptorSetLayout,
 ) -> api::VkResult {
-    unimplemented!()
+    parse_next_chain_const!{
+        create_info,
+        root = api::VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+    }
+    let create_info = &*create_info;
+    *set_layout =
+        OwnedHandle::<api::VkDescriptorSetLayout>::new(Arc::new(DescriptorSetLayout::new(
+            slice_or_empty(create_info.pBindings, create_info.bindingCount as usize),
+        )))
+        .take();
+    api::VK_SUCCESS
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkDestroyDescriptorSetLayout(
     _device: api::VkDevice,
-    _descriptorSetLayout: api::VkDescriptorSetLayout,
-    _pAllocator: *const api::VkAllocationCallbacks,
+    set_layout: api::VkDescriptorSetLayout,
+    _allocator: *const api::VkAllocationCallbacks,
 ) {
-    unimplemented!()
+    OwnedHandle::from(set_layout);
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCreateDescriptorPool(
     _device: api::VkDevice,
-    _pCreateInfo: *const api::VkDescriptorPoolCreateInfo,
-    _pAllocator: *const api::VkAllocationCallbacks,
-    _pDescriptorPool: *mut api::VkDescriptorPool,
+    create_info: *const api::VkDescriptorPoolCreateInfo,
+    _allocator: *const api::VkAllocationCallbacks,
+    descriptor_pool: *mut api::VkDescriptorPool,
 ) -> api::VkResult {
-    unimplemented!()
+    parse_next_chain_const!{
+        create_info,
+        root = api::VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+    }
+    let create_info = &*create_info;
+    *descriptor_pool = OwnedHandle::<api::VkDescriptorPool>::new(DescriptorPool::new(
+        create_info.maxSets,
+        slice_or_empty(create_info.pPoolSizes, create_info.poolSizeCount as usize),
+    ))
+    .take();
+    api::VK_SUCCESS
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkDestroyDescriptorPool(
     _device: api::VkDevice,
-    _descriptorPool: api::VkDescriptorPool,
-    _pAllocator: *const api::VkAllocationCallbacks,
+    descriptor_pool: api::VkDescriptorPool,
+    _allocator: *const api::VkAllocationCallbacks,
 ) {
-    unimplemented!()
+    OwnedHandle::from(descriptor_pool);
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkResetDescriptorPool(
     _device: api::VkDevice,
-    _descriptorPool: api::VkDescriptorPool,
+    descriptor_pool: api::VkDescriptorPool,
     _flags: api::VkDescriptorPoolResetFlags,
 ) -> api::VkResult {
-    unimplemented!()
+    MutHandle::from(descriptor_pool).unwrap().reset();
+    api::VK_SUCCESS
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkAllocateDescriptorSets(
     _device: api::VkDevice,
-    _pAllocateInfo: *const api::VkDescriptorSetAllocateInfo,
-    _pDescriptorSets: *mut api::VkDescriptorSet,
+    allocate_info: *const api::VkDescriptorSetAllocateInfo,
+    descriptor_sets: *mut api::VkDescriptorSet,
 ) -> api::VkResult {
-    unimplemented!()
+    parse_next_chain_const!{
+        allocate_info,
+        root = api::VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+    }
+    let allocate_info = &*allocate_info;
+    let mut descriptor_pool = MutHandle::from(allocate_info.descriptorPool).unwrap();
+    let set_layouts = slice_or_empty(
+        allocate_info.pSetLayouts,
+        allocate_info.descriptorSetCount as usize,
+    );
+    let descriptor_sets =
+        slice::from_raw_parts_mut(descriptor_sets, allocate_info.descriptorSetCount as usize);
+    for (index, &set_layout) in set_layouts.iter().enumerate() {
+        let set_layout = (*SharedHandle::from(set_layout).unwrap()).clone();
+        match descriptor_pool.allocate(set_layout) {
+            Ok(descriptor_set) => descriptor_sets[index] = descriptor_set,
+            Err(error) => {
+                // the spec requires freeing the sets that were already allocated
+                for descriptor_set in &mut descriptor_sets[..index] {
+                    descriptor_pool.free(descriptor_set.take());
+                }
+                for descriptor_set in &mut descriptor_sets[index..] {
+                    *descriptor_set = Handle::null();
+                }
+                return error;
+            }
+        }
+    }
+    api::VK_SUCCESS
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkFreeDescriptorSets(
     _device: api::VkDevice,
-    _descriptorPool: api::VkDescriptorPool,
-    _descriptorSetCount: u32,
-    _pDescriptorSets: *const api::VkDescriptorSet,
+    descriptor_pool: api::VkDescriptorPool,
+    descriptor_set_count: u32,
+    descriptor_sets: *const api::VkDescriptorSet,
 ) -> api::VkResult {
-    unimplemented!()
+    let mut descriptor_pool = MutHandle::from(descriptor_pool).unwrap();
+    for &descriptor_set in slice::from_raw_parts(descriptor_sets, descriptor_set_count as usize) {
+        descriptor_pool.free(descriptor_set);
+    }
+    api::VK_SUCCESS
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkUpdateDescriptorSets(
     _device: api::VkDevice,
-    _descriptorWriteCount: u32,
-    _pDescriptorWrites: *const api::VkWriteDescriptorSet,
-    _descriptorCopyCount: u32,
-    _pDescriptorCopies: *const api::VkCopyDescriptorSet,
+    descriptor_write_count: u32,
+    descriptor_writes: *const api::VkWriteDescriptorSet,
+    descriptor_copy_count: u32,
+    descriptor_copies: *const api::VkCopyDescriptorSet,
 ) {
-    unimplemented!()
+    for descriptor_write in slice_or_empty(descriptor_writes, descriptor_write_count as usize) {
+        parse_next_chain_const!{
+            descriptor_write as *const api::VkWriteDescriptorSet,
+            root = api::VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        }
+        SharedHandle::from(descriptor_write.dstSet)
+            .unwrap()
+            .write(descriptor_write);
+    }
+    for descriptor_copy in slice_or_empty(descriptor_copies, descriptor_copy_count as usize) {
+        parse_next_chain_const!{
+            descriptor_copy as *const api::VkCopyDescriptorSet,
+            root = api::VK_STRUCTURE_TYPE_COPY_DESCRIPTOR_SET,
+        }
+        SharedHandle::from(descriptor_copy.dstSet).unwrap().copy(
+            &SharedHandle::from(descriptor_copy.srcSet).unwrap(),
+            descriptor_copy,
+        );
+    }
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCreateFramebuffer(
     _device: api::VkDevice,
-    _pCreateInfo: *const api::VkFramebufferCreateInfo,
-    _pAllocator: *const api::VkAllocationCallbacks,
-    _pFramebuffer: *mut api::VkFramebuffer,
+    create_info: *const api::VkFramebufferCreateInfo,
+    _allocator: *const api::VkAllocationCallbacks,
+    framebuffer: *mut api::VkFramebuffer,
 ) -> api::VkResult {
-    unimplemented!()
+    parse_next_chain_const!{
+        create_info,
+        root = api::VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+    }
+    let create_info = &*create_info;
+    *framebuffer = OwnedHandle::<api::VkFramebuffer>::new(Framebuffer {
+        attachments: slice_or_empty(
+            create_info.pAttachments,
+            create_info.attachmentCount as usize,
+        )
+        .iter()
+        .map(|&attachment| SharedHandle::from(attachment).unwrap())
+        .collect(),
+        width: create_info.width,
+        height: create_info.height,
+        layers: create_info.layers,
+    })
+    .take();
+    api::VK_SUCCESS
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkDestroyFramebuffer(
     _device: api::VkDevice,
-    _framebuffer: api::VkFramebuffer,
-    _pAllocator: *const api::VkAllocationCallbacks,
+    framebuffer: api::VkFramebuffer,
+    _allocator: *const api::VkAllocationCallbacks,
 ) {
-    unimplemented!()
+    OwnedHandle::from(framebuffer);
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCreateRenderPass(
     _device: api::VkDevice,
-    _pCreateInfo: *const api::VkRenderPassCreateInfo,
-    _pAllocator: *const api::VkAllocationCallbacks,
-    _pRenderPass: *mut api::VkRenderPass,
+    create_info: *const api::VkRenderPassCreateInfo,
+    _allocator: *const api::VkAllocationCallbacks,
+    render_pass: *mut api::VkRenderPass,
 ) -> api::VkResult {
-    unimplemented!()
+    parse_next_chain_const!{
+        create_info,
+        root = api::VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+    }
+    let create_info = &*create_info;
+    let subpasses = slice_or_empty(create_info.pSubpasses, create_info.subpassCount as usize)
+        .iter()
+        .map(|subpass| {
+            let color_attachment_count = subpass.colorAttachmentCount as usize;
+            Subpass {
+                input_attachments: slice_or_empty(
+                    subpass.pInputAttachments,
+                    subpass.inputAttachmentCount as usize,
+                )
+                .into(),
+                color_attachments: slice_or_empty(
+                    subpass.pColorAttachments,
+                    color_attachment_count,
+                )
+                .into(),
+                resolve_attachments: if subpass.pResolveAttachments.is_null() {
+                    Vec::new()
+                } else {
+                    slice_or_empty(subpass.pResolveAttachments, color_attachment_count).into()
+                },
+                depth_stencil_attachment: subpass.pDepthStencilAttachment.as_ref().cloned(),
+            }
+        })
+        .collect();
+    *render_pass = OwnedHandle::<api::VkRenderPass>::new(RenderPass {
+        attachments: slice_or_empty(
+            create_info.pAttachments,
+            create_info.attachmentCount as usize,
+        )
+        .into(),
+        subpasses,
+    })
+    .take();
+    api::VK_SUCCESS
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkDestroyRenderPass(
     _device: api::VkDevice,
-    _renderPass: api::VkRenderPass,
-    _pAllocator: *const api::VkAllocationCallbacks,
+    render_pass: api::VkRenderPass,
+    _allocator: *const api::VkAllocationCallbacks,
 ) {
-    unimplemented!()
+    OwnedHandle::from(render_pass);
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkGetRenderAreaGranularity(
     _device: api::VkDevice,
-    _renderPass: api::VkRenderPass,
-    _pGranularity: *mut api::VkExtent2D,
+    _render_pass: api::VkRenderPass,
+    granularity: *mut api::VkExtent2D,
 ) {
-    unimplemented!()
+    // clears of whole tiles are deferred or written with a single fill
+    *granularity = api::VkExtent2D {
+        width: image::TILE_SIZE,
+        height: image::TILE_SIZE,
+    };
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCreateCommandPool(
     _device: api::VkDevice,
-    _pCreateInfo: *const api::VkCommandPoolCreateInfo,
-    _pAllocator: *const api::VkAllocationCallbacks,
-    _pCommandPool: *mut api::VkCommandPool,
+    create_info: *const api::VkCommandPoolCreateInfo,
+    _allocator: *const api::VkAllocationCallbacks,
+    command_pool: *mut api::VkCommandPool,
 ) -> api::VkResult {
-    unimplemented!()
+    parse_next_chain_const!{
+        create_info,
+        root = api::VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+    }
+    let create_info = &*create_info;
+    assert!(create_info.queueFamilyIndex < QUEUE_FAMILY_COUNT);
+    *command_pool =
+        OwnedHandle::<api::VkCommandPool>::new(CommandPool::new(create_info.flags)).take();
+    api::VK_SUCCESS
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkDestroyCommandPool(
     _device: api::VkDevice,
-    _commandPool: api::VkCommandPool,
-    _pAllocator: *const api::VkAllocationCallbacks,
+    command_pool: api::VkCommandPool,
+    _allocator: *const api::VkAllocationCallbacks,
 ) {
-    unimplemented!()
+    OwnedHandle::from(command_pool);
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkResetCommandPool(
     _device: api::VkDevice,
-    _commandPool: api::VkCommandPool,
-    _flags: api::VkCommandPoolResetFlags,
+    command_pool: api::VkCommandPool,
+    flags: api::VkCommandPoolResetFlags,
 ) -> api::VkResult {
-    unimplemented!()
+    MutHandle::from(command_pool)
+        .unwrap()
+        .reset(flags & api::VK_COMMAND_POOL_RESET_RELEASE_RESOURCES_BIT != 0);
+    api::VK_SUCCESS
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkAllocateCommandBuffers(
     _device: api::VkDevice,
-    _pAllocateInfo: *const api::VkCommandBufferAllocateInfo,
-    _pCommandBuffers: *mut api::VkCommandBuffer,
+    allocate_info: *const api::VkCommandBufferAllocateInfo,
+    command_buffers: *mut api::VkCommandBuffer,
 ) -> api::VkResult {
-    unimplemented!()
+    parse_next_chain_const!{
+        allocate_info,
+        root = api::VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+    }
+    let allocate_info = &*allocate_info;
+    let mut command_pool = MutHandle::from(allocate_info.commandPool).unwrap();
+    let command_buffers =
+        slice::from_raw_parts_mut(command_buffers, allocate_info.commandBufferCount as usize);
+    for command_buffer in command_buffers {
+        *command_buffer = command_pool.allocate_command_buffer(allocate_info.level);
+    }
+    api::VK_SUCCESS
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkFreeCommandBuffers(
     _device: api::VkDevice,
-    _commandPool: api::VkCommandPool,
-    _commandBufferCount: u32,
-    _pCommandBuffers: *const api::VkCommandBuffer,
+    command_pool: api::VkCommandPool,
+    command_buffer_count: u32,
+    command_buffers: *const api::VkCommandBuffer,
 ) {
-    unimplemented!()
+    let mut command_pool = MutHandle::from(command_pool).unwrap();
+    for &command_buffer in slice::from_raw_parts(command_buffers, command_buffer_count as usize) {
+        command_pool.free_command_buffer(command_buffer);
+    }
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkBeginCommandBuffer(
-    _commandBuffer: api::VkCommandBuffer,
-    _pBeginInfo: *const api::VkCommandBufferBeginInfo,
+    command_buffer: api::VkCommandBuffer,
+    begin_info: *const api::VkCommandBufferBeginInfo,
 ) -> api::VkResult {
-    unimplemented!()
+    parse_next_chain_const!{
+        begin_info,
+        root = api::VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        device_group_command_buffer_begin_info: api::VkDeviceGroupCommandBufferBeginInfo = api::VK_STRUCTURE_TYPE_DEVICE_GROUP_COMMAND_BUFFER_BEGIN_INFO,
+    }
+    // there is only one physical device per device, so the device mask is ignored
+    let _ = device_group_command_buffer_begin_info;
+    let begin_info = &*begin_info;
+    let mut command_buffer = MutHandle::from(command_buffer).unwrap();
+    if command_buffer.level() == api::VK_COMMAND_BUFFER_LEVEL_SECONDARY {
+        unimplemented!("secondary command buffers");
+    }
+    command_buffer.begin(begin_info.flags);
+    api::VK_SUCCESS
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkEndCommandBuffer(
-    _commandBuffer: api::VkCommandBuffer,
+    command_buffer: api::VkCommandBuffer,
 ) -> api::VkResult {
-    unimplemented!()
+    MutHandle::from(command_buffer).unwrap().end();
+    api::VK_SUCCESS
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkResetCommandBuffer(
-    _commandBuffer: api::VkCommandBuffer,
-    _flags: api::VkCommandBufferResetFlags,
+    command_buffer: api::VkCommandBuffer,
+    flags: api::VkCommandBufferResetFlags,
 ) -> api::VkResult {
-    unimplemented!()
+    MutHandle::from(command_buffer)
+        .unwrap()
+        .reset(flags & api::VK_COMMAND_BUFFER_RESET_RELEASE_RESOURCES_BIT != 0);
+    api::VK_SUCCESS
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdBindPipeline(
-    _commandBuffer: api::VkCommandBuffer,
-    _pipelineBindPoint: api::VkPipelineBindPoint,
-    _pipeline: api::VkPipeline,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    pipeline_bind_point: api::VkPipelineBindPoint,
+    pipeline: api::VkPipeline,
+) {
+    MutHandle::from(command_buffer)
+        .unwrap()
+        .record(commands::BindPipeline {
+            pipeline_bind_point,
+            pipeline,
+        });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdSetViewport(
-    _commandBuffer: api::VkCommandBuffer,
-    _firstViewport: u32,
-    _viewportCount: u32,
-    _pViewports: *const api::VkViewport,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    first_viewport: u32,
+    viewport_count: u32,
+    viewports: *const api::VkViewport,
+) {
+    let mut command_buffer = MutHandle::from(command_buffer).unwrap();
+    let viewports =
+        command_buffer.allocate_slice(slice_or_empty(viewports, viewport_count as usize));
+    command_buffer.record(commands::SetViewport {
+        first_viewport,
+        viewports,
+    });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdSetScissor(
-    _commandBuffer: api::VkCommandBuffer,
-    _firstScissor: u32,
-    _scissorCount: u32,
-    _pScissors: *const api::VkRect2D,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    first_scissor: u32,
+    scissor_count: u32,
+    scissors: *const api::VkRect2D,
+) {
+    let mut command_buffer = MutHandle::from(command_buffer).unwrap();
+    let scissors = command_buffer.allocate_slice(slice_or_empty(scissors, scissor_count as usize));
+    command_buffer.record(commands::SetScissor {
+        first_scissor,
+        scissors,
+    });
 }
 
 #[allow(non_snake_case)]
@@ -4622,220 +5420,356 @@ pub unsafe extern "system" fn vkCmdSetStencilReference(
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdBindDescriptorSets(
-    _commandBuffer: api::VkCommandBuffer,
-    _pipelineBindPoint: api::VkPipelineBindPoint,
-    _layout: api::VkPipelineLayout,
-    _firstSet: u32,
-    _descriptorSetCount: u32,
-    _pDescriptorSets: *const api::VkDescriptorSet,
-    _dynamicOffsetCount: u32,
-    _pDynamicOffsets: *const u32,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    pipeline_bind_point: api::VkPipelineBindPoint,
+    layout: api::VkPipelineLayout,
+    first_set: u32,
+    descriptor_set_count: u32,
+    descriptor_sets: *const api::VkDescriptorSet,
+    dynamic_offset_count: u32,
+    dynamic_offsets: *const u32,
+) {
+    let layout = SharedHandle::from(layout).unwrap();
+    let mut command_buffer = MutHandle::from(command_buffer).unwrap();
+    let descriptor_sets = command_buffer.allocate_slice(slice_or_empty(
+        descriptor_sets,
+        descriptor_set_count as usize,
+    ));
+    let dynamic_offsets = command_buffer.allocate_slice(slice_or_empty(
+        dynamic_offsets,
+        dynamic_offset_count as usize,
+    ));
+    command_buffer.record(commands::BindDescriptorSets {
+        pipeline_bind_point,
+        first_set,
+        first_dynamic_offset: layout.dynamic_offset_starts[first_set as usize],
+        descriptor_sets,
+        dynamic_offsets,
+    });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdBindIndexBuffer(
-    _commandBuffer: api::VkCommandBuffer,
-    _buffer: api::VkBuffer,
-    _offset: api::VkDeviceSize,
-    _indexType: api::VkIndexType,
+    command_buffer: api::VkCommandBuffer,
+    buffer: api::VkBuffer,
+    offset: api::VkDeviceSize,
+    index_type: api::VkIndexType,
 ) {
-    unimplemented!()
+    MutHandle::from(command_buffer)
+        .unwrap()
+        .record(commands::BindIndexBuffer {
+            buffer,
+            offset,
+            index_type,
+        });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdBindVertexBuffers(
-    _commandBuffer: api::VkCommandBuffer,
-    _firstBinding: u32,
-    _bindingCount: u32,
-    _pBuffers: *const api::VkBuffer,
-    _pOffsets: *const api::VkDeviceSize,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    first_binding: u32,
+    binding_count: u32,
+    buffers: *const api::VkBuffer,
+    offsets: *const api::VkDeviceSize,
+) {
+    let mut command_buffer = MutHandle::from(command_buffer).unwrap();
+    let buffers = command_buffer.allocate_slice(slice_or_empty(buffers, binding_count as usize));
+    let offsets = command_buffer.allocate_slice(slice_or_empty(offsets, binding_count as usize));
+    command_buffer.record(commands::BindVertexBuffers {
+        first_binding,
+        buffers,
+        offsets,
+    });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdDraw(
-    _commandBuffer: api::VkCommandBuffer,
-    _vertexCount: u32,
-    _instanceCount: u32,
-    _firstVertex: u32,
-    _firstInstance: u32,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    vertex_count: u32,
+    instance_count: u32,
+    first_vertex: u32,
+    first_instance: u32,
+) {
+    MutHandle::from(command_buffer)
+        .unwrap()
+        .record(commands::Draw {
+            vertex_count,
+            instance_count,
+            first_vertex,
+            first_instance,
+        });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdDrawIndexed(
-    _commandBuffer: api::VkCommandBuffer,
-    _indexCount: u32,
-    _instanceCount: u32,
-    _firstIndex: u32,
-    _vertexOffset: i32,
-    _firstInstance: u32,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    index_count: u32,
+    instance_count: u32,
+    first_index: u32,
+    vertex_offset: i32,
+    first_instance: u32,
+) {
+    MutHandle::from(command_buffer)
+        .unwrap()
+        .record(commands::DrawIndexed {
+            index_count,
+            instance_count,
+            first_index,
+            vertex_offset,
+            first_instance,
+        });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdDrawIndirect(
-    _commandBuffer: api::VkCommandBuffer,
-    _buffer: api::VkBuffer,
-    _offset: api::VkDeviceSize,
-    _drawCount: u32,
-    _stride: u32,
+    command_buffer: api::VkCommandBuffer,
+    buffer: api::VkBuffer,
+    offset: api::VkDeviceSize,
+    draw_count: u32,
+    stride: u32,
 ) {
-    unimplemented!()
+    MutHandle::from(command_buffer)
+        .unwrap()
+        .record(commands::DrawIndirect {
+            buffer,
+            offset,
+            draw_count,
+            stride,
+        });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdDrawIndexedIndirect(
-    _commandBuffer: api::VkCommandBuffer,
-    _buffer: api::VkBuffer,
-    _offset: api::VkDeviceSize,
-    _drawCount: u32,
-    _stride: u32,
+    command_buffer: api::VkCommandBuffer,
+    buffer: api::VkBuffer,
+    offset: api::VkDeviceSize,
+    draw_count: u32,
+    stride: u32,
 ) {
-    unimplemented!()
+    MutHandle::from(command_buffer)
+        .unwrap()
+        .record(commands::DrawIndexedIndirect {
+            buffer,
+            offset,
+            draw_count,
+            stride,
+        });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdDispatch(
-    _commandBuffer: api::VkCommandBuffer,
-    _groupCountX: u32,
-    _groupCountY: u32,
-    _groupCountZ: u32,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    group_count_x: u32,
+    group_count_y: u32,
+    group_count_z: u32,
+) {
+    MutHandle::from(command_buffer)
+        .unwrap()
+        .record(commands::Dispatch {
+            base_group_x: 0,
+            base_group_y: 0,
+            base_group_z: 0,
+            group_count_x,
+            group_count_y,
+            group_count_z,
+        });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdDispatchIndirect(
-    _commandBuffer: api::VkCommandBuffer,
-    _buffer: api::VkBuffer,
-    _offset: api::VkDeviceSize,
+    command_buffer: api::VkCommandBuffer,
+    buffer: api::VkBuffer,
+    offset: api::VkDeviceSize,
 ) {
-    unimplemented!()
+    MutHandle::from(command_buffer)
+        .unwrap()
+        .record(commands::DispatchIndirect { buffer, offset });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdCopyBuffer(
-    _commandBuffer: api::VkCommandBuffer,
-    _srcBuffer: api::VkBuffer,
-    _dstBuffer: api::VkBuffer,
-    _regionCount: u32,
-    _pRegions: *const api::VkBufferCopy,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    src_buffer: api::VkBuffer,
+    dst_buffer: api::VkBuffer,
+    region_count: u32,
+    regions: *const api::VkBufferCopy,
+) {
+    let mut command_buffer = MutHandle::from(command_buffer).unwrap();
+    let regions = command_buffer.allocate_slice(slice_or_empty(regions, region_count as usize));
+    command_buffer.record(commands::CopyBuffer {
+        src_buffer,
+        dst_buffer,
+        regions,
+    });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdCopyImage(
-    _commandBuffer: api::VkCommandBuffer,
-    _srcImage: api::VkImage,
-    _srcImageLayout: api::VkImageLayout,
-    _dstImage: api::VkImage,
-    _dstImageLayout: api::VkImageLayout,
-    _regionCount: u32,
-    _pRegions: *const api::VkImageCopy,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    src_image: api::VkImage,
+    _src_image_layout: api::VkImageLayout,
+    dst_image: api::VkImage,
+    _dst_image_layout: api::VkImageLayout,
+    region_count: u32,
+    regions: *const api::VkImageCopy,
+) {
+    let mut command_buffer = MutHandle::from(command_buffer).unwrap();
+    let regions = command_buffer.allocate_slice(slice_or_empty(regions, region_count as usize));
+    command_buffer.record(commands::CopyImage {
+        src_image,
+        dst_image,
+        regions,
+    });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdBlitImage(
-    _commandBuffer: api::VkCommandBuffer,
-    _srcImage: api::VkImage,
-    _srcImageLayout: api::VkImageLayout,
-    _dstImage: api::VkImage,
-    _dstImageLayout: api::VkImageLayout,
-    _regionCount: u32,
-    _pRegions: *const api::VkImageBlit,
-    _filter: api::VkFilter,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    src_image: api::VkImage,
+    _src_image_layout: api::VkImageLayout,
+    dst_image: api::VkImage,
+    _dst_image_layout: api::VkImageLayout,
+    region_count: u32,
+    regions: *const api::VkImageBlit,
+    filter: api::VkFilter,
+) {
+    let mut command_buffer = MutHandle::from(command_buffer).unwrap();
+    let regions = command_buffer.allocate_slice(slice_or_empty(regions, region_count as usize));
+    command_buffer.record(commands::BlitImage {
+        src_image,
+        dst_image,
+        regions,
+        filter,
+    });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdCopyBufferToImage(
-    _commandBuffer: api::VkCommandBuffer,
-    _srcBuffer: api::VkBuffer,
-    _dstImage: api::VkImage,
-    _dstImageLayout: api::VkImageLayout,
-    _regionCount: u32,
-    _pRegions: *const api::VkBufferImageCopy,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    src_buffer: api::VkBuffer,
+    dst_image: api::VkImage,
+    _dst_image_layout: api::VkImageLayout,
+    region_count: u32,
+    regions: *const api::VkBufferImageCopy,
+) {
+    let mut command_buffer = MutHandle::from(command_buffer).unwrap();
+    let regions = command_buffer.allocate_slice(slice_or_empty(regions, region_count as usize));
+    command_buffer.record(commands::CopyBufferToImage {
+        src_buffer,
+        dst_image,
+        regions,
+    });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdCopyImageToBuffer(
-    _commandBuffer: api::VkCommandBuffer,
-    _srcImage: api::VkImage,
-    _srcImageLayout: api::VkImageLayout,
-    _dstBuffer: api::VkBuffer,
-    _regionCount: u32,
-    _pRegions: *const api::VkBufferImageCopy,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    src_image: api::VkImage,
+    _src_image_layout: api::VkImageLayout,
+    dst_buffer: api::VkBuffer,
+    region_count: u32,
+    regions: *const api::VkBufferImageCopy,
+) {
+    let mut command_buffer = MutHandle::from(command_buffer).unwrap();
+    let regions = command_buffer.allocate_slice(slice_or_empty(regions, region_count as usize));
+    command_buffer.record(commands::CopyImageToBuffer {
+        src_image,
+        dst_buffer,
+        regions,
+    });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdUpdateBuffer(
-    _commandBuffer: api::VkCommandBuffer,
-    _dstBuffer: api::VkBuffer,
-    _dstOffset: api::VkDeviceSize,
-    _dataSize: api::VkDeviceSize,
-    _pData: *const c_void,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    dst_buffer: api::VkBuffer,
+    dst_offset: api::VkDeviceSize,
+    data_size: api::VkDeviceSize,
+    data: *const c_void,
+) {
+    let mut command_buffer = MutHandle::from(command_buffer).unwrap();
+    let data = command_buffer.allocate_slice(slice_or_empty(data as *const u8, data_size as usize));
+    command_buffer.record(commands::UpdateBuffer {
+        dst_buffer,
+        dst_offset,
+        data,
+    });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdFillBuffer(
-    _commandBuffer: api::VkCommandBuffer,
-    _dstBuffer: api::VkBuffer,
-    _dstOffset: api::VkDeviceSize,
-    _size: api::VkDeviceSize,
-    _data: u32,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    dst_buffer: api::VkBuffer,
+    dst_offset: api::VkDeviceSize,
+    size: api::VkDeviceSize,
+    data: u32,
+) {
+    MutHandle::from(command_buffer)
+        .unwrap()
+        .record(commands::FillBuffer {
+            dst_buffer,
+            dst_offset,
+            size,
+            data,
+        });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdClearColorImage(
-    _commandBuffer: api::VkCommandBuffer,
-    _image: api::VkImage,
-    _imageLayout: api::VkImageLayout,
-    _pColor: *const api::VkClearColorValue,
-    _rangeCount: u32,
-    _pRanges: *const api::VkImageSubresourceRange,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    image: api::VkImage,
+    _image_layout: api::VkImageLayout,
+    color: *const api::VkClearColorValue,
+    range_count: u32,
+    ranges: *const api::VkImageSubresourceRange,
+) {
+    let mut command_buffer = MutHandle::from(command_buffer).unwrap();
+    let ranges = command_buffer.allocate_slice(slice_or_empty(ranges, range_count as usize));
+    command_buffer.record(commands::ClearColorImage {
+        image,
+        color: (*color).uint32,
+        ranges,
+    });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdClearDepthStencilImage(
-    _commandBuffer: api::VkCommandBuffer,
-    _image: api::VkImage,
-    _imageLayout: api::VkImageLayout,
-    _pDepthStencil: *const api::VkClearDepthStencilValue,
-    _rangeCount: u32,
-    _pRanges: *const api::VkImageSubresourceRange,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    image: api::VkImage,
+    _image_layout: api::VkImageLayout,
+    depth_stencil: *const api::VkClearDepthStencilValue,
+    range_count: u32,
+    ranges: *const api::VkImageSubresourceRange,
+) {
+    let mut command_buffer = MutHandle::from(command_buffer).unwrap();
+    let ranges = command_buffer.allocate_slice(slice_or_empty(ranges, range_count as usize));
+    command_buffer.record(commands::ClearDepthStencilImage {
+        image,
+        depth_stencil: *depth_stencil,
+        ranges,
+    });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdClearAttachments(
-    _commandBuffer: api::VkCommandBuffer,
-    _attachmentCount: u32,
-    _pAttachments: *const api::VkClearAttachment,
-    _rectCount: u32,
-    _pRects: *const api::VkClearRect,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    attachment_count: u32,
+    attachments: *const api::VkClearAttachment,
+    rect_count: u32,
+    rects: *const api::VkClearRect,
+) {
+    let mut command_buffer = MutHandle::from(command_buffer).unwrap();
+    let attachments: Vec<_> = slice_or_empty(attachments, attachment_count as usize)
+        .iter()
+        .map(|attachment| ClearAttachment {
+            aspect_mask: attachment.aspectMask,
+            color_attachment: attachment.colorAttachment,
+            value: attachment.clearValue.color.uint32,
+        })
+        .collect();
+    let attachments = command_buffer.allocate_slice(&attachments);
+    let rects = command_buffer.allocate_slice(slice_or_empty(rects, rect_count as usize));
+    command_buffer.record(commands::ClearAttachments { attachments, rects });
 }
 
 #[allow(non_snake_case)]
@@ -4888,105 +5822,166 @@ pub unsafe extern "system" fn vkCmdWaitEvents(
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdPipelineBarrier(
-    _commandBuffer: api::VkCommandBuffer,
-    _srcStageMask: api::VkPipelineStageFlags,
-    _dstStageMask: api::VkPipelineStageFlags,
-    _dependencyFlags: api::VkDependencyFlags,
-    _memoryBarrierCount: u32,
-    _pMemoryBarriers: *const api::VkMemoryBarrier,
-    _bufferMemoryBarrierCount: u32,
-    _pBufferMemoryBarriers: *const api::VkBufferMemoryBarrier,
-    _imageMemoryBarrierCount: u32,
-    _pImageMemoryBarriers: *const api::VkImageMemoryBarrier,
+    _command_buffer: api::VkCommandBuffer,
+    _src_stage_mask: api::VkPipelineStageFlags,
+    _dst_stage_mask: api::VkPipelineStageFlags,
+    _dependency_flags: api::VkDependencyFlags,
+    _memory_barrier_count: u32,
+    _memory_barriers: *const api::VkMemoryBarrier,
+    _buffer_memory_barrier_count: u32,
+    _buffer_memory_barriers: *const api::VkBufferMemoryBarrier,
+    _image_memory_barrier_count: u32,
+    _image_memory_barriers: *const api::VkImageMemoryBarrier,
 ) {
-    unimplemented!()
+    // commands are executed in order, each finishing before the next starts,
+    // so there is nothing to wait for
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdBeginQuery(
-    _commandBuffer: api::VkCommandBuffer,
-    _queryPool: api::VkQueryPool,
-    _query: u32,
-    _flags: api::VkQueryControlFlags,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    query_pool: api::VkQueryPool,
+    query: u32,
+    flags: api::VkQueryControlFlags,
+) {
+    MutHandle::from(command_buffer)
+        .unwrap()
+        .record(commands::BeginQuery {
+            query_pool,
+            query,
+            flags,
+        });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdEndQuery(
-    _commandBuffer: api::VkCommandBuffer,
-    _queryPool: api::VkQueryPool,
-    _query: u32,
+    command_buffer: api::VkCommandBuffer,
+    query_pool: api::VkQueryPool,
+    query: u32,
 ) {
-    unimplemented!()
+    MutHandle::from(command_buffer)
+        .unwrap()
+        .record(commands::EndQuery { query_pool, query });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdResetQueryPool(
-    _commandBuffer: api::VkCommandBuffer,
-    _queryPool: api::VkQueryPool,
-    _firstQuery: u32,
-    _queryCount: u32,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    query_pool: api::VkQueryPool,
+    first_query: u32,
+    query_count: u32,
+) {
+    MutHandle::from(command_buffer)
+        .unwrap()
+        .record(commands::ResetQueryPool {
+            query_pool,
+            first_query,
+            query_count,
+        });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdWriteTimestamp(
-    _commandBuffer: api::VkCommandBuffer,
-    _pipelineStage: api::VkPipelineStageFlagBits,
-    _queryPool: api::VkQueryPool,
-    _query: u32,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    pipeline_stage: api::VkPipelineStageFlagBits,
+    query_pool: api::VkQueryPool,
+    query: u32,
+) {
+    MutHandle::from(command_buffer)
+        .unwrap()
+        .record(commands::WriteTimestamp {
+            pipeline_stage,
+            query_pool,
+            query,
+        });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdCopyQueryPoolResults(
-    _commandBuffer: api::VkCommandBuffer,
-    _queryPool: api::VkQueryPool,
-    _firstQuery: u32,
-    _queryCount: u32,
-    _dstBuffer: api::VkBuffer,
-    _dstOffset: api::VkDeviceSize,
-    _stride: api::VkDeviceSize,
-    _flags: api::VkQueryResultFlags,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    query_pool: api::VkQueryPool,
+    first_query: u32,
+    query_count: u32,
+    dst_buffer: api::VkBuffer,
+    dst_offset: api::VkDeviceSize,
+    stride: api::VkDeviceSize,
+    flags: api::VkQueryResultFlags,
+) {
+    MutHandle::from(command_buffer)
+        .unwrap()
+        .record(commands::CopyQueryPoolResults {
+            query_pool,
+            first_query,
+            query_count,
+            dst_buffer,
+            dst_offset,
+            stride,
+            flags,
+        });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdPushConstants(
-    _commandBuffer: api::VkCommandBuffer,
-    _layout: api::VkPipelineLayout,
-    _stageFlags: api::VkShaderStageFlags,
-    _offset: u32,
-    _size: u32,
-    _pValues: *const c_void,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    layout: api::VkPipelineLayout,
+    stage_flags: api::VkShaderStageFlags,
+    offset: u32,
+    size: u32,
+    values: *const c_void,
+) {
+    let mut command_buffer = MutHandle::from(command_buffer).unwrap();
+    let values = command_buffer.allocate_slice(slice_or_empty(values as *const u8, size as usize));
+    command_buffer.record(commands::PushConstants {
+        layout,
+        stage_flags,
+        offset,
+        values,
+    });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdBeginRenderPass(
-    _commandBuffer: api::VkCommandBuffer,
-    _pRenderPassBegin: *const api::VkRenderPassBeginInfo,
+    command_buffer: api::VkCommandBuffer,
+    render_pass_begin: *const api::VkRenderPassBeginInfo,
     _contents: api::VkSubpassContents,
 ) {
-    unimplemented!()
+    parse_next_chain_const!{
+        render_pass_begin,
+        root = api::VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+    }
+    let render_pass_begin = &*render_pass_begin;
+    let mut command_buffer = MutHandle::from(command_buffer).unwrap();
+    let clear_values: Vec<_> = slice_or_empty(
+        render_pass_begin.pClearValues,
+        render_pass_begin.clearValueCount as usize,
+    )
+    .iter()
+    .map(|clear_value| clear_value.color.uint32)
+    .collect();
+    let clear_values = command_buffer.allocate_slice(&clear_values);
+    command_buffer.record(commands::BeginRenderPass {
+        render_pass: render_pass_begin.renderPass,
+        framebuffer: render_pass_begin.framebuffer,
+        render_area: render_pass_begin.renderArea,
+        clear_values,
+    });
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdNextSubpass(
-    _commandBuffer: api::VkCommandBuffer,
+    command_buffer: api::VkCommandBuffer,
     _contents: api::VkSubpassContents,
 ) {
-    unimplemented!()
+    MutHandle::from(command_buffer)
+        .unwrap()
+        .record(commands::NextSubpass {});
 }
 
 #[allow(non_snake_case)]
-pub unsafe extern "system" fn vkCmdEndRenderPass(_commandBuffer: api::VkCommandBuffer) {
-    unimplemented!()
+pub unsafe extern "system" fn vkCmdEndRenderPass(command_buffer: api::VkCommandBuffer) {
+    MutHandle::from(command_buffer)
+        .unwrap()
+        .record(commands::EndRenderPass {});
 }
 
 #[allow(non_snake_case)]
@@ -5104,15 +6099,24 @@ pub unsafe extern "system" fn vkCmdSetDeviceMask(
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCmdDispatchBase(
-    _commandBuffer: api::VkCommandBuffer,
-    _baseGroupX: u32,
-    _baseGroupY: u32,
-    _baseGroupZ: u32,
-    _groupCountX: u32,
-    _groupCountY: u32,
-    _groupCountZ: u32,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    base_group_x: u32,
+    base_group_y: u32,
+    base_group_z: u32,
+    group_count_x: u32,
+    group_count_y: u32,
+    group_count_z: u32,
+) {
+    MutHandle::from(command_buffer)
+        .unwrap()
+        .record(commands::Dispatch {
+            base_group_x,
+            base_group_y,
+            base_group_z,
+            group_count_x,
+            group_count_y,
+            group_count_z,
+        });
 }
 
 #[allow(non_snake_case)]
@@ -5292,7 +6296,7 @@ pub unsafe extern "system" fn vkGetPhysicalDeviceProperties2(
     }
     let properties = &mut *properties;
     let physical_device = SharedHandle::from(physical_device).unwrap();
-    properties.properties = physical_device.properties;
+    properties.properties = physical_device.get_properties();
     if !point_clipping_properties.is_null() {
         let point_clipping_properties = &mut *point_clipping_properties;
         *point_clipping_properties = api::VkPhysicalDevicePointClippingProperties {
@@ -5375,12 +6379,13 @@ pub unsafe extern "system" fn vkGetPhysicalDeviceQueueFamilyProperties2(
     enumerate_helper(
         queue_family_property_count,
         queue_family_properties,
-        QUEUE_COUNTS.iter(),
-        |queue_family_properties, &count| {
+        QUEUE_COUNTS.iter().zip(QUEUE_FAMILY_FLAGS.iter()),
+        |queue_family_properties, (&count, &flags)| {
             get_physical_device_queue_family_properties(
                 &SharedHandle::from(physical_device).unwrap(),
                 queue_family_properties,
                 count,
+                flags,
             );
         },
     );
@@ -5432,10 +6437,10 @@ pub unsafe extern "system" fn vkGetPhysicalDeviceSparseImageFormatProperties2(
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkTrimCommandPool(
     _device: api::VkDevice,
-    _commandPool: api::VkCommandPool,
+    command_pool: api::VkCommandPool,
     _flags: api::VkCommandPoolTrimFlags,
 ) {
-    unimplemented!()
+    MutHandle::from(command_pool).unwrap().trim();
 }
 
 #[allow(non_snake_case)]
@@ -5477,30 +6482,55 @@ pub unsafe extern "system" fn vkDestroySamplerYcbcrConversion(
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkCreateDescriptorUpdateTemplate(
     _device: api::VkDevice,
-    _pCreateInfo: *const api::VkDescriptorUpdateTemplateCreateInfo,
-    _pAllocator: *const api::VkAllocationCallbacks,
-    _pDescriptorUpdateTemplate: *mut api::VkDescriptorUpdateTemplate,
+    create_info: *const api::VkDescriptorUpdateTemplateCreateInfo,
+    _allocator: *const api::VkAllocationCallbacks,
+    descriptor_update_template: *mut api::VkDescriptorUpdateTemplate,
 ) -> api::VkResult {
-    unimplemented!()
+    parse_next_chain_const!{
+        create_info,
+        root = api::VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO,
+    }
+    let create_info = &*create_info;
+    // push descriptors aren't supported, so templates always update descriptor sets
+    assert_eq!(
+        create_info.templateType,
+        api::VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET
+    );
+    let set_layout = SharedHandle::from(create_info.descriptorSetLayout).unwrap();
+    *descriptor_update_template =
+        OwnedHandle::<api::VkDescriptorUpdateTemplate>::new(DescriptorUpdateTemplate::new(
+            &set_layout,
+            slice_or_empty(
+                create_info.pDescriptorUpdateEntries,
+                create_info.descriptorUpdateEntryCount as usize,
+            ),
+        ))
+        .take();
+    api::VK_SUCCESS
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkDestroyDescriptorUpdateTemplate(
     _device: api::VkDevice,
-    _descriptorUpdateTemplate: api::VkDescriptorUpdateTemplate,
-    _pAllocator: *const api::VkAllocationCallbacks,
+    descriptor_update_template: api::VkDescriptorUpdateTemplate,
+    _allocator: *const api::VkAllocationCallbacks,
 ) {
-    unimplemented!()
+    OwnedHandle::from(descriptor_update_template);
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkUpdateDescriptorSetWithTemplate(
     _device: api::VkDevice,
-    _descriptorSet: api::VkDescriptorSet,
-    _descriptorUpdateTemplate: api::VkDescriptorUpdateTemplate,
-    _pData: *const c_void,
-) {
-    unimplemented!()
+    descriptor_set: api::VkDescriptorSet,
+    descriptor_update_template: api::VkDescriptorUpdateTemplate,
+    data: *const c_void,
+) {
+    SharedHandle::from(descriptor_update_template)
+        .unwrap()
+        .update(
+            &SharedHandle::from(descriptor_set).unwrap(),
+            data as *const u8,
+        );
 }
 
 #[allow(non_snake_case)]
@@ -5533,10 +6563,19 @@ pub unsafe extern "system" fn vkGetPhysicalDeviceExternalSemaphoreProperties(
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkGetDescriptorSetLayoutSupport(
     _device: api::VkDevice,
-    _pCreateInfo: *const api::VkDescriptorSetLayoutCreateInfo,
-    _pSupport: *mut api::VkDescriptorSetLayoutSupport,
+    create_info: *const api::VkDescriptorSetLayoutCreateInfo,
+    support: *mut api::VkDescriptorSetLayoutSupport,
 ) {
-    unimplemented!()
+    parse_next_chain_const!{
+        create_info,
+        root = api::VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+    }
+    parse_next_chain_mut!{
+        support,
+        root = api::VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_SUPPORT,
+    }
+    // descriptor sets have no size limit
+    (*support).supported = api::VK_TRUE;
 }
 
 #[allow(non_snake_case)]
@@ -5555,12 +6594,15 @@ pub unsafe extern "system" fn vkDestroySurfaceKHR(
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkGetPhysicalDeviceSurfaceSupportKHR(
-    _physicalDevice: api::VkPhysicalDevice,
-    _queueFamilyIndex: u32,
+    _physical_device: api::VkPhysicalDevice,
+    queue_family_index: u32,
     _surface: api::VkSurfaceKHR,
-    _pSupported: *mut api::VkBool32,
+    supported: *mut api::VkBool32,
 ) -> api::VkResult {
-    unimplemented!()
+    assert!(queue_family_index < QUEUE_FAMILY_COUNT);
+    // every queue presents the same way, through the swapchain's presentation thread
+    *supported = api::VK_TRUE;
+    api::VK_SUCCESS
 }
 
 #[allow(non_snake_case)]
@@ -5682,31 +6724,99 @@ pub unsafe extern "system" fn vkDestroySwapchainKHR(
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkGetSwapchainImagesKHR(
     _device: api::VkDevice,
-    _swapchain: api::VkSwapchainKHR,
-    _pSwapchainImageCount: *mut u32,
-    _pSwapchainImages: *mut api::VkImage,
+    swapchain: api::VkSwapchainKHR,
+    swapchain_image_count: *mut u32,
+    swapchain_images: *mut api::VkImage,
 ) -> api::VkResult {
-    unimplemented!()
+    let swapchain = SharedHandle::from(swapchain).unwrap();
+    enumerate_helper(
+        swapchain_image_count,
+        swapchain_images,
+        (0..swapchain.get_image_count()).map(|image_index| swapchain.get_image(image_index)),
+        |l, r| *l = r,
+    )
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkAcquireNextImageKHR(
-    _device: api::VkDevice,
-    _swapchain: api::VkSwapchainKHR,
-    _timeout: u64,
-    _semaphore: api::VkSemaphore,
-    _fence: api::VkFence,
-    _pImageIndex: *mut u32,
+    device: api::VkDevice,
+    swapchain: api::VkSwapchainKHR,
+    timeout: u64,
+    semaphore: api::VkSemaphore,
+    fence: api::VkFence,
+    image_index: *mut u32,
 ) -> api::VkResult {
-    unimplemented!()
+    vkAcquireNextImage2KHR(
+        device,
+        &api::VkAcquireNextImageInfoKHR {
+            sType: api::VK_STRUCTURE_TYPE_ACQUIRE_NEXT_IMAGE_INFO_KHR,
+            pNext: null(),
+            swapchain,
+            timeout,
+            semaphore,
+            fence,
+            deviceMask: 1,
+        },
+        image_index,
+    )
 }
 
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkQueuePresentKHR(
-    _queue: api::VkQueue,
-    _pPresentInfo: *const api::VkPresentInfoKHR,
+    queue: api::VkQueue,
+    present_info: *const api::VkPresentInfoKHR,
 ) -> api::VkResult {
-    unimplemented!()
+    parse_next_chain_const!{
+        present_info,
+        root = api::VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+        device_group_present_info: api::VkDeviceGroupPresentInfoKHR = api::VK_STRUCTURE_TYPE_DEVICE_GROUP_PRESENT_INFO_KHR,
+    }
+    let present_info = &*present_info;
+    if !device_group_present_info.is_null() {
+        let device_group_present_info = &*device_group_present_info;
+        assert_eq!(
+            device_group_present_info.mode,
+            api::VK_DEVICE_GROUP_PRESENT_MODE_LOCAL_BIT_KHR
+        );
+    }
+    let swapchains = slice_or_empty(
+        present_info.pSwapchains,
+        present_info.swapchainCount as usize,
+    );
+    let image_indices = slice_or_empty(
+        present_info.pImageIndices,
+        present_info.swapchainCount as usize,
+    );
+    // the queue thread presents after waiting for the semaphores, so this doesn't block
+    let batch = Batch {
+        wait_semaphores: slice_or_empty(
+            present_info.pWaitSemaphores,
+            present_info.waitSemaphoreCount as usize,
+        )
+        .iter()
+        .map(|&semaphore| (semaphore, 0))
+        .collect(),
+        command_buffers: Vec::new(),
+        presents: swapchains
+            .iter()
+            .cloned()
+            .zip(image_indices.iter().cloned())
+            .collect(),
+        signal_semaphores: Vec::new(),
+    };
+    if SharedHandle::from(queue)
+        .unwrap()
+        .submit(vec![batch], Handle::null())
+        .is_err()
+    {
+        return api::VK_ERROR_DEVICE_LOST;
+    }
+    if !present_info.pResults.is_null() {
+        for index in 0..swapchains.len() {
+            *present_info.pResults.add(index) = api::VK_SUCCESS;
+        }
+    }
+    api::VK_SUCCESS
 }
 
 #[allow(non_snake_case)]
@@ -5739,10 +6849,32 @@ pub unsafe extern "system" fn vkGetPhysicalDevicePresentRectanglesKHR(
 #[allow(non_snake_case)]
 pub unsafe extern "system" fn vkAcquireNextImage2KHR(
     _device: api::VkDevice,
-    _pAcquireInfo: *const api::VkAcquireNextImageInfoKHR,
-    _pImageIndex: *mut u32,
+    acquire_info: *const api::VkAcquireNextImageInfoKHR,
+    image_index: *mut u32,
 ) -> api::VkResult {
-    unimplemented!()
+    parse_next_chain_const!{
+        acquire_info,
+        root = api::VK_STRUCTURE_TYPE_ACQUIRE_NEXT_IMAGE_INFO_KHR,
+    }
+    let acquire_info = &*acquire_info;
+    assert_eq!(acquire_info.deviceMask, 1);
+    match SharedHandle::from(acquire_info.swapchain)
+        .unwrap()
+        .acquire_next_image(acquire_info.timeout)
+    {
+        Ok(acquired_image_index) => {
+            // the image is ready as soon as it's acquired
+            if let Some(semaphore) = SharedHandle::from(acquire_info.semaphore) {
+                semaphore.signal(0);
+            }
+            if let Some(fence) = SharedHandle::from(acquire_info.fence) {
+                fence.signal();
+            }
+            *image_index = acquired_image_index;
+            api::VK_SUCCESS
+        }
+        Err(error) => error,
+    }
 }
 
 #[allow(non_snake_case)]
@@ -6048,31 +7180,47 @@ pub unsafe extern "system" fn vkGetDisplayPlaneCapabilities2KHR(
 }
 
 #[allow(non_snake_case)]
-#[cfg(kazan_include_unused_vulkan_api)]
 pub unsafe extern "system" fn vkCmdDrawIndirectCountKHR(
-    _commandBuffer: api::VkCommandBuffer,
-    _buffer: api::VkBuffer,
-    _offset: api::VkDeviceSize,
-    _countBuffer: api::VkBuffer,
-    _countBufferOffset: api::VkDeviceSize,
-    _maxDrawCount: u32,
-    _stride: u32,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    buffer: api::VkBuffer,
+    offset: api::VkDeviceSize,
+    count_buffer: api::VkBuffer,
+    count_buffer_offset: api::VkDeviceSize,
+    max_draw_count: u32,
+    stride: u32,
+) {
+    MutHandle::from(command_buffer)
+        .unwrap()
+        .record(commands::DrawIndirectCount {
+            buffer,
+            offset,
+            count_buffer,
+            count_buffer_offset,
+            max_draw_count,
+            stride,
+        });
 }
 
 #[allow(non_snake_case)]
-#[cfg(kazan_include_unused_vulkan_api)]
 pub unsafe extern "system" fn vkCmdDrawIndexedIndirectCountKHR(
-    _commandBuffer: api::VkCommandBuffer,
-    _buffer: api::VkBuffer,
-    _offset: api::VkDeviceSize,
-    _countBuffer: api::VkBuffer,
-    _countBufferOffset: api::VkDeviceSize,
-    _maxDrawCount: u32,
-    _stride: u32,
-) {
-    unimplemented!()
+    command_buffer: api::VkCommandBuffer,
+    buffer: api::VkBuffer,
+    offset: api::VkDeviceSize,
+    count_buffer: api::VkBuffer,
+    count_buffer_offset: api::VkDeviceSize,
+    max_draw_count: u32,
+    stride: u32,
+) {
+    MutHandle::from(command_buffer)
+        .unwrap()
+        .record(commands::DrawIndexedIndirectCount {
+            buffer,
+            offset,
+            count_buffer,
+            count_buffer_offset,
+            max_draw_count,
+            stride,
+        });
 }
 
 #[allow(non_snake_case)]
@@ -6660,3 +7808,26 @@ pub unsafe extern "system" fn vkGetPhysicalDeviceXcbPresentationSupportKHR(
 ) -> api::VkBool32 {
     unimplemented!()
 }
+
+#[cfg(target_os = "linux")]
+#[allow(non_snake_case)]
+pub unsafe extern "system" fn vkCreateHeadlessSurfaceEXT(
+    _instance: api::VkInstance,
+    create_info: *const api::VkHeadlessSurfaceCreateInfoEXT,
+    _allocator: *const api::VkAllocationCallbacks,
+    surface: *mut api::VkSurfaceKHR,
+) -> api::VkResult {
+    parse_next_chain_const!{
+        create_info,
+        root = api::VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT,
+    }
+    let new_surface = Box::new(api::VkIcdSurfaceHeadless {
+        base: api::VkIcdSurfaceBase {
+            platform: api::VK_ICD_WSI_PLATFORM_HEADLESS,
+        },
+    });
+    *surface = api::VkSurfaceKHR::new(NonNull::new(
+        Box::into_raw(new_surface) as *mut api::VkIcdSurfaceBase
+    ));
+    api::VK_SUCCESS
+}
@@ -0,0 +1,254 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright 2018 Jacob Lifshay
+
+// The benchmarks of `benches/driver.rs`, which live in the driver since they need its internals.
+// They call what the Vulkan commands call, without creating an instance and device, so they
+// measure the driver's own work: memory allocation, copies, and binning and rasterizing
+// generated scenes at 1080p and 4K.
+
+use api;
+use buffer::{Buffer, BufferMemory};
+use constants::MIN_MEMORY_MAP_ALIGNMENT;
+use device_memory::{DeviceMemory, DeviceMemoryAllocation, DeviceMemoryLayout, DeviceMemoryPool};
+use handle::{OwnedHandle, SharedHandle};
+use image::{Image, ImageMemory, ImageMultisampleCount, ImageProperties, SupportedTilings};
+use rasterizer::{DrawState, Rect, TileBins, TileFragments, Triangle, Vertex};
+use shader_compiler_backend::benchmark::{Runner, Throughput};
+use std::ptr;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Arc;
+use thread_pool::ThreadPool;
+use transfer;
+
+/// the size of the buffers and images copied, in bytes
+const COPY_SIZE: usize = 64 << 20;
+/// the width and height of the copied images, which are `COPY_SIZE` bytes of RGBA8
+const COPY_IMAGE_SIZE: u32 = 4096;
+
+const RESOLUTIONS: &[(&str, u32, u32)] = &[("1080p", 1920, 1080), ("4K", 3840, 2160)];
+
+pub fn run(runner: &mut Runner) {
+    let thread_pool = ThreadPool::with_thread_per_core("kazan benchmark");
+    run_memory_benchmarks(runner);
+    unsafe {
+        run_copy_benchmarks(runner, &thread_pool);
+    }
+    run_raster_benchmarks(runner, &thread_pool);
+}
+
+/// `vkAllocateMemory` and `vkFreeMemory`, for sizes from the pool and from the default heap
+fn run_memory_benchmarks(runner: &mut Runner) {
+    let pool = Arc::new(DeviceMemoryPool::new(false));
+    for &(name, size, count) in &[
+        ("4KiB", 4 << 10, 256),
+        ("1MiB", 1 << 20, 32),
+        ("128MiB", 128 << 20, 4),
+    ] {
+        let layout = DeviceMemoryLayout::calculate(size, MIN_MEMORY_MAP_ALIGNMENT);
+        runner.run(
+            &format!("allocate and free memory {}", name),
+            Throughput::Elements("allocations", count),
+            || {
+                let memories: Vec<_> = (0..count)
+                    .map(|_| {
+                        OwnedHandle::<api::VkDeviceMemory>::new(
+                            DeviceMemory::allocate_from_pool(&pool, layout).unwrap(),
+                        )
+                    })
+                    .collect();
+                drop(memories);
+            },
+        );
+    }
+}
+
+unsafe fn allocate_memory(size: usize) -> OwnedHandle<api::VkDeviceMemory> {
+    let memory = OwnedHandle::<api::VkDeviceMemory>::new(
+        DeviceMemory::allocate_from_default_heap(DeviceMemoryLayout::calculate(
+            size,
+            MIN_MEMORY_MAP_ALIGNMENT,
+        ))
+        .unwrap(),
+    );
+    // so copies read real pages, instead of the shared zero page of untouched memory
+    ptr::write_bytes(memory.get().as_ptr(), 1, size);
+    memory
+}
+
+unsafe fn create_buffer(memory: &OwnedHandle<api::VkDeviceMemory>) -> Buffer {
+    Buffer {
+        size: COPY_SIZE,
+        memory: Some(BufferMemory {
+            device_memory: SharedHandle::from(memory.get_handle()).unwrap(),
+            offset: 0,
+        }),
+    }
+}
+
+unsafe fn create_image(memory: &OwnedHandle<api::VkDeviceMemory>) -> Image {
+    let properties = ImageProperties {
+        supported_tilings: SupportedTilings::Any,
+        format: api::VK_FORMAT_R8G8B8A8_UNORM,
+        extents: api::VkExtent3D {
+            width: COPY_IMAGE_SIZE,
+            height: COPY_IMAGE_SIZE,
+            depth: 1,
+        },
+        array_layers: 1,
+        mip_levels: 1,
+        multisample_count: ImageMultisampleCount::Count1,
+        swapchain_present_tiling: None,
+    };
+    assert!(properties.computed_properties().memory_layout.size <= COPY_SIZE);
+    Image {
+        properties,
+        memory: Some(ImageMemory {
+            device_memory: SharedHandle::from(memory.get_handle()).unwrap(),
+            offset: 0,
+        }),
+    }
+}
+
+/// `vkCmdCopyBuffer`, `vkCmdCopyImage` and `vkCmdCopyBufferToImage`
+unsafe fn run_copy_benchmarks(runner: &mut Runner, thread_pool: &ThreadPool) {
+    let memories: Vec<_> = (0..4).map(|_| allocate_memory(COPY_SIZE)).collect();
+    let src_buffer = create_buffer(&memories[0]);
+    let dst_buffer = create_buffer(&memories[1]);
+    let src_image = create_image(&memories[2]);
+    let dst_image = create_image(&memories[3]);
+    let subresource = api::VkImageSubresourceLayers {
+        aspectMask: api::VK_IMAGE_ASPECT_COLOR_BIT,
+        mipLevel: 0,
+        baseArrayLayer: 0,
+        layerCount: 1,
+    };
+    let offset = api::VkOffset3D { x: 0, y: 0, z: 0 };
+    let extent = src_image.properties.extents;
+    let bytes = Throughput::Bytes(COPY_SIZE as u64);
+    runner.run("copy buffer 64MiB", bytes, || {
+        transfer::copy_buffer(
+            thread_pool,
+            &src_buffer,
+            &dst_buffer,
+            &api::VkBufferCopy {
+                srcOffset: 0,
+                dstOffset: 0,
+                size: COPY_SIZE as u64,
+            },
+        )
+    });
+    runner.run("copy image 4096x4096 RGBA8", bytes, || {
+        transfer::copy_image(
+            thread_pool,
+            &src_image,
+            &dst_image,
+            &api::VkImageCopy {
+                srcSubresource: subresource,
+                srcOffset: offset,
+                dstSubresource: subresource,
+                dstOffset: offset,
+                extent,
+            },
+        )
+    });
+    runner.run("copy buffer to image 4096x4096 RGBA8", bytes, || {
+        transfer::copy_buffer_to_image(
+            thread_pool,
+            &src_buffer,
+            &dst_image,
+            &api::VkBufferImageCopy {
+                bufferOffset: 0,
+                bufferRowLength: 0,
+                bufferImageHeight: 0,
+                imageSubresource: subresource,
+                imageOffset: offset,
+                imageExtent: extent,
+            },
+        )
+    });
+}
+
+fn make_quad(x: f32, y: f32, width: f32, height: f32, depth: f32) -> [Triangle; 2] {
+    let vertex = |x, y| Vertex {
+        position: [x, y, depth, 1.0],
+    };
+    let (end_x, end_y) = (x + width, y + height);
+    [
+        Triangle {
+            vertices: [vertex(x, y), vertex(end_x, y), vertex(x, end_y)],
+        },
+        Triangle {
+            vertices: [vertex(x, end_y), vertex(end_x, y), vertex(end_x, end_y)],
+        },
+    ]
+}
+
+/// the canned scenes: a grid of 8x8 pixel quads, and 8 layers of quads covering the framebuffer
+fn make_scenes(width: u32, height: u32) -> Vec<(&'static str, Vec<Triangle>)> {
+    const CELL_SIZE: u32 = 8;
+    let small_triangles = (0..height / CELL_SIZE)
+        .flat_map(|y| (0..width / CELL_SIZE).map(move |x| (x, y)))
+        .flat_map(|(x, y)| {
+            let cell_size = CELL_SIZE as f32;
+            make_quad(
+                (x * CELL_SIZE) as f32,
+                (y * CELL_SIZE) as f32,
+                cell_size,
+                cell_size,
+                0.5,
+            )
+            .to_vec()
+        })
+        .collect();
+    let overdraw = (0..8)
+        .flat_map(|layer| {
+            make_quad(0.0, 0.0, width as f32, height as f32, layer as f32 / 8.0).to_vec()
+        })
+        .collect();
+    vec![("small triangles", small_triangles), ("overdraw", overdraw)]
+}
+
+/// binning and rasterizing. pixels are the fragments rasterized, since fragment shading isn't
+/// implemented yet
+fn run_raster_benchmarks(runner: &mut Runner, thread_pool: &ThreadPool) {
+    for &(resolution, width, height) in RESOLUTIONS {
+        let draw_state = DrawState {
+            cull_mode: api::VK_CULL_MODE_NONE,
+            front_face: api::VK_FRONT_FACE_COUNTER_CLOCKWISE,
+            scissor: Rect {
+                x: 0,
+                y: 0,
+                width,
+                height,
+            },
+        };
+        for (scene, triangles) in make_scenes(width, height) {
+            let bin = || {
+                let mut tile_bins = TileBins::new(width, height);
+                tile_bins.add_draw(0, draw_state, triangles.iter().cloned());
+                tile_bins
+            };
+            runner.run(
+                &format!("bin {} {}", scene, resolution),
+                Throughput::Elements("triangles", triangles.len() as u64),
+                || {
+                    bin();
+                },
+            );
+            let tile_bins = bin();
+            let fragment_count = AtomicUsize::new(0);
+            let count_fragments = |tile: &TileFragments| {
+                let mut count = 0;
+                tile.for_each_fragment(|_, _| count += 1);
+                fragment_count.fetch_add(count, Ordering::Relaxed);
+            };
+            tile_bins.rasterize(thread_pool, count_fragments);
+            let pixel_count = fragment_count.load(Ordering::Relaxed) as u64;
+            runner.run(
+                &format!("rasterize {} {}", scene, resolution),
+                Throughput::Elements("pixels", pixel_count),
+                || tile_bins.rasterize(thread_pool, count_fragments),
+            );
+        }
+    }
+}
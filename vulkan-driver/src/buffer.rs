@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: LGPL-2.1-or-later
 // Copyright 2018 Jacob Lifshay
 use api;
+use device_memory::DeviceMemoryAllocation;
 use handle::SharedHandle;
 
 pub struct BufferMemory {
@@ -12,3 +13,11 @@ pub struct Buffer {
     pub size: usize,
     pub memory: Option<BufferMemory>,
 }
+
+impl Buffer {
+    /// the buffer must be bound to memory
+    pub unsafe fn get_memory(&self) -> *mut u8 {
+        let memory = self.memory.as_ref().expect("buffer not bound to memory");
+        memory.device_memory.get().as_ptr().add(memory.offset)
+    }
+}
@@ -0,0 +1,765 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright 2018 Jacob Lifshay
+
+// Clears of whole subresources aren't written to memory when they're executed. Instead, the
+// subresource is marked as cleared to a value, with a flag for each `TILE_SIZE` by `TILE_SIZE`
+// tile of texel blocks (a single contiguous run of memory in tiled images) saying whether the tile
+// still has to be written. Commands that read a subresource write its pending tiles first, and
+// commands that write it drop the pending tiles they completely overwrite, so those are never
+// written at all. Whatever is still pending is written when the batch finishes, before anything
+// else can see the memory.
+// FIXME: aliased images and buffers don't see each other's pending clears
+
+use api;
+use image::{Image, ImageMultisampleCount, SubresourceLayout, TILE_SIZE, TILE_SIZE_LOG2};
+use std::cmp;
+use std::collections::HashMap;
+use std::ptr::NonNull;
+use thread_pool::ThreadPool;
+use transfer::{self, SharedPointer, TexelFormat};
+
+/// a `VkClearAttachment` with the clear value as the bits of the `VkClearValue`,
+/// since unions don't implement `Debug`
+#[derive(Copy, Clone, Debug)]
+pub struct ClearAttachment {
+    pub aspect_mask: api::VkImageAspectFlags,
+    pub color_attachment: u32,
+    pub value: [u32; 4],
+}
+
+/// the depth and stencil values in the bits of a `VkClearValue`
+pub fn get_clear_depth_stencil_value(value: [u32; 4]) -> api::VkClearDepthStencilValue {
+    api::VkClearDepthStencilValue {
+        depth: f32::from_bits(value[0]),
+        stencil: value[1],
+    }
+}
+
+/// the samples of a texel are stored next to each other, so every sample is set
+fn repeat_for_samples(multisample_count: ImageMultisampleCount, sample: &[u8]) -> Vec<u8> {
+    let mut retval = Vec::with_capacity(sample.len() * multisample_count.get());
+    for _ in 0..multisample_count.get() {
+        retval.extend_from_slice(sample);
+    }
+    retval
+}
+
+/// the aspects of a format, ignoring the planes of multi-planar formats
+pub fn get_format_aspects(format: api::VkFormat) -> api::VkImageAspectFlags {
+    match format {
+        api::VK_FORMAT_D16_UNORM
+        | api::VK_FORMAT_X8_D24_UNORM_PACK32
+        | api::VK_FORMAT_D32_SFLOAT => api::VK_IMAGE_ASPECT_DEPTH_BIT,
+        api::VK_FORMAT_S8_UINT => api::VK_IMAGE_ASPECT_STENCIL_BIT,
+        format if transfer::is_combined_depth_stencil(format) => {
+            api::VK_IMAGE_ASPECT_DEPTH_BIT | api::VK_IMAGE_ASPECT_STENCIL_BIT
+        }
+        _ => api::VK_IMAGE_ASPECT_COLOR_BIT,
+    }
+}
+
+/// the texel block written when clearing `image`, viewed as `format`, to `color`,
+/// which is the bits of a `VkClearColorValue`
+pub fn get_color_pattern(image: &Image, format: api::VkFormat, color: [u32; 4]) -> Vec<u8> {
+    let texel_format =
+        TexelFormat::get(format).unwrap_or_else(|| unimplemented!("clearing {:?} images", format));
+    let mut sample = [0; 16];
+    unsafe { texel_format.encode(color, sample.as_mut_ptr()) };
+    let block_size = image.properties.computed_properties().block.size_in_bytes;
+    let sample_size = block_size / image.properties.multisample_count.get();
+    repeat_for_samples(image.properties.multisample_count, &sample[..sample_size])
+}
+
+/// `depth`, clamped to `[0, 1]`, converted to a `bits`-bit unsigned normalized integer
+pub fn depth_to_unorm(depth: f32, bits: u32) -> u32 {
+    // in `f64`, since `f32` rounds 1.0 to 2^24 for 24 bits
+    let max = ((1u64 << bits) - 1) as f64;
+    // `max` returns 0 for NaN
+    (f64::from(depth.max(0.0).min(1.0)) * max + 0.5) as u32
+}
+
+/// the texel block written when clearing a depth/stencil image to `value`.
+/// combined formats store the depth in the low bytes, followed by the stencil in the next byte
+pub fn get_depth_stencil_pattern(image: &Image, value: api::VkClearDepthStencilValue) -> Vec<u8> {
+    let format = image.properties.format;
+    let unorm = |bits| depth_to_unorm(value.depth, bits);
+    let stencil = value.stencil as u8;
+    let sample = match format {
+        api::VK_FORMAT_D16_UNORM => (unorm(16) as u16).to_le_bytes().to_vec(),
+        api::VK_FORMAT_X8_D24_UNORM_PACK32 => unorm(24).to_le_bytes().to_vec(),
+        api::VK_FORMAT_D32_SFLOAT => value.depth.to_bits().to_le_bytes().to_vec(),
+        api::VK_FORMAT_S8_UINT => vec![stencil],
+        api::VK_FORMAT_D16_UNORM_S8_UINT => {
+            let depth = (unorm(16) as u16).to_le_bytes();
+            vec![depth[0], depth[1], stencil, 0]
+        }
+        api::VK_FORMAT_D24_UNORM_S8_UINT => (unorm(24) | u32::from(stencil) << 24)
+            .to_le_bytes()
+            .to_vec(),
+        api::VK_FORMAT_D32_SFLOAT_S8_UINT => {
+            let mut sample = value.depth.to_bits().to_le_bytes().to_vec();
+            sample.extend_from_slice(&[stencil, 0, 0, 0]);
+            sample
+        }
+        _ => unimplemented!("clearing {:?} images", format),
+    };
+    repeat_for_samples(image.properties.multisample_count, &sample)
+}
+
+/// the bytes of a texel block of `image` that hold the aspects in `aspect_mask`, for clearing
+/// one aspect of a combined depth/stencil format; `None` if they're the whole texel block
+pub fn get_aspect_mask(image: &Image, aspect_mask: api::VkImageAspectFlags) -> Option<Vec<u8>> {
+    let format = image.properties.format;
+    let all_aspects = get_format_aspects(format);
+    if aspect_mask & all_aspects == all_aspects {
+        return None;
+    }
+    let (depth_size, sample_size) = match format {
+        api::VK_FORMAT_D16_UNORM_S8_UINT => (2, 4),
+        api::VK_FORMAT_D24_UNORM_S8_UINT => (3, 4),
+        api::VK_FORMAT_D32_SFLOAT_S8_UINT => (4, 8),
+        // every other format has one aspect
+        _ => return None,
+    };
+    let mut sample = vec![0; sample_size];
+    if aspect_mask & api::VK_IMAGE_ASPECT_DEPTH_BIT != 0 {
+        sample[..depth_size].iter_mut().for_each(|v| *v = !0);
+    }
+    if aspect_mask & api::VK_IMAGE_ASPECT_STENCIL_BIT != 0 {
+        sample[depth_size] = !0;
+    }
+    Some(repeat_for_samples(
+        image.properties.multisample_count,
+        &sample,
+    ))
+}
+
+/// a region of some of the array layers of one mip level, in texels
+#[derive(Copy, Clone, Debug)]
+pub struct ImageRegion {
+    pub mip_level: u32,
+    pub base_array_layer: u32,
+    pub layer_count: u32,
+    pub offset: api::VkOffset3D,
+    pub extent: api::VkExtent3D,
+}
+
+impl ImageRegion {
+    pub fn new(
+        subresource: &api::VkImageSubresourceLayers,
+        offset: api::VkOffset3D,
+        extent: api::VkExtent3D,
+    ) -> Self {
+        Self {
+            mip_level: subresource.mipLevel,
+            base_array_layer: subresource.baseArrayLayer,
+            layer_count: subresource.layerCount,
+            offset,
+            extent,
+        }
+    }
+    /// all of the mip level
+    pub fn whole_level(image: &Image, subresource: &api::VkImageSubresourceLayers) -> Self {
+        let get_mip_size = |v: u32| cmp::max(v >> subresource.mipLevel, 1);
+        let extents = image.properties.extents;
+        Self::new(
+            subresource,
+            api::VkOffset3D { x: 0, y: 0, z: 0 },
+            api::VkExtent3D {
+                width: get_mip_size(extents.width),
+                height: get_mip_size(extents.height),
+                depth: get_mip_size(extents.depth),
+            },
+        )
+    }
+}
+
+/// a range of texel blocks and depth slices in one subresource
+#[derive(Copy, Clone, Debug)]
+struct BlockRegion {
+    x: u32,
+    y: u32,
+    z: u32,
+    end_x: u32,
+    end_y: u32,
+    end_z: u32,
+}
+
+impl BlockRegion {
+    fn new(layout: &SubresourceLayout, offset: api::VkOffset3D, extent: api::VkExtent3D) -> Self {
+        let (x, y, width, height) = layout.get_block_region(offset, extent);
+        Self {
+            x,
+            y,
+            z: offset.z as u32,
+            end_x: x + width,
+            end_y: y + height,
+            end_z: offset.z as u32 + extent.depth,
+        }
+    }
+    fn is_whole_subresource(&self, layout: &SubresourceLayout) -> bool {
+        self.x == 0
+            && self.y == 0
+            && self.z == 0
+            && self.end_x == layout.width_in_blocks
+            && self.end_y == layout.height_in_blocks
+            && self.end_z == layout.depth
+    }
+    /// the tiles overlapping this region as `(first_x, first_y, end_x, end_y)`
+    fn get_tile_range(&self) -> (u32, u32, u32, u32) {
+        let end = |v: u32| (v + TILE_SIZE - 1) >> TILE_SIZE_LOG2;
+        (
+            self.x >> TILE_SIZE_LOG2,
+            self.y >> TILE_SIZE_LOG2,
+            end(self.end_x),
+            end(self.end_y),
+        )
+    }
+    /// whether the region contains every texel block of the tile, ignoring padding past the
+    /// edges of the subresource
+    fn covers_tile(&self, layout: &SubresourceLayout, tile_x: u32, tile_y: u32) -> bool {
+        let x = tile_x << TILE_SIZE_LOG2;
+        let y = tile_y << TILE_SIZE_LOG2;
+        self.x <= x
+            && self.y <= y
+            && self.end_x >= cmp::min(x + TILE_SIZE, layout.width_in_blocks)
+            && self.end_y >= cmp::min(y + TILE_SIZE, layout.height_in_blocks)
+    }
+}
+
+/// fill `region` with `pattern`, filling whole tiles at once.
+/// the rows of tiles run in parallel on `thread_pool` if the region is big enough
+unsafe fn fill_blocks(
+    thread_pool: &ThreadPool,
+    image_memory: *mut u8,
+    layout: &SubresourceLayout,
+    region: BlockRegion,
+    pattern: &[u8],
+) {
+    let image_memory = SharedPointer(image_memory);
+    let (first_tile_x, first_tile_y, end_tile_x, end_tile_y) = region.get_tile_range();
+    let tile_rows = (end_tile_y - first_tile_y) as usize;
+    let fill_tile_row = |index: usize| {
+        let tile_y = first_tile_y + (index % tile_rows) as u32;
+        let z = region.z + (index / tile_rows) as u32;
+        for tile_x in first_tile_x..end_tile_x {
+            if region.covers_tile(layout, tile_x, tile_y) {
+                layout.fill_tile(image_memory.0, tile_x, tile_y, z, pattern);
+                continue;
+            }
+            let x = cmp::max(tile_x << TILE_SIZE_LOG2, region.x);
+            let y = cmp::max(tile_y << TILE_SIZE_LOG2, region.y);
+            let end_x = cmp::min((tile_x + 1) << TILE_SIZE_LOG2, region.end_x);
+            let end_y = cmp::min((tile_y + 1) << TILE_SIZE_LOG2, region.end_y);
+            layout.fill_region(
+                image_memory.0,
+                api::VkOffset3D {
+                    x: (x * layout.block.width) as i32,
+                    y: (y * layout.block.height) as i32,
+                    z: z as i32,
+                },
+                api::VkExtent3D {
+                    width: (end_x - x) * layout.block.width,
+                    height: (end_y - y) * layout.block.height,
+                    depth: 1,
+                },
+                pattern,
+            );
+        }
+    };
+    let row_count = tile_rows * (region.end_z - region.z) as usize;
+    let size = (region.end_x - region.x) as usize
+        * (region.end_y - region.y) as usize
+        * (region.end_z - region.z) as usize
+        * layout.block.size_in_bytes;
+    if size < transfer::PARALLEL_THRESHOLD {
+        (0..row_count).for_each(fill_tile_row);
+    } else {
+        thread_pool.for_each_index(row_count, || (), |_, index| fill_tile_row(index));
+    }
+}
+
+/// a clear that hasn't been written to all of a subresource yet
+struct PendingClear {
+    image_memory: SharedPointer,
+    layout: SubresourceLayout,
+    pattern: Vec<u8>,
+    tile_counts: (u32, u32),
+    /// whether each tile still has to be written, indexed by `x + (y + z * tiles_y) * tiles_x`
+    pending_tiles: Vec<bool>,
+    pending_count: usize,
+}
+
+impl PendingClear {
+    fn get_tile_index(&self, tile_x: u32, tile_y: u32, z: u32) -> usize {
+        let (tiles_x, tiles_y) = self.tile_counts;
+        (tile_x + (tile_y + z * tiles_y) * tiles_x) as usize
+    }
+    /// write the tiles that are pending for which `write_tile` returns true
+    unsafe fn write_tiles<F: Fn(u32, u32, u32) -> bool>(
+        &mut self,
+        thread_pool: &ThreadPool,
+        write_tile: F,
+    ) {
+        let (tiles_x, tiles_y) = self.tile_counts;
+        let mut tiles = Vec::new();
+        for z in 0..self.layout.depth {
+            for tile_y in 0..tiles_y {
+                for tile_x in 0..tiles_x {
+                    let index = self.get_tile_index(tile_x, tile_y, z);
+                    if self.pending_tiles[index] && write_tile(tile_x, tile_y, z) {
+                        self.pending_tiles[index] = false;
+                        tiles.push((tile_x, tile_y, z));
+                    }
+                }
+            }
+        }
+        if tiles.len() == self.pending_tiles.len() {
+            // the padding in partial tiles is cleared too, so the whole subresource is one fill
+            transfer::parallel_fill_memory(
+                thread_pool,
+                self.image_memory.0.add(self.layout.offset),
+                self.layout.size,
+                &self.pattern,
+            );
+        } else {
+            let layout = &self.layout;
+            let image_memory = self.image_memory;
+            let pattern = &self.pattern;
+            let tile_size = (TILE_SIZE * TILE_SIZE) as usize * layout.block.size_in_bytes;
+            let fill_tile = |&(tile_x, tile_y, z): &(u32, u32, u32)| {
+                layout.fill_tile(image_memory.0, tile_x, tile_y, z, pattern)
+            };
+            if tiles.len() * tile_size < transfer::PARALLEL_THRESHOLD {
+                tiles.iter().for_each(fill_tile);
+            } else {
+                thread_pool.for_each_index(tiles.len(), || (), |_, index| fill_tile(&tiles[index]));
+            }
+        }
+        self.pending_count -= tiles.len();
+    }
+}
+
+#[derive(Copy, Clone, Eq, PartialEq, Debug)]
+enum Access {
+    Read,
+    /// the accessed texel blocks are written before they're read
+    Write,
+    /// the accessed texel blocks become undefined
+    Discard,
+}
+
+/// the clears that are pending in a batch, by image, mip level and array layer
+pub struct DeferredClears {
+    clears: HashMap<(NonNull<Image>, u32, u32), PendingClear>,
+}
+
+impl DeferredClears {
+    pub fn new() -> Self {
+        Self {
+            clears: HashMap::new(),
+        }
+    }
+    /// clear `region` to `pattern`, which is one texel block. with a `mask` from
+    /// `get_aspect_mask`, only the bytes where it's nonzero are written.
+    /// clearing a whole subresource is deferred; the rest are written immediately
+    pub unsafe fn clear(
+        &mut self,
+        thread_pool: &ThreadPool,
+        image: &Image,
+        region: &ImageRegion,
+        pattern: &[u8],
+        mask: Option<&[u8]>,
+    ) {
+        let computed_properties = image.properties.computed_properties();
+        for array_layer in region.base_array_layer..region.base_array_layer + region.layer_count {
+            let layout = computed_properties.get_subresource_layout(region.mip_level, array_layer);
+            let block_region = BlockRegion::new(&layout, region.offset, region.extent);
+            if let Some(mask) = mask {
+                let key = (NonNull::from(image), region.mip_level, array_layer);
+                if let Some(pending_clear) = self.clears.get_mut(&key).filter(|pending_clear| {
+                    block_region.is_whole_subresource(&layout)
+                        && pending_clear.pending_count == pending_clear.pending_tiles.len()
+                }) {
+                    // none of the subresource is written yet, so the clears combine
+                    for ((value, &new_value), &mask) in
+                        pending_clear.pattern.iter_mut().zip(pattern).zip(mask)
+                    {
+                        if mask != 0 {
+                            *value = new_value;
+                        }
+                    }
+                    continue;
+                }
+                // the bytes that aren't cleared are kept, so they have to be in memory
+                self.access(
+                    thread_pool,
+                    image,
+                    region.mip_level,
+                    array_layer,
+                    block_region,
+                    Access::Read,
+                );
+                layout.fill_region_masked(
+                    image.get_memory(),
+                    region.offset,
+                    region.extent,
+                    pattern,
+                    mask,
+                );
+                continue;
+            }
+            if block_region.is_whole_subresource(&layout) {
+                let tile_counts = layout.get_tile_counts();
+                let tile_count = (tile_counts.0 * tile_counts.1 * layout.depth) as usize;
+                self.clears.insert(
+                    (NonNull::from(image), region.mip_level, array_layer),
+                    PendingClear {
+                        image_memory: SharedPointer(image.get_memory()),
+                        layout,
+                        pattern: pattern.into(),
+                        tile_counts,
+                        pending_tiles: vec![true; tile_count],
+                        pending_count: tile_count,
+                    },
+                );
+                continue;
+            }
+            self.access(
+                thread_pool,
+                image,
+                region.mip_level,
+                array_layer,
+                block_region,
+                Access::Write,
+            );
+            fill_blocks(
+                thread_pool,
+                image.get_memory(),
+                &layout,
+                block_region,
+                pattern,
+            );
+        }
+    }
+    /// clear the subresources in `range`
+    pub unsafe fn clear_subresource_range(
+        &mut self,
+        thread_pool: &ThreadPool,
+        image: &Image,
+        range: &api::VkImageSubresourceRange,
+        pattern: &[u8],
+        mask: Option<&[u8]>,
+    ) {
+        let (level_count, layer_count) = image.get_level_and_layer_counts(range);
+        for mip_level in range.baseMipLevel..range.baseMipLevel + level_count {
+            let subresource = api::VkImageSubresourceLayers {
+                aspectMask: range.aspectMask,
+                mipLevel: mip_level,
+                baseArrayLayer: range.baseArrayLayer,
+                layerCount: layer_count,
+            };
+            self.clear(
+                thread_pool,
+                image,
+                &ImageRegion::whole_level(image, &subresource),
+                pattern,
+                mask,
+            );
+        }
+    }
+    unsafe fn access(
+        &mut self,
+        thread_pool: &ThreadPool,
+        image: &Image,
+        mip_level: u32,
+        array_layer: u32,
+        region: BlockRegion,
+        access: Access,
+    ) {
+        let key = (NonNull::from(image), mip_level, array_layer);
+        let finished = match self.clears.get_mut(&key) {
+            None => return,
+            Some(pending_clear) => {
+                let (first_tile_x, first_tile_y, end_tile_x, end_tile_y) = region.get_tile_range();
+                let overlaps = |tile_x: u32, tile_y: u32, z: u32| {
+                    tile_x >= first_tile_x
+                        && tile_x < end_tile_x
+                        && tile_y >= first_tile_y
+                        && tile_y < end_tile_y
+                        && z >= region.z
+                        && z < region.end_z
+                };
+                if access != Access::Read {
+                    for z in region.z..region.end_z {
+                        for tile_y in first_tile_y..end_tile_y {
+                            for tile_x in first_tile_x..end_tile_x {
+                                let index = pending_clear.get_tile_index(tile_x, tile_y, z);
+                                if pending_clear.pending_tiles[index]
+                                    && region.covers_tile(&pending_clear.layout, tile_x, tile_y)
+                                {
+                                    pending_clear.pending_tiles[index] = false;
+                                    pending_clear.pending_count -= 1;
+                                }
+                            }
+                        }
+                    }
+                }
+                if access != Access::Discard {
+                    pending_clear.write_tiles(thread_pool, overlaps);
+                }
+                pending_clear.pending_count == 0
+            }
+        };
+        if finished {
+            self.clears.remove(&key);
+        }
+    }
+    unsafe fn access_region(
+        &mut self,
+        thread_pool: &ThreadPool,
+        image: &Image,
+        region: &ImageRegion,
+        access: Access,
+    ) {
+        if self.clears.is_empty() {
+            return;
+        }
+        let computed_properties = image.properties.computed_properties();
+        for array_layer in region.base_array_layer..region.base_array_layer + region.layer_count {
+            let layout = computed_properties.get_subresource_layout(region.mip_level, array_layer);
+            let block_region = BlockRegion::new(&layout, region.offset, region.extent);
+            self.access(
+                thread_pool,
+                image,
+                region.mip_level,
+                array_layer,
+                block_region,
+                access,
+            );
+        }
+    }
+    /// write the pending clears in `region`, before it's read
+    pub unsafe fn prepare_read(
+        &mut self,
+        thread_pool: &ThreadPool,
+        image: &Image,
+        region: &ImageRegion,
+    ) {
+        self.access_region(thread_pool, image, region, Access::Read)
+    }
+    /// get `region` ready to be overwritten: the pending clears of the tiles it covers are
+    /// dropped, and the tiles it only partly covers are written
+    pub unsafe fn prepare_write(
+        &mut self,
+        thread_pool: &ThreadPool,
+        image: &Image,
+        region: &ImageRegion,
+    ) {
+        self.access_region(thread_pool, image, region, Access::Write)
+    }
+    /// drop the pending clears of the tiles covered by `region`, whose contents are now undefined
+    pub unsafe fn discard(
+        &mut self,
+        thread_pool: &ThreadPool,
+        image: &Image,
+        region: &ImageRegion,
+    ) {
+        self.access_region(thread_pool, image, region, Access::Discard)
+    }
+    /// the pattern that a subresource is cleared to, if none of it has been written since
+    pub fn get_clear_pattern(
+        &self,
+        image: &Image,
+        mip_level: u32,
+        array_layer: u32,
+    ) -> Option<&[u8]> {
+        self.clears
+            .get(&(NonNull::from(image), mip_level, array_layer))
+            .filter(|pending_clear| {
+                pending_clear.pending_count == pending_clear.pending_tiles.len()
+            })
+            .map(|pending_clear| &*pending_clear.pattern)
+    }
+    /// write all of the pending clears, for commands that could access any image
+    pub unsafe fn write_all(&mut self, thread_pool: &ThreadPool) {
+        for (_, mut pending_clear) in self.clears.drain() {
+            pending_clear.write_tiles(thread_pool, |_, _, _| true);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use constants::MIN_MEMORY_MAP_ALIGNMENT;
+    use device_memory::{DeviceMemory, DeviceMemoryAllocation, DeviceMemoryLayout};
+    use handle::{OwnedHandle, SharedHandle};
+    use image::{ImageMemory, ImageProperties, SupportedTilings, Tiling};
+    use std::ptr;
+
+    /// a 40x20 image, which is 3x2 tiles, with every byte set to `0xAA`
+    unsafe fn create_image(format: api::VkFormat) -> (OwnedHandle<api::VkDeviceMemory>, Image) {
+        let properties = ImageProperties {
+            supported_tilings: SupportedTilings::Any,
+            format,
+            extents: api::VkExtent3D {
+                width: 40,
+                height: 20,
+                depth: 1,
+            },
+            array_layers: 1,
+            mip_levels: 1,
+            multisample_count: ImageMultisampleCount::Count1,
+            swapchain_present_tiling: None,
+        };
+        let computed_properties = properties.computed_properties();
+        assert_eq!(computed_properties.tiling, Tiling::Tiled);
+        let size = computed_properties.memory_layout.size;
+        let memory = OwnedHandle::<api::VkDeviceMemory>::new(
+            DeviceMemory::allocate_from_default_heap(DeviceMemoryLayout::calculate(
+                size,
+                MIN_MEMORY_MAP_ALIGNMENT,
+            ))
+            .unwrap(),
+        );
+        ptr::write_bytes(memory.get().as_ptr(), 0xAA, size);
+        let image = Image {
+            properties,
+            memory: Some(ImageMemory {
+                device_memory: SharedHandle::from(memory.get_handle()).unwrap(),
+                offset: 0,
+            }),
+        };
+        (memory, image)
+    }
+
+    unsafe fn get_texel(image: &Image, x: u32, y: u32) -> [u8; 4] {
+        let layout = image
+            .properties
+            .computed_properties()
+            .get_subresource_layout(0, 0);
+        let mut texel = [0; 4];
+        ptr::copy_nonoverlapping(
+            image.get_memory().add(layout.get_block_offset(x, y, 0)),
+            texel.as_mut_ptr(),
+            4,
+        );
+        texel
+    }
+
+    fn get_region(x: i32, y: i32, width: u32, height: u32) -> ImageRegion {
+        ImageRegion {
+            mip_level: 0,
+            base_array_layer: 0,
+            layer_count: 1,
+            offset: api::VkOffset3D { x, y, z: 0 },
+            extent: api::VkExtent3D {
+                width,
+                height,
+                depth: 1,
+            },
+        }
+    }
+
+    #[test]
+    fn test_deferred_clear() {
+        let thread_pool = ThreadPool::new(2, "test");
+        let (_memory, image) = unsafe { create_image(api::VK_FORMAT_R8G8B8A8_UNORM) };
+        let whole_image = get_region(0, 0, 40, 20);
+        let pattern = [1, 2, 3, 4];
+        let mut deferred_clears = DeferredClears::new();
+        unsafe {
+            deferred_clears.clear(&thread_pool, &image, &whole_image, &pattern, None);
+            assert_eq!(
+                deferred_clears.get_clear_pattern(&image, 0, 0),
+                Some(&pattern[..])
+            );
+            assert_eq!(get_texel(&image, 0, 0), [0xAA; 4]);
+            // tile (1, 0) is completely overwritten, so it's never cleared
+            deferred_clears.prepare_write(&thread_pool, &image, &get_region(16, 0, 16, 16));
+            assert_eq!(deferred_clears.get_clear_pattern(&image, 0, 0), None);
+            assert_eq!(get_texel(&image, 0, 0), [0xAA; 4]);
+            // tile (0, 0) is only partly overwritten, so it's cleared now
+            deferred_clears.prepare_write(&thread_pool, &image, &get_region(0, 0, 8, 8));
+            assert_eq!(get_texel(&image, 15, 15), pattern);
+            assert_eq!(get_texel(&image, 39, 0), [0xAA; 4]);
+            deferred_clears.write_all(&thread_pool);
+            for &(x, y) in &[(0, 0), (39, 0), (0, 19), (39, 19), (16, 16)] {
+                assert_eq!(get_texel(&image, x, y), pattern);
+            }
+            assert_eq!(get_texel(&image, 16, 0), [0xAA; 4]);
+            assert_eq!(get_texel(&image, 31, 15), [0xAA; 4]);
+        }
+    }
+
+    #[test]
+    fn test_partial_clear() {
+        let thread_pool = ThreadPool::new(2, "test");
+        let (_memory, image) = unsafe { create_image(api::VK_FORMAT_R8G8B8A8_UNORM) };
+        let pattern = [1, 2, 3, 4];
+        let mut deferred_clears = DeferredClears::new();
+        unsafe {
+            deferred_clears.clear(
+                &thread_pool,
+                &image,
+                &get_region(8, 4, 24, 8),
+                &pattern,
+                None,
+            );
+            assert_eq!(deferred_clears.get_clear_pattern(&image, 0, 0), None);
+            assert_eq!(get_texel(&image, 8, 4), pattern);
+            assert_eq!(get_texel(&image, 31, 11), pattern);
+            assert_eq!(get_texel(&image, 7, 4), [0xAA; 4]);
+            assert_eq!(get_texel(&image, 32, 11), [0xAA; 4]);
+            assert_eq!(get_texel(&image, 8, 12), [0xAA; 4]);
+        }
+    }
+
+    #[test]
+    fn test_stencil_clear() {
+        let thread_pool = ThreadPool::new(2, "test");
+        let (_memory, image) = unsafe { create_image(api::VK_FORMAT_D24_UNORM_S8_UINT) };
+        let whole_image = get_region(0, 0, 40, 20);
+        let value = |depth, stencil| {
+            get_depth_stencil_pattern(&image, api::VkClearDepthStencilValue { depth, stencil })
+        };
+        let stencil_mask = get_aspect_mask(&image, api::VK_IMAGE_ASPECT_STENCIL_BIT).unwrap();
+        assert_eq!(stencil_mask, [0, 0, 0, 0xFF]);
+        assert_eq!(
+            get_aspect_mask(
+                &image,
+                api::VK_IMAGE_ASPECT_DEPTH_BIT | api::VK_IMAGE_ASPECT_STENCIL_BIT
+            ),
+            None
+        );
+        let mut deferred_clears = DeferredClears::new();
+        unsafe {
+            // nothing is pending, so the stencil is written and the depth is kept
+            deferred_clears.clear(
+                &thread_pool,
+                &image,
+                &whole_image,
+                &value(0.0, 5),
+                Some(&stencil_mask),
+            );
+            assert_eq!(get_texel(&image, 39, 19), [0xAA, 0xAA, 0xAA, 5]);
+            // the stencil clear combines with the pending clear
+            deferred_clears.clear(&thread_pool, &image, &whole_image, &value(1.0, 0), None);
+            deferred_clears.clear(
+                &thread_pool,
+                &image,
+                &whole_image,
+                &value(0.0, 7),
+                Some(&stencil_mask),
+            );
+            assert_eq!(
+                deferred_clears.get_clear_pattern(&image, 0, 0),
+                Some(&[0xFF, 0xFF, 0xFF, 7][..])
+            );
+            assert_eq!(get_texel(&image, 0, 0), [0xAA, 0xAA, 0xAA, 5]);
+            deferred_clears.write_all(&thread_pool);
+            assert_eq!(get_texel(&image, 0, 0), [0xFF, 0xFF, 0xFF, 7]);
+        }
+    }
+}
@@ -0,0 +1,613 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright 2018 Jacob Lifshay
+
+// Commands are recorded into chunks that are reused after the command buffer is reset.
+// Each record is a `RecordHeader` followed by the command, padded to `RECORD_ALIGNMENT`.
+// Variable-length command arguments are stored in `CommandTag::Data` records that are skipped
+// when reading the commands back, and are referenced through `ArenaSlice`.
+// A chunk that has no room for the next record is ended with a `CommandTag::ChunkEnd` record.
+
+use api;
+use clear::ClearAttachment;
+use handle::{Handle, OwnedHandle};
+use std::fmt;
+use std::marker::PhantomData;
+use std::mem;
+use std::ptr;
+use std::slice;
+use std::sync::{Arc, Mutex};
+
+const CHUNK_SIZE: usize = 64 * 1024;
+
+const RECORD_ALIGNMENT: usize = 8;
+
+#[derive(Copy, Clone)]
+#[repr(C, align(64))]
+struct CacheLine([u8; 64]);
+
+/// a block of memory that records are written into
+struct Chunk(Box<[CacheLine]>);
+
+impl Chunk {
+    fn new(size: usize) -> Self {
+        let line_size = mem::size_of::<CacheLine>();
+        Chunk(vec![CacheLine([0; 64]); (size + line_size - 1) / line_size].into_boxed_slice())
+    }
+    fn size(&self) -> usize {
+        self.0.len() * mem::size_of::<CacheLine>()
+    }
+    fn as_ptr(&self) -> *const u8 {
+        self.0.as_ptr() as *const u8
+    }
+    fn as_mut_ptr(&mut self) -> *mut u8 {
+        self.0.as_mut_ptr() as *mut u8
+    }
+}
+
+#[repr(C)]
+struct RecordHeader {
+    tag: CommandTag,
+    /// the size of the whole record, including the header
+    size: u32,
+}
+
+const RECORD_HEADER_SIZE: usize = mem::size_of::<RecordHeader>();
+
+fn get_record_size(payload_size: usize) -> usize {
+    (RECORD_HEADER_SIZE + payload_size + RECORD_ALIGNMENT - 1) & !(RECORD_ALIGNMENT - 1)
+}
+
+/// a slice stored in the same command buffer as the command referencing it
+pub struct ArenaSlice<T: Copy + 'static> {
+    ptr: *const T,
+    len: usize,
+    _phantom: PhantomData<&'static [T]>,
+}
+
+impl<T: Copy + 'static> Clone for ArenaSlice<T> {
+    fn clone(&self) -> Self {
+        *self
+    }
+}
+
+impl<T: Copy + 'static> Copy for ArenaSlice<T> {}
+
+impl<T: Copy + 'static> ArenaSlice<T> {
+    /// the returned slice is only valid while the command referencing `self` is
+    pub fn get(&self) -> &[T] {
+        if self.len == 0 {
+            &[]
+        } else {
+            unsafe { slice::from_raw_parts(self.ptr, self.len) }
+        }
+    }
+}
+
+impl<T: Copy + fmt::Debug + 'static> fmt::Debug for ArenaSlice<T> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        self.get().fmt(f)
+    }
+}
+
+pub trait Command: Copy + 'static {
+    const TAG: CommandTag;
+}
+
+macro_rules! commands {
+    ($($name:ident {$($field:ident: $type:ty,)*},)*) => {
+        pub mod commands {
+            use super::*;
+            $(
+                #[derive(Copy, Clone, Debug)]
+                pub struct $name {
+                    $(pub $field: $type,)*
+                }
+
+                impl Command for $name {
+                    const TAG: CommandTag = CommandTag::$name;
+                }
+            )*
+        }
+
+        #[derive(Copy, Clone, Eq, PartialEq, Debug)]
+        #[repr(u32)]
+        pub enum CommandTag {
+            ChunkEnd,
+            Data,
+            $($name,)*
+        }
+
+        #[derive(Copy, Clone, Debug)]
+        pub enum CommandRef<'a> {
+            $($name(&'a commands::$name),)*
+        }
+
+        impl<'a> CommandRef<'a> {
+            /// `payload` must point to a command with the type given by `tag`
+            unsafe fn from_record(tag: CommandTag, payload: *const u8) -> Option<Self> {
+                match tag {
+                    CommandTag::ChunkEnd | CommandTag::Data => None,
+                    $(CommandTag::$name => Some(CommandRef::$name(&*(payload as *const commands::$name))),)*
+                }
+            }
+        }
+    };
+}
+
+commands! {
+    BindPipeline {
+        pipeline_bind_point: api::VkPipelineBindPoint,
+        pipeline: api::VkPipeline,
+    },
+    SetViewport {
+        first_viewport: u32,
+        viewports: ArenaSlice<api::VkViewport>,
+    },
+    SetScissor {
+        first_scissor: u32,
+        scissors: ArenaSlice<api::VkRect2D>,
+    },
+    BindIndexBuffer {
+        buffer: api::VkBuffer,
+        offset: api::VkDeviceSize,
+        index_type: api::VkIndexType,
+    },
+    BindDescriptorSets {
+        pipeline_bind_point: api::VkPipelineBindPoint,
+        first_set: u32,
+        // the index of the dynamic offset of `first_set` in the pipeline layout, which can be
+        // destroyed before the command buffer is executed
+        first_dynamic_offset: u32,
+        descriptor_sets: ArenaSlice<api::VkDescriptorSet>,
+        dynamic_offsets: ArenaSlice<u32>,
+    },
+    BindVertexBuffers {
+        first_binding: u32,
+        buffers: ArenaSlice<api::VkBuffer>,
+        offsets: ArenaSlice<api::VkDeviceSize>,
+    },
+    Draw {
+        vertex_count: u32,
+        instance_count: u32,
+        first_vertex: u32,
+        first_instance: u32,
+    },
+    DrawIndexed {
+        index_count: u32,
+        instance_count: u32,
+        first_index: u32,
+        vertex_offset: i32,
+        first_instance: u32,
+    },
+    DrawIndirect {
+        buffer: api::VkBuffer,
+        offset: api::VkDeviceSize,
+        draw_count: u32,
+        stride: u32,
+    },
+    DrawIndexedIndirect {
+        buffer: api::VkBuffer,
+        offset: api::VkDeviceSize,
+        draw_count: u32,
+        stride: u32,
+    },
+    DrawIndirectCount {
+        buffer: api::VkBuffer,
+        offset: api::VkDeviceSize,
+        count_buffer: api::VkBuffer,
+        count_buffer_offset: api::VkDeviceSize,
+        max_draw_count: u32,
+        stride: u32,
+    },
+    DrawIndexedIndirectCount {
+        buffer: api::VkBuffer,
+        offset: api::VkDeviceSize,
+        count_buffer: api::VkBuffer,
+        count_buffer_offset: api::VkDeviceSize,
+        max_draw_count: u32,
+        stride: u32,
+    },
+    Dispatch {
+        base_group_x: u32,
+        base_group_y: u32,
+        base_group_z: u32,
+        group_count_x: u32,
+        group_count_y: u32,
+        group_count_z: u32,
+    },
+    DispatchIndirect {
+        buffer: api::VkBuffer,
+        offset: api::VkDeviceSize,
+    },
+    CopyBuffer {
+        src_buffer: api::VkBuffer,
+        dst_buffer: api::VkBuffer,
+        regions: ArenaSlice<api::VkBufferCopy>,
+    },
+    CopyImage {
+        src_image: api::VkImage,
+        dst_image: api::VkImage,
+        regions: ArenaSlice<api::VkImageCopy>,
+    },
+    BlitImage {
+        src_image: api::VkImage,
+        dst_image: api::VkImage,
+        regions: ArenaSlice<api::VkImageBlit>,
+        filter: api::VkFilter,
+    },
+    CopyBufferToImage {
+        src_buffer: api::VkBuffer,
+        dst_image: api::VkImage,
+        regions: ArenaSlice<api::VkBufferImageCopy>,
+    },
+    CopyImageToBuffer {
+        src_image: api::VkImage,
+        dst_buffer: api::VkBuffer,
+        regions: ArenaSlice<api::VkBufferImageCopy>,
+    },
+    UpdateBuffer {
+        dst_buffer: api::VkBuffer,
+        dst_offset: api::VkDeviceSize,
+        data: ArenaSlice<u8>,
+    },
+    FillBuffer {
+        dst_buffer: api::VkBuffer,
+        dst_offset: api::VkDeviceSize,
+        size: api::VkDeviceSize,
+        data: u32,
+    },
+    ClearColorImage {
+        image: api::VkImage,
+        // the bits of the `VkClearColorValue`
+        color: [u32; 4],
+        ranges: ArenaSlice<api::VkImageSubresourceRange>,
+    },
+    ClearDepthStencilImage {
+        image: api::VkImage,
+        depth_stencil: api::VkClearDepthStencilValue,
+        ranges: ArenaSlice<api::VkImageSubresourceRange>,
+    },
+    ClearAttachments {
+        attachments: ArenaSlice<ClearAttachment>,
+        rects: ArenaSlice<api::VkClearRect>,
+    },
+    BeginRenderPass {
+        render_pass: api::VkRenderPass,
+        framebuffer: api::VkFramebuffer,
+        render_area: api::VkRect2D,
+        // the bits of the `VkClearValue`s
+        clear_values: ArenaSlice<[u32; 4]>,
+    },
+    NextSubpass {},
+    EndRenderPass {},
+    BeginQuery {
+        query_pool: api::VkQueryPool,
+        query: u32,
+        flags: api::VkQueryControlFlags,
+    },
+    EndQuery {
+        query_pool: api::VkQueryPool,
+        query: u32,
+    },
+    ResetQueryPool {
+        query_pool: api::VkQueryPool,
+        first_query: u32,
+        query_count: u32,
+    },
+    WriteTimestamp {
+        pipeline_stage: api::VkPipelineStageFlagBits,
+        query_pool: api::VkQueryPool,
+        query: u32,
+    },
+    CopyQueryPoolResults {
+        query_pool: api::VkQueryPool,
+        first_query: u32,
+        query_count: u32,
+        dst_buffer: api::VkBuffer,
+        dst_offset: api::VkDeviceSize,
+        stride: api::VkDeviceSize,
+        flags: api::VkQueryResultFlags,
+    },
+    PushConstants {
+        layout: api::VkPipelineLayout,
+        stage_flags: api::VkShaderStageFlags,
+        offset: u32,
+        values: ArenaSlice<u8>,
+    },
+}
+
+#[derive(Copy, Clone, Eq, PartialEq, Debug)]
+pub enum CommandBufferState {
+    Initial,
+    Recording,
+    Executable,
+}
+
+pub struct CommandBuffer {
+    spare_chunks: Arc<Mutex<Vec<Chunk>>>,
+    chunks: Vec<Chunk>,
+    /// index in `chunks` of the chunk being written
+    current_chunk: usize,
+    /// offset in the current chunk of the next record
+    current_offset: usize,
+    state: CommandBufferState,
+    level: api::VkCommandBufferLevel,
+    usage_flags: api::VkCommandBufferUsageFlags,
+}
+
+// commands only reference memory owned by the command buffer
+unsafe impl Send for CommandBuffer {}
+
+unsafe impl Sync for CommandBuffer {}
+
+impl CommandBuffer {
+    pub fn state(&self) -> CommandBufferState {
+        self.state
+    }
+    #[allow(dead_code)]
+    pub fn level(&self) -> api::VkCommandBufferLevel {
+        self.level
+    }
+    #[allow(dead_code)]
+    pub fn usage_flags(&self) -> api::VkCommandBufferUsageFlags {
+        self.usage_flags
+    }
+    /// doesn't free any memory unless `release_resources` is true, so recording again is cheap
+    pub fn reset(&mut self, release_resources: bool) {
+        self.current_chunk = 0;
+        self.current_offset = 0;
+        self.state = CommandBufferState::Initial;
+        if release_resources {
+            self.spare_chunks
+                .lock()
+                .unwrap()
+                .extend(self.chunks.drain(..));
+        }
+    }
+    pub fn begin(&mut self, usage_flags: api::VkCommandBufferUsageFlags) {
+        if self.state != CommandBufferState::Initial {
+            self.reset(false);
+        }
+        self.usage_flags = usage_flags;
+        self.state = CommandBufferState::Recording;
+    }
+    pub fn end(&mut self) {
+        assert_eq!(self.state, CommandBufferState::Recording);
+        self.state = CommandBufferState::Executable;
+    }
+    unsafe fn write_header(&mut self, tag: CommandTag, size: usize) {
+        ptr::write(
+            self.chunks[self.current_chunk]
+                .as_mut_ptr()
+                .add(self.current_offset) as *mut RecordHeader,
+            RecordHeader {
+                tag,
+                size: size as u32,
+            },
+        );
+    }
+    /// returns a pointer to the payload of the new record
+    fn allocate_record(&mut self, tag: CommandTag, payload_size: usize) -> *mut u8 {
+        debug_assert_eq!(self.state, CommandBufferState::Recording);
+        let record_size = get_record_size(payload_size);
+        assert!(record_size <= u32::max_value() as usize);
+        // always leave space for a `ChunkEnd` record
+        let required_chunk_size = record_size + RECORD_HEADER_SIZE;
+        loop {
+            if self.current_chunk == self.chunks.len() {
+                let spare_chunk = if required_chunk_size <= CHUNK_SIZE {
+                    self.spare_chunks.lock().unwrap().pop()
+                } else {
+                    None
+                };
+                let chunk =
+                    spare_chunk.unwrap_or_else(|| Chunk::new(required_chunk_size.max(CHUNK_SIZE)));
+                self.chunks.push(chunk);
+            }
+            if self.current_offset + required_chunk_size <= self.chunks[self.current_chunk].size() {
+                break;
+            }
+            unsafe {
+                self.write_header(CommandTag::ChunkEnd, RECORD_HEADER_SIZE);
+            }
+            self.current_chunk += 1;
+            self.current_offset = 0;
+        }
+        unsafe {
+            self.write_header(tag, record_size);
+            let payload = self.chunks[self.current_chunk]
+                .as_mut_ptr()
+                .add(self.current_offset + RECORD_HEADER_SIZE);
+            self.current_offset += record_size;
+            payload
+        }
+    }
+    pub fn record<T: Command>(&mut self, command: T) {
+        assert!(mem::align_of::<T>() <= RECORD_ALIGNMENT);
+        unsafe {
+            ptr::write(
+                self.allocate_record(T::TAG, mem::size_of::<T>()) as *mut T,
+                command,
+            );
+        }
+    }
+    /// copy `values` into `self` so they can be referenced by a command
+    pub fn allocate_slice<T: Copy + 'static>(&mut self, values: &[T]) -> ArenaSlice<T> {
+        assert!(mem::align_of::<T>() <= RECORD_ALIGNMENT);
+        if values.is_empty() {
+            return ArenaSlice {
+                ptr: ptr::null(),
+                len: 0,
+                _phantom: PhantomData,
+            };
+        }
+        let size = mem::size_of::<T>().checked_mul(values.len()).unwrap();
+        unsafe {
+            let data = self.allocate_record(CommandTag::Data, size) as *mut T;
+            ptr::copy_nonoverlapping(values.as_ptr(), data, values.len());
+            ArenaSlice {
+                ptr: data,
+                len: values.len(),
+                _phantom: PhantomData,
+            }
+        }
+    }
+    pub fn commands(&self) -> Commands {
+        Commands {
+            command_buffer: self,
+            chunk: 0,
+            offset: 0,
+        }
+    }
+}
+
+/// iterates over the commands recorded in a `CommandBuffer`
+pub struct Commands<'a> {
+    command_buffer: &'a CommandBuffer,
+    chunk: usize,
+    offset: usize,
+}
+
+impl<'a> Iterator for Commands<'a> {
+    type Item = CommandRef<'a>;
+    fn next(&mut self) -> Option<CommandRef<'a>> {
+        loop {
+            if self.chunk == self.command_buffer.current_chunk
+                && self.offset == self.command_buffer.current_offset
+            {
+                return None;
+            }
+            unsafe {
+                let record = self.command_buffer.chunks[self.chunk]
+                    .as_ptr()
+                    .add(self.offset);
+                let header = &*(record as *const RecordHeader);
+                if header.tag == CommandTag::ChunkEnd {
+                    self.chunk += 1;
+                    self.offset = 0;
+                    continue;
+                }
+                self.offset += header.size as usize;
+                if let Some(command) =
+                    CommandRef::from_record(header.tag, record.add(RECORD_HEADER_SIZE))
+                {
+                    return Some(command);
+                }
+            }
+        }
+    }
+}
+
+pub struct CommandPool {
+    flags: api::VkCommandPoolCreateFlags,
+    /// chunks released by `CommandBuffer::reset`, for use by any command buffer in this pool
+    spare_chunks: Arc<Mutex<Vec<Chunk>>>,
+    command_buffers: Vec<OwnedHandle<api::VkCommandBuffer>>,
+}
+
+impl CommandPool {
+    pub fn new(flags: api::VkCommandPoolCreateFlags) -> Self {
+        Self {
+            flags,
+            spare_chunks: Arc::new(Mutex::new(Vec::new())),
+            command_buffers: Vec::new(),
+        }
+    }
+    pub fn flags(&self) -> api::VkCommandPoolCreateFlags {
+        self.flags
+    }
+    pub fn allocate_command_buffer(
+        &mut self,
+        level: api::VkCommandBufferLevel,
+    ) -> api::VkCommandBuffer {
+        let command_buffer = OwnedHandle::<api::VkCommandBuffer>::new(CommandBuffer {
+            spare_chunks: self.spare_chunks.clone(),
+            chunks: Vec::new(),
+            current_chunk: 0,
+            current_offset: 0,
+            state: CommandBufferState::Initial,
+            level,
+            usage_flags: 0,
+        });
+        let retval = unsafe { command_buffer.get_handle() };
+        self.command_buffers.push(command_buffer);
+        retval
+    }
+    pub fn free_command_buffer(&mut self, command_buffer: api::VkCommandBuffer) {
+        if command_buffer.is_null() {
+            return;
+        }
+        let index = self
+            .command_buffers
+            .iter()
+            .position(|v| unsafe { v.get_handle() } == command_buffer)
+            .expect("command buffer not allocated from this command pool");
+        self.command_buffers.swap_remove(index);
+    }
+    pub fn reset(&mut self, release_resources: bool) {
+        for command_buffer in &mut self.command_buffers {
+            command_buffer.reset(release_resources);
+        }
+        if release_resources {
+            self.trim();
+        }
+    }
+    /// free the chunks that aren't used by any command buffer
+    pub fn trim(&mut self) {
+        self.spare_chunks.lock().unwrap().clear();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use handle::MutHandle;
+
+    #[test]
+    fn test_record() {
+        let mut command_pool = CommandPool::new(0);
+        let command_buffer =
+            command_pool.allocate_command_buffer(api::VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+        let mut command_buffer = unsafe { MutHandle::from(command_buffer).unwrap() };
+        // enough commands to need several chunks
+        let draw_count = 3 * CHUNK_SIZE / mem::size_of::<commands::Draw>();
+        for _ in 0..2 {
+            command_buffer.begin(0);
+            for i in 0..draw_count as u32 {
+                let data = command_buffer.allocate_slice(&[i as u8, 1, 2]);
+                command_buffer.record(commands::UpdateBuffer {
+                    dst_buffer: Handle::null(),
+                    dst_offset: 0,
+                    data,
+                });
+                command_buffer.record(commands::Draw {
+                    vertex_count: i,
+                    instance_count: 1,
+                    first_vertex: 0,
+                    first_instance: 0,
+                });
+            }
+            command_buffer.end();
+            let chunk_count = command_buffer.chunks.len();
+            assert!(chunk_count > 1);
+            let mut count = 0;
+            for (index, command) in command_buffer.commands().enumerate() {
+                let i = (index / 2) as u32;
+                match command {
+                    CommandRef::UpdateBuffer(command) if index % 2 == 0 => {
+                        assert_eq!(command.data.get(), [i as u8, 1, 2])
+                    }
+                    CommandRef::Draw(command) if index % 2 == 1 => {
+                        assert_eq!(command.vertex_count, i)
+                    }
+                    _ => panic!("unexpected command: {:?}", command),
+                }
+                count += 1;
+            }
+            assert_eq!(count, draw_count * 2);
+            command_buffer.reset(false);
+            // resetting keeps the chunks
+            assert_eq!(command_buffer.chunks.len(), chunk_count);
+        }
+    }
+}
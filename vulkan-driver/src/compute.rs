@@ -0,0 +1,240 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright 2018 Jacob Lifshay
+
+// A compute pipeline's entry point is called once per workgroup and runs all of the workgroup's
+// invocations itself, a SIMD group at a time, splitting its loop over the invocations at every
+// barrier. So a workgroup only ever needs one thread, and barriers never block.
+// Dispatches spread their workgroups over the device's thread pool with
+// `ThreadPool::for_each_index`. Each thread keeps its own workgroup memory arena, which later
+// dispatches reuse.
+
+use api;
+use descriptor::BoundDescriptorSets;
+use pipeline::{Pipeline, ShaderStage};
+use query::PipelineStatistics;
+use shader_module::WorkgroupMemoryLayout;
+use spirv_parser::ExecutionModel;
+use std::cell::RefCell;
+use std::cmp;
+use std::mem;
+use std::ptr;
+use thread_pool::ThreadPool;
+
+// the argument of `ComputeShaderEntryPoint`, `workgroup_memory` holds the variables in the
+// `Workgroup` storage class at the offsets given by the pipeline's `WorkgroupMemoryLayout`.
+// `descriptor_sets` points to the memory of each bound descriptor set, see `BoundDescriptorSets`
+buildable_struct!{
+    #[derive(Copy)]
+    #[derive(Clone)]
+    pub struct WorkgroupContext {
+        workgroup_id: [u32; 3],
+        workgroup_count: [u32; 3],
+        workgroup_memory: *mut u8,
+        descriptor_sets: *const *const u8,
+        dynamic_offsets: *const u32,
+    }
+}
+
+// every workgroup only reads the descriptor sets
+unsafe impl Sync for WorkgroupContext {}
+
+/// the type of the generated compute shader entry points
+pub type ComputeShaderEntryPoint = unsafe extern "C" fn(*const WorkgroupContext);
+
+const ARENA_ALIGNMENT: usize = 64;
+
+#[derive(Copy, Clone)]
+#[repr(C, align(64))]
+struct ArenaLine([u8; ARENA_ALIGNMENT]);
+
+thread_local! {
+    static WORKGROUP_ARENA: RefCell<Vec<ArenaLine>> = RefCell::new(Vec::new());
+}
+
+/// the current thread's workgroup memory, taken out of `WORKGROUP_ARENA` while a dispatch uses it
+struct WorkgroupArena(Vec<ArenaLine>);
+
+impl WorkgroupArena {
+    fn take(size: usize) -> Self {
+        let mut lines =
+            WORKGROUP_ARENA.with(|arena| mem::replace(&mut *arena.borrow_mut(), Vec::new()));
+        let line_count = (size + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT;
+        if lines.len() < line_count {
+            lines.resize(line_count, ArenaLine([0; ARENA_ALIGNMENT]));
+        }
+        WorkgroupArena(lines)
+    }
+    fn as_mut_ptr(&mut self) -> *mut u8 {
+        self.0.as_mut_ptr() as *mut u8
+    }
+}
+
+impl Drop for WorkgroupArena {
+    fn drop(&mut self) {
+        let lines = mem::replace(&mut self.0, Vec::new());
+        // the thread-local is already gone if the thread is exiting
+        let _ = WORKGROUP_ARENA.try_with(|arena| *arena.borrow_mut() = lines);
+    }
+}
+
+#[derive(Clone, Debug)]
+pub struct WorkgroupLayout {
+    /// the number of invocations in each dimension
+    pub local_size: [u32; 3],
+    pub memory: WorkgroupMemoryLayout,
+}
+
+impl WorkgroupLayout {
+    pub fn new(stage: &ShaderStage) -> Result<Self, String> {
+        let index = stage.index.as_ref().map_err(Clone::clone)?;
+        let entry_point = index
+            .find_entry_point(ExecutionModel::GLCompute, &stage.entry_point_name)
+            .ok_or_else(|| format!("shader entry point not found: {}", stage.entry_point_name))?;
+        let constants = stage.get_specialized_constants()?;
+        let local_size = index
+            .get_local_size(&stage.code, &constants, entry_point)?
+            .ok_or_else(|| "compute shader has no workgroup size".to_string())?;
+        let memory = index.get_workgroup_memory_layout(&stage.code, &constants)?;
+        if memory.alignment > ARENA_ALIGNMENT {
+            return Err(format!(
+                "workgroup memory alignment too big: {}",
+                memory.alignment
+            ));
+        }
+        Ok(Self { local_size, memory })
+    }
+}
+
+/// the most indexes `ThreadPool::for_each_index` takes
+const MAX_RUN_LEN: u64 = u32::max_value() as u64;
+
+/// split the workgroups of a dispatch into runs of at most `max_run_len`, calling `f` with the
+/// first z slice of each run, and the start and length of its range of indexes counted from that
+/// slice. runs are whole slices, or parts of one when a slice is bigger than `max_run_len`
+fn for_each_run<F: FnMut(u32, u64, u64)>(workgroup_count: [u32; 3], max_run_len: u64, mut f: F) {
+    let slice_len = u64::from(workgroup_count[0]) * u64::from(workgroup_count[1]);
+    if slice_len == 0 {
+        return;
+    }
+    let slices_per_run = cmp::max(max_run_len / slice_len, 1);
+    let mut z = 0;
+    while z < workgroup_count[2] {
+        let slice_count = cmp::min(slices_per_run, u64::from(workgroup_count[2] - z));
+        let run_len = slice_len * slice_count;
+        let mut start = 0;
+        while start < run_len {
+            let len = cmp::min(run_len - start, max_run_len);
+            f(z, start, len);
+            start += len;
+        }
+        z += slice_count as u32;
+    }
+}
+
+/// the ID, relative to the base workgroup, of the workgroup at `index` counted from the start of
+/// z slice `z`. consecutive indexes are neighboring workgroups in x, for locality
+fn get_workgroup_id(workgroup_count: [u32; 3], z: u32, index: u64) -> [u32; 3] {
+    let count_x = u64::from(workgroup_count[0]);
+    let count_y = u64::from(workgroup_count[1]);
+    [
+        (index % count_x) as u32,
+        (index / count_x % count_y) as u32,
+        z + (index / count_x / count_y) as u32,
+    ]
+}
+
+/// runs the workgroups with IDs from `base_workgroup` to `base_workgroup + workgroup_count`
+/// on `thread_pool`, returning when they're all finished. adds the invocations to `statistics`
+pub unsafe fn dispatch(
+    pipeline: &Pipeline,
+    thread_pool: &ThreadPool,
+    descriptor_sets: &BoundDescriptorSets,
+    base_workgroup: [u32; 3],
+    workgroup_count: [u32; 3],
+    statistics: &mut PipelineStatistics,
+) {
+    let layout = pipeline
+        .workgroup_layout()
+        .expect("dispatch needs a compute pipeline");
+    let entry_point = pipeline.get_compute_function().unwrap();
+    // every workgroup runs all of its invocations, so they needn't be counted as they run.
+    // the counters saturate rather than wrap for dispatches too big to ever finish
+    let invocation_count = workgroup_count
+        .iter()
+        .chain(&layout.local_size)
+        .fold(1u64, |count, &size| count.saturating_mul(u64::from(size)));
+    statistics.add(
+        api::VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT,
+        invocation_count,
+    );
+    let base_context = WorkgroupContext {
+        workgroup_id: base_workgroup,
+        workgroup_count,
+        workgroup_memory: ptr::null_mut(),
+        descriptor_sets: descriptor_sets.sets.as_ptr(),
+        dynamic_offsets: descriptor_sets.dynamic_offsets.as_ptr(),
+    };
+    // `maxComputeWorkGroupCount` allows more workgroups than `for_each_index` takes at once
+    for_each_run(workgroup_count, MAX_RUN_LEN, |z, start, len| {
+        thread_pool.for_each_index(
+            len as usize,
+            || WorkgroupArena::take(layout.memory.size),
+            |arena, index| {
+                let id = get_workgroup_id(workgroup_count, z, start + index as u64);
+                let context = WorkgroupContext {
+                    workgroup_id: [
+                        base_workgroup[0] + id[0],
+                        base_workgroup[1] + id[1],
+                        base_workgroup[2] + id[2],
+                    ],
+                    workgroup_memory: arena.as_mut_ptr(),
+                    ..base_context
+                };
+                entry_point(&context);
+            },
+        )
+    });
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_runs() {
+        let runs = |workgroup_count, max_run_len| {
+            let mut runs = vec![];
+            let mut ids = vec![];
+            for_each_run(workgroup_count, max_run_len, |z, start, len| {
+                runs.push((z, start, len));
+                ids.extend(
+                    (start..start + len).map(|index| get_workgroup_id(workgroup_count, z, index)),
+                );
+            });
+            ids.sort();
+            let mut expected_ids = vec![];
+            for x in 0..workgroup_count[0] {
+                for y in 0..workgroup_count[1] {
+                    for z in 0..workgroup_count[2] {
+                        expected_ids.push([x, y, z]);
+                    }
+                }
+            }
+            // every workgroup runs once
+            assert_eq!(ids, expected_ids);
+            runs
+        };
+        assert_eq!(runs([2, 1, 5], 4), vec![(0, 0, 4), (2, 0, 4), (4, 0, 2)]);
+        assert_eq!(
+            runs([3, 2, 2], 4),
+            vec![(0, 0, 4), (0, 4, 2), (1, 0, 4), (1, 4, 2)]
+        );
+        assert_eq!(runs([3, 0, 2], 4), vec![]);
+        // one run of 2^32 - 1 indexes and one of 1
+        let mut runs = vec![];
+        for_each_run([65536, 65536, 1], MAX_RUN_LEN, |z, start, len| {
+            runs.push((z, start, len))
+        });
+        assert_eq!(runs, vec![(0, 0, MAX_RUN_LEN), (0, MAX_RUN_LEN, 1)]);
+    }
+}
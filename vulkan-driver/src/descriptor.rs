@@ -0,0 +1,842 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright 2018 Jacob Lifshay
+
+// Descriptor sets have a flat layout. Creating a `DescriptorSetLayout` gives each binding a fixed
+// byte offset, and the binding's descriptors are stored one after another at that offset as the
+// `repr(C)` structs below. Generated shader code can then load any descriptor from the set's base
+// pointer at a constant offset.
+// A pool allocates one arena for all of its sets when it's created. The pool also holds the
+// `DescriptorSet` structs that the handles point to, so a set's base pointer stays put until the
+// set is freed.
+// Writing descriptors converts the `VkDescriptor*Info` structs in place, one binding's run of
+// descriptors at a time. Copying descriptors is a `memcpy`. Update templates compute their
+// destination offsets once, when they're created.
+
+use api;
+use handle::{BufferView, Handle, SharedHandle};
+use image::ImageView;
+use sampler::Sampler;
+use std::cmp;
+use std::mem;
+use std::ptr::{self, null, null_mut, NonNull};
+use std::sync::Arc;
+
+/// descriptor set memory is made of `usize`s, so every descriptor is pointer-aligned
+type DescriptorWord = usize;
+
+const DESCRIPTOR_WORD_SIZE: usize = mem::size_of::<DescriptorWord>();
+
+/// VK_WHOLE_SIZE
+const WHOLE_SIZE: api::VkDeviceSize = !0;
+
+/// the descriptor for `VK_DESCRIPTOR_TYPE_SAMPLER`
+#[derive(Copy, Clone, Debug)]
+#[repr(C)]
+pub struct SamplerDescriptor {
+    pub sampler: *const Sampler,
+}
+
+/// the descriptor for `VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER`,
+/// `VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE`, `VK_DESCRIPTOR_TYPE_STORAGE_IMAGE` and
+/// `VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT`. `sampler` is null except for combined image samplers
+#[derive(Copy, Clone, Debug)]
+#[repr(C)]
+pub struct ImageDescriptor {
+    pub image_view: *const ImageView,
+    pub sampler: *const Sampler,
+}
+
+/// the descriptor for `VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER` and
+/// `VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER`
+#[derive(Copy, Clone, Debug)]
+#[repr(C)]
+pub struct TexelBufferDescriptor {
+    pub buffer_view: *const BufferView,
+}
+
+/// the descriptor for uniform and storage buffers.
+/// for dynamic buffers, `base` doesn't include the dynamic offset
+#[derive(Copy, Clone, Debug)]
+#[repr(C)]
+pub struct BufferDescriptor {
+    pub base: *mut u8,
+    pub size: usize,
+}
+
+#[derive(Copy, Clone, Eq, PartialEq, Debug)]
+enum DescriptorKind {
+    Sampler,
+    Image,
+    TexelBuffer,
+    Buffer,
+}
+
+unsafe fn get_pointer<T: Handle>(handle: T) -> *const T::Value {
+    handle
+        .get()
+        .map(|v| v.as_ptr() as *const _)
+        .unwrap_or(null())
+}
+
+impl DescriptorKind {
+    fn new(descriptor_type: api::VkDescriptorType) -> Self {
+        match descriptor_type {
+            api::VK_DESCRIPTOR_TYPE_SAMPLER => DescriptorKind::Sampler,
+            api::VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER
+            | api::VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE
+            | api::VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
+            | api::VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT => DescriptorKind::Image,
+            api::VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER
+            | api::VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER => DescriptorKind::TexelBuffer,
+            api::VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER
+            | api::VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+            | api::VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC
+            | api::VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC => DescriptorKind::Buffer,
+            _ => unreachable!("invalid descriptor type: {}", descriptor_type),
+        }
+    }
+    /// the size of the descriptor in descriptor set memory
+    fn get_size(self) -> usize {
+        match self {
+            DescriptorKind::Sampler => mem::size_of::<SamplerDescriptor>(),
+            DescriptorKind::Image => mem::size_of::<ImageDescriptor>(),
+            DescriptorKind::TexelBuffer => mem::size_of::<TexelBufferDescriptor>(),
+            DescriptorKind::Buffer => mem::size_of::<BufferDescriptor>(),
+        }
+    }
+    /// the size of the struct a descriptor is written from in `VkWriteDescriptorSet`
+    fn get_source_size(self) -> usize {
+        match self {
+            DescriptorKind::Sampler | DescriptorKind::Image => {
+                mem::size_of::<api::VkDescriptorImageInfo>()
+            }
+            DescriptorKind::TexelBuffer => mem::size_of::<api::VkBufferView>(),
+            DescriptorKind::Buffer => mem::size_of::<api::VkDescriptorBufferInfo>(),
+        }
+    }
+    /// `source` points to a `VkDescriptorImageInfo`, `VkBufferView` or `VkDescriptorBufferInfo`.
+    /// samplers are left alone if the binding has immutable samplers
+    unsafe fn write(
+        self,
+        descriptor_type: api::VkDescriptorType,
+        descriptor: *mut u8,
+        source: *const u8,
+        has_immutable_samplers: bool,
+    ) {
+        match self {
+            DescriptorKind::Sampler => {
+                if !has_immutable_samplers {
+                    let source = &*(source as *const api::VkDescriptorImageInfo);
+                    *(descriptor as *mut SamplerDescriptor) = SamplerDescriptor {
+                        sampler: get_pointer(source.sampler),
+                    };
+                }
+            }
+            DescriptorKind::Image => {
+                let source = &*(source as *const api::VkDescriptorImageInfo);
+                let descriptor = &mut *(descriptor as *mut ImageDescriptor);
+                descriptor.image_view = get_pointer(source.imageView);
+                if descriptor_type == api::VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER
+                    && !has_immutable_samplers
+                {
+                    descriptor.sampler = get_pointer(source.sampler);
+                }
+            }
+            DescriptorKind::TexelBuffer => {
+                *(descriptor as *mut TexelBufferDescriptor) = TexelBufferDescriptor {
+                    buffer_view: get_pointer(*(source as *const api::VkBufferView)),
+                };
+            }
+            DescriptorKind::Buffer => {
+                let source = &*(source as *const api::VkDescriptorBufferInfo);
+                let buffer = SharedHandle::from(source.buffer).unwrap();
+                let offset = source.offset as usize;
+                assert!(offset <= buffer.size);
+                let size = if source.range == WHOLE_SIZE {
+                    buffer.size - offset
+                } else {
+                    source.range as usize
+                };
+                assert!(offset + size <= buffer.size);
+                *(descriptor as *mut BufferDescriptor) = BufferDescriptor {
+                    base: buffer.get_memory().add(offset),
+                    size,
+                };
+            }
+        }
+    }
+}
+
+fn is_dynamic(descriptor_type: api::VkDescriptorType) -> bool {
+    match descriptor_type {
+        api::VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC
+        | api::VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC => true,
+        _ => false,
+    }
+}
+
+pub struct DescriptorSetLayoutBinding {
+    pub descriptor_type: api::VkDescriptorType,
+    pub descriptor_count: u32,
+    pub stage_flags: api::VkShaderStageFlags,
+    /// the byte offset of the binding's first descriptor in the set
+    pub offset: usize,
+    /// for dynamic buffers, the index of the dynamic offset for the binding's first descriptor
+    /// among the set's dynamic offsets
+    pub dynamic_offset_index: u32,
+    /// either empty or a sampler for each descriptor
+    pub immutable_samplers: Vec<SharedHandle<api::VkSampler>>,
+}
+
+impl DescriptorSetLayoutBinding {
+    pub fn get_descriptor_size(&self) -> usize {
+        DescriptorKind::new(self.descriptor_type).get_size()
+    }
+}
+
+pub struct DescriptorSetLayout {
+    /// indexed by binding number
+    bindings: Vec<Option<DescriptorSetLayoutBinding>>,
+    /// the size of a set's memory in bytes
+    pub size: usize,
+    pub dynamic_offset_count: u32,
+}
+
+// the immutable samplers are only read
+unsafe impl Send for DescriptorSetLayout {}
+
+unsafe impl Sync for DescriptorSetLayout {}
+
+/// a run of descriptors that are next to each other in a set and have the same type
+#[derive(Copy, Clone, Debug)]
+struct DescriptorRange {
+    descriptor_type: api::VkDescriptorType,
+    /// the byte offset of the first descriptor in the set
+    offset: usize,
+    descriptor_count: usize,
+    /// the index of the first descriptor among all the descriptors in the update
+    first_index: usize,
+    has_immutable_samplers: bool,
+}
+
+impl DescriptorRange {
+    unsafe fn write(&self, memory: *mut u8, source: *const u8, source_stride: usize) {
+        let kind = DescriptorKind::new(self.descriptor_type);
+        let size = kind.get_size();
+        for index in 0..self.descriptor_count {
+            kind.write(
+                self.descriptor_type,
+                memory.add(self.offset + index * size),
+                source.add(index * source_stride),
+                self.has_immutable_samplers,
+            );
+        }
+    }
+}
+
+impl DescriptorSetLayout {
+    pub unsafe fn new(bindings: &[api::VkDescriptorSetLayoutBinding]) -> Self {
+        let binding_count = bindings
+            .iter()
+            .map(|binding| binding.binding as usize + 1)
+            .max()
+            .unwrap_or(0);
+        let mut sorted_bindings: Vec<_> = bindings.iter().collect();
+        sorted_bindings.sort_by_key(|binding| binding.binding);
+        let mut retval = Self {
+            bindings: (0..binding_count).map(|_| None).collect(),
+            size: 0,
+            dynamic_offset_count: 0,
+        };
+        // bindings are laid out in order, so writes that overflow into the next binding stay
+        // contiguous
+        for binding in sorted_bindings {
+            let descriptor_size = DescriptorKind::new(binding.descriptorType).get_size();
+            let immutable_samplers = match binding.descriptorType {
+                api::VK_DESCRIPTOR_TYPE_SAMPLER
+                | api::VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER
+                    if !binding.pImmutableSamplers.is_null() =>
+                {
+                    (0..binding.descriptorCount as usize)
+                        .map(|index| {
+                            SharedHandle::from(*binding.pImmutableSamplers.add(index)).unwrap()
+                        })
+                        .collect()
+                }
+                _ => Vec::new(),
+            };
+            let slot = &mut retval.bindings[binding.binding as usize];
+            assert!(slot.is_none(), "duplicate binding: {}", binding.binding);
+            *slot = Some(DescriptorSetLayoutBinding {
+                descriptor_type: binding.descriptorType,
+                descriptor_count: binding.descriptorCount,
+                stage_flags: binding.stageFlags,
+                offset: retval.size,
+                dynamic_offset_index: retval.dynamic_offset_count,
+                immutable_samplers,
+            });
+            retval.size += descriptor_size * binding.descriptorCount as usize;
+            if is_dynamic(binding.descriptorType) {
+                retval.dynamic_offset_count += binding.descriptorCount;
+            }
+        }
+        retval
+    }
+    /// one more than the largest binding number
+    pub fn get_binding_count(&self) -> u32 {
+        self.bindings.len() as u32
+    }
+    pub fn get_binding(&self, binding: u32) -> Option<&DescriptorSetLayoutBinding> {
+        self.bindings.get(binding as usize)?.as_ref()
+    }
+    /// the byte offset of a descriptor in the set's memory
+    pub fn get_descriptor_offset(&self, binding: u32, array_element: u32) -> usize {
+        let binding = self.get_binding(binding).expect("invalid binding");
+        assert!(array_element < binding.descriptor_count);
+        binding.offset + binding.get_descriptor_size() * array_element as usize
+    }
+    fn get_word_count(&self) -> usize {
+        self.size / DESCRIPTOR_WORD_SIZE
+    }
+    /// split `descriptor_count` descriptors, starting at `array_element` of `binding`, by the
+    /// bindings they're in. descriptors past the end of a binding continue with the next one
+    fn get_ranges(
+        &self,
+        binding: u32,
+        array_element: u32,
+        descriptor_count: u32,
+    ) -> DescriptorRanges {
+        DescriptorRanges {
+            layout: self,
+            binding,
+            array_element,
+            descriptor_count: descriptor_count as usize,
+            first_index: 0,
+            pending: None,
+        }
+    }
+    /// `memory` is zeroed, then the immutable samplers are written
+    unsafe fn initialize(&self, memory: *mut u8) {
+        ptr::write_bytes(memory, 0, self.size);
+        for binding in self.bindings.iter().filter_map(Option::as_ref) {
+            for (index, sampler) in binding.immutable_samplers.iter().enumerate() {
+                let sampler = &**sampler as *const Sampler;
+                let descriptor = memory.add(binding.offset + index * binding.get_descriptor_size());
+                if binding.descriptor_type == api::VK_DESCRIPTOR_TYPE_SAMPLER {
+                    *(descriptor as *mut SamplerDescriptor) = SamplerDescriptor { sampler };
+                } else {
+                    (*(descriptor as *mut ImageDescriptor)).sampler = sampler;
+                }
+            }
+        }
+    }
+}
+
+/// the ranges of `DescriptorSetLayout::get_ranges`, with adjacent bindings of the same type
+/// merged
+struct DescriptorRanges<'a> {
+    layout: &'a DescriptorSetLayout,
+    binding: u32,
+    array_element: u32,
+    descriptor_count: usize,
+    first_index: usize,
+    /// the range read past the end of the last merged range
+    pending: Option<DescriptorRange>,
+}
+
+impl<'a> DescriptorRanges<'a> {
+    /// the range in the next binding, without merging
+    fn next_binding_range(&mut self) -> Option<DescriptorRange> {
+        while self.first_index < self.descriptor_count {
+            let layout_binding = self
+                .layout
+                .bindings
+                .get(self.binding as usize)
+                .expect("descriptor update past the last binding");
+            self.binding += 1;
+            let layout_binding = match layout_binding {
+                Some(layout_binding) => layout_binding,
+                None => continue,
+            };
+            if self.array_element >= layout_binding.descriptor_count {
+                self.array_element -= layout_binding.descriptor_count;
+                continue;
+            }
+            let count = cmp::min(
+                (layout_binding.descriptor_count - self.array_element) as usize,
+                self.descriptor_count - self.first_index,
+            );
+            let range = DescriptorRange {
+                descriptor_type: layout_binding.descriptor_type,
+                offset: layout_binding.offset
+                    + layout_binding.get_descriptor_size() * self.array_element as usize,
+                descriptor_count: count,
+                first_index: self.first_index,
+                has_immutable_samplers: !layout_binding.immutable_samplers.is_empty(),
+            };
+            self.first_index += count;
+            self.array_element = 0;
+            return Some(range);
+        }
+        None
+    }
+}
+
+impl<'a> Iterator for DescriptorRanges<'a> {
+    type Item = DescriptorRange;
+    fn next(&mut self) -> Option<DescriptorRange> {
+        let mut range = self.pending.take().or_else(|| self.next_binding_range())?;
+        let descriptor_size = DescriptorKind::new(range.descriptor_type).get_size();
+        while let Some(next) = self.next_binding_range() {
+            if next.descriptor_type == range.descriptor_type
+                && next.has_immutable_samplers == range.has_immutable_samplers
+                && range.offset + range.descriptor_count * descriptor_size == next.offset
+            {
+                range.descriptor_count += next.descriptor_count;
+            } else {
+                self.pending = Some(next);
+                break;
+            }
+        }
+        Some(range)
+    }
+}
+
+pub struct DescriptorSet {
+    /// `None` if this entry in the pool is free
+    layout: Option<Arc<DescriptorSetLayout>>,
+    memory: *mut u8,
+    /// the index of `memory` in the pool's arena
+    arena_offset: usize,
+}
+
+impl DescriptorSet {
+    pub fn layout(&self) -> &DescriptorSetLayout {
+        self.layout.as_ref().expect("descriptor set was freed")
+    }
+    /// the base pointer for `DescriptorSetLayout::get_descriptor_offset`
+    pub fn get_memory(&self) -> *mut u8 {
+        self.memory
+    }
+    pub unsafe fn write(&self, write: &api::VkWriteDescriptorSet) {
+        let kind = DescriptorKind::new(write.descriptorType);
+        let source = match kind {
+            DescriptorKind::Sampler | DescriptorKind::Image => write.pImageInfo as *const u8,
+            DescriptorKind::TexelBuffer => write.pTexelBufferView as *const u8,
+            DescriptorKind::Buffer => write.pBufferInfo as *const u8,
+        };
+        let source_stride = kind.get_source_size();
+        for range in self.layout().get_ranges(
+            write.dstBinding,
+            write.dstArrayElement,
+            write.descriptorCount,
+        ) {
+            assert_eq!(range.descriptor_type, write.descriptorType);
+            range.write(
+                self.memory,
+                source.add(range.first_index * source_stride),
+                source_stride,
+            );
+        }
+    }
+    /// `self` is the destination set
+    pub unsafe fn copy(&self, src_set: &DescriptorSet, copy: &api::VkCopyDescriptorSet) {
+        let mut src_ranges = src_set
+            .layout()
+            .get_ranges(copy.srcBinding, copy.srcArrayElement, copy.descriptorCount)
+            .peekable();
+        let mut dst_ranges = self
+            .layout()
+            .get_ranges(copy.dstBinding, copy.dstArrayElement, copy.descriptorCount)
+            .peekable();
+        let mut index = 0;
+        while index < copy.descriptorCount as usize {
+            let src_range = *src_ranges.peek().unwrap();
+            let dst_range = *dst_ranges.peek().unwrap();
+            assert_eq!(src_range.descriptor_type, dst_range.descriptor_type);
+            let src_end = src_range.first_index + src_range.descriptor_count;
+            let dst_end = dst_range.first_index + dst_range.descriptor_count;
+            let count = cmp::min(src_end, dst_end) - index;
+            let descriptor_size = DescriptorKind::new(dst_range.descriptor_type).get_size();
+            let src = src_set
+                .memory
+                .add(src_range.offset + (index - src_range.first_index) * descriptor_size);
+            let dst = self
+                .memory
+                .add(dst_range.offset + (index - dst_range.first_index) * descriptor_size);
+            if !dst_range.has_immutable_samplers {
+                ptr::copy_nonoverlapping(src, dst, count * descriptor_size);
+            } else if dst_range.descriptor_type == api::VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER {
+                let src = src as *const ImageDescriptor;
+                let dst = dst as *mut ImageDescriptor;
+                for i in 0..count {
+                    (*dst.add(i)).image_view = (*src.add(i)).image_view;
+                }
+            }
+            index += count;
+            if index == src_end {
+                src_ranges.next();
+            }
+            if index == dst_end {
+                dst_ranges.next();
+            }
+        }
+    }
+}
+
+struct DescriptorUpdateTemplateEntry {
+    range: DescriptorRange,
+    /// the byte offset of the range's first source struct in the update data
+    source_offset: usize,
+    source_stride: usize,
+}
+
+pub struct DescriptorUpdateTemplate {
+    entries: Vec<DescriptorUpdateTemplateEntry>,
+}
+
+impl DescriptorUpdateTemplate {
+    pub fn new(
+        layout: &DescriptorSetLayout,
+        entries: &[api::VkDescriptorUpdateTemplateEntry],
+    ) -> Self {
+        let mut template_entries = Vec::new();
+        for entry in entries {
+            for range in layout.get_ranges(
+                entry.dstBinding,
+                entry.dstArrayElement,
+                entry.descriptorCount,
+            ) {
+                assert_eq!(range.descriptor_type, entry.descriptorType);
+                template_entries.push(DescriptorUpdateTemplateEntry {
+                    range,
+                    source_offset: entry.offset + range.first_index * entry.stride,
+                    source_stride: entry.stride,
+                });
+            }
+        }
+        Self {
+            entries: template_entries,
+        }
+    }
+    /// `descriptor_set` must have the layout the template was created with
+    pub unsafe fn update(&self, descriptor_set: &DescriptorSet, data: *const u8) {
+        for entry in &self.entries {
+            entry.range.write(
+                descriptor_set.memory,
+                data.add(entry.source_offset),
+                entry.source_stride,
+            );
+        }
+    }
+}
+
+pub struct DescriptorPool {
+    /// allocated when the pool is created and never resized, so sets don't move
+    arena: Vec<DescriptorWord>,
+    /// the free ranges of `arena`, sorted and never touching
+    free_ranges: Vec<(usize, usize)>,
+    /// the `VkDescriptorSet` handles point to these. never resized
+    sets: Vec<DescriptorSet>,
+    free_sets: Vec<usize>,
+}
+
+impl DescriptorPool {
+    pub fn new(max_sets: u32, pool_sizes: &[api::VkDescriptorPoolSize]) -> Self {
+        let size: usize = pool_sizes
+            .iter()
+            .map(|pool_size| {
+                DescriptorKind::new(pool_size.type_).get_size() * pool_size.descriptorCount as usize
+            })
+            .sum();
+        let mut retval = Self {
+            arena: vec![0; size / DESCRIPTOR_WORD_SIZE],
+            free_ranges: Vec::new(),
+            sets: (0..max_sets)
+                .map(|_| DescriptorSet {
+                    layout: None,
+                    memory: null_mut(),
+                    arena_offset: 0,
+                })
+                .collect(),
+            free_sets: Vec::new(),
+        };
+        retval.reset();
+        retval
+    }
+    fn allocate_memory(&mut self, word_count: usize) -> Result<usize, api::VkResult> {
+        if word_count == 0 {
+            return Ok(0);
+        }
+        // first fit
+        match self
+            .free_ranges
+            .iter()
+            .position(|&(start, end)| end - start >= word_count)
+        {
+            Some(index) => {
+                let (start, end) = self.free_ranges[index];
+                if end - start == word_count {
+                    self.free_ranges.remove(index);
+                } else {
+                    self.free_ranges[index].0 += word_count;
+                }
+                Ok(start)
+            }
+            None => {
+                let free_word_count: usize = self
+                    .free_ranges
+                    .iter()
+                    .map(|&(start, end)| end - start)
+                    .sum();
+                if free_word_count >= word_count {
+                    Err(api::VK_ERROR_FRAGMENTED_POOL)
+                } else {
+                    Err(api::VK_ERROR_OUT_OF_POOL_MEMORY)
+                }
+            }
+        }
+    }
+    fn free_memory(&mut self, start: usize, word_count: usize) {
+        if word_count == 0 {
+            return;
+        }
+        let end = start + word_count;
+        let index = self
+            .free_ranges
+            .iter()
+            .position(|&(free_start, _)| free_start > start)
+            .unwrap_or(self.free_ranges.len());
+        let merge_previous = index > 0 && self.free_ranges[index - 1].1 == start;
+        let merge_next = index < self.free_ranges.len() && self.free_ranges[index].0 == end;
+        match (merge_previous, merge_next) {
+            (true, true) => {
+                self.free_ranges[index - 1].1 = self.free_ranges[index].1;
+                self.free_ranges.remove(index);
+            }
+            (true, false) => self.free_ranges[index - 1].1 = end,
+            (false, true) => self.free_ranges[index].0 = start,
+            (false, false) => self.free_ranges.insert(index, (start, end)),
+        }
+    }
+    pub unsafe fn allocate(
+        &mut self,
+        layout: Arc<DescriptorSetLayout>,
+    ) -> Result<api::VkDescriptorSet, api::VkResult> {
+        let set_index = *self
+            .free_sets
+            .last()
+            .ok_or(api::VK_ERROR_OUT_OF_POOL_MEMORY)?;
+        let arena_offset = self.allocate_memory(layout.get_word_count())?;
+        self.free_sets.pop();
+        let memory = self.arena.as_mut_ptr().add(arena_offset) as *mut u8;
+        layout.initialize(memory);
+        let set = &mut self.sets[set_index];
+        *set = DescriptorSet {
+            layout: Some(layout),
+            memory,
+            arena_offset,
+        };
+        Ok(api::VkDescriptorSet::new(Some(NonNull::from(set))))
+    }
+    pub unsafe fn free(&mut self, descriptor_set: api::VkDescriptorSet) {
+        let set = match descriptor_set.get() {
+            Some(set) => set.as_ptr(),
+            None => return,
+        };
+        let set_index = (set as usize).wrapping_sub(self.sets.as_ptr() as usize)
+            / mem::size_of::<DescriptorSet>();
+        assert!(
+            set_index < self.sets.len(),
+            "descriptor set not allocated from this descriptor pool"
+        );
+        let layout = self.sets[set_index]
+            .layout
+            .take()
+            .expect("descriptor set already freed");
+        let arena_offset = self.sets[set_index].arena_offset;
+        self.free_memory(arena_offset, layout.get_word_count());
+        self.free_sets.push(set_index);
+    }
+    pub fn reset(&mut self) {
+        for set in &mut self.sets {
+            set.layout = None;
+        }
+        self.free_sets = (0..self.sets.len()).rev().collect();
+        self.free_ranges.clear();
+        if !self.arena.is_empty() {
+            self.free_ranges.push((0, self.arena.len()));
+        }
+    }
+}
+
+pub struct PipelineLayout {
+    pub set_layouts: Vec<Arc<DescriptorSetLayout>>,
+    /// the index of each set's first dynamic offset among the dynamic offsets of all the sets
+    pub dynamic_offset_starts: Vec<u32>,
+    pub push_constant_ranges: Vec<api::VkPushConstantRange>,
+}
+
+impl PipelineLayout {
+    pub fn new(
+        set_layouts: Vec<Arc<DescriptorSetLayout>>,
+        push_constant_ranges: Vec<api::VkPushConstantRange>,
+    ) -> Self {
+        let mut dynamic_offset_count = 0;
+        let dynamic_offset_starts = set_layouts
+            .iter()
+            .map(|set_layout| {
+                let start = dynamic_offset_count;
+                dynamic_offset_count += set_layout.dynamic_offset_count;
+                start
+            })
+            .collect();
+        Self {
+            set_layouts,
+            dynamic_offset_starts,
+            push_constant_ranges,
+        }
+    }
+}
+
+/// the descriptor sets bound to a pipeline bind point while a command buffer executes
+#[derive(Default)]
+pub struct BoundDescriptorSets {
+    /// the memory of the bound sets, indexed by set number
+    pub sets: Vec<*const u8>,
+    /// indexed like `PipelineLayout::dynamic_offset_starts`
+    pub dynamic_offsets: Vec<u32>,
+}
+
+impl BoundDescriptorSets {
+    pub unsafe fn bind(
+        &mut self,
+        first_set: u32,
+        first_dynamic_offset: u32,
+        descriptor_sets: &[api::VkDescriptorSet],
+        dynamic_offsets: &[u32],
+    ) {
+        let first_set = first_set as usize;
+        let set_end = first_set + descriptor_sets.len();
+        if self.sets.len() < set_end {
+            self.sets.resize(set_end, null());
+        }
+        for (bound_set, &descriptor_set) in self.sets[first_set..].iter_mut().zip(descriptor_sets) {
+            *bound_set = SharedHandle::from(descriptor_set).unwrap().get_memory();
+        }
+        let first_dynamic_offset = first_dynamic_offset as usize;
+        let dynamic_offset_end = first_dynamic_offset + dynamic_offsets.len();
+        if self.dynamic_offsets.len() < dynamic_offset_end {
+            self.dynamic_offsets.resize(dynamic_offset_end, 0);
+        }
+        self.dynamic_offsets[first_dynamic_offset..dynamic_offset_end]
+            .copy_from_slice(dynamic_offsets);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn make_binding(
+        binding: u32,
+        descriptor_type: api::VkDescriptorType,
+        descriptor_count: u32,
+    ) -> api::VkDescriptorSetLayoutBinding {
+        api::VkDescriptorSetLayoutBinding {
+            binding,
+            descriptorType: descriptor_type,
+            descriptorCount: descriptor_count,
+            stageFlags: api::VK_SHADER_STAGE_ALL,
+            pImmutableSamplers: null(),
+        }
+    }
+
+    #[test]
+    fn test_descriptor_set_layout() {
+        let image_size = mem::size_of::<ImageDescriptor>();
+        let buffer_size = mem::size_of::<BufferDescriptor>();
+        let layout = unsafe {
+            DescriptorSetLayout::new(&[
+                make_binding(2, api::VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 2),
+                make_binding(0, api::VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 3),
+                make_binding(3, api::VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1),
+            ])
+        };
+        assert_eq!(layout.get_binding_count(), 4);
+        assert!(layout.get_binding(1).is_none());
+        assert_eq!(layout.get_descriptor_offset(0, 1), image_size);
+        assert_eq!(layout.get_descriptor_offset(2, 0), 3 * image_size);
+        assert_eq!(
+            layout.get_descriptor_offset(3, 0),
+            3 * image_size + 2 * buffer_size
+        );
+        assert_eq!(layout.size, 3 * image_size + 3 * buffer_size);
+        assert_eq!(layout.dynamic_offset_count, 3);
+        assert_eq!(layout.get_binding(3).unwrap().dynamic_offset_index, 2);
+        // descriptors past the end of binding 2 continue in binding 3
+        let ranges: Vec<_> = layout.get_ranges(2, 1, 2).collect();
+        assert_eq!(ranges.len(), 1);
+        assert_eq!(ranges[0].offset, 3 * image_size + buffer_size);
+        assert_eq!(ranges[0].descriptor_count, 2);
+        let ranges: Vec<_> = layout.get_ranges(0, 2, 2).collect();
+        assert_eq!(ranges.len(), 2);
+        assert_eq!(ranges[1].first_index, 1);
+        assert_eq!(ranges[1].offset, 3 * image_size);
+    }
+
+    #[test]
+    fn test_descriptor_pool() {
+        unsafe {
+            let small_layout = Arc::new(DescriptorSetLayout::new(&[make_binding(
+                0,
+                api::VK_DESCRIPTOR_TYPE_SAMPLER,
+                1,
+            )]));
+            let big_layout = Arc::new(DescriptorSetLayout::new(&[make_binding(
+                0,
+                api::VK_DESCRIPTOR_TYPE_SAMPLER,
+                2,
+            )]));
+            let mut pool = DescriptorPool::new(
+                5,
+                &[api::VkDescriptorPoolSize {
+                    type_: api::VK_DESCRIPTOR_TYPE_SAMPLER,
+                    descriptorCount: 4,
+                }],
+            );
+            let sets: Vec<_> = (0..4)
+                .map(|_| pool.allocate(small_layout.clone()).unwrap())
+                .collect();
+            assert_eq!(
+                pool.allocate(small_layout.clone()),
+                Err(api::VK_ERROR_OUT_OF_POOL_MEMORY)
+            );
+            let first_set_memory = SharedHandle::from(sets[0]).unwrap().get_memory();
+            pool.free(sets[0]);
+            pool.free(sets[2]);
+            assert_eq!(
+                pool.allocate(big_layout.clone()),
+                Err(api::VK_ERROR_FRAGMENTED_POOL)
+            );
+            pool.free(sets[1]);
+            let set = pool.allocate(big_layout.clone()).unwrap();
+            assert_eq!(
+                SharedHandle::from(set).unwrap().get_memory(),
+                first_set_memory
+            );
+            pool.reset();
+            let sets: Vec<_> = (0..2)
+                .map(|_| pool.allocate(big_layout.clone()).unwrap())
+                .collect();
+            assert_eq!(
+                pool.allocate(small_layout.clone()),
+                Err(api::VK_ERROR_OUT_OF_POOL_MEMORY)
+            );
+            assert_eq!(
+                SharedHandle::from(sets[1]).unwrap().layout().size,
+                big_layout.size
+            );
+        }
+    }
+}
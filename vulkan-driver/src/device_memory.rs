@@ -2,10 +2,16 @@
 // Copyright 2018 Jacob Lifshay
 use api;
 use enum_map::EnumMap;
+#[cfg(unix)]
+use libc;
 use std::alloc;
+use std::collections::BTreeSet;
 use std::fmt::{self, Debug, Display};
 use std::ops::{Deref, DerefMut};
-use std::ptr::NonNull;
+#[cfg(unix)]
+use std::ptr::null_mut;
+use std::ptr::{self, NonNull};
+use std::sync::{Arc, Mutex};
 
 #[derive(Copy, Clone, Eq, PartialEq, Hash, Debug, Enum)]
 #[repr(u32)]
@@ -240,10 +246,266 @@ impl Drop for DefaultDeviceMemoryAllocation {
     }
 }
 
+const POOL_MIN_BLOCK_SIZE_LOG2: u32 = 12;
+
+const POOL_ARENA_SIZE_LOG2: u32 = 26;
+
+const POOL_ARENA_SIZE: usize = 1 << POOL_ARENA_SIZE_LOG2;
+
+const POOL_ORDER_COUNT: usize = (POOL_ARENA_SIZE_LOG2 - POOL_MIN_BLOCK_SIZE_LOG2 + 1) as usize;
+
+/// the transparent huge page size on x86_64 and aarch64
+const POOL_ARENA_ALIGNMENT: usize = 1 << 21;
+
+fn get_pool_block_size(order: usize) -> usize {
+    1 << (order as u32 + POOL_MIN_BLOCK_SIZE_LOG2)
+}
+
+#[derive(Debug)]
+struct PoolArena {
+    memory: NonNull<u8>,
+}
+
+unsafe impl Send for PoolArena {}
+
+impl PoolArena {
+    #[cfg(unix)]
+    fn new(prefault: bool) -> Option<Self> {
+        unsafe {
+            // map extra so the arena can be aligned by unmapping the ends.
+            // not `MAP_POPULATE`, since that would fault in small pages before `MADV_HUGEPAGE`
+            let mapped_size = POOL_ARENA_SIZE + POOL_ARENA_ALIGNMENT;
+            let mapped = libc::mmap(
+                null_mut(),
+                mapped_size,
+                libc::PROT_READ | libc::PROT_WRITE,
+                libc::MAP_PRIVATE | libc::MAP_ANONYMOUS,
+                -1,
+                0,
+            );
+            if mapped == libc::MAP_FAILED {
+                return None;
+            }
+            let head_size = (POOL_ARENA_ALIGNMENT - mapped as usize % POOL_ARENA_ALIGNMENT)
+                % POOL_ARENA_ALIGNMENT;
+            let memory = (mapped as *mut u8).add(head_size) as *mut libc::c_void;
+            if head_size != 0 {
+                libc::munmap(mapped, head_size);
+            }
+            let tail_size = mapped_size - head_size - POOL_ARENA_SIZE;
+            if tail_size != 0 {
+                libc::munmap(
+                    (memory as *mut u8).add(POOL_ARENA_SIZE) as *mut libc::c_void,
+                    tail_size,
+                );
+            }
+            // only a hint, so ignore failures
+            #[cfg(target_os = "linux")]
+            libc::madvise(memory, POOL_ARENA_SIZE, libc::MADV_HUGEPAGE);
+            let memory = NonNull::new(memory as *mut u8)?;
+            if prefault {
+                Self::prefault(memory);
+            }
+            Some(PoolArena { memory })
+        }
+    }
+    /// fault in the arena after it's advised, so it gets huge pages where possible
+    #[cfg(unix)]
+    unsafe fn prefault(memory: NonNull<u8>) {
+        #[cfg(target_os = "linux")]
+        {
+            /// `MADV_POPULATE_WRITE`, which `libc` doesn't have yet; added in Linux 5.14
+            const MADV_POPULATE_WRITE: libc::c_int = 23;
+            if libc::madvise(
+                memory.as_ptr() as *mut libc::c_void,
+                POOL_ARENA_SIZE,
+                MADV_POPULATE_WRITE,
+            ) == 0
+            {
+                return;
+            }
+        }
+        // older kernels: write to every page, which is already zero
+        for offset in (0..POOL_ARENA_SIZE).step_by(4096) {
+            ptr::write_volatile(memory.as_ptr().add(offset), 0);
+        }
+    }
+    #[cfg(not(unix))]
+    fn new(prefault: bool) -> Option<Self> {
+        unsafe {
+            let memory = NonNull::new(alloc::alloc(Self::layout()))?;
+            if prefault {
+                for offset in (0..POOL_ARENA_SIZE).step_by(4096) {
+                    ptr::write_volatile(memory.as_ptr().add(offset), 0);
+                }
+            }
+            Some(PoolArena { memory })
+        }
+    }
+    #[cfg(not(unix))]
+    fn layout() -> alloc::Layout {
+        alloc::Layout::from_size_align(POOL_ARENA_SIZE, POOL_ARENA_ALIGNMENT).unwrap()
+    }
+}
+
+impl Drop for PoolArena {
+    fn drop(&mut self) {
+        unsafe {
+            #[cfg(unix)]
+            libc::munmap(self.memory.as_ptr() as *mut libc::c_void, POOL_ARENA_SIZE);
+            #[cfg(not(unix))]
+            alloc::dealloc(self.memory.as_ptr(), Self::layout());
+        }
+    }
+}
+
+#[derive(Debug)]
+struct PoolState {
+    arenas: Vec<Option<PoolArena>>,
+    /// the free blocks of each size as (arena index, offset in arena).
+    /// ordered so allocations are packed towards the start of the oldest arenas
+    free_blocks: Vec<BTreeSet<(usize, usize)>>,
+}
+
+/// a buddy allocator for device memory, so allocating and freeing memory doesn't have to map,
+/// unmap, and page fault memory every time.
+/// keeps one completely free arena around so memory that is freed and reallocated every frame stays mapped
+#[derive(Debug)]
+pub struct DeviceMemoryPool {
+    state: Mutex<PoolState>,
+    prefault: bool,
+}
+
+impl DeviceMemoryPool {
+    /// if `prefault` is true, then memory is faulted in when an arena is created
+    /// instead of the first time it's written to
+    pub fn new(prefault: bool) -> Self {
+        DeviceMemoryPool {
+            state: Mutex::new(PoolState {
+                arenas: Vec::new(),
+                free_blocks: (0..POOL_ORDER_COUNT).map(|_| BTreeSet::new()).collect(),
+            }),
+            prefault,
+        }
+    }
+    /// returns `None` if `layout` is too big for the pool or creating a new arena failed
+    pub fn allocate(
+        self: &Arc<Self>,
+        layout: DeviceMemoryLayout,
+    ) -> Option<DeviceMemoryPoolAllocation> {
+        let size = layout
+            .size
+            .max(layout.alignment)
+            .checked_next_power_of_two()?;
+        if size > POOL_ARENA_SIZE || layout.alignment > POOL_ARENA_ALIGNMENT {
+            return None;
+        }
+        let order = size
+            .trailing_zeros()
+            .saturating_sub(POOL_MIN_BLOCK_SIZE_LOG2) as usize;
+        let mut state = self.state.lock().unwrap();
+        let (mut block_order, (arena_index, offset)) = match (order..POOL_ORDER_COUNT)
+            .filter_map(|order| Some((order, *state.free_blocks[order].iter().next()?)))
+            .next()
+        {
+            Some((block_order, block)) => {
+                state.free_blocks[block_order].remove(&block);
+                (block_order, block)
+            }
+            None => {
+                let arena = Some(PoolArena::new(self.prefault)?);
+                let arena_index = match state.arenas.iter().position(Option::is_none) {
+                    Some(arena_index) => {
+                        state.arenas[arena_index] = arena;
+                        arena_index
+                    }
+                    None => {
+                        state.arenas.push(arena);
+                        state.arenas.len() - 1
+                    }
+                };
+                (POOL_ORDER_COUNT - 1, (arena_index, 0))
+            }
+        };
+        // split the block, freeing the upper halves
+        while block_order > order {
+            block_order -= 1;
+            state.free_blocks[block_order]
+                .insert((arena_index, offset + get_pool_block_size(block_order)));
+        }
+        let memory = unsafe {
+            NonNull::new_unchecked(
+                state.arenas[arena_index]
+                    .as_ref()
+                    .unwrap()
+                    .memory
+                    .as_ptr()
+                    .add(offset),
+            )
+        };
+        Some(DeviceMemoryPoolAllocation {
+            pool: self.clone(),
+            memory,
+            arena_index,
+            offset,
+            order,
+            layout,
+        })
+    }
+    fn free(&self, arena_index: usize, mut offset: usize, mut order: usize) {
+        let mut state = self.state.lock().unwrap();
+        // merge with free buddies
+        while order < POOL_ORDER_COUNT - 1 {
+            let buddy_offset = offset ^ get_pool_block_size(order);
+            if !state.free_blocks[order].remove(&(arena_index, buddy_offset)) {
+                break;
+            }
+            offset = offset.min(buddy_offset);
+            order += 1;
+        }
+        if order == POOL_ORDER_COUNT - 1 && !state.free_blocks[order].is_empty() {
+            // there's already a spare arena
+            state.arenas[arena_index] = None;
+        } else {
+            state.free_blocks[order].insert((arena_index, offset));
+        }
+    }
+}
+
+#[derive(Debug)]
+pub struct DeviceMemoryPoolAllocation {
+    pool: Arc<DeviceMemoryPool>,
+    memory: NonNull<u8>,
+    arena_index: usize,
+    offset: usize,
+    order: usize,
+    layout: DeviceMemoryLayout,
+}
+
+unsafe impl Send for DeviceMemoryPoolAllocation {}
+
+unsafe impl Sync for DeviceMemoryPoolAllocation {}
+
+impl DeviceMemoryAllocation for DeviceMemoryPoolAllocation {
+    unsafe fn get(&self) -> NonNull<u8> {
+        self.memory
+    }
+    fn layout(&self) -> DeviceMemoryLayout {
+        self.layout
+    }
+}
+
+impl Drop for DeviceMemoryPoolAllocation {
+    fn drop(&mut self) {
+        self.pool.free(self.arena_index, self.offset, self.order);
+    }
+}
+
 #[derive(Debug)]
 pub enum DeviceMemory {
     Default(DefaultDeviceMemoryAllocation),
-    #[allow(dead_code)]
+    /// stored inline, so allocating from the pool doesn't allocate on the heap too
+    Pool(DeviceMemoryPoolAllocation),
     Special(Box<dyn DeviceMemoryAllocation>),
 }
 
@@ -255,19 +517,60 @@ impl DeviceMemory {
             layout,
         )?))
     }
+    /// allocations that don't fit in `pool` are allocated from the default heap
+    pub fn allocate_from_pool(
+        pool: &Arc<DeviceMemoryPool>,
+        layout: DeviceMemoryLayout,
+    ) -> Result<Self, DefaultDeviceMemoryAllocationFailure> {
+        match pool.allocate(layout) {
+            Some(allocation) => Ok(DeviceMemory::Pool(allocation)),
+            None => Self::allocate_from_default_heap(layout),
+        }
+    }
 }
 
 impl DeviceMemoryAllocation for DeviceMemory {
     unsafe fn get(&self) -> NonNull<u8> {
         match self {
             DeviceMemory::Default(memory) => memory.get(),
+            DeviceMemory::Pool(memory) => memory.get(),
             DeviceMemory::Special(memory) => memory.as_ref().get(),
         }
     }
     fn layout(&self) -> DeviceMemoryLayout {
         match self {
             DeviceMemory::Default(memory) => memory.layout(),
+            DeviceMemory::Pool(memory) => memory.layout(),
             DeviceMemory::Special(memory) => memory.as_ref().layout(),
         }
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_pool() {
+        let pool = Arc::new(DeviceMemoryPool::new(false));
+        let layout = DeviceMemoryLayout::calculate(5000, 128);
+        let allocations: Vec<_> = (0..100).map(|_| pool.allocate(layout).unwrap()).collect();
+        let mut addresses: Vec<_> = allocations
+            .iter()
+            .map(|allocation| unsafe { allocation.get().as_ptr() as usize })
+            .collect();
+        addresses.sort();
+        for pair in addresses.windows(2) {
+            assert!(pair[1] - pair[0] >= 8192);
+        }
+        drop(allocations);
+        {
+            let state = pool.state.lock().unwrap();
+            assert_eq!(state.arenas.iter().filter(|v| v.is_some()).count(), 1);
+            assert_eq!(state.free_blocks[POOL_ORDER_COUNT - 1].len(), 1);
+        }
+        assert!(pool
+            .allocate(DeviceMemoryLayout::calculate(POOL_ARENA_SIZE + 1, 128))
+            .is_none());
+    }
+}
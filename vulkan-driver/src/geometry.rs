@@ -0,0 +1,1037 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright 2018 Jacob Lifshay
+
+// Geometry front-end:
+//
+// Draws are split into batches of up to `VERTEX_BATCH_SIZE` distinct vertices, and every batch
+// runs the vertex shader once, a SIMD group of vertices at a time.
+// The vertex inputs of a batch are fetched an attribute at a time into one lane array per
+// component, so the shader loads them with vector loads. Each attribute's decoder is picked when
+// the pipeline is created, and attributes made of 32-bit values are only copied.
+// Batches are also the post-transform vertex cache: a vertex used by several triangles of the
+// same batch is fetched and shaded once, which is most of them for indexed meshes, where each
+// vertex is shared by about 6 triangles.
+// Shaded triangles are clipped to the view volume in clip space, then go through the viewport
+// transform to the rasterizer.
+
+use api;
+use descriptor::BoundDescriptorSets;
+use handle::SharedHandle;
+use pipeline::{Pipeline, PipelineState, VertexInputState};
+use query::PipelineStatistics;
+use rasterizer::{Triangle, Vertex};
+use std::ptr::{self, null};
+use transfer::TexelFormat;
+
+/// the most vertices shaded together
+pub const VERTEX_BATCH_SIZE: usize = 64;
+
+/// the values of one shader input location for each vertex in a batch, indexed by component,
+/// then by the vertex's index in the batch
+pub type VertexBatchValues = [[u32; VERTEX_BATCH_SIZE]; 4];
+
+/// the clip-space positions written by the vertex shader, laid out like `VertexBatchValues`
+pub type VertexBatchPositions = [[f32; VERTEX_BATCH_SIZE]; 4];
+
+// the argument of `VertexShaderEntryPoint`, shading the first `vertex_count` vertices of a batch.
+// `vertex_indices` has each vertex's `VertexIndex`, `inputs` has a `VertexBatchValues` for each
+// input location, and the shader writes its `Position` output to the `VertexBatchPositions` at
+// `positions`. `descriptor_sets` is like in `WorkgroupContext`
+buildable_struct!{
+    #[derive(Copy)]
+    #[derive(Clone)]
+    pub struct VertexShaderBatch {
+        vertex_count: u32,
+        instance_index: u32,
+        vertex_indices: *const u32,
+        inputs: *const u32,
+        positions: *mut f32,
+        descriptor_sets: *const *const u8,
+        dynamic_offsets: *const u32,
+    }
+}
+
+/// the type of the generated vertex shader entry points
+pub type VertexShaderEntryPoint = unsafe extern "C" fn(*const VertexShaderBatch);
+
+#[derive(Default)]
+pub struct BoundVertexBuffers {
+    /// the memory at the bound offset of each binding
+    pub buffers: Vec<*const u8>,
+}
+
+impl BoundVertexBuffers {
+    pub unsafe fn bind(
+        &mut self,
+        first_binding: u32,
+        buffers: &[api::VkBuffer],
+        offsets: &[api::VkDeviceSize],
+    ) {
+        let first_binding = first_binding as usize;
+        let binding_end = first_binding + buffers.len();
+        if self.buffers.len() < binding_end {
+            self.buffers.resize(binding_end, null());
+        }
+        for ((bound_buffer, &buffer), &offset) in self.buffers[first_binding..]
+            .iter_mut()
+            .zip(buffers)
+            .zip(offsets)
+        {
+            *bound_buffer = SharedHandle::from(buffer)
+                .unwrap()
+                .get_memory()
+                .add(offset as usize);
+        }
+    }
+}
+
+#[derive(Copy, Clone)]
+pub struct BoundIndexBuffer {
+    memory: *const u8,
+    index_type: api::VkIndexType,
+}
+
+impl BoundIndexBuffer {
+    pub unsafe fn new(
+        buffer: api::VkBuffer,
+        offset: api::VkDeviceSize,
+        index_type: api::VkIndexType,
+    ) -> Self {
+        Self {
+            memory: SharedHandle::from(buffer)
+                .unwrap()
+                .get_memory()
+                .add(offset as usize),
+            index_type,
+        }
+    }
+    /// the index that restarts strips and fans when primitive restart is enabled
+    fn get_restart_index(self) -> u32 {
+        match self.index_type {
+            api::VK_INDEX_TYPE_UINT16 => 0xFFFF,
+            api::VK_INDEX_TYPE_UINT32 => 0xFFFF_FFFF,
+            _ => unreachable!("invalid index type"),
+        }
+    }
+    unsafe fn read(self, index: u32) -> u32 {
+        match self.index_type {
+            api::VK_INDEX_TYPE_UINT16 => u32::from(ptr::read_unaligned(
+                (self.memory as *const u16).add(index as usize),
+            )),
+            api::VK_INDEX_TYPE_UINT32 => {
+                ptr::read_unaligned((self.memory as *const u32).add(index as usize))
+            }
+            _ => unreachable!("invalid index type"),
+        }
+    }
+}
+
+#[derive(Copy, Clone, Debug)]
+struct VertexAttribute {
+    location: usize,
+    binding: usize,
+    offset: usize,
+    stride: usize,
+    per_instance: bool,
+    format: TexelFormat,
+    /// `Some` when fetching only copies words
+    word_count: Option<usize>,
+}
+
+/// fetches the vertex inputs of a graphics pipeline
+#[derive(Clone, Debug)]
+pub struct VertexFetch {
+    attributes: Vec<VertexAttribute>,
+    /// the number of `VertexBatchValues` a batch needs
+    location_count: usize,
+}
+
+impl VertexFetch {
+    pub fn new(vertex_input: &VertexInputState) -> Result<Self, String> {
+        let attributes = vertex_input
+            .attributes
+            .iter()
+            .map(|attribute| {
+                let binding = vertex_input
+                    .bindings
+                    .iter()
+                    .find(|binding| binding.binding == attribute.binding)
+                    .ok_or_else(|| {
+                        format!(
+                            "vertex attribute uses a missing binding: {}",
+                            attribute.binding
+                        )
+                    })?;
+                let format = TexelFormat::get(attribute.format).ok_or_else(|| {
+                    format!("unsupported vertex attribute format: {}", attribute.format)
+                })?;
+                Ok(VertexAttribute {
+                    location: attribute.location as usize,
+                    binding: attribute.binding as usize,
+                    offset: attribute.offset as usize,
+                    stride: binding.stride as usize,
+                    per_instance: binding.inputRate == api::VK_VERTEX_INPUT_RATE_INSTANCE,
+                    format,
+                    word_count: format.get_word_count(),
+                })
+            })
+            .collect::<Result<Vec<_>, String>>()?;
+        let location_count = attributes
+            .iter()
+            .map(|attribute| attribute.location + 1)
+            .max()
+            .unwrap_or(0);
+        Ok(Self {
+            attributes,
+            location_count,
+        })
+    }
+    /// fetches the inputs of the vertices with `vertex_indices` into the first
+    /// `vertex_indices.len()` lanes of `inputs`, which is indexed by location.
+    /// locations without an attribute aren't written
+    pub unsafe fn fetch(
+        &self,
+        vertex_buffers: &BoundVertexBuffers,
+        vertex_indices: &[u32],
+        instance_index: u32,
+        inputs: &mut [VertexBatchValues],
+    ) {
+        let vertex_count = vertex_indices.len();
+        assert!(vertex_count <= VERTEX_BATCH_SIZE);
+        for attribute in &self.attributes {
+            let values = &mut inputs[attribute.location];
+            let base = vertex_buffers.buffers[attribute.binding].add(attribute.offset);
+            if attribute.per_instance {
+                let value = attribute
+                    .format
+                    .decode(base.add(instance_index as usize * attribute.stride));
+                for (lanes, &value) in values.iter_mut().zip(&value) {
+                    for lane in &mut lanes[..vertex_count] {
+                        *lane = value;
+                    }
+                }
+                continue;
+            }
+            match attribute.word_count {
+                Some(word_count) => {
+                    let default_value = attribute.format.get_default_value();
+                    for (lanes, &value) in values.iter_mut().zip(&default_value).skip(word_count) {
+                        for lane in &mut lanes[..vertex_count] {
+                            *lane = value;
+                        }
+                    }
+                    for (lane, &vertex_index) in vertex_indices.iter().enumerate() {
+                        let texel =
+                            base.add(vertex_index as usize * attribute.stride) as *const u32;
+                        for (component, lanes) in values[..word_count].iter_mut().enumerate() {
+                            lanes[lane] = ptr::read_unaligned(texel.add(component));
+                        }
+                    }
+                }
+                None => {
+                    for (lane, &vertex_index) in vertex_indices.iter().enumerate() {
+                        let value = attribute
+                            .format
+                            .decode(base.add(vertex_index as usize * attribute.stride));
+                        for (lanes, &value) in values.iter_mut().zip(&value) {
+                            lanes[lane] = value;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+/// triangles sharing their vertices
+#[derive(Default, Debug)]
+pub struct PrimitiveBatch {
+    /// the `VertexIndex` of each vertex, at most `VERTEX_BATCH_SIZE` of them
+    pub vertex_indices: Vec<u32>,
+    /// the vertices of each triangle, as indexes into `vertex_indices`
+    pub triangles: Vec<[u8; 3]>,
+}
+
+const VERTEX_CACHE_SIZE: usize = 2 * VERTEX_BATCH_SIZE;
+
+#[derive(Copy, Clone, Default)]
+struct VertexCacheEntry {
+    vertex_index: u32,
+    /// the entry is empty unless this is the current generation
+    generation: u32,
+    /// the vertex's index in the batch
+    batch_index: u8,
+}
+
+/// adds triangles to a `PrimitiveBatch`, reusing the vertices it already holds
+struct BatchBuilder {
+    batch: PrimitiveBatch,
+    /// hash table from `VertexIndex` to the vertices of the current batch, using linear probing.
+    /// it's never more than half full
+    cache: [VertexCacheEntry; VERTEX_CACHE_SIZE],
+    /// incremented for every batch, which empties `cache` without touching it
+    generation: u32,
+}
+
+impl BatchBuilder {
+    fn new() -> Self {
+        Self {
+            batch: PrimitiveBatch {
+                vertex_indices: Vec::with_capacity(VERTEX_BATCH_SIZE),
+                triangles: Vec::with_capacity(VERTEX_BATCH_SIZE * 2),
+            },
+            cache: [VertexCacheEntry::default(); VERTEX_CACHE_SIZE],
+            generation: 1,
+        }
+    }
+    /// returns the vertex's index in the batch, or else the empty cache slot for it
+    fn find(&self, vertex_index: u32) -> Result<u8, usize> {
+        // Fibonacci hashing, so consecutive indexes don't land in consecutive slots
+        let mut slot = (vertex_index.wrapping_mul(0x9E37_79B9) >> 25) as usize;
+        loop {
+            let entry = &self.cache[slot];
+            if entry.generation != self.generation {
+                return Err(slot);
+            }
+            if entry.vertex_index == vertex_index {
+                return Ok(entry.batch_index);
+            }
+            slot = (slot + 1) % VERTEX_CACHE_SIZE;
+        }
+    }
+    fn add_triangle<F: FnMut(&PrimitiveBatch)>(&mut self, vertex_indices: [u32; 3], f: &mut F) {
+        let new_vertex_count = vertex_indices
+            .iter()
+            .enumerate()
+            .filter(|&(i, &vertex_index)| {
+                !vertex_indices[..i].contains(&vertex_index) && self.find(vertex_index).is_err()
+            })
+            .count();
+        if self.batch.vertex_indices.len() + new_vertex_count > VERTEX_BATCH_SIZE {
+            self.flush(f);
+        }
+        let mut triangle = [0; 3];
+        for (batch_index, &vertex_index) in triangle.iter_mut().zip(&vertex_indices) {
+            *batch_index = match self.find(vertex_index) {
+                Ok(batch_index) => batch_index,
+                Err(slot) => {
+                    let batch_index = self.batch.vertex_indices.len() as u8;
+                    self.cache[slot] = VertexCacheEntry {
+                        vertex_index,
+                        generation: self.generation,
+                        batch_index,
+                    };
+                    self.batch.vertex_indices.push(vertex_index);
+                    batch_index
+                }
+            };
+        }
+        self.batch.triangles.push(triangle);
+    }
+    fn flush<F: FnMut(&PrimitiveBatch)>(&mut self, f: &mut F) {
+        if !self.batch.triangles.is_empty() {
+            f(&self.batch);
+        }
+        self.batch.vertex_indices.clear();
+        self.batch.triangles.clear();
+        self.generation = self.generation.wrapping_add(1);
+        if self.generation == 0 {
+            // entries from generation 0 could look current again
+            self.cache = [VertexCacheEntry::default(); VERTEX_CACHE_SIZE];
+            self.generation = 1;
+        }
+    }
+}
+
+/// calls `f` with the vertices of each triangle in `vertex_indices`, where `None` is the
+/// primitive restart index. returns the number of vertices, not counting restarts
+pub fn assemble_triangles<I: IntoIterator<Item = Option<u32>>, F: FnMut([u32; 3])>(
+    topology: api::VkPrimitiveTopology,
+    vertex_indices: I,
+    mut f: F,
+) -> u64 {
+    let mut total_vertex_count = 0;
+    // the first vertex and the last 2 vertices of the current primitive
+    let mut first = 0;
+    let mut previous = [0; 2];
+    // the number of vertices in the current primitive
+    let mut vertex_count = 0usize;
+    for vertex_index in vertex_indices {
+        let vertex_index = match vertex_index {
+            Some(vertex_index) => vertex_index,
+            None => {
+                vertex_count = 0;
+                continue;
+            }
+        };
+        if vertex_count == 0 {
+            first = vertex_index;
+        }
+        vertex_count += 1;
+        total_vertex_count += 1;
+        match topology {
+            api::VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST => {
+                if vertex_count == 3 {
+                    f([previous[0], previous[1], vertex_index]);
+                    vertex_count = 0;
+                }
+            }
+            // triangle `i` uses vertices `i`, `i + 1 + i % 2` and `i + 2 - i % 2`
+            api::VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP => {
+                if vertex_count >= 3 {
+                    if vertex_count % 2 == 1 {
+                        f([previous[0], previous[1], vertex_index]);
+                    } else {
+                        f([previous[0], vertex_index, previous[1]]);
+                    }
+                }
+            }
+            // triangle `i` uses vertices `i + 1`, `i + 2` and 0
+            api::VK_PRIMITIVE_TOPOLOGY_TRIANGLE_FAN => {
+                if vertex_count >= 3 {
+                    f([previous[1], vertex_index, first]);
+                }
+            }
+            _ => unimplemented!("primitive topology: {}", topology),
+        }
+        previous = [previous[1], vertex_index];
+    }
+    total_vertex_count
+}
+
+/// clip a triangle with clip-space `positions` to the view volume, then call `f` with the
+/// triangles of the clipped polygon after the viewport transform. with `depth_clamp_enable`,
+/// it isn't clipped to the near and far planes, and the depths are clamped instead
+pub fn clip_triangle<F: FnMut(Triangle)>(
+    positions: [[f32; 4]; 3],
+    viewport: &api::VkViewport,
+    depth_clamp_enable: bool,
+    mut f: F,
+) {
+    // the planes of the view volume, as a function that's negative outside the plane
+    let distance = |plane: usize, v: &[f32; 4]| match plane {
+        0 => v[3] + v[0],
+        1 => v[3] - v[0],
+        2 => v[3] + v[1],
+        3 => v[3] - v[1],
+        4 => v[2],
+        _ => v[3] - v[2],
+    };
+    let plane_count = if depth_clamp_enable { 4 } else { 6 };
+    // clipping a convex polygon to a plane adds at most one vertex
+    let mut polygon = [[0.0; 4]; 9];
+    polygon[..3].copy_from_slice(&positions);
+    let mut vertex_count = 3;
+    for plane in 0..plane_count {
+        if polygon[..vertex_count]
+            .iter()
+            .all(|v| distance(plane, v) >= 0.0)
+        {
+            continue;
+        }
+        let mut clipped = [[0.0; 4]; 9];
+        let mut clipped_count = 0;
+        for index in 0..vertex_count {
+            let current = polygon[index];
+            let next = polygon[(index + 1) % vertex_count];
+            let current_distance = distance(plane, &current);
+            let next_distance = distance(plane, &next);
+            if current_distance >= 0.0 {
+                clipped[clipped_count] = current;
+                clipped_count += 1;
+            }
+            if (current_distance >= 0.0) != (next_distance >= 0.0) {
+                let t = current_distance / (current_distance - next_distance);
+                for component in 0..4 {
+                    clipped[clipped_count][component] =
+                        current[component] + (next[component] - current[component]) * t;
+                }
+                clipped_count += 1;
+            }
+        }
+        if clipped_count < 3 {
+            return;
+        }
+        polygon = clipped;
+        vertex_count = clipped_count;
+    }
+    let min_depth = viewport.minDepth.min(viewport.maxDepth);
+    let max_depth = viewport.minDepth.max(viewport.maxDepth);
+    let transform = |v: &[f32; 4]| {
+        let inverse_w = 1.0 / v[3];
+        let mut depth =
+            viewport.minDepth + v[2] * inverse_w * (viewport.maxDepth - viewport.minDepth);
+        if depth_clamp_enable {
+            depth = depth.max(min_depth).min(max_depth);
+        }
+        Vertex {
+            position: [
+                viewport.x + (v[0] * inverse_w + 1.0) * 0.5 * viewport.width,
+                viewport.y + (v[1] * inverse_w + 1.0) * 0.5 * viewport.height,
+                depth,
+                inverse_w,
+            ],
+        }
+    };
+    // the polygon is convex, so it's split into a fan
+    let first = transform(&polygon[0]);
+    let mut previous = transform(&polygon[1]);
+    for v in &polygon[2..vertex_count] {
+        let vertex = transform(v);
+        f(Triangle {
+            vertices: [first, previous, vertex],
+        });
+        previous = vertex;
+    }
+}
+
+/// runs the vertex shader on batches, calling `f` with each shaded batch
+struct VertexShading<'a, F> {
+    vertex_fetch: &'a VertexFetch,
+    entry_point: VertexShaderEntryPoint,
+    vertex_buffers: &'a BoundVertexBuffers,
+    descriptor_sets: &'a BoundDescriptorSets,
+    /// the `InstanceIndex` of the vertices in the current batch
+    instance_index: u32,
+    inputs: Vec<VertexBatchValues>,
+    positions: VertexBatchPositions,
+    statistics: &'a mut PipelineStatistics,
+    f: F,
+}
+
+impl<'a, F: FnMut(&PrimitiveBatch, &VertexBatchPositions)> VertexShading<'a, F> {
+    unsafe fn shade(&mut self, batch: &PrimitiveBatch) {
+        self.vertex_fetch.fetch(
+            self.vertex_buffers,
+            &batch.vertex_indices,
+            self.instance_index,
+            &mut self.inputs,
+        );
+        (self.entry_point)(&VertexShaderBatch {
+            vertex_count: batch.vertex_indices.len() as u32,
+            instance_index: self.instance_index,
+            vertex_indices: batch.vertex_indices.as_ptr(),
+            inputs: self.inputs.as_ptr() as *const u32,
+            positions: self.positions.as_mut_ptr() as *mut f32,
+            descriptor_sets: self.descriptor_sets.sets.as_ptr(),
+            dynamic_offsets: self.descriptor_sets.dynamic_offsets.as_ptr(),
+        });
+        let triangle_count = batch.triangles.len() as u64;
+        self.statistics.add(
+            api::VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT,
+            batch.vertex_indices.len() as u64,
+        );
+        // FIXME: count the triangles `clip_triangle` outputs, which runs after the batch is
+        // handed to `f`
+        self.statistics.add(
+            api::VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT,
+            triangle_count,
+        );
+        self.statistics.add(
+            api::VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT,
+            triangle_count,
+        );
+        (self.f)(batch, &self.positions);
+    }
+}
+
+/// runs a sequence of draws using the same pipeline and bindings.
+/// the draws share their batches, so a draw only adds its triangles: thousands of tiny
+/// indirect draws still fill whole batches, and are set up once.
+/// batches only break where the `InstanceIndex` changes, since nothing else a vertex shader can
+/// see differs between the draws
+pub struct DrawBatcher<'a, F> {
+    topology: api::VkPrimitiveTopology,
+    primitive_restart_enable: bool,
+    index_buffer: Option<BoundIndexBuffer>,
+    builder: BatchBuilder,
+    shading: VertexShading<'a, F>,
+}
+
+impl<'a, F: FnMut(&PrimitiveBatch, &VertexBatchPositions)> DrawBatcher<'a, F> {
+    pub fn new(
+        pipeline: &'a Pipeline,
+        vertex_buffers: &'a BoundVertexBuffers,
+        index_buffer: Option<BoundIndexBuffer>,
+        descriptor_sets: &'a BoundDescriptorSets,
+        statistics: &'a mut PipelineStatistics,
+        f: F,
+    ) -> Self {
+        let state = match pipeline.state() {
+            PipelineState::Graphics(state) => state,
+            PipelineState::Compute => panic!("draw needs a graphics pipeline"),
+        };
+        Self::with_vertex_shader(
+            state.topology,
+            state.primitive_restart_enable,
+            pipeline.vertex_fetch().unwrap(),
+            pipeline.get_vertex_function().unwrap(),
+            vertex_buffers,
+            index_buffer,
+            descriptor_sets,
+            statistics,
+            f,
+        )
+    }
+    /// like `new`, with the parts of the pipeline a draw uses
+    #[cfg_attr(feature = "cargo-clippy", allow(clippy::too_many_arguments))]
+    fn with_vertex_shader(
+        topology: api::VkPrimitiveTopology,
+        primitive_restart_enable: bool,
+        vertex_fetch: &'a VertexFetch,
+        entry_point: VertexShaderEntryPoint,
+        vertex_buffers: &'a BoundVertexBuffers,
+        index_buffer: Option<BoundIndexBuffer>,
+        descriptor_sets: &'a BoundDescriptorSets,
+        statistics: &'a mut PipelineStatistics,
+        f: F,
+    ) -> Self {
+        Self {
+            topology,
+            primitive_restart_enable,
+            index_buffer,
+            builder: BatchBuilder::new(),
+            shading: VertexShading {
+                vertex_fetch,
+                entry_point,
+                vertex_buffers,
+                descriptor_sets,
+                instance_index: 0,
+                inputs: vec![[[0; VERTEX_BATCH_SIZE]; 4]; vertex_fetch.location_count],
+                positions: [[0.0; VERTEX_BATCH_SIZE]; 4],
+                statistics,
+                f,
+            },
+        }
+    }
+    unsafe fn add_triangles<I: Iterator<Item = Option<u32>> + Clone>(
+        &mut self,
+        vertex_indices: I,
+        first_instance: u32,
+        instance_count: u32,
+    ) {
+        let DrawBatcher {
+            topology,
+            builder,
+            shading,
+            ..
+        } = self;
+        for instance_index in first_instance..first_instance + instance_count {
+            if instance_index != shading.instance_index {
+                builder.flush(&mut |batch| shading.shade(batch));
+                shading.instance_index = instance_index;
+            }
+            let mut triangle_count = 0;
+            let vertex_count = assemble_triangles(*topology, vertex_indices.clone(), |triangle| {
+                triangle_count += 1;
+                builder.add_triangle(triangle, &mut |batch| shading.shade(batch))
+            });
+            shading.statistics.add(
+                api::VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT,
+                vertex_count,
+            );
+            shading.statistics.add(
+                api::VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT,
+                triangle_count,
+            );
+        }
+    }
+    /// `vkCmdDraw`
+    pub unsafe fn draw(
+        &mut self,
+        vertex_count: u32,
+        instance_count: u32,
+        first_vertex: u32,
+        first_instance: u32,
+    ) {
+        self.add_triangles(
+            (first_vertex..first_vertex + vertex_count).map(Some),
+            first_instance,
+            instance_count,
+        );
+    }
+    /// `vkCmdDrawIndexed`
+    pub unsafe fn draw_indexed(
+        &mut self,
+        index_count: u32,
+        instance_count: u32,
+        first_index: u32,
+        vertex_offset: i32,
+        first_instance: u32,
+    ) {
+        let index_buffer = self.index_buffer.expect("no index buffer bound");
+        let primitive_restart_enable = self.primitive_restart_enable;
+        let restart_index = index_buffer.get_restart_index();
+        // the restart index is compared before `vertex_offset` is added
+        let vertex_indices = (first_index..first_index + index_count).map(move |index| {
+            match index_buffer.read(index) {
+                vertex_index if primitive_restart_enable && vertex_index == restart_index => None,
+                vertex_index => Some((vertex_index as i32).wrapping_add(vertex_offset) as u32),
+            }
+        });
+        self.add_triangles(vertex_indices, first_instance, instance_count);
+    }
+    /// `vkCmdDrawIndirect`, `draws` points to the first `VkDrawIndirectCommand`
+    pub unsafe fn draw_indirect(&mut self, draws: *const u8, draw_count: u32, stride: u32) {
+        for draw in 0..draw_count as usize {
+            let command: api::VkDrawIndirectCommand =
+                ptr::read_unaligned(draws.add(draw * stride as usize) as *const _);
+            self.draw(
+                command.vertexCount,
+                command.instanceCount,
+                command.firstVertex,
+                command.firstInstance,
+            );
+        }
+    }
+    /// `vkCmdDrawIndexedIndirect`, `draws` points to the first `VkDrawIndexedIndirectCommand`
+    pub unsafe fn draw_indexed_indirect(&mut self, draws: *const u8, draw_count: u32, stride: u32) {
+        for draw in 0..draw_count as usize {
+            let command: api::VkDrawIndexedIndirectCommand =
+                ptr::read_unaligned(draws.add(draw * stride as usize) as *const _);
+            self.draw_indexed(
+                command.indexCount,
+                command.instanceCount,
+                command.firstIndex,
+                command.vertexOffset,
+                command.firstInstance,
+            );
+        }
+    }
+    /// shades the triangles still waiting for their batch to fill up
+    pub unsafe fn finish(mut self) {
+        let DrawBatcher {
+            builder, shading, ..
+        } = &mut self;
+        builder.flush(&mut |batch| shading.shade(batch));
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::cell::RefCell;
+
+    fn get_batches<I: IntoIterator<Item = [u32; 3]>>(
+        triangles: I,
+    ) -> Vec<(Vec<u32>, Vec<[u8; 3]>)> {
+        let mut batches = vec![];
+        let mut builder = BatchBuilder::new();
+        let mut f = |batch: &PrimitiveBatch| {
+            batches.push((batch.vertex_indices.clone(), batch.triangles.clone()))
+        };
+        for triangle in triangles {
+            builder.add_triangle(triangle, &mut f);
+        }
+        builder.flush(&mut f);
+        batches
+    }
+
+    #[test]
+    fn test_batch_builder() {
+        // a grid of 16x16 quads, as an indexed triangle list
+        let width = 17;
+        let mut triangles = vec![];
+        for y in 0..16 {
+            for x in 0..16 {
+                let v = y * width + x;
+                triangles.push([v, v + 1, v + width]);
+                triangles.push([v + width, v + 1, v + width + 1]);
+            }
+        }
+        let batches = get_batches(triangles.iter().cloned());
+        let mut triangle_count = 0;
+        let mut vertex_count = 0;
+        for (vertex_indices, batch_triangles) in &batches {
+            assert!(vertex_indices.len() <= VERTEX_BATCH_SIZE);
+            for (i, &vertex_index) in vertex_indices.iter().enumerate() {
+                assert!(!vertex_indices[..i].contains(&vertex_index));
+            }
+            for batch_triangle in batch_triangles {
+                let triangle = [
+                    vertex_indices[batch_triangle[0] as usize],
+                    vertex_indices[batch_triangle[1] as usize],
+                    vertex_indices[batch_triangle[2] as usize],
+                ];
+                assert_eq!(triangle, triangles[triangle_count]);
+                triangle_count += 1;
+            }
+            vertex_count += vertex_indices.len();
+        }
+        assert_eq!(triangle_count, triangles.len());
+        // without reuse there'd be 3 vertices per triangle
+        assert!(vertex_count * 2 < triangle_count * 3);
+        // degenerate triangles only use their distinct vertices
+        assert_eq!(
+            get_batches(vec![[5, 5, 5], [5, 6, 5]]),
+            vec![(vec![5, 6], vec![[0, 0, 0], [0, 1, 0]])]
+        );
+    }
+
+    #[test]
+    fn test_assemble_triangles() {
+        let assemble = |topology, vertex_indices: &[Option<u32>]| {
+            let mut triangles = vec![];
+            assemble_triangles(topology, vertex_indices.iter().cloned(), |triangle| {
+                triangles.push(triangle)
+            });
+            triangles
+        };
+        let vertex_indices = [
+            Some(0),
+            Some(1),
+            Some(2),
+            Some(3),
+            Some(4),
+            None,
+            Some(5),
+            Some(6),
+            Some(7),
+        ];
+        assert_eq!(
+            assemble(api::VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, &vertex_indices),
+            vec![[0, 1, 2], [5, 6, 7]]
+        );
+        assert_eq!(
+            assemble(api::VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP, &vertex_indices),
+            vec![[0, 1, 2], [1, 3, 2], [2, 3, 4], [5, 6, 7]]
+        );
+        assert_eq!(
+            assemble(api::VK_PRIMITIVE_TOPOLOGY_TRIANGLE_FAN, &vertex_indices),
+            vec![[1, 2, 0], [2, 3, 0], [3, 4, 0], [6, 7, 5]]
+        );
+    }
+
+    #[test]
+    fn test_draw_batcher() {
+        thread_local! {
+            /// the `InstanceIndex` and vertex count of each shaded batch
+            static SHADED: RefCell<Vec<(u32, u32)>> = RefCell::new(vec![]);
+        }
+        unsafe extern "C" fn vertex_shader(batch: *const VertexShaderBatch) {
+            let batch = &*batch;
+            SHADED.with(|shaded| {
+                shaded
+                    .borrow_mut()
+                    .push((batch.instance_index, batch.vertex_count))
+            });
+        }
+        let vertex_fetch = VertexFetch::new(&VertexInputState {
+            bindings: vec![],
+            attributes: vec![],
+        })
+        .unwrap();
+        let vertex_buffers = BoundVertexBuffers::default();
+        let descriptor_sets = BoundDescriptorSets::default();
+        let indices: [u16; 6] = [0, 1, 2, 2, 1, 3];
+        let index_buffer = BoundIndexBuffer {
+            memory: indices.as_ptr() as *const u8,
+            index_type: api::VK_INDEX_TYPE_UINT16,
+        };
+        // each command is followed by padding, which `stride` skips
+        let draws: [[u32; 5]; 2] = [[3, 1, 0, 0, !0], [3, 1, 3, 0, !0]];
+        let indexed_draws: [[u32; 6]; 1] = [[6, 1, 0, 4, 0, !0]];
+        let mut statistics = PipelineStatistics::default();
+        let mut batches = vec![];
+        unsafe {
+            let mut batcher = DrawBatcher::with_vertex_shader(
+                api::VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+                false,
+                &vertex_fetch,
+                vertex_shader,
+                &vertex_buffers,
+                Some(index_buffer),
+                &descriptor_sets,
+                &mut statistics,
+                |batch: &PrimitiveBatch, _: &VertexBatchPositions| {
+                    batches.push((batch.vertex_indices.clone(), batch.triangles.len()))
+                },
+            );
+            batcher.draw(3, 1, 10, 0);
+            batcher.draw_indirect(draws.as_ptr() as *const u8, 2, 20);
+            batcher.draw_indexed_indirect(indexed_draws.as_ptr() as *const u8, 1, 24);
+            // a different instance starts a new batch
+            batcher.draw(3, 1, 0, 1);
+            batcher.finish();
+        }
+        // the draws share a batch, and the vertices they share are shaded once
+        assert_eq!(
+            batches,
+            vec![
+                (vec![10, 11, 12, 0, 1, 2, 3, 4, 5, 6, 7], 5),
+                (vec![0, 1, 2], 1)
+            ]
+        );
+        assert_eq!(
+            SHADED.with(|shaded| shaded.borrow().clone()),
+            vec![(0, 11), (1, 3)]
+        );
+    }
+
+    #[test]
+    fn test_clip_triangle() {
+        let viewport = api::VkViewport {
+            x: 0.0,
+            y: 0.0,
+            width: 100.0,
+            height: 50.0,
+            minDepth: 0.0,
+            maxDepth: 1.0,
+        };
+        let clip = |positions, depth_clamp_enable| {
+            let mut triangles = vec![];
+            clip_triangle(positions, &viewport, depth_clamp_enable, |triangle| {
+                triangles.push(
+                    triangle
+                        .vertices
+                        .iter()
+                        .map(|v| v.position)
+                        .collect::<Vec<_>>(),
+                )
+            });
+            triangles
+        };
+        // inside the view volume, so only transformed
+        assert_eq!(
+            clip(
+                [
+                    [-1.0, -1.0, 0.0, 1.0],
+                    [2.0, -2.0, 1.0, 2.0],
+                    [0.0, 1.0, 0.5, 1.0]
+                ],
+                false
+            ),
+            vec![vec![
+                [0.0, 0.0, 0.0, 1.0],
+                [100.0, 0.0, 0.5, 0.5],
+                [50.0, 50.0, 0.5, 1.0]
+            ]]
+        );
+        // the corner past the right edge is cut off, leaving a quadrilateral
+        assert_eq!(
+            clip(
+                [
+                    [0.0, -1.0, 0.0, 1.0],
+                    [2.0, -1.0, 0.0, 1.0],
+                    [0.0, 1.0, 0.0, 1.0]
+                ],
+                false
+            ),
+            vec![
+                vec![
+                    [50.0, 0.0, 0.0, 1.0],
+                    [100.0, 0.0, 0.0, 1.0],
+                    [100.0, 25.0, 0.0, 1.0]
+                ],
+                vec![
+                    [50.0, 0.0, 0.0, 1.0],
+                    [100.0, 25.0, 0.0, 1.0],
+                    [50.0, 50.0, 0.0, 1.0]
+                ]
+            ]
+        );
+        // behind the near plane
+        let behind = [
+            [-1.0, -1.0, -1.0, 1.0],
+            [1.0, -1.0, -1.0, 1.0],
+            [0.0, 1.0, -0.5, 1.0],
+        ];
+        assert!(clip(behind, false).is_empty());
+        // depth clamping keeps it, at the near plane
+        let clamped = clip(behind, true);
+        assert_eq!(clamped.len(), 1);
+        assert!(clamped[0].iter().all(|position| position[2] == 0.0));
+    }
+
+    #[test]
+    fn test_vertex_fetch() {
+        let vertex_input = VertexInputState {
+            bindings: vec![
+                api::VkVertexInputBindingDescription {
+                    binding: 0,
+                    stride: 12,
+                    inputRate: api::VK_VERTEX_INPUT_RATE_VERTEX,
+                },
+                api::VkVertexInputBindingDescription {
+                    binding: 1,
+                    stride: 4,
+                    inputRate: api::VK_VERTEX_INPUT_RATE_INSTANCE,
+                },
+            ],
+            attributes: vec![
+                api::VkVertexInputAttributeDescription {
+                    location: 0,
+                    binding: 0,
+                    format: api::VK_FORMAT_R32G32_SFLOAT,
+                    offset: 0,
+                },
+                api::VkVertexInputAttributeDescription {
+                    location: 2,
+                    binding: 0,
+                    format: api::VK_FORMAT_R8G8B8A8_UNORM,
+                    offset: 8,
+                },
+                api::VkVertexInputAttributeDescription {
+                    location: 1,
+                    binding: 1,
+                    format: api::VK_FORMAT_R16G16_UINT,
+                    offset: 0,
+                },
+            ],
+        };
+        let vertex_fetch = VertexFetch::new(&vertex_input).unwrap();
+        assert_eq!(vertex_fetch.location_count, 3);
+        #[repr(C)]
+        struct Vertex {
+            position: [f32; 2],
+            color: [u8; 4],
+        }
+        let vertices: Vec<_> = (0..8)
+            .map(|i| Vertex {
+                position: [i as f32, -(i as f32)],
+                color: [i as u8 * 17, 0, 255, 0],
+            })
+            .collect();
+        let instances = [[1u16, 2], [3, 4]];
+        let vertex_buffers = BoundVertexBuffers {
+            buffers: vec![
+                vertices.as_ptr() as *const u8,
+                instances.as_ptr() as *const u8,
+            ],
+        };
+        let mut inputs = vec![[[0; VERTEX_BATCH_SIZE]; 4]; 3];
+        unsafe {
+            vertex_fetch.fetch(&vertex_buffers, &[5, 2, 7], 1, &mut inputs);
+        }
+        for (lane, &i) in [5u32, 2, 7].iter().enumerate() {
+            let get = |location: usize| -> [u32; 4] {
+                let values: &VertexBatchValues = &inputs[location];
+                [
+                    values[0][lane],
+                    values[1][lane],
+                    values[2][lane],
+                    values[3][lane],
+                ]
+            };
+            assert_eq!(
+                get(0),
+                [
+                    (i as f32).to_bits(),
+                    (-(i as f32)).to_bits(),
+                    0,
+                    1.0f32.to_bits()
+                ]
+            );
+            assert_eq!(get(1), [3, 4, 0, 1]);
+            let color = get(2);
+            assert!((f32::from_bits(color[0]) - (i * 17) as f32 / 255.0).abs() < 1e-6);
+            assert_eq!(color[1..], [0, 1.0f32.to_bits(), 0][..]);
+        }
+        // vertex attributes must use a bound binding
+        assert!(VertexFetch::new(&VertexInputState {
+            bindings: vec![],
+            attributes: vertex_input.attributes.clone(),
+        })
+        .is_err());
+    }
+}
@@ -1,10 +1,20 @@
 // SPDX-License-Identifier: LGPL-2.1-or-later
 // Copyright 2018 Jacob Lifshay
 use api;
-use api_impl::{Device, Instance, PhysicalDevice, Queue};
+use api_impl::{Device, Instance, PhysicalDevice};
 use buffer::Buffer;
+use command_buffer::{CommandBuffer, CommandPool};
+use descriptor::{
+    DescriptorPool, DescriptorSet, DescriptorSetLayout, DescriptorUpdateTemplate, PipelineLayout,
+};
 use device_memory::DeviceMemory;
-use image::Image;
+use handle_pool;
+use image::{Image, ImageView};
+use pipeline::Pipeline;
+use pipeline_cache::PipelineCache;
+use query::QueryPool;
+use queue::Queue;
+use render_pass::{Framebuffer, RenderPass};
 use sampler::Sampler;
 use sampler::SamplerYcbcrConversion;
 use shader_module::ShaderModule;
@@ -15,7 +25,9 @@ use std::ops::Deref;
 use std::ops::DerefMut;
 use std::ptr::null_mut;
 use std::ptr::NonNull;
+use std::sync::Arc;
 use swapchain::Swapchain;
+use sync::{Fence, Semaphore};
 
 #[repr(C)]
 pub struct DispatchableType<T> {
@@ -47,12 +59,10 @@ impl<T> DerefMut for DispatchableType<T> {
 
 pub trait HandleAllocFree: Handle {
     unsafe fn allocate<T: Into<Self::Value>>(v: T) -> Self {
-        Self::new(Some(NonNull::new_unchecked(Box::into_raw(Box::new(
-            v.into(),
-        )))))
+        Self::new(Some(handle_pool::allocate(v.into())))
     }
     unsafe fn free(self) {
-        Box::from_raw(self.get().unwrap().as_ptr());
+        handle_pool::free(self.get().unwrap());
     }
 }
 
@@ -302,20 +312,14 @@ pub type VkQueue = DispatchableHandle<Queue>;
 
 impl HandleAllocFree for VkQueue {}
 
-pub struct CommandBuffer {}
-
 pub type VkCommandBuffer = DispatchableHandle<CommandBuffer>;
 
 impl HandleAllocFree for VkCommandBuffer {}
 
-pub struct Semaphore {}
-
 pub type VkSemaphore = NondispatchableHandle<Semaphore>;
 
 impl HandleAllocFree for VkSemaphore {}
 
-pub struct Fence {}
-
 pub type VkFence = NondispatchableHandle<Fence>;
 
 impl HandleAllocFree for VkFence {}
@@ -338,8 +342,6 @@ pub type VkEvent = NondispatchableHandle<Event>;
 
 impl HandleAllocFree for VkEvent {}
 
-pub struct QueryPool {}
-
 pub type VkQueryPool = NondispatchableHandle<QueryPool>;
 
 impl HandleAllocFree for VkQueryPool {}
@@ -350,8 +352,6 @@ pub type VkBufferView = NondispatchableHandle<BufferView>;
 
 impl HandleAllocFree for VkBufferView {}
 
-pub struct ImageView {}
-
 pub type VkImageView = NondispatchableHandle<ImageView>;
 
 impl HandleAllocFree for VkImageView {}
@@ -360,33 +360,23 @@ pub type VkShaderModule = NondispatchableHandle<ShaderModule>;
 
 impl HandleAllocFree for VkShaderModule {}
 
-pub struct PipelineCache {}
-
 pub type VkPipelineCache = NondispatchableHandle<PipelineCache>;
 
 impl HandleAllocFree for VkPipelineCache {}
 
-pub struct PipelineLayout {}
-
 pub type VkPipelineLayout = NondispatchableHandle<PipelineLayout>;
 
 impl HandleAllocFree for VkPipelineLayout {}
 
-pub struct RenderPass {}
-
 pub type VkRenderPass = NondispatchableHandle<RenderPass>;
 
 impl HandleAllocFree for VkRenderPass {}
 
-pub struct Pipeline {}
-
 pub type VkPipeline = NondispatchableHandle<Pipeline>;
 
 impl HandleAllocFree for VkPipeline {}
 
-pub struct DescriptorSetLayout {}
-
-pub type VkDescriptorSetLayout = NondispatchableHandle<DescriptorSetLayout>;
+pub type VkDescriptorSetLayout = NondispatchableHandle<Arc<DescriptorSetLayout>>;
 
 impl HandleAllocFree for VkDescriptorSetLayout {}
 
@@ -394,26 +384,19 @@ pub type VkSampler = NondispatchableHandle<Sampler>;
 
 impl HandleAllocFree for VkSampler {}
 
-pub struct DescriptorPool {}
-
 pub type VkDescriptorPool = NondispatchableHandle<DescriptorPool>;
 
 impl HandleAllocFree for VkDescriptorPool {}
 
-pub struct DescriptorSet {}
-
 pub type VkDescriptorSet = NondispatchableHandle<DescriptorSet>;
 
-impl HandleAllocFree for VkDescriptorSet {}
-
-pub struct Framebuffer {}
+// HandleAllocFree specifically not implemented for VkDescriptorSet, sets are allocated from their
+// DescriptorPool
 
 pub type VkFramebuffer = NondispatchableHandle<Framebuffer>;
 
 impl HandleAllocFree for VkFramebuffer {}
 
-pub struct CommandPool {}
-
 pub type VkCommandPool = NondispatchableHandle<CommandPool>;
 
 impl HandleAllocFree for VkCommandPool {}
@@ -422,8 +405,6 @@ pub type VkSamplerYcbcrConversion = NondispatchableHandle<SamplerYcbcrConversion
 
 impl HandleAllocFree for VkSamplerYcbcrConversion {}
 
-pub struct DescriptorUpdateTemplate {}
-
 pub type VkDescriptorUpdateTemplate = NondispatchableHandle<DescriptorUpdateTemplate>;
 
 impl HandleAllocFree for VkDescriptorUpdateTemplate {}
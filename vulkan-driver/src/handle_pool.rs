@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright 2018 Jacob Lifshay
+
+// The objects behind handles are allocated from pools of fixed-size blocks, one pool per size
+// class, so creating and destroying short-lived objects every frame stays off the global
+// allocator. Every thread caches free blocks for each size class and only takes the global lock
+// when its cache runs empty or overflows; objects can be freed on a different thread than they
+// were allocated on. Blocks are carved out of slabs that are never returned to the system, so
+// the memory used is bounded by the most objects that were alive at once.
+
+use std::alloc::{self, Layout};
+use std::cell::RefCell;
+use std::ptr::{self, NonNull};
+use std::sync::Mutex;
+
+const BLOCK_ALIGNMENT: usize = 16;
+const SIZE_CLASS_COUNT: usize = 32;
+/// objects bigger than this or aligned to more than `BLOCK_ALIGNMENT` are allocated with `Box`
+const MAX_BLOCK_SIZE: usize = BLOCK_ALIGNMENT * SIZE_CLASS_COUNT;
+const SLAB_BLOCK_COUNT: usize = 64;
+/// the number of blocks moved between a thread's cache and the global free lists at once
+const TRANSFER_BLOCK_COUNT: usize = SLAB_BLOCK_COUNT;
+const MAX_THREAD_CACHE_BLOCK_COUNT: usize = 2 * TRANSFER_BLOCK_COUNT;
+
+const EMPTY_FREE_LIST: Vec<usize> = Vec::new();
+
+/// free block addresses for every size class
+static GLOBAL_FREE_BLOCKS: Mutex<[Vec<usize>; SIZE_CLASS_COUNT]> =
+    Mutex::new([EMPTY_FREE_LIST; SIZE_CLASS_COUNT]);
+
+struct ThreadCache {
+    free_blocks: [Vec<usize>; SIZE_CLASS_COUNT],
+}
+
+impl ThreadCache {
+    fn new() -> Self {
+        Self {
+            free_blocks: [EMPTY_FREE_LIST; SIZE_CLASS_COUNT],
+        }
+    }
+}
+
+impl Drop for ThreadCache {
+    fn drop(&mut self) {
+        let mut global_free_blocks = GLOBAL_FREE_BLOCKS.lock().unwrap();
+        for (global_free_list, free_list) in global_free_blocks
+            .iter_mut()
+            .zip(self.free_blocks.iter_mut())
+        {
+            global_free_list.append(free_list);
+        }
+    }
+}
+
+thread_local! {
+    static THREAD_CACHE: RefCell<ThreadCache> = RefCell::new(ThreadCache::new());
+}
+
+/// runs `f` on the current thread's cache.
+/// while thread-locals are being destroyed, runs `f` on a temporary cache instead, which gives
+/// its blocks back to the global free lists when it's dropped
+fn with_free_list<R, F: FnOnce(&mut Vec<usize>) -> R>(size_class: usize, f: F) -> R {
+    let mut f = Some(f);
+    match THREAD_CACHE
+        .try_with(|cache| f.take().unwrap()(&mut cache.borrow_mut().free_blocks[size_class]))
+    {
+        Ok(retval) => retval,
+        Err(_) => f.take().unwrap()(&mut ThreadCache::new().free_blocks[size_class]),
+    }
+}
+
+fn get_size_class(layout: Layout) -> Option<usize> {
+    if layout.size() > MAX_BLOCK_SIZE || layout.align() > BLOCK_ALIGNMENT {
+        None
+    } else {
+        // zero-sized objects still get a block, so every handle is unique
+        Some(layout.size().saturating_sub(1) / BLOCK_ALIGNMENT)
+    }
+}
+
+fn get_block_size(size_class: usize) -> usize {
+    (size_class + 1) * BLOCK_ALIGNMENT
+}
+
+fn allocate_block(size_class: usize, free_list: &mut Vec<usize>) -> NonNull<u8> {
+    if free_list.is_empty() {
+        {
+            let global_free_list = &mut GLOBAL_FREE_BLOCKS.lock().unwrap()[size_class];
+            let start = global_free_list.len().saturating_sub(TRANSFER_BLOCK_COUNT);
+            free_list.extend(global_free_list.drain(start..));
+        }
+        if free_list.is_empty() {
+            let block_size = get_block_size(size_class);
+            let layout =
+                Layout::from_size_align(block_size * SLAB_BLOCK_COUNT, BLOCK_ALIGNMENT).unwrap();
+            let slab = unsafe { alloc::alloc(layout) };
+            if slab.is_null() {
+                alloc::handle_alloc_error(layout);
+            }
+            free_list.extend(
+                (0..SLAB_BLOCK_COUNT)
+                    .rev()
+                    .map(|index| slab as usize + index * block_size),
+            );
+        }
+    }
+    unsafe { NonNull::new_unchecked(free_list.pop().unwrap() as *mut u8) }
+}
+
+fn free_block(size_class: usize, block: NonNull<u8>, free_list: &mut Vec<usize>) {
+    free_list.push(block.as_ptr() as usize);
+    if free_list.len() > MAX_THREAD_CACHE_BLOCK_COUNT {
+        let start = free_list.len() - TRANSFER_BLOCK_COUNT;
+        GLOBAL_FREE_BLOCKS.lock().unwrap()[size_class].extend(free_list.drain(start..));
+    }
+}
+
+pub fn allocate<T>(value: T) -> NonNull<T> {
+    match get_size_class(Layout::new::<T>()) {
+        Some(size_class) => unsafe {
+            let block = with_free_list(size_class, |free_list| {
+                allocate_block(size_class, free_list)
+            })
+            .cast::<T>();
+            ptr::write(block.as_ptr(), value);
+            block
+        },
+        None => unsafe { NonNull::new_unchecked(Box::into_raw(Box::new(value))) },
+    }
+}
+
+/// `value` must have been returned by `allocate`
+pub unsafe fn free<T>(value: NonNull<T>) {
+    match get_size_class(Layout::new::<T>()) {
+        Some(size_class) => {
+            // dropping may free other objects, so don't hold the cache while dropping
+            ptr::drop_in_place(value.as_ptr());
+            with_free_list(size_class, |free_list| {
+                free_block(size_class, value.cast(), free_list)
+            });
+        }
+        None => drop(Box::from_raw(value.as_ptr())),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::collections::HashSet;
+    use std::sync::atomic::{AtomicUsize, Ordering};
+    use std::sync::Arc;
+    use std::thread;
+
+    struct Counted(Arc<AtomicUsize>);
+
+    impl Drop for Counted {
+        fn drop(&mut self) {
+            self.0.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+
+    #[test]
+    fn test_handle_pool() {
+        struct Empty;
+        let objects: Vec<_> = (0..1000).map(|_| allocate(Empty)).collect();
+        let addresses: HashSet<_> = objects.iter().map(|v| v.as_ptr() as usize).collect();
+        assert_eq!(addresses.len(), objects.len());
+        for &object in &objects {
+            unsafe { free(object) };
+        }
+        let big_object = allocate([0u8; MAX_BLOCK_SIZE + 1]);
+        unsafe { free(big_object) };
+        // free on another thread than the objects were allocated on
+        let drop_count = Arc::new(AtomicUsize::new(0));
+        let objects: Vec<_> = (0..1000)
+            .map(|_| allocate(Counted(drop_count.clone())).as_ptr() as usize)
+            .collect();
+        thread::spawn(move || {
+            for object in objects {
+                unsafe { free(NonNull::new_unchecked(object as *mut Counted)) };
+            }
+        })
+        .join()
+        .unwrap();
+        assert_eq!(drop_count.load(Ordering::Relaxed), 1000);
+    }
+}
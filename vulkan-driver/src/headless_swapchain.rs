@@ -0,0 +1,672 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright 2018 Jacob Lifshay
+
+// Swapchains for VK_EXT_headless_surface, for rendering without a display server.
+// Where presented images go is chosen when the swapchain is created, by the file descriptor in
+// the `KAZAN_HEADLESS_OUTPUT_FD` environment variable:
+// - unset: presented images are dropped.
+// - a regular file or memfd: it's resized to hold a `RingHeader` followed by all the swapchain
+//   images and mapped, so images are rendered straight into the caller's buffers.
+//   Presenting adds the image index to `RingHeader::presented_images` and increments
+//   `write_count`. The consumer returns images in the same order by incrementing `read_count`.
+//   Both counters are woken with shared futexes. Returning an image that the consumer doesn't
+//   have is ignored.
+// - anything else, such as a pipe or socket: the pixels of each presented image are written to
+//   it as tightly packed rows.
+// Each swapchain has a presentation thread, so presenting never blocks the queue thread.
+
+use api;
+use device_memory::{DeviceMemory, DeviceMemoryAllocation, DeviceMemoryLayout};
+use errno;
+use handle::{OwnedHandle, SharedHandle};
+use image::{
+    Image, ImageComputedProperties, ImageMemory, ImageMultisampleCount, ImageProperties,
+    SupportedTilings, Tiling,
+};
+use libc;
+use std::borrow::Cow;
+use std::cmp;
+use std::env;
+use std::fmt;
+use std::mem;
+use std::os::raw::c_int;
+use std::ptr::{null_mut, NonNull};
+use std::slice;
+use std::sync::atomic::{AtomicBool, AtomicU32, Ordering};
+use std::sync::Arc;
+use std::thread;
+use swapchain::{
+    AvailableImages, PresentQueue, SurfaceImplementation, SurfacePlatform, Swapchain,
+    MAX_SWAPCHAIN_IMAGE_COUNT,
+};
+use sync::{futex, get_deadline, SyncGroup};
+
+pub const RING_MAGIC: u32 = 0x4B5A_5247;
+pub const RING_VERSION: u32 = 1;
+
+/// images start at `image_offset` and are `image_stride` bytes apart
+#[repr(C)]
+pub struct RingHeader {
+    pub magic: u32,
+    pub version: u32,
+    pub image_count: u32,
+    pub format: api::VkFormat,
+    pub width: u32,
+    pub height: u32,
+    pub row_pitch: u32,
+    pub _padding: u32,
+    pub image_offset: u64,
+    pub image_stride: u64,
+    /// image indexes in present order, indexed by `write_count` and `read_count` modulo the length
+    pub presented_images: [AtomicU32; MAX_SWAPCHAIN_IMAGE_COUNT as usize],
+    /// the number of presented images
+    pub write_count: AtomicU32,
+    /// the number of presented images the consumer is done with
+    pub read_count: AtomicU32,
+}
+
+/// images in the ring are page aligned so the consumer can map them one at a time
+const RING_ALIGNMENT: usize = 4096;
+
+fn round_up(v: usize, alignment: usize) -> usize {
+    (v + alignment - 1) / alignment * alignment
+}
+
+#[derive(Debug)]
+struct MappedFile {
+    memory: NonNull<u8>,
+    size: usize,
+}
+
+unsafe impl Send for MappedFile {}
+unsafe impl Sync for MappedFile {}
+
+impl MappedFile {
+    unsafe fn new(fd: c_int, size: usize) -> Result<Self, errno::Errno> {
+        if libc::ftruncate(fd, size as libc::off_t) != 0 {
+            return Err(errno::errno());
+        }
+        let memory = libc::mmap(
+            null_mut(),
+            size,
+            libc::PROT_READ | libc::PROT_WRITE,
+            libc::MAP_SHARED,
+            fd,
+            0,
+        );
+        if memory == libc::MAP_FAILED {
+            return Err(errno::errno());
+        }
+        Ok(Self {
+            memory: NonNull::new(memory as *mut u8).unwrap(),
+            size,
+        })
+    }
+    fn header(&self) -> &RingHeader {
+        unsafe { &*(self.memory.as_ptr() as *const RingHeader) }
+    }
+}
+
+impl Drop for MappedFile {
+    fn drop(&mut self) {
+        unsafe {
+            libc::munmap(self.memory.as_ptr() as *mut libc::c_void, self.size);
+        }
+    }
+}
+
+#[derive(Debug)]
+struct RingDeviceMemory {
+    file: Arc<MappedFile>,
+    offset: usize,
+    layout: DeviceMemoryLayout,
+}
+
+impl DeviceMemoryAllocation for RingDeviceMemory {
+    unsafe fn get(&self) -> NonNull<u8> {
+        NonNull::new(self.file.memory.as_ptr().add(self.offset)).unwrap()
+    }
+    fn layout(&self) -> DeviceMemoryLayout {
+        self.layout
+    }
+}
+
+enum Output {
+    Discard,
+    Ring(Arc<MappedFile>),
+    Stream(c_int),
+}
+
+/// shared with the presentation and ring threads
+struct PresentState {
+    output: Output,
+    computed_properties: ImageComputedProperties,
+    /// the memory of each image
+    images: Vec<NonNull<u8>>,
+    sync_group: Arc<SyncGroup>,
+    available_images: AvailableImages,
+    present_queue: PresentQueue,
+    /// the images presented to the ring that the consumer hasn't returned, one bit per image
+    ring_images: AtomicU32,
+    /// set when writing to the output failed
+    lost: AtomicBool,
+    shutting_down: AtomicBool,
+    /// set by the ring thread when it stops
+    ring_thread_stopped: AtomicBool,
+}
+
+// the image memory is only accessed while the image isn't acquired
+unsafe impl Send for PresentState {}
+unsafe impl Sync for PresentState {}
+
+fn write_all(fd: c_int, mut data: &[u8]) -> Result<(), errno::Errno> {
+    while !data.is_empty() {
+        match unsafe { libc::write(fd, data.as_ptr() as *const libc::c_void, data.len()) } {
+            -1 => match errno::errno() {
+                errno::Errno(libc::EINTR) => {}
+                error => return Err(error),
+            },
+            written => data = &data[written as usize..],
+        }
+    }
+    Ok(())
+}
+
+impl PresentState {
+    /// called from the presentation thread
+    unsafe fn present(&self, image_index: u32) {
+        match &self.output {
+            Output::Discard => {}
+            Output::Ring(file) => {
+                // the ring thread releases the image once the consumer is done with it
+                self.ring_images
+                    .fetch_or(1 << image_index, Ordering::Relaxed);
+                let header = file.header();
+                let write_count = header.write_count.load(Ordering::Relaxed);
+                header.presented_images[write_count as usize % header.presented_images.len()]
+                    .store(image_index, Ordering::Relaxed);
+                header
+                    .write_count
+                    .store(write_count.wrapping_add(1), Ordering::Release);
+                futex::wake_all(&header.write_count, true);
+                return;
+            }
+            &Output::Stream(fd) => {
+                let extent = self.computed_properties.extents;
+                let layout = self.computed_properties.get_subresource_layout(0, 0);
+                let row_size = extent.width as usize * self.computed_properties.block.size_in_bytes;
+                let memory = self.images[image_index as usize]
+                    .as_ptr()
+                    .add(layout.offset);
+                let result = if row_size == layout.row_pitch {
+                    write_all(
+                        fd,
+                        slice::from_raw_parts(memory, row_size * extent.height as usize),
+                    )
+                } else {
+                    (0..extent.height as usize).try_for_each(|y| {
+                        write_all(
+                            fd,
+                            slice::from_raw_parts(memory.add(y * layout.row_pitch), row_size),
+                        )
+                    })
+                };
+                if result.is_err() {
+                    self.lost.store(true, Ordering::Release);
+                }
+            }
+        }
+        self.available_images.release(image_index);
+        self.sync_group.signaled();
+    }
+}
+
+fn present_thread_main(state: &PresentState) {
+    loop {
+        let mut image_index = None;
+        state.sync_group.wait_until(None, || {
+            if state.shutting_down.load(Ordering::Acquire) {
+                return true;
+            }
+            image_index = state.present_queue.pop();
+            image_index.is_some()
+        });
+        match image_index {
+            Some(image_index) => unsafe { state.present(image_index) },
+            None => break,
+        }
+    }
+}
+
+/// releases images as the consumer returns them
+fn ring_thread_main(state: &PresentState, file: &MappedFile) {
+    let header = file.header();
+    let mut returned_count = header.read_count.load(Ordering::Acquire);
+    // only reported once, so a misbehaving consumer can't flood stderr
+    let mut reported_invalid_image = false;
+    loop {
+        let read_count = header.read_count.load(Ordering::Acquire);
+        while returned_count != read_count {
+            let image_index = header.presented_images
+                [returned_count as usize % header.presented_images.len()]
+            .load(Ordering::Relaxed);
+            returned_count = returned_count.wrapping_add(1);
+            // the header is writable by the consumer, so the index can't be trusted
+            let image_bit = 1u32.checked_shl(image_index).unwrap_or(0);
+            if state.ring_images.fetch_and(!image_bit, Ordering::Relaxed) & image_bit == 0 {
+                if !reported_invalid_image {
+                    reported_invalid_image = true;
+                    eprintln!(
+                        "ignoring images returned to the headless swapchain that the consumer \
+                         doesn't have, starting with image {}",
+                        image_index
+                    );
+                }
+                continue;
+            }
+            state.available_images.release(image_index);
+            state.sync_group.signaled();
+        }
+        if state.shutting_down.load(Ordering::Acquire) {
+            break;
+        }
+        futex::wait(&header.read_count, read_count, None, true);
+    }
+    state.ring_thread_stopped.store(true, Ordering::Release);
+}
+
+pub struct HeadlessSwapchain {
+    state: Arc<PresentState>,
+    present_thread: Option<thread::JoinHandle<()>>,
+    ring_thread: Option<thread::JoinHandle<()>>,
+    images: Vec<OwnedHandle<api::VkImage>>,
+    /// dropped after the images
+    device_memory: Vec<OwnedHandle<api::VkDeviceMemory>>,
+}
+
+// the images are only used through their handles, which the application synchronizes
+unsafe impl Send for HeadlessSwapchain {}
+unsafe impl Sync for HeadlessSwapchain {}
+
+impl fmt::Debug for HeadlessSwapchain {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("HeadlessSwapchain")
+            .field("image_count", &self.images.len())
+            .field(
+                "output",
+                &match self.state.output {
+                    Output::Discard => "discard",
+                    Output::Ring(_) => "ring",
+                    Output::Stream(_) => "stream",
+                },
+            )
+            .finish()
+    }
+}
+
+impl Swapchain for HeadlessSwapchain {
+    fn get_image_count(&self) -> u32 {
+        self.images.len() as u32
+    }
+    unsafe fn get_image(&self, image_index: u32) -> api::VkImage {
+        self.images[image_index as usize].get_handle()
+    }
+    unsafe fn acquire_next_image(&self, timeout: u64) -> Result<u32, api::VkResult> {
+        let state = &*self.state;
+        if state.lost.load(Ordering::Acquire) {
+            return Err(api::VK_ERROR_SURFACE_LOST_KHR);
+        }
+        let mut image_index = None;
+        if state.sync_group.wait_until(get_deadline(timeout), || {
+            image_index = state.available_images.take();
+            image_index.is_some()
+        }) {
+            Ok(image_index.unwrap())
+        } else if timeout == 0 {
+            Err(api::VK_NOT_READY)
+        } else {
+            Err(api::VK_TIMEOUT)
+        }
+    }
+    unsafe fn present(&self, image_index: u32) {
+        let state = &*self.state;
+        if image_index as usize >= self.images.len() {
+            eprintln!(
+                "ignoring presenting image {} of a headless swapchain with {} images",
+                image_index,
+                self.images.len()
+            );
+            return;
+        }
+        if let Some(replaced_image_index) = state.present_queue.push(image_index) {
+            state.available_images.release(replaced_image_index);
+        }
+        state.sync_group.signaled();
+    }
+}
+
+impl Drop for HeadlessSwapchain {
+    fn drop(&mut self) {
+        self.state.shutting_down.store(true, Ordering::Release);
+        self.state.sync_group.signaled();
+        // a panic was already reported by the thread, so don't panic again while dropping
+        if self.present_thread.take().unwrap().join().is_err() {
+            eprintln!("headless swapchain present thread panicked");
+        }
+        if let Some(ring_thread) = self.ring_thread.take() {
+            if let Output::Ring(file) = &self.state.output {
+                // it may have checked `shutting_down` just before waiting, so wake it until it
+                // stops
+                while !self.state.ring_thread_stopped.load(Ordering::Acquire) {
+                    futex::wake_all(&file.header().read_count, true);
+                    thread::yield_now();
+                }
+            }
+            if ring_thread.join().is_err() {
+                eprintln!("headless swapchain ring thread panicked");
+            }
+        }
+    }
+}
+
+impl HeadlessSwapchain {
+    unsafe fn new(
+        create_info: &api::VkSwapchainCreateInfoKHR,
+        device_group_create_info: Option<&api::VkDeviceGroupSwapchainCreateInfoKHR>,
+    ) -> Result<Self, api::VkResult> {
+        let output_fd = match env::var("KAZAN_HEADLESS_OUTPUT_FD") {
+            Err(_) => None,
+            Ok(fd) => Some(
+                fd.parse()
+                    .map_err(|_| api::VK_ERROR_INITIALIZATION_FAILED)?,
+            ),
+        };
+        Self::with_output_fd(create_info, device_group_create_info, output_fd)
+    }
+    /// writes the presented images to `output_fd`, or discards them if it's `None`
+    unsafe fn with_output_fd(
+        create_info: &api::VkSwapchainCreateInfoKHR,
+        device_group_create_info: Option<&api::VkDeviceGroupSwapchainCreateInfoKHR>,
+        output_fd: Option<c_int>,
+    ) -> Result<Self, api::VkResult> {
+        if let Some(device_group_create_info) = device_group_create_info {
+            assert_eq!(
+                device_group_create_info.modes,
+                api::VK_DEVICE_GROUP_PRESENT_MODE_LOCAL_BIT_KHR
+            );
+        }
+        let capabilities = HeadlessSurfaceImplementation.get_capabilities(create_info.surface)?;
+        assert!(create_info.minImageCount <= capabilities.maxImageCount);
+        let image_count = create_info.minImageCount as usize;
+        let image_properties = ImageProperties {
+            supported_tilings: SupportedTilings::Any,
+            format: create_info.imageFormat,
+            extents: api::VkExtent3D {
+                width: create_info.imageExtent.width,
+                height: create_info.imageExtent.height,
+                depth: 1,
+            },
+            array_layers: create_info.imageArrayLayers,
+            mip_levels: 1,
+            multisample_count: ImageMultisampleCount::Count1,
+            swapchain_present_tiling: Some(Tiling::Linear),
+        };
+        let computed_properties = image_properties.computed_properties();
+        let memory_layout = computed_properties.memory_layout;
+        let output = match output_fd {
+            None => Output::Discard,
+            Some(fd) => {
+                let mut stat: libc::stat = mem::zeroed();
+                if libc::fstat(fd, &mut stat) != 0 {
+                    return Err(api::VK_ERROR_INITIALIZATION_FAILED);
+                }
+                if stat.st_mode & libc::S_IFMT == libc::S_IFREG {
+                    let image_offset = round_up(mem::size_of::<RingHeader>(), RING_ALIGNMENT);
+                    let image_stride = round_up(
+                        memory_layout.size,
+                        cmp::max(RING_ALIGNMENT, memory_layout.alignment),
+                    );
+                    let file = MappedFile::new(fd, image_offset + image_stride * image_count)
+                        .map_err(|_| api::VK_ERROR_OUT_OF_HOST_MEMORY)?;
+                    let layout = computed_properties.get_subresource_layout(0, 0);
+                    let header = file.memory.as_ptr() as *mut RingHeader;
+                    header.write(RingHeader {
+                        magic: RING_MAGIC,
+                        version: RING_VERSION,
+                        image_count: image_count as u32,
+                        format: create_info.imageFormat,
+                        width: create_info.imageExtent.width,
+                        height: create_info.imageExtent.height,
+                        row_pitch: layout.row_pitch as u32,
+                        _padding: 0,
+                        image_offset: image_offset as u64,
+                        image_stride: image_stride as u64,
+                        presented_images: Default::default(),
+                        write_count: AtomicU32::new(0),
+                        read_count: AtomicU32::new(0),
+                    });
+                    Output::Ring(Arc::new(file))
+                } else {
+                    Output::Stream(fd)
+                }
+            }
+        };
+        let mut device_memory = Vec::with_capacity(image_count);
+        let mut images = Vec::with_capacity(image_count);
+        let mut image_memory = Vec::with_capacity(image_count);
+        for image_index in 0..image_count {
+            let memory = match &output {
+                Output::Ring(file) => {
+                    let header = file.header();
+                    DeviceMemory::Special(Box::new(RingDeviceMemory {
+                        file: file.clone(),
+                        offset: (header.image_offset + header.image_stride * image_index as u64)
+                            as usize,
+                        layout: memory_layout,
+                    }))
+                }
+                Output::Discard | Output::Stream(_) => {
+                    DeviceMemory::allocate_from_default_heap(memory_layout)
+                        .map_err(|_| api::VK_ERROR_OUT_OF_HOST_MEMORY)?
+                }
+            };
+            let memory = OwnedHandle::<api::VkDeviceMemory>::new(memory);
+            image_memory.push(memory.get());
+            images.push(OwnedHandle::<api::VkImage>::new(Image {
+                properties: image_properties,
+                memory: Some(ImageMemory {
+                    device_memory: SharedHandle::from(memory.get_handle()).unwrap(),
+                    offset: 0,
+                }),
+            }));
+            device_memory.push(memory);
+        }
+        let state = Arc::new(PresentState {
+            output,
+            computed_properties,
+            images: image_memory,
+            sync_group: SyncGroup::new(),
+            available_images: AvailableImages::new(image_count as u32),
+            present_queue: PresentQueue::new(create_info.presentMode),
+            ring_images: AtomicU32::new(0),
+            lost: AtomicBool::new(false),
+            shutting_down: AtomicBool::new(false),
+            ring_thread_stopped: AtomicBool::new(false),
+        });
+        let present_thread = {
+            let state = state.clone();
+            thread::Builder::new()
+                .name("kazan present".into())
+                .spawn(move || present_thread_main(&state))
+                .expect("can't create present thread")
+        };
+        let ring_thread = match &state.output {
+            Output::Ring(file) => {
+                let state = state.clone();
+                let file = file.clone();
+                Some(
+                    thread::Builder::new()
+                        .name("kazan headless ring".into())
+                        .spawn(move || ring_thread_main(&state, &file))
+                        .expect("can't create headless ring thread"),
+                )
+            }
+            Output::Discard | Output::Stream(_) => None,
+        };
+        Ok(Self {
+            state,
+            present_thread: Some(present_thread),
+            ring_thread,
+            images,
+            device_memory,
+        })
+    }
+}
+
+#[derive(Debug)]
+pub struct HeadlessSurfaceImplementation;
+
+impl SurfaceImplementation for HeadlessSurfaceImplementation {
+    fn get_platform(&self) -> SurfacePlatform {
+        SurfacePlatform::VK_ICD_WSI_PLATFORM_HEADLESS
+    }
+    unsafe fn get_surface_formats(
+        &self,
+        _surface: api::VkSurfaceKHR,
+    ) -> Result<Cow<'static, [api::VkSurfaceFormatKHR]>, api::VkResult> {
+        const SURFACE_FORMATS: &[api::VkSurfaceFormatKHR] = &[
+            api::VkSurfaceFormatKHR {
+                format: api::VK_FORMAT_B8G8R8A8_SRGB,
+                colorSpace: api::VK_COLOR_SPACE_SRGB_NONLINEAR_KHR,
+            },
+            api::VkSurfaceFormatKHR {
+                format: api::VK_FORMAT_B8G8R8A8_UNORM,
+                colorSpace: api::VK_COLOR_SPACE_SRGB_NONLINEAR_KHR,
+            },
+            api::VkSurfaceFormatKHR {
+                format: api::VK_FORMAT_R8G8B8A8_SRGB,
+                colorSpace: api::VK_COLOR_SPACE_SRGB_NONLINEAR_KHR,
+            },
+            api::VkSurfaceFormatKHR {
+                format: api::VK_FORMAT_R8G8B8A8_UNORM,
+                colorSpace: api::VK_COLOR_SPACE_SRGB_NONLINEAR_KHR,
+            },
+        ];
+        Ok(Cow::Borrowed(SURFACE_FORMATS))
+    }
+    unsafe fn get_present_modes(
+        &self,
+        _surface: api::VkSurfaceKHR,
+    ) -> Result<Cow<'static, [api::VkPresentModeKHR]>, api::VkResult> {
+        // there is no vertical blanking, so IMMEDIATE would be the same as FIFO
+        const PRESENT_MODES: &[api::VkPresentModeKHR] = &[
+            api::VK_PRESENT_MODE_FIFO_KHR,
+            api::VK_PRESENT_MODE_MAILBOX_KHR,
+        ];
+        Ok(Cow::Borrowed(PRESENT_MODES))
+    }
+    unsafe fn get_capabilities(
+        &self,
+        _surface: api::VkSurfaceKHR,
+    ) -> Result<api::VkSurfaceCapabilitiesKHR, api::VkResult> {
+        const MAX_IMAGE_EXTENT: u32 = 16384;
+        Ok(api::VkSurfaceCapabilitiesKHR {
+            minImageCount: 2,
+            maxImageCount: MAX_SWAPCHAIN_IMAGE_COUNT,
+            // the swapchain decides the size
+            currentExtent: api::VkExtent2D {
+                width: !0,
+                height: !0,
+            },
+            minImageExtent: api::VkExtent2D {
+                width: 1,
+                height: 1,
+            },
+            maxImageExtent: api::VkExtent2D {
+                width: MAX_IMAGE_EXTENT,
+                height: MAX_IMAGE_EXTENT,
+            },
+            maxImageArrayLayers: 1,
+            supportedTransforms: api::VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR,
+            currentTransform: api::VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR,
+            supportedCompositeAlpha: api::VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
+            supportedUsageFlags: api::VK_IMAGE_USAGE_TRANSFER_SRC_BIT
+                | api::VK_IMAGE_USAGE_TRANSFER_DST_BIT
+                | api::VK_IMAGE_USAGE_SAMPLED_BIT
+                | api::VK_IMAGE_USAGE_STORAGE_BIT
+                | api::VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
+                | api::VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT,
+        })
+    }
+    unsafe fn build(
+        &self,
+        create_info: &api::VkSwapchainCreateInfoKHR,
+        device_group_create_info: Option<&api::VkDeviceGroupSwapchainCreateInfoKHR>,
+    ) -> Result<Box<Swapchain>, api::VkResult> {
+        Ok(Box::new(HeadlessSwapchain::new(
+            create_info,
+            device_group_create_info,
+        )?))
+    }
+    unsafe fn destroy_surface(&self, surface: NonNull<api::VkIcdSurfaceBase>) {
+        Box::from_raw(surface.as_ptr() as *mut api::VkIcdSurfaceHeadless);
+    }
+    fn duplicate(&self) -> Box<dyn SurfaceImplementation> {
+        Box::new(Self {})
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::fs::OpenOptions;
+    use std::os::unix::io::AsRawFd;
+
+    #[test]
+    fn test_ring() {
+        let path = env::temp_dir().join(format!("kazan-test-ring-{}", std::process::id()));
+        let file = OpenOptions::new()
+            .read(true)
+            .write(true)
+            .create(true)
+            .truncate(true)
+            .open(&path)
+            .unwrap();
+        std::fs::remove_file(&path).unwrap();
+        unsafe {
+            let mut create_info: api::VkSwapchainCreateInfoKHR = mem::zeroed();
+            create_info.minImageCount = 2;
+            create_info.imageFormat = api::VK_FORMAT_B8G8R8A8_UNORM;
+            create_info.imageExtent = api::VkExtent2D {
+                width: 4,
+                height: 2,
+            };
+            create_info.imageArrayLayers = 1;
+            create_info.presentMode = api::VK_PRESENT_MODE_FIFO_KHR;
+            let swapchain =
+                HeadlessSwapchain::with_output_fd(&create_info, None, Some(file.as_raw_fd()))
+                    .unwrap();
+            let header = match &swapchain.state.output {
+                Output::Ring(file) => file.header(),
+                _ => unreachable!(),
+            };
+            assert_eq!((header.magic, header.image_count), (RING_MAGIC, 2));
+            assert_eq!(swapchain.acquire_next_image(0), Ok(0));
+            assert_eq!(swapchain.acquire_next_image(0), Ok(1));
+            assert_eq!(swapchain.acquire_next_image(0), Err(api::VK_NOT_READY));
+            swapchain.present(1);
+            while header.write_count.load(Ordering::Acquire) == 0 {
+                futex::wait(&header.write_count, 0, None, true);
+            }
+            assert_eq!(header.presented_images[0].load(Ordering::Relaxed), 1);
+            // the second image returned was never presented, so it's ignored
+            header.read_count.store(2, Ordering::Release);
+            futex::wake_all(&header.read_count, true);
+            assert_eq!(swapchain.acquire_next_image(!0), Ok(1));
+            assert_eq!(swapchain.acquire_next_image(0), Err(api::VK_NOT_READY));
+            // out of range
+            swapchain.present(5);
+            drop(swapchain);
+        }
+    }
+}
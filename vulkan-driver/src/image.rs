@@ -6,8 +6,256 @@
 )]
 use api;
 use constants::IMAGE_ALIGNMENT;
-use device_memory::DeviceMemoryLayout;
+use device_memory::{DeviceMemoryAllocation, DeviceMemoryLayout};
 use handle::SharedHandle;
+use std::cmp;
+use transfer;
+
+/// log2 of the width and height of a tile in texel blocks.
+/// texel blocks in a tile are stored in Morton order, so each aligned 4x4 block (a micro-tile) is
+/// contiguous and fills a cache line for 4-byte formats, and the micro-tiles themselves are in Morton order
+pub const TILE_SIZE_LOG2: u32 = 4;
+
+pub const TILE_SIZE: u32 = 1 << TILE_SIZE_LOG2;
+
+const TILE_BLOCK_COUNT: usize = 1 << (2 * TILE_SIZE_LOG2);
+
+/// spread the bits of `v` apart so there is a zero bit between each of them
+fn morton_spread(v: u32) -> u32 {
+    debug_assert!(v < TILE_SIZE);
+    let v = (v | v << 2) & 0x33;
+    (v | v << 1) & 0x55
+}
+
+/// index of the texel block at (`x`, `y`) within a tile
+#[inline]
+fn get_tile_block_index(x: u32, y: u32) -> usize {
+    (morton_spread(x) | morton_spread(y) << 1) as usize
+}
+
+fn align_up(v: usize, alignment: usize) -> usize {
+    debug_assert!(alignment.is_power_of_two());
+    v.checked_add(alignment - 1).unwrap() & !(alignment - 1)
+}
+
+/// the smallest unit of a format that can be addressed:
+/// a single texel for uncompressed formats or a compressed block
+#[derive(Copy, Clone, Eq, PartialEq, Hash, Debug)]
+pub struct FormatBlock {
+    pub width: u32,
+    pub height: u32,
+    pub size_in_bytes: usize,
+}
+
+impl FormatBlock {
+    /// returns `None` for `VK_FORMAT_UNDEFINED` and multi-planar formats
+    pub fn get(format: api::VkFormat) -> Option<Self> {
+        let (width, height, size_in_bytes) = match format {
+            api::VK_FORMAT_R4G4_UNORM_PACK8
+            | api::VK_FORMAT_R8_UNORM
+            | api::VK_FORMAT_R8_SNORM
+            | api::VK_FORMAT_R8_USCALED
+            | api::VK_FORMAT_R8_SSCALED
+            | api::VK_FORMAT_R8_UINT
+            | api::VK_FORMAT_R8_SINT
+            | api::VK_FORMAT_R8_SRGB
+            | api::VK_FORMAT_S8_UINT => (1, 1, 1),
+            api::VK_FORMAT_R4G4B4A4_UNORM_PACK16
+            | api::VK_FORMAT_B4G4R4A4_UNORM_PACK16
+            | api::VK_FORMAT_R5G6B5_UNORM_PACK16
+            | api::VK_FORMAT_B5G6R5_UNORM_PACK16
+            | api::VK_FORMAT_R5G5B5A1_UNORM_PACK16
+            | api::VK_FORMAT_B5G5R5A1_UNORM_PACK16
+            | api::VK_FORMAT_A1R5G5B5_UNORM_PACK16
+            | api::VK_FORMAT_R8G8_UNORM
+            | api::VK_FORMAT_R8G8_SNORM
+            | api::VK_FORMAT_R8G8_USCALED
+            | api::VK_FORMAT_R8G8_SSCALED
+            | api::VK_FORMAT_R8G8_UINT
+            | api::VK_FORMAT_R8G8_SINT
+            | api::VK_FORMAT_R8G8_SRGB
+            | api::VK_FORMAT_R16_UNORM
+            | api::VK_FORMAT_R16_SNORM
+            | api::VK_FORMAT_R16_USCALED
+            | api::VK_FORMAT_R16_SSCALED
+            | api::VK_FORMAT_R16_UINT
+            | api::VK_FORMAT_R16_SINT
+            | api::VK_FORMAT_R16_SFLOAT
+            | api::VK_FORMAT_D16_UNORM
+            | api::VK_FORMAT_R10X6_UNORM_PACK16
+            | api::VK_FORMAT_R12X4_UNORM_PACK16 => (1, 1, 2),
+            api::VK_FORMAT_R8G8B8_UNORM
+            | api::VK_FORMAT_R8G8B8_SNORM
+            | api::VK_FORMAT_R8G8B8_USCALED
+            | api::VK_FORMAT_R8G8B8_SSCALED
+            | api::VK_FORMAT_R8G8B8_UINT
+            | api::VK_FORMAT_R8G8B8_SINT
+            | api::VK_FORMAT_R8G8B8_SRGB
+            | api::VK_FORMAT_B8G8R8_UNORM
+            | api::VK_FORMAT_B8G8R8_SNORM
+            | api::VK_FORMAT_B8G8R8_USCALED
+            | api::VK_FORMAT_B8G8R8_SSCALED
+            | api::VK_FORMAT_B8G8R8_UINT
+            | api::VK_FORMAT_B8G8R8_SINT
+            | api::VK_FORMAT_B8G8R8_SRGB => (1, 1, 3),
+            api::VK_FORMAT_R8G8B8A8_UNORM
+            | api::VK_FORMAT_R8G8B8A8_SNORM
+            | api::VK_FORMAT_R8G8B8A8_USCALED
+            | api::VK_FORMAT_R8G8B8A8_SSCALED
+            | api::VK_FORMAT_R8G8B8A8_UINT
+            | api::VK_FORMAT_R8G8B8A8_SINT
+            | api::VK_FORMAT_R8G8B8A8_SRGB
+            | api::VK_FORMAT_B8G8R8A8_UNORM
+            | api::VK_FORMAT_B8G8R8A8_SNORM
+            | api::VK_FORMAT_B8G8R8A8_USCALED
+            | api::VK_FORMAT_B8G8R8A8_SSCALED
+            | api::VK_FORMAT_B8G8R8A8_UINT
+            | api::VK_FORMAT_B8G8R8A8_SINT
+            | api::VK_FORMAT_B8G8R8A8_SRGB
+            | api::VK_FORMAT_A8B8G8R8_UNORM_PACK32
+            | api::VK_FORMAT_A8B8G8R8_SNORM_PACK32
+            | api::VK_FORMAT_A8B8G8R8_USCALED_PACK32
+            | api::VK_FORMAT_A8B8G8R8_SSCALED_PACK32
+            | api::VK_FORMAT_A8B8G8R8_UINT_PACK32
+            | api::VK_FORMAT_A8B8G8R8_SINT_PACK32
+            | api::VK_FORMAT_A8B8G8R8_SRGB_PACK32
+            | api::VK_FORMAT_A2R10G10B10_UNORM_PACK32
+            | api::VK_FORMAT_A2R10G10B10_SNORM_PACK32
+            | api::VK_FORMAT_A2R10G10B10_USCALED_PACK32
+            | api::VK_FORMAT_A2R10G10B10_SSCALED_PACK32
+            | api::VK_FORMAT_A2R10G10B10_UINT_PACK32
+            | api::VK_FORMAT_A2R10G10B10_SINT_PACK32
+            | api::VK_FORMAT_A2B10G10R10_UNORM_PACK32
+            | api::VK_FORMAT_A2B10G10R10_SNORM_PACK32
+            | api::VK_FORMAT_A2B10G10R10_USCALED_PACK32
+            | api::VK_FORMAT_A2B10G10R10_SSCALED_PACK32
+            | api::VK_FORMAT_A2B10G10R10_UINT_PACK32
+            | api::VK_FORMAT_A2B10G10R10_SINT_PACK32
+            | api::VK_FORMAT_R16G16_UNORM
+            | api::VK_FORMAT_R16G16_SNORM
+            | api::VK_FORMAT_R16G16_USCALED
+            | api::VK_FORMAT_R16G16_SSCALED
+            | api::VK_FORMAT_R16G16_UINT
+            | api::VK_FORMAT_R16G16_SINT
+            | api::VK_FORMAT_R16G16_SFLOAT
+            | api::VK_FORMAT_R32_UINT
+            | api::VK_FORMAT_R32_SINT
+            | api::VK_FORMAT_R32_SFLOAT
+            | api::VK_FORMAT_B10G11R11_UFLOAT_PACK32
+            | api::VK_FORMAT_E5B9G9R9_UFLOAT_PACK32
+            | api::VK_FORMAT_X8_D24_UNORM_PACK32
+            | api::VK_FORMAT_D32_SFLOAT
+            | api::VK_FORMAT_D24_UNORM_S8_UINT
+            | api::VK_FORMAT_R10X6G10X6_UNORM_2PACK16
+            | api::VK_FORMAT_R12X4G12X4_UNORM_2PACK16 => (1, 1, 4),
+            // the stencil value is stored in the padding after the depth value
+            api::VK_FORMAT_D16_UNORM_S8_UINT => (1, 1, 4),
+            api::VK_FORMAT_R16G16B16_UNORM
+            | api::VK_FORMAT_R16G16B16_SNORM
+            | api::VK_FORMAT_R16G16B16_USCALED
+            | api::VK_FORMAT_R16G16B16_SSCALED
+            | api::VK_FORMAT_R16G16B16_UINT
+            | api::VK_FORMAT_R16G16B16_SINT
+            | api::VK_FORMAT_R16G16B16_SFLOAT => (1, 1, 6),
+            api::VK_FORMAT_R16G16B16A16_UNORM
+            | api::VK_FORMAT_R16G16B16A16_SNORM
+            | api::VK_FORMAT_R16G16B16A16_USCALED
+            | api::VK_FORMAT_R16G16B16A16_SSCALED
+            | api::VK_FORMAT_R16G16B16A16_UINT
+            | api::VK_FORMAT_R16G16B16A16_SINT
+            | api::VK_FORMAT_R16G16B16A16_SFLOAT
+            | api::VK_FORMAT_R32G32_UINT
+            | api::VK_FORMAT_R32G32_SINT
+            | api::VK_FORMAT_R32G32_SFLOAT
+            | api::VK_FORMAT_R64_UINT
+            | api::VK_FORMAT_R64_SINT
+            | api::VK_FORMAT_R64_SFLOAT
+            | api::VK_FORMAT_D32_SFLOAT_S8_UINT
+            | api::VK_FORMAT_R10X6G10X6B10X6A10X6_UNORM_4PACK16
+            | api::VK_FORMAT_R12X4G12X4B12X4A12X4_UNORM_4PACK16 => (1, 1, 8),
+            api::VK_FORMAT_R32G32B32_UINT
+            | api::VK_FORMAT_R32G32B32_SINT
+            | api::VK_FORMAT_R32G32B32_SFLOAT => (1, 1, 12),
+            api::VK_FORMAT_R32G32B32A32_UINT
+            | api::VK_FORMAT_R32G32B32A32_SINT
+            | api::VK_FORMAT_R32G32B32A32_SFLOAT
+            | api::VK_FORMAT_R64G64_UINT
+            | api::VK_FORMAT_R64G64_SINT
+            | api::VK_FORMAT_R64G64_SFLOAT => (1, 1, 16),
+            api::VK_FORMAT_R64G64B64_UINT
+            | api::VK_FORMAT_R64G64B64_SINT
+            | api::VK_FORMAT_R64G64B64_SFLOAT => (1, 1, 24),
+            api::VK_FORMAT_R64G64B64A64_UINT
+            | api::VK_FORMAT_R64G64B64A64_SINT
+            | api::VK_FORMAT_R64G64B64A64_SFLOAT => (1, 1, 32),
+            api::VK_FORMAT_G8B8G8R8_422_UNORM | api::VK_FORMAT_B8G8R8G8_422_UNORM => (2, 1, 4),
+            api::VK_FORMAT_G10X6B10X6G10X6R10X6_422_UNORM_4PACK16
+            | api::VK_FORMAT_B10X6G10X6R10X6G10X6_422_UNORM_4PACK16
+            | api::VK_FORMAT_G12X4B12X4G12X4R12X4_422_UNORM_4PACK16
+            | api::VK_FORMAT_B12X4G12X4R12X4G12X4_422_UNORM_4PACK16
+            | api::VK_FORMAT_G16B16G16R16_422_UNORM
+            | api::VK_FORMAT_B16G16R16G16_422_UNORM => (2, 1, 8),
+            api::VK_FORMAT_BC1_RGB_UNORM_BLOCK
+            | api::VK_FORMAT_BC1_RGB_SRGB_BLOCK
+            | api::VK_FORMAT_BC1_RGBA_UNORM_BLOCK
+            | api::VK_FORMAT_BC1_RGBA_SRGB_BLOCK
+            | api::VK_FORMAT_BC4_UNORM_BLOCK
+            | api::VK_FORMAT_BC4_SNORM_BLOCK
+            | api::VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK
+            | api::VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK
+            | api::VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK
+            | api::VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK
+            | api::VK_FORMAT_EAC_R11_UNORM_BLOCK
+            | api::VK_FORMAT_EAC_R11_SNORM_BLOCK => (4, 4, 8),
+            api::VK_FORMAT_BC2_UNORM_BLOCK
+            | api::VK_FORMAT_BC2_SRGB_BLOCK
+            | api::VK_FORMAT_BC3_UNORM_BLOCK
+            | api::VK_FORMAT_BC3_SRGB_BLOCK
+            | api::VK_FORMAT_BC5_UNORM_BLOCK
+            | api::VK_FORMAT_BC5_SNORM_BLOCK
+            | api::VK_FORMAT_BC6H_UFLOAT_BLOCK
+            | api::VK_FORMAT_BC6H_SFLOAT_BLOCK
+            | api::VK_FORMAT_BC7_UNORM_BLOCK
+            | api::VK_FORMAT_BC7_SRGB_BLOCK
+            | api::VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK
+            | api::VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK
+            | api::VK_FORMAT_EAC_R11G11_UNORM_BLOCK
+            | api::VK_FORMAT_EAC_R11G11_SNORM_BLOCK => (4, 4, 16),
+            api::VK_FORMAT_ASTC_4x4_UNORM_BLOCK | api::VK_FORMAT_ASTC_4x4_SRGB_BLOCK => (4, 4, 16),
+            api::VK_FORMAT_ASTC_5x4_UNORM_BLOCK | api::VK_FORMAT_ASTC_5x4_SRGB_BLOCK => (5, 4, 16),
+            api::VK_FORMAT_ASTC_5x5_UNORM_BLOCK | api::VK_FORMAT_ASTC_5x5_SRGB_BLOCK => (5, 5, 16),
+            api::VK_FORMAT_ASTC_6x5_UNORM_BLOCK | api::VK_FORMAT_ASTC_6x5_SRGB_BLOCK => (6, 5, 16),
+            api::VK_FORMAT_ASTC_6x6_UNORM_BLOCK | api::VK_FORMAT_ASTC_6x6_SRGB_BLOCK => (6, 6, 16),
+            api::VK_FORMAT_ASTC_8x5_UNORM_BLOCK | api::VK_FORMAT_ASTC_8x5_SRGB_BLOCK => (8, 5, 16),
+            api::VK_FORMAT_ASTC_8x6_UNORM_BLOCK | api::VK_FORMAT_ASTC_8x6_SRGB_BLOCK => (8, 6, 16),
+            api::VK_FORMAT_ASTC_8x8_UNORM_BLOCK | api::VK_FORMAT_ASTC_8x8_SRGB_BLOCK => (8, 8, 16),
+            api::VK_FORMAT_ASTC_10x5_UNORM_BLOCK | api::VK_FORMAT_ASTC_10x5_SRGB_BLOCK => {
+                (10, 5, 16)
+            }
+            api::VK_FORMAT_ASTC_10x6_UNORM_BLOCK | api::VK_FORMAT_ASTC_10x6_SRGB_BLOCK => {
+                (10, 6, 16)
+            }
+            api::VK_FORMAT_ASTC_10x8_UNORM_BLOCK | api::VK_FORMAT_ASTC_10x8_SRGB_BLOCK => {
+                (10, 8, 16)
+            }
+            api::VK_FORMAT_ASTC_10x10_UNORM_BLOCK | api::VK_FORMAT_ASTC_10x10_SRGB_BLOCK => {
+                (10, 10, 16)
+            }
+            api::VK_FORMAT_ASTC_12x10_UNORM_BLOCK | api::VK_FORMAT_ASTC_12x10_SRGB_BLOCK => {
+                (12, 10, 16)
+            }
+            api::VK_FORMAT_ASTC_12x12_UNORM_BLOCK | api::VK_FORMAT_ASTC_12x12_SRGB_BLOCK => {
+                (12, 12, 16)
+            }
+            _ => return None,
+        };
+        Some(FormatBlock {
+            width,
+            height,
+            size_in_bytes,
+        })
+    }
+}
 
 #[derive(Copy, Clone, Eq, PartialEq, Hash, Debug)]
 pub enum SupportedTilings {
@@ -18,7 +266,7 @@ pub enum SupportedTilings {
 #[derive(Copy, Clone, Eq, PartialEq, Hash, Debug)]
 pub enum Tiling {
     Linear,
-    #[allow(dead_code)]
+    /// rows of `TILE_SIZE` by `TILE_SIZE` tiles
     Tiled,
 }
 
@@ -28,6 +276,15 @@ pub enum ImageMultisampleCount {
     Count4,
 }
 
+impl ImageMultisampleCount {
+    pub fn get(self) -> usize {
+        match self {
+            ImageMultisampleCount::Count1 => 1,
+            ImageMultisampleCount::Count4 => 4,
+        }
+    }
+}
+
 #[derive(Copy, Clone, Debug)]
 pub struct ImageProperties {
     pub supported_tilings: SupportedTilings,
@@ -39,42 +296,361 @@ pub struct ImageProperties {
     pub swapchain_present_tiling: Option<Tiling>,
 }
 
+/// the memory layout of one mip level of one array layer
+#[derive(Copy, Clone, Debug)]
+pub struct SubresourceLayout {
+    pub block: FormatBlock,
+    pub tiling: Tiling,
+    /// bytes from the start of the image
+    pub offset: usize,
+    pub size: usize,
+    pub width_in_blocks: u32,
+    pub height_in_blocks: u32,
+    pub depth: u32,
+    /// bytes from one row of texel blocks to the next for `Tiling::Linear`,
+    /// or from one row of tiles to the next for `Tiling::Tiled`
+    pub row_pitch: usize,
+    /// bytes from one depth slice to the next
+    pub depth_pitch: usize,
+}
+
+impl SubresourceLayout {
+    fn new(block: FormatBlock, tiling: Tiling, extents: api::VkExtent3D, mip_level: u32) -> Self {
+        let get_mip_size = |v: u32, block_size: u32| {
+            let v = cmp::max(v >> mip_level, 1);
+            (v + block_size - 1) / block_size
+        };
+        let width_in_blocks = get_mip_size(extents.width, block.width);
+        let height_in_blocks = get_mip_size(extents.height, block.height);
+        let depth = get_mip_size(extents.depth, 1);
+        let (row_pitch, row_count) = match tiling {
+            Tiling::Linear => (
+                block
+                    .size_in_bytes
+                    .checked_mul(width_in_blocks as usize)
+                    .unwrap(),
+                height_in_blocks as usize,
+            ),
+            Tiling::Tiled => {
+                let round_up_to_tiles =
+                    |v: u32| (v as usize + TILE_SIZE as usize - 1) >> TILE_SIZE_LOG2;
+                (
+                    (TILE_BLOCK_COUNT * block.size_in_bytes)
+                        .checked_mul(round_up_to_tiles(width_in_blocks))
+                        .unwrap(),
+                    round_up_to_tiles(height_in_blocks),
+                )
+            }
+        };
+        let depth_pitch = row_pitch.checked_mul(row_count).unwrap();
+        Self {
+            block,
+            tiling,
+            offset: 0,
+            size: depth_pitch.checked_mul(depth as usize).unwrap(),
+            width_in_blocks,
+            height_in_blocks,
+            depth,
+            row_pitch,
+            depth_pitch,
+        }
+    }
+    /// byte offset from the start of the image of the texel block at (`x`, `y`, `z`),
+    /// where `x` and `y` are in texel blocks
+    pub fn get_block_offset(&self, x: u32, y: u32, z: u32) -> usize {
+        let slice_offset = self.offset + z as usize * self.depth_pitch;
+        match self.tiling {
+            Tiling::Linear => {
+                slice_offset + y as usize * self.row_pitch + x as usize * self.block.size_in_bytes
+            }
+            Tiling::Tiled => {
+                let tile_offset = (y >> TILE_SIZE_LOG2) as usize * self.row_pitch
+                    + (x >> TILE_SIZE_LOG2) as usize * TILE_BLOCK_COUNT * self.block.size_in_bytes;
+                let block_index = get_tile_block_index(x % TILE_SIZE, y % TILE_SIZE);
+                slice_offset + tile_offset + block_index * self.block.size_in_bytes
+            }
+        }
+    }
+    /// converts a region in texels to `(x, y, width, height)` in texel blocks,
+    /// panicking if it's not inside this subresource
+    pub fn get_block_region(
+        &self,
+        offset: api::VkOffset3D,
+        extent: api::VkExtent3D,
+    ) -> (u32, u32, u32, u32) {
+        assert!(offset.x >= 0 && offset.y >= 0 && offset.z >= 0);
+        // offsets are in texels, but are required to be a multiple of the block size
+        let block_x = offset.x as u32 / self.block.width;
+        let block_y = offset.y as u32 / self.block.height;
+        let width_in_blocks = (extent.width + self.block.width - 1) / self.block.width;
+        let height_in_blocks = (extent.height + self.block.height - 1) / self.block.height;
+        assert!(block_x + width_in_blocks <= self.width_in_blocks);
+        assert!(block_y + height_in_blocks <= self.height_in_blocks);
+        assert!(offset.z as u32 + extent.depth <= self.depth);
+        (block_x, block_y, width_in_blocks, height_in_blocks)
+    }
+    /// calls `f` with the image offset, the linear offset and the length in texel blocks of every
+    /// run of texel blocks that is contiguous in both layouts.
+    /// runs in tiled images are at most 2 blocks, since only horizontal pairs are adjacent in Morton order
+    fn for_each_run<F: FnMut(usize, usize, u32)>(
+        &self,
+        offset: api::VkOffset3D,
+        extent: api::VkExtent3D,
+        linear_row_pitch: usize,
+        linear_depth_pitch: usize,
+        mut f: F,
+    ) {
+        let (block_x, block_y, width_in_blocks, height_in_blocks) =
+            self.get_block_region(offset, extent);
+        for z in 0..extent.depth {
+            for y in 0..height_in_blocks {
+                let linear_row_offset =
+                    z as usize * linear_depth_pitch + y as usize * linear_row_pitch;
+                if self.tiling == Tiling::Linear {
+                    f(
+                        self.get_block_offset(block_x, block_y + y, offset.z as u32 + z),
+                        linear_row_offset,
+                        width_in_blocks,
+                    );
+                    continue;
+                }
+                let mut x = 0;
+                while x < width_in_blocks {
+                    let run_length = if (block_x + x) % 2 == 0 && x + 1 < width_in_blocks {
+                        2
+                    } else {
+                        1
+                    };
+                    f(
+                        self.get_block_offset(block_x + x, block_y + y, offset.z as u32 + z),
+                        linear_row_offset + x as usize * self.block.size_in_bytes,
+                        run_length,
+                    );
+                    x += run_length;
+                }
+            }
+        }
+    }
+    /// the number of tiles in each row and column, counting partial tiles.
+    /// linear images are split into tiles of the same size, although their tiles aren't contiguous
+    pub fn get_tile_counts(&self) -> (u32, u32) {
+        let round_up_to_tiles = |v: u32| (v + TILE_SIZE - 1) >> TILE_SIZE_LOG2;
+        (
+            round_up_to_tiles(self.width_in_blocks),
+            round_up_to_tiles(self.height_in_blocks),
+        )
+    }
+    /// fill every texel block of a tile with `pattern`, which is one texel block.
+    /// a tile of a tiled image is a single fill, including the padding past the edges of the image
+    pub unsafe fn fill_tile(
+        &self,
+        image_memory: *mut u8,
+        tile_x: u32,
+        tile_y: u32,
+        z: u32,
+        pattern: &[u8],
+    ) {
+        debug_assert_eq!(pattern.len(), self.block.size_in_bytes);
+        let x = tile_x << TILE_SIZE_LOG2;
+        let y = tile_y << TILE_SIZE_LOG2;
+        match self.tiling {
+            Tiling::Linear => {
+                let width = cmp::min(TILE_SIZE, self.width_in_blocks - x);
+                for y in y..cmp::min(y + TILE_SIZE, self.height_in_blocks) {
+                    transfer::fill_memory(
+                        image_memory.add(self.get_block_offset(x, y, z)),
+                        width as usize * self.block.size_in_bytes,
+                        pattern,
+                    );
+                }
+            }
+            Tiling::Tiled => transfer::fill_memory(
+                image_memory.add(self.get_block_offset(x, y, z)),
+                TILE_BLOCK_COUNT * self.block.size_in_bytes,
+                pattern,
+            ),
+        }
+    }
+    /// fill the `extent` texels at `offset` with `pattern`, which is one texel block
+    pub unsafe fn fill_region(
+        &self,
+        image_memory: *mut u8,
+        offset: api::VkOffset3D,
+        extent: api::VkExtent3D,
+        pattern: &[u8],
+    ) {
+        debug_assert_eq!(pattern.len(), self.block.size_in_bytes);
+        let block_size = self.block.size_in_bytes;
+        self.for_each_run(offset, extent, 0, 0, |image_offset, _, run_length| {
+            transfer::fill_memory(
+                image_memory.add(image_offset),
+                run_length as usize * block_size,
+                pattern,
+            );
+        });
+    }
+    /// like `fill_region`, except only the bytes of each texel block where `mask` is nonzero
+    /// are written
+    pub unsafe fn fill_region_masked(
+        &self,
+        image_memory: *mut u8,
+        offset: api::VkOffset3D,
+        extent: api::VkExtent3D,
+        pattern: &[u8],
+        mask: &[u8],
+    ) {
+        debug_assert_eq!(pattern.len(), self.block.size_in_bytes);
+        debug_assert_eq!(mask.len(), self.block.size_in_bytes);
+        let block_size = self.block.size_in_bytes;
+        self.for_each_run(offset, extent, 0, 0, |image_offset, _, run_length| {
+            for block in 0..run_length as usize {
+                let block = image_memory.add(image_offset + block * block_size);
+                for (index, (&value, &mask)) in pattern.iter().zip(mask).enumerate() {
+                    if mask != 0 {
+                        *block.add(index) = value;
+                    }
+                }
+            }
+        });
+    }
+    /// the number of bytes of linear memory that `copy_from_linear` and `copy_to_linear` access
+    pub fn get_linear_size(
+        &self,
+        extent: api::VkExtent3D,
+        linear_row_pitch: usize,
+        linear_depth_pitch: usize,
+    ) -> usize {
+        let width_in_blocks = (extent.width + self.block.width - 1) / self.block.width;
+        let height_in_blocks = (extent.height + self.block.height - 1) / self.block.height;
+        if width_in_blocks == 0 || height_in_blocks == 0 || extent.depth == 0 {
+            return 0;
+        }
+        (extent.depth as usize - 1) * linear_depth_pitch
+            + (height_in_blocks as usize - 1) * linear_row_pitch
+            + width_in_blocks as usize * self.block.size_in_bytes
+    }
+    /// copy the `extent` texels at `offset` in `image_memory` from `linear`,
+    /// which has rows of texel blocks `linear_row_pitch` bytes apart and depth slices `linear_depth_pitch` apart.
+    /// used for buffer to image copies and for uploading linear data into tiled images.
+    ///
+    /// `image_memory` must point to the start of the image, and `linear` to at least
+    /// `get_linear_size` bytes. the copy is a single pass, swizzling into tiled layouts as it goes
+    pub unsafe fn copy_from_linear(
+        &self,
+        image_memory: *mut u8,
+        linear: *const u8,
+        linear_row_pitch: usize,
+        linear_depth_pitch: usize,
+        offset: api::VkOffset3D,
+        extent: api::VkExtent3D,
+    ) {
+        let block_size = self.block.size_in_bytes;
+        self.for_each_run(
+            offset,
+            extent,
+            linear_row_pitch,
+            linear_depth_pitch,
+            |image_offset, linear_offset, run_length| {
+                transfer::copy_run(
+                    image_memory.add(image_offset),
+                    linear.add(linear_offset),
+                    run_length as usize * block_size,
+                );
+            },
+        );
+    }
+    /// the opposite of `copy_from_linear`.
+    /// used for image to buffer copies and for presenting tiled images
+    pub unsafe fn copy_to_linear(
+        &self,
+        image_memory: *const u8,
+        linear: *mut u8,
+        linear_row_pitch: usize,
+        linear_depth_pitch: usize,
+        offset: api::VkOffset3D,
+        extent: api::VkExtent3D,
+    ) {
+        let block_size = self.block.size_in_bytes;
+        self.for_each_run(
+            offset,
+            extent,
+            linear_row_pitch,
+            linear_depth_pitch,
+            |image_offset, linear_offset, run_length| {
+                transfer::copy_run(
+                    linear.add(linear_offset),
+                    image_memory.add(image_offset),
+                    run_length as usize * block_size,
+                );
+            },
+        );
+    }
+}
+
+// Images are stored as a sequence of array layers, each `array_pitch` bytes apart.
+// Each array layer is its mip levels from largest to smallest, starting at `IMAGE_ALIGNMENT` offsets.
 #[derive(Copy, Clone, Debug)]
 pub struct ImageComputedProperties {
-    pub pixel_size_in_bytes: usize,
+    pub block: FormatBlock,
+    pub tiling: Tiling,
+    pub extents: api::VkExtent3D,
+    pub mip_levels: u32,
+    pub array_pitch: usize,
     pub memory_layout: DeviceMemoryLayout,
 }
 
+impl ImageComputedProperties {
+    pub fn get_subresource_layout(&self, mip_level: u32, array_layer: u32) -> SubresourceLayout {
+        assert!(mip_level < self.mip_levels);
+        let mut offset = array_layer as usize * self.array_pitch;
+        for level in 0..mip_level {
+            offset += align_up(
+                SubresourceLayout::new(self.block, self.tiling, self.extents, level).size,
+                IMAGE_ALIGNMENT,
+            );
+        }
+        SubresourceLayout {
+            offset,
+            ..SubresourceLayout::new(self.block, self.tiling, self.extents, mip_level)
+        }
+    }
+}
+
 impl ImageProperties {
+    pub fn get_tiling(&self) -> Tiling {
+        match (self.supported_tilings, self.swapchain_present_tiling) {
+            (SupportedTilings::LinearOnly, _) | (_, Some(Tiling::Linear)) => Tiling::Linear,
+            (SupportedTilings::Any, _) => Tiling::Tiled,
+        }
+    }
     pub fn computed_properties(&self) -> ImageComputedProperties {
-        match *self {
-            Self {
-                supported_tilings: SupportedTilings::Any,
-                format: api::VK_FORMAT_R8G8B8A8_UNORM,
-                extents,
-                array_layers,
-                mip_levels: 1,
-                multisample_count: ImageMultisampleCount::Count1,
-                swapchain_present_tiling: _,
-            } => {
-                let pixel_size_in_bytes = 4;
-                ImageComputedProperties {
-                    pixel_size_in_bytes,
-                    memory_layout: DeviceMemoryLayout::calculate(
-                        pixel_size_in_bytes
-                            .checked_mul(extents.width as usize)
-                            .unwrap()
-                            .checked_mul(extents.height as usize)
-                            .unwrap()
-                            .checked_mul(extents.depth as usize)
-                            .unwrap()
-                            .checked_mul(array_layers as usize)
-                            .unwrap(),
-                        IMAGE_ALIGNMENT,
-                    ),
-                }
-            }
-            _ => unimplemented!("ImageProperties::computed_properties({:?})", self),
+        let block = match FormatBlock::get(self.format) {
+            Some(block) => block,
+            None => unimplemented!("ImageProperties::computed_properties({:?})", self),
+        };
+        // samples of a texel are stored next to each other
+        let block = FormatBlock {
+            size_in_bytes: block.size_in_bytes * self.multisample_count.get(),
+            ..block
+        };
+        let tiling = self.get_tiling();
+        let mut array_pitch = 0;
+        for mip_level in 0..self.mip_levels {
+            array_pitch = align_up(array_pitch, IMAGE_ALIGNMENT)
+                .checked_add(SubresourceLayout::new(block, tiling, self.extents, mip_level).size)
+                .unwrap();
+        }
+        let array_pitch = align_up(array_pitch, IMAGE_ALIGNMENT);
+        ImageComputedProperties {
+            block,
+            tiling,
+            extents: self.extents,
+            mip_levels: self.mip_levels,
+            array_pitch,
+            memory_layout: DeviceMemoryLayout::calculate(
+                array_pitch.checked_mul(self.array_layers as usize).unwrap(),
+                IMAGE_ALIGNMENT,
+            ),
         }
     }
 }
@@ -90,3 +666,138 @@ pub struct Image {
     pub properties: ImageProperties,
     pub memory: Option<ImageMemory>,
 }
+
+impl Image {
+    /// the image must be bound to memory
+    pub unsafe fn get_memory(&self) -> *mut u8 {
+        let memory = self.memory.as_ref().expect("image not bound to memory");
+        memory.device_memory.get().as_ptr().add(memory.offset)
+    }
+    /// the number of mip levels and array layers in `range`,
+    /// replacing `VK_REMAINING_MIP_LEVELS` and `VK_REMAINING_ARRAY_LAYERS`
+    pub fn get_level_and_layer_counts(&self, range: &api::VkImageSubresourceRange) -> (u32, u32) {
+        const REMAINING: u32 = !0;
+        let level_count = match range.levelCount {
+            REMAINING => self.properties.mip_levels - range.baseMipLevel,
+            level_count => level_count,
+        };
+        let layer_count = match range.layerCount {
+            REMAINING => self.properties.array_layers - range.baseArrayLayer,
+            layer_count => layer_count,
+        };
+        assert!(range.baseMipLevel + level_count <= self.properties.mip_levels);
+        assert!(range.baseArrayLayer + layer_count <= self.properties.array_layers);
+        (level_count, layer_count)
+    }
+}
+
+pub struct ImageView {
+    pub image: SharedHandle<api::VkImage>,
+    pub view_type: api::VkImageViewType,
+    pub format: api::VkFormat,
+    pub component_mapping: api::VkComponentMapping,
+    /// the level and layer counts are never `VK_REMAINING_MIP_LEVELS` or
+    /// `VK_REMAINING_ARRAY_LAYERS`
+    pub subresource_range: api::VkImageSubresourceRange,
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_tiled_layout() {
+        let properties = ImageProperties {
+            supported_tilings: SupportedTilings::Any,
+            format: api::VK_FORMAT_R8G8B8A8_UNORM,
+            extents: api::VkExtent3D {
+                width: 37,
+                height: 21,
+                depth: 1,
+            },
+            array_layers: 2,
+            mip_levels: 1,
+            multisample_count: ImageMultisampleCount::Count1,
+            swapchain_present_tiling: None,
+        };
+        let computed_properties = properties.computed_properties();
+        assert_eq!(computed_properties.tiling, Tiling::Tiled);
+        let layer_0 = computed_properties.get_subresource_layout(0, 0);
+        let layer_1 = computed_properties.get_subresource_layout(0, 1);
+        // micro-tiles are contiguous
+        assert_eq!(layer_0.get_block_offset(3, 3, 0), 15 * 4);
+        assert_eq!(layer_0.get_block_offset(4, 0, 0), 16 * 4);
+        let extent = api::VkExtent3D {
+            width: 37,
+            height: 21,
+            depth: 1,
+        };
+        let linear_row_pitch = 40 * 4;
+        let linear: Vec<u8> = (0..linear_row_pitch * 21).map(|v| v as u8).collect();
+        let mut image_memory = vec![0; computed_properties.memory_layout.size];
+        let mut round_trip = vec![0; linear.len()];
+        let origin = api::VkOffset3D { x: 0, y: 0, z: 0 };
+        assert!(layer_0.get_linear_size(extent, linear_row_pitch, linear.len()) <= linear.len());
+        for layout in &[layer_0, layer_1] {
+            unsafe {
+                layout.copy_from_linear(
+                    image_memory.as_mut_ptr(),
+                    linear.as_ptr(),
+                    linear_row_pitch,
+                    linear.len(),
+                    origin,
+                    extent,
+                );
+            }
+        }
+        unsafe {
+            layer_1.copy_to_linear(
+                image_memory.as_ptr(),
+                round_trip.as_mut_ptr(),
+                linear_row_pitch,
+                linear.len(),
+                origin,
+                extent,
+            );
+        }
+        for y in 0..21 {
+            let row = y * linear_row_pitch;
+            assert_eq!(round_trip[row..row + 37 * 4], linear[row..row + 37 * 4]);
+        }
+    }
+
+    #[test]
+    fn test_mip_levels() {
+        let properties = ImageProperties {
+            supported_tilings: SupportedTilings::LinearOnly,
+            format: api::VK_FORMAT_BC1_RGB_UNORM_BLOCK,
+            extents: api::VkExtent3D {
+                width: 64,
+                height: 30,
+                depth: 1,
+            },
+            array_layers: 3,
+            mip_levels: 7,
+            multisample_count: ImageMultisampleCount::Count1,
+            swapchain_present_tiling: None,
+        };
+        let computed_properties = properties.computed_properties();
+        let mut end = 0;
+        for array_layer in 0..3 {
+            for mip_level in 0..7 {
+                let layout = computed_properties.get_subresource_layout(mip_level, array_layer);
+                assert!(layout.offset >= end);
+                assert_eq!(layout.offset % IMAGE_ALIGNMENT, 0);
+                end = layout.offset + layout.size;
+            }
+        }
+        assert!(end <= computed_properties.memory_layout.size);
+        let level_0 = computed_properties.get_subresource_layout(0, 0);
+        assert_eq!(level_0.row_pitch, 16 * 8);
+        assert_eq!(level_0.size, 16 * 8 * 8);
+        // 1x1 texel mip levels still take a whole block
+        let level_6 = computed_properties.get_subresource_layout(6, 0);
+        assert_eq!((level_6.width_in_blocks, level_6.height_in_blocks), (1, 1));
+        assert_eq!(level_6.size, 8);
+    }
+}
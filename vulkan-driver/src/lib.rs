@@ -7,22 +7,45 @@ extern crate enum_map;
 extern crate errno;
 #[cfg(unix)]
 extern crate libc;
+#[macro_use]
 extern crate shader_compiler_backend;
+extern crate shader_compiler_backend_llvm_7;
+extern crate spirv_parser;
 extern crate sys_info;
 extern crate uuid;
 #[cfg(unix)]
 extern crate xcb;
 mod api;
 mod api_impl;
+#[cfg(feature = "benchmarks")]
+#[doc(hidden)]
+pub mod benchmarks;
 mod buffer;
+mod clear;
+mod command_buffer;
+mod compute;
+mod descriptor;
 mod device_memory;
+mod geometry;
 mod handle;
+mod handle_pool;
+#[cfg(target_os = "linux")]
+mod headless_swapchain;
 mod image;
+mod pipeline;
+mod pipeline_cache;
+mod query;
+mod queue;
+mod rasterizer;
+mod render_pass;
 mod sampler;
 mod shader_module;
 #[cfg(unix)]
 mod shm;
 mod swapchain;
+mod sync;
+mod thread_pool;
+mod transfer;
 #[cfg(unix)]
 mod xcb_swapchain;
 use std::ffi::CStr;
@@ -31,9 +54,14 @@ use std::os::raw::c_char;
 mod constants {
     pub const KAZAN_DEVICE_NAME: &str = "Kazan Software Renderer";
     pub const MIN_MEMORY_MAP_ALIGNMENT: usize = 128; // must be at least 64 and a power of 2 according to Vulkan spec
-    pub const QUEUE_FAMILY_COUNT: u32 = 1;
-    pub const QUEUE_COUNTS: [u32; QUEUE_FAMILY_COUNT as usize] = [1];
-    pub const TOTAL_QUEUE_COUNT: usize = 1;
+    pub const QUEUE_FAMILY_COUNT: u32 = 2;
+    /// a general family and an async compute/transfer family, each queue has its own thread
+    pub const QUEUE_COUNTS: [u32; QUEUE_FAMILY_COUNT as usize] = [4, 2];
+    pub const QUEUE_FAMILY_FLAGS: [::api::VkQueueFlags; QUEUE_FAMILY_COUNT as usize] = [
+        ::api::VK_QUEUE_GRAPHICS_BIT | ::api::VK_QUEUE_COMPUTE_BIT | ::api::VK_QUEUE_TRANSFER_BIT,
+        ::api::VK_QUEUE_COMPUTE_BIT | ::api::VK_QUEUE_TRANSFER_BIT,
+    ];
+    pub const TOTAL_QUEUE_COUNT: usize = 6;
     pub const BUFFER_ALIGNMENT: usize = 64; // FIXME: determine correct value
     pub const IMAGE_ALIGNMENT: usize = 64; // FIXME: determine correct value
 }
@@ -0,0 +1,625 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright 2018 Jacob Lifshay
+use api;
+use compute::{ComputeShaderEntryPoint, WorkgroupLayout};
+use descriptor::DescriptorSetLayout;
+use geometry::{VertexFetch, VertexShaderEntryPoint};
+use pipeline_cache::{PipelineCache, PipelineCacheKey, PipelineCacheKeyBuilder};
+use shader_compiler_backend as backend;
+use shader_compiler_backend::types::TypeBuilder;
+use shader_compiler_backend::{
+    AttachedBuilder, Compiler, Context, DetachedBuilder, Function, Module,
+};
+use shader_compiler_backend_llvm_7::{LLVM7CompilerConfig, LLVM_7_SHADER_COMPILER};
+use shader_module::{ShaderModuleIndex, SpecializedConstants};
+use spirv_parser::ExecutionModel;
+use std::collections::HashMap;
+use std::mem;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex};
+use thread_pool::ThreadPool;
+
+/// the functions generated by the shader compiler for a pipeline
+#[derive(Copy, Clone, Eq, PartialEq, Hash, Debug)]
+pub enum PipelineFunction {
+    VertexShader,
+    FragmentShader,
+    ComputeShader,
+}
+
+impl PipelineFunction {
+    pub fn to_u32(self) -> u32 {
+        match self {
+            PipelineFunction::VertexShader => 0,
+            PipelineFunction::FragmentShader => 1,
+            PipelineFunction::ComputeShader => 2,
+        }
+    }
+    pub fn from_u32(v: u32) -> Option<Self> {
+        match v {
+            0 => Some(PipelineFunction::VertexShader),
+            1 => Some(PipelineFunction::FragmentShader),
+            2 => Some(PipelineFunction::ComputeShader),
+            _ => None,
+        }
+    }
+    fn get_symbol_name(self) -> &'static str {
+        match self {
+            PipelineFunction::VertexShader => "vertex_shader",
+            PipelineFunction::FragmentShader => "fragment_shader",
+            PipelineFunction::ComputeShader => "compute_shader",
+        }
+    }
+    fn get_execution_model(self) -> ExecutionModel {
+        match self {
+            PipelineFunction::VertexShader => ExecutionModel::Vertex,
+            PipelineFunction::FragmentShader => ExecutionModel::Fragment,
+            PipelineFunction::ComputeShader => ExecutionModel::GLCompute,
+        }
+    }
+}
+
+/// the type of the generated shader entry points
+pub type ShaderEntryPoint = unsafe extern "C" fn();
+
+pub struct SpecializationInfo {
+    pub map_entries: Vec<api::VkSpecializationMapEntry>,
+    pub data: Vec<u8>,
+}
+
+pub struct ShaderStage {
+    pub function: PipelineFunction,
+    pub code: Arc<[u32]>,
+    /// shared with every other pipeline created from the same shader module
+    pub index: Result<Arc<ShaderModuleIndex>, String>,
+    pub entry_point_name: String,
+    pub specialization_info: Option<SpecializationInfo>,
+}
+
+impl ShaderStage {
+    /// the stage's constants with the values in `specialization_info` substituted
+    pub fn get_specialized_constants(&self) -> Result<SpecializedConstants, String> {
+        let index = self.index.as_ref().map_err(Clone::clone)?;
+        index.specialize_constants(&self.code, |constant_id| {
+            let specialization_info = self.specialization_info.as_ref()?;
+            let map_entry = specialization_info
+                .map_entries
+                .iter()
+                .find(|map_entry| map_entry.constantID == constant_id)?;
+            let offset = map_entry.offset as usize;
+            specialization_info
+                .data
+                .get(offset..offset + map_entry.size)
+        })
+    }
+    fn add_to_key(&self, key: &mut PipelineCacheKeyBuilder) {
+        key.add_u32(self.function.to_u32())
+            .add_words(&self.code)
+            .add_str(&self.entry_point_name);
+        match &self.specialization_info {
+            None => {
+                key.add_u32(0);
+            }
+            Some(specialization_info) => {
+                key.add_u32(1)
+                    .add_u32(specialization_info.map_entries.len() as u32);
+                for map_entry in &specialization_info.map_entries {
+                    key.add_u32(map_entry.constantID)
+                        .add_u32(map_entry.offset)
+                        .add_u32(map_entry.size as u32);
+                }
+                key.add_bytes(&specialization_info.data);
+            }
+        }
+    }
+}
+
+pub struct VertexInputState {
+    pub bindings: Vec<api::VkVertexInputBindingDescription>,
+    pub attributes: Vec<api::VkVertexInputAttributeDescription>,
+}
+
+pub struct RasterizationState {
+    pub depth_clamp_enable: bool,
+    pub rasterizer_discard_enable: bool,
+    pub polygon_mode: api::VkPolygonMode,
+    pub cull_mode: api::VkCullModeFlags,
+    pub front_face: api::VkFrontFace,
+    pub depth_bias_enable: bool,
+    pub depth_bias_constant_factor: f32,
+    pub depth_bias_clamp: f32,
+    pub depth_bias_slope_factor: f32,
+    pub line_width: f32,
+}
+
+pub struct DepthStencilState {
+    pub depth_test_enable: bool,
+    pub depth_write_enable: bool,
+    pub depth_compare_op: api::VkCompareOp,
+    pub depth_bounds_test_enable: bool,
+    pub stencil_test_enable: bool,
+    pub front: api::VkStencilOpState,
+    pub back: api::VkStencilOpState,
+    pub min_depth_bounds: f32,
+    pub max_depth_bounds: f32,
+}
+
+pub struct ColorBlendState {
+    pub logic_op: Option<api::VkLogicOp>,
+    pub attachments: Vec<api::VkPipelineColorBlendAttachmentState>,
+    pub blend_constants: [f32; 4],
+}
+
+pub struct GraphicsPipelineState {
+    pub vertex_input: VertexInputState,
+    pub topology: api::VkPrimitiveTopology,
+    pub primitive_restart_enable: bool,
+    pub viewports: Vec<api::VkViewport>,
+    pub scissors: Vec<api::VkRect2D>,
+    pub rasterization: RasterizationState,
+    pub rasterization_samples: api::VkSampleCountFlagBits,
+    pub depth_stencil: Option<DepthStencilState>,
+    pub color_blend: Option<ColorBlendState>,
+    pub dynamic_states: Vec<api::VkDynamicState>,
+}
+
+impl GraphicsPipelineState {
+    pub fn is_dynamic(&self, dynamic_state: api::VkDynamicState) -> bool {
+        self.dynamic_states.contains(&dynamic_state)
+    }
+    /// the value of a piece of state, or 0 when it's dynamic: it doesn't change the
+    /// generated code then, so pipelines only differing in it share their cache entry
+    fn get_static_value(&self, dynamic_state: api::VkDynamicState, value: u32) -> u32 {
+        if self.is_dynamic(dynamic_state) {
+            0
+        } else {
+            value
+        }
+    }
+    fn add_stencil_op_state_to_key(
+        &self,
+        key: &mut PipelineCacheKeyBuilder,
+        v: &api::VkStencilOpState,
+    ) {
+        key.add_u32(v.failOp as u32)
+            .add_u32(v.passOp as u32)
+            .add_u32(v.depthFailOp as u32)
+            .add_u32(v.compareOp as u32)
+            .add_u32(
+                self.get_static_value(api::VK_DYNAMIC_STATE_STENCIL_COMPARE_MASK, v.compareMask),
+            )
+            .add_u32(self.get_static_value(api::VK_DYNAMIC_STATE_STENCIL_WRITE_MASK, v.writeMask))
+            .add_u32(self.get_static_value(api::VK_DYNAMIC_STATE_STENCIL_REFERENCE, v.reference));
+    }
+    fn add_to_key(&self, key: &mut PipelineCacheKeyBuilder) {
+        key.add_u32(self.vertex_input.bindings.len() as u32);
+        for binding in &self.vertex_input.bindings {
+            key.add_u32(binding.binding)
+                .add_u32(binding.stride)
+                .add_u32(binding.inputRate as u32);
+        }
+        key.add_u32(self.vertex_input.attributes.len() as u32);
+        for attribute in &self.vertex_input.attributes {
+            key.add_u32(attribute.location)
+                .add_u32(attribute.binding)
+                .add_u32(attribute.format as u32)
+                .add_u32(attribute.offset);
+        }
+        key.add_u32(self.topology as u32)
+            .add_u32(self.primitive_restart_enable as u32);
+        key.add_u32(self.viewports.len() as u32);
+        for viewport in &self.viewports {
+            key.add_u32(viewport.x.to_bits())
+                .add_u32(viewport.y.to_bits())
+                .add_u32(viewport.width.to_bits())
+                .add_u32(viewport.height.to_bits())
+                .add_u32(viewport.minDepth.to_bits())
+                .add_u32(viewport.maxDepth.to_bits());
+        }
+        key.add_u32(self.scissors.len() as u32);
+        for scissor in &self.scissors {
+            key.add_u32(scissor.offset.x as u32)
+                .add_u32(scissor.offset.y as u32)
+                .add_u32(scissor.extent.width)
+                .add_u32(scissor.extent.height);
+        }
+        let RasterizationState {
+            depth_clamp_enable,
+            rasterizer_discard_enable,
+            polygon_mode,
+            cull_mode,
+            front_face,
+            depth_bias_enable,
+            depth_bias_constant_factor,
+            depth_bias_clamp,
+            depth_bias_slope_factor,
+            line_width,
+        } = self.rasterization;
+        key.add_u32(depth_clamp_enable as u32)
+            .add_u32(rasterizer_discard_enable as u32)
+            .add_u32(polygon_mode as u32)
+            .add_u32(cull_mode as u32)
+            .add_u32(front_face as u32)
+            .add_u32(depth_bias_enable as u32)
+            .add_u32(self.get_static_value(
+                api::VK_DYNAMIC_STATE_DEPTH_BIAS,
+                depth_bias_constant_factor.to_bits(),
+            ))
+            .add_u32(
+                self.get_static_value(api::VK_DYNAMIC_STATE_DEPTH_BIAS, depth_bias_clamp.to_bits()),
+            )
+            .add_u32(self.get_static_value(
+                api::VK_DYNAMIC_STATE_DEPTH_BIAS,
+                depth_bias_slope_factor.to_bits(),
+            ))
+            .add_u32(self.get_static_value(api::VK_DYNAMIC_STATE_LINE_WIDTH, line_width.to_bits()));
+        key.add_u32(self.rasterization_samples as u32);
+        match &self.depth_stencil {
+            None => {
+                key.add_u32(0);
+            }
+            Some(depth_stencil) => {
+                key.add_u32(1)
+                    .add_u32(depth_stencil.depth_test_enable as u32)
+                    .add_u32(depth_stencil.depth_write_enable as u32)
+                    .add_u32(depth_stencil.depth_compare_op as u32)
+                    .add_u32(depth_stencil.depth_bounds_test_enable as u32)
+                    .add_u32(depth_stencil.stencil_test_enable as u32);
+                self.add_stencil_op_state_to_key(key, &depth_stencil.front);
+                self.add_stencil_op_state_to_key(key, &depth_stencil.back);
+                key.add_u32(self.get_static_value(
+                    api::VK_DYNAMIC_STATE_DEPTH_BOUNDS,
+                    depth_stencil.min_depth_bounds.to_bits(),
+                ))
+                .add_u32(self.get_static_value(
+                    api::VK_DYNAMIC_STATE_DEPTH_BOUNDS,
+                    depth_stencil.max_depth_bounds.to_bits(),
+                ));
+            }
+        }
+        match &self.color_blend {
+            None => {
+                key.add_u32(0);
+            }
+            Some(color_blend) => {
+                key.add_u32(1);
+                match color_blend.logic_op {
+                    None => key.add_u32(0),
+                    Some(logic_op) => key.add_u32(1).add_u32(logic_op as u32),
+                };
+                key.add_u32(color_blend.attachments.len() as u32);
+                for attachment in &color_blend.attachments {
+                    key.add_u32(attachment.blendEnable)
+                        .add_u32(attachment.srcColorBlendFactor as u32)
+                        .add_u32(attachment.dstColorBlendFactor as u32)
+                        .add_u32(attachment.colorBlendOp as u32)
+                        .add_u32(attachment.srcAlphaBlendFactor as u32)
+                        .add_u32(attachment.dstAlphaBlendFactor as u32)
+                        .add_u32(attachment.alphaBlendOp as u32)
+                        .add_u32(attachment.colorWriteMask);
+                }
+                for blend_constant in &color_blend.blend_constants {
+                    key.add_u32(self.get_static_value(
+                        api::VK_DYNAMIC_STATE_BLEND_CONSTANTS,
+                        blend_constant.to_bits(),
+                    ));
+                }
+            }
+        }
+        key.add_u32(self.dynamic_states.len() as u32);
+        for &dynamic_state in &self.dynamic_states {
+            key.add_u32(dynamic_state as u32);
+        }
+    }
+}
+
+pub enum PipelineState {
+    Graphics(GraphicsPipelineState),
+    Compute,
+}
+
+/// everything needed to create a `Pipeline`, copied out of `VkGraphicsPipelineCreateInfo` or
+/// `VkComputePipelineCreateInfo` so it can be sent to other threads
+pub struct PipelineCreateInfo {
+    pub stages: Vec<ShaderStage>,
+    pub state: PipelineState,
+    /// from `VK_PIPELINE_CREATE_DISABLE_OPTIMIZATION_BIT`
+    pub disable_optimization: bool,
+    /// from the pipeline layout, the generated code loads descriptors at the offsets they give
+    pub set_layouts: Vec<Arc<DescriptorSetLayout>>,
+}
+
+impl PipelineCreateInfo {
+    fn add_to_key(&self, key: &mut PipelineCacheKeyBuilder) {
+        key.add_u32(self.stages.len() as u32);
+        for stage in &self.stages {
+            stage.add_to_key(key);
+        }
+        match &self.state {
+            PipelineState::Graphics(state) => {
+                key.add_u32(0);
+                state.add_to_key(key);
+            }
+            PipelineState::Compute => {
+                key.add_u32(1);
+            }
+        }
+        key.add_u32(self.set_layouts.len() as u32);
+        for set_layout in &self.set_layouts {
+            let binding_count = set_layout.get_binding_count();
+            key.add_u32(binding_count);
+            for binding in 0..binding_count {
+                match set_layout.get_binding(binding) {
+                    None => {
+                        key.add_u32(0);
+                    }
+                    Some(binding) => {
+                        key.add_u32(1)
+                            .add_u32(binding.descriptor_type as u32)
+                            .add_u32(binding.descriptor_count)
+                            .add_u32(binding.stage_flags)
+                            .add_u32(binding.immutable_samplers.len() as u32);
+                    }
+                }
+            }
+        }
+    }
+}
+
+struct PipelineCompilerUser<'a> {
+    create_info: &'a PipelineCreateInfo,
+}
+
+impl<'b> backend::CompilerUser for PipelineCompilerUser<'b> {
+    type FunctionKey = PipelineFunction;
+    type Error = String;
+    fn create_error(message: String) -> String {
+        message
+    }
+    fn run<'a, C: Context<'a>>(
+        self,
+        context: &'a C,
+    ) -> Result<backend::CompileInputs<'a, C, PipelineFunction>, String> {
+        let type_builder = context.create_type_builder();
+        let mut module = context.create_module("pipeline");
+        let mut detached_builder = context.create_builder();
+        let mut callable_functions = HashMap::new();
+        for stage in &self.create_info.stages {
+            let index = stage.index.as_ref().map_err(Clone::clone)?;
+            index
+                .find_entry_point(
+                    stage.function.get_execution_model(),
+                    &stage.entry_point_name,
+                )
+                .ok_or_else(|| {
+                    format!("shader entry point not found: {}", stage.entry_point_name)
+                })?;
+            let function_type = match stage.function {
+                PipelineFunction::VertexShader => type_builder.build::<VertexShaderEntryPoint>(),
+                PipelineFunction::ComputeShader => type_builder.build::<ComputeShaderEntryPoint>(),
+                PipelineFunction::FragmentShader => type_builder.build::<ShaderEntryPoint>(),
+            };
+            let mut function = module.add_function(stage.function.get_symbol_name(), function_type);
+            // FIXME: the generated function is empty, since there's no SPIR-V translator yet.
+            // specialization only changes the workgroup size, the workgroup memory layout and the
+            // cache key so far; emitting the specialized constants with the backend's constant
+            // builders, and fusing the static fixed-function state into the shaders, waits for
+            // the translator
+            let builder = detached_builder.attach(function.append_new_basic_block(None));
+            detached_builder = builder.build_return(None);
+            callable_functions.insert(stage.function, function);
+        }
+        let module = module.verify().map_err(|v| v.to_string())?;
+        Ok(backend::CompileInputs {
+            module,
+            callable_functions,
+        })
+    }
+}
+
+/// the entry points of the most optimized code compiled so far for a `Pipeline`
+struct PipelineCode {
+    /// stored as `usize` so they can be replaced atomically while other threads use them
+    entry_points: HashMap<PipelineFunction, AtomicUsize>,
+    /// every tier is kept alive, since previously loaded entry points may still be running
+    compiled_code: Mutex<Vec<Box<dyn backend::CompiledCode<PipelineFunction>>>>,
+}
+
+impl PipelineCode {
+    fn new(
+        create_info: &PipelineCreateInfo,
+        compiled_code: Box<dyn backend::CompiledCode<PipelineFunction>>,
+    ) -> Self {
+        let entry_points = create_info
+            .stages
+            .iter()
+            .map(|stage| {
+                let entry_point = compiled_code.get(&stage.function).unwrap();
+                (stage.function, AtomicUsize::new(entry_point as usize))
+            })
+            .collect();
+        Self {
+            entry_points,
+            compiled_code: Mutex::new(vec![compiled_code]),
+        }
+    }
+    fn replace(&self, compiled_code: Box<dyn backend::CompiledCode<PipelineFunction>>) {
+        let mut compiled_code_list = self.compiled_code.lock().unwrap();
+        for (function, entry_point) in &self.entry_points {
+            entry_point.store(
+                compiled_code.get(function).unwrap() as usize,
+                Ordering::Release,
+            );
+        }
+        compiled_code_list.push(compiled_code);
+    }
+}
+
+fn get_cache_key(
+    create_info: &PipelineCreateInfo,
+    compiler_config: &LLVM7CompilerConfig,
+) -> PipelineCacheKey {
+    let mut key =
+        PipelineCacheKeyBuilder::new(&LLVM_7_SHADER_COMPILER.get_code_fingerprint(compiler_config));
+    create_info.add_to_key(&mut key);
+    key.finish()
+}
+
+fn compile(
+    create_info: &PipelineCreateInfo,
+    compiler_config: &LLVM7CompilerConfig,
+) -> Result<Box<dyn backend::CompiledCode<PipelineFunction>>, String> {
+    LLVM_7_SHADER_COMPILER.run(
+        PipelineCompilerUser { create_info },
+        compiler_config.clone(),
+    )
+}
+
+pub struct Pipeline {
+    create_info: Arc<PipelineCreateInfo>,
+    code: Arc<PipelineCode>,
+    /// `Some` for compute pipelines
+    workgroup_layout: Option<WorkgroupLayout>,
+    /// `Some` for graphics pipelines
+    vertex_fetch: Option<VertexFetch>,
+}
+
+impl Pipeline {
+    /// create a new `Pipeline`, reusing the compiled code in `pipeline_cache` if it's there.
+    ///
+    /// if `background_compiler` is `Some`, the pipeline is first compiled without optimizations
+    /// so it can be used sooner, then recompiled with `compiler_config` on `background_compiler`.
+    /// the optimized code replaces the unoptimized code when it's finished
+    pub fn new(
+        create_info: PipelineCreateInfo,
+        compiler_config: &LLVM7CompilerConfig,
+        pipeline_cache: Option<&PipelineCache>,
+        background_compiler: Option<&ThreadPool>,
+    ) -> Result<Self, String> {
+        let create_info = Arc::new(create_info);
+        let workgroup_layout = match create_info.state {
+            PipelineState::Compute => Some(
+                create_info
+                    .stages
+                    .iter()
+                    .find(|stage| stage.function == PipelineFunction::ComputeShader)
+                    .ok_or_else(|| "compute pipeline has no compute shader".to_string())
+                    .and_then(WorkgroupLayout::new)?,
+            ),
+            PipelineState::Graphics(_) => None,
+        };
+        let vertex_fetch = match &create_info.state {
+            PipelineState::Graphics(state) => Some(VertexFetch::new(&state.vertex_input)?),
+            PipelineState::Compute => None,
+        };
+        let compiler_config = if create_info.disable_optimization {
+            LLVM7CompilerConfig {
+                optimization_mode: backend::OptimizationMode::NoOptimizations,
+                ..compiler_config.clone()
+            }
+        } else {
+            compiler_config.clone()
+        };
+        let key = get_cache_key(&create_info, &compiler_config);
+        if let Some(object_code) =
+            pipeline_cache.and_then(|pipeline_cache| pipeline_cache.get(&key))
+        {
+            match LLVM_7_SHADER_COMPILER
+                .load_object_code((*object_code).clone(), compiler_config.clone())
+            {
+                Ok(compiled_code) => {
+                    return Ok(Self {
+                        code: Arc::new(PipelineCode::new(&create_info, compiled_code)),
+                        create_info,
+                        workgroup_layout,
+                        vertex_fetch,
+                    })
+                }
+                Err(error) => eprintln!("ignoring invalid pipeline cache entry: {}", error),
+            }
+        }
+        let pipeline_cache = pipeline_cache.map(PipelineCache::inserter);
+        // there's nothing to gain from recompiling without optimizations
+        let background_compiler =
+            if compiler_config.optimization_mode == backend::OptimizationMode::NoOptimizations {
+                None
+            } else {
+                background_compiler
+            };
+        let background_compiler = match background_compiler {
+            Some(background_compiler) => background_compiler,
+            None => {
+                let compiled_code = compile(&create_info, &compiler_config)?;
+                if let Some(pipeline_cache) = pipeline_cache {
+                    pipeline_cache.insert(key, Arc::new(compiled_code.object_code().clone()));
+                }
+                return Ok(Self {
+                    code: Arc::new(PipelineCode::new(&create_info, compiled_code)),
+                    create_info,
+                    workgroup_layout,
+                    vertex_fetch,
+                });
+            }
+        };
+        let unoptimized_code = compile(
+            &create_info,
+            &LLVM7CompilerConfig {
+                optimization_mode: backend::OptimizationMode::NoOptimizations,
+                ..compiler_config.clone()
+            },
+        )?;
+        let code = Arc::new(PipelineCode::new(&create_info, unoptimized_code));
+        let weak_code = Arc::downgrade(&code);
+        let background_create_info = create_info.clone();
+        background_compiler.spawn_low_priority(move || {
+            // don't bother if the pipeline was already destroyed
+            if weak_code.upgrade().is_none() {
+                return;
+            }
+            let compiled_code = match compile(&background_create_info, &compiler_config) {
+                Ok(compiled_code) => compiled_code,
+                Err(error) => {
+                    eprintln!("background pipeline compilation failed: {}", error);
+                    return;
+                }
+            };
+            if let Some(pipeline_cache) = pipeline_cache {
+                pipeline_cache.insert(key, Arc::new(compiled_code.object_code().clone()));
+            }
+            if let Some(code) = weak_code.upgrade() {
+                code.replace(compiled_code);
+            }
+        });
+        Ok(Self {
+            create_info,
+            code,
+            workgroup_layout,
+            vertex_fetch,
+        })
+    }
+    pub fn state(&self) -> &PipelineState {
+        &self.create_info.state
+    }
+    pub fn get_function(&self, function: PipelineFunction) -> Option<ShaderEntryPoint> {
+        let entry_point = self
+            .code
+            .entry_points
+            .get(&function)?
+            .load(Ordering::Acquire);
+        Some(unsafe { mem::transmute::<usize, ShaderEntryPoint>(entry_point) })
+    }
+    pub fn workgroup_layout(&self) -> Option<&WorkgroupLayout> {
+        self.workgroup_layout.as_ref()
+    }
+    pub fn get_compute_function(&self) -> Option<ComputeShaderEntryPoint> {
+        let entry_point = self.get_function(PipelineFunction::ComputeShader)?;
+        Some(unsafe { mem::transmute::<ShaderEntryPoint, ComputeShaderEntryPoint>(entry_point) })
+    }
+    pub fn vertex_fetch(&self) -> Option<&VertexFetch> {
+        self.vertex_fetch.as_ref()
+    }
+    pub fn get_vertex_function(&self) -> Option<VertexShaderEntryPoint> {
+        let entry_point = self.get_function(PipelineFunction::VertexShader)?;
+        Some(unsafe { mem::transmute::<ShaderEntryPoint, VertexShaderEntryPoint>(entry_point) })
+    }
+}
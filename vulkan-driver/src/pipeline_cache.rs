@@ -0,0 +1,320 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright 2018 Jacob Lifshay
+
+// Serialized pipeline cache format (all integers are little endian):
+//
+// header, as required by the Vulkan spec:
+//     u32 header size (32)
+//     u32 VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+//     u32 vendor ID
+//     u32 device ID
+//     [u8; 16] pipeline cache UUID
+// followed by any number of entries:
+//     [u8; 16] key
+//     u32 symbol count
+//     for each symbol:
+//         u32 PipelineFunction
+//         u32 name length
+//         [u8] name
+//     u32 object file length
+//     [u8] object file
+//
+// The pipeline cache UUID changes whenever this format or the shader compiler changes,
+// so data from other versions is ignored instead of misinterpreted.
+
+use api;
+use pipeline::PipelineFunction;
+use shader_compiler_backend::ObjectCode;
+use std::collections::HashMap;
+use std::sync::Arc;
+use std::sync::Mutex;
+use uuid;
+
+const HEADER_SIZE: usize = 32;
+
+const KEY_SIZE: usize = 16;
+
+#[derive(Copy, Clone, Debug, Eq, PartialEq)]
+pub struct PipelineCacheHeader {
+    pub vendor_id: u32,
+    pub device_id: u32,
+    pub pipeline_cache_uuid: [u8; api::VK_UUID_SIZE as usize],
+}
+
+impl PipelineCacheHeader {
+    fn write(&self, output: &mut Vec<u8>) {
+        write_u32(output, HEADER_SIZE as u32);
+        write_u32(output, api::VK_PIPELINE_CACHE_HEADER_VERSION_ONE as u32);
+        write_u32(output, self.vendor_id);
+        write_u32(output, self.device_id);
+        output.extend_from_slice(&self.pipeline_cache_uuid);
+    }
+    fn read(reader: &mut Reader) -> Option<Self> {
+        if reader.read_u32()? as usize != HEADER_SIZE {
+            return None;
+        }
+        if reader.read_u32()? != api::VK_PIPELINE_CACHE_HEADER_VERSION_ONE as u32 {
+            return None;
+        }
+        let vendor_id = reader.read_u32()?;
+        let device_id = reader.read_u32()?;
+        let mut pipeline_cache_uuid = [0; api::VK_UUID_SIZE as usize];
+        pipeline_cache_uuid.copy_from_slice(reader.read_bytes(api::VK_UUID_SIZE as usize)?);
+        Some(PipelineCacheHeader {
+            vendor_id,
+            device_id,
+            pipeline_cache_uuid,
+        })
+    }
+}
+
+/// digest of everything that affects the generated code for a pipeline
+#[derive(Copy, Clone, Debug, Eq, PartialEq, Hash)]
+pub struct PipelineCacheKey([u8; KEY_SIZE]);
+
+/// builds a `PipelineCacheKey`.
+/// variable-length inputs are length-prefixed so different inputs can't produce the same byte stream
+pub struct PipelineCacheKeyBuilder {
+    bytes: Vec<u8>,
+}
+
+impl PipelineCacheKeyBuilder {
+    /// `code_fingerprint` is from `Compiler::get_code_fingerprint`, it covers the optimization mode
+    /// and the target CPU features
+    pub fn new(code_fingerprint: &str) -> Self {
+        let mut retval = PipelineCacheKeyBuilder { bytes: Vec::new() };
+        retval.add_str(code_fingerprint);
+        retval
+    }
+    pub fn add_u32(&mut self, v: u32) -> &mut Self {
+        write_u32(&mut self.bytes, v);
+        self
+    }
+    pub fn add_bytes(&mut self, v: &[u8]) -> &mut Self {
+        write_u32(&mut self.bytes, v.len() as u32);
+        self.bytes.extend_from_slice(v);
+        self
+    }
+    pub fn add_str(&mut self, v: &str) -> &mut Self {
+        self.add_bytes(v.as_bytes())
+    }
+    pub fn add_words(&mut self, v: &[u32]) -> &mut Self {
+        write_u32(&mut self.bytes, v.len() as u32);
+        self.bytes.reserve(v.len() * 4);
+        for &word in v {
+            write_u32(&mut self.bytes, word);
+        }
+        self
+    }
+    pub fn finish(&self) -> PipelineCacheKey {
+        // version 5 UUIDs are truncated SHA-1 hashes
+        PipelineCacheKey(*uuid::Uuid::new_v5(&uuid::Uuid::nil(), &self.bytes).as_bytes())
+    }
+}
+
+fn write_u32(output: &mut Vec<u8>, v: u32) {
+    output.extend_from_slice(&[v as u8, (v >> 8) as u8, (v >> 16) as u8, (v >> 24) as u8]);
+}
+
+struct Reader<'a> {
+    data: &'a [u8],
+}
+
+impl<'a> Reader<'a> {
+    fn read_bytes(&mut self, count: usize) -> Option<&'a [u8]> {
+        if count > self.data.len() {
+            return None;
+        }
+        let (retval, rest) = self.data.split_at(count);
+        self.data = rest;
+        Some(retval)
+    }
+    fn read_u32(&mut self) -> Option<u32> {
+        let bytes = self.read_bytes(4)?;
+        Some(
+            u32::from(bytes[0])
+                | u32::from(bytes[1]) << 8
+                | u32::from(bytes[2]) << 16
+                | u32::from(bytes[3]) << 24,
+        )
+    }
+}
+
+type Entries = HashMap<PipelineCacheKey, Arc<ObjectCode<PipelineFunction>>>;
+
+fn write_entry(
+    output: &mut Vec<u8>,
+    key: &PipelineCacheKey,
+    object_code: &ObjectCode<PipelineFunction>,
+) {
+    output.extend_from_slice(&key.0);
+    write_u32(output, object_code.symbols.len() as u32);
+    for (function, name) in &object_code.symbols {
+        write_u32(output, function.to_u32());
+        write_u32(output, name.len() as u32);
+        output.extend_from_slice(name.as_bytes());
+    }
+    write_u32(output, object_code.object_file.len() as u32);
+    output.extend_from_slice(&object_code.object_file);
+}
+
+fn read_entry(reader: &mut Reader) -> Option<(PipelineCacheKey, ObjectCode<PipelineFunction>)> {
+    let mut key = [0; KEY_SIZE];
+    key.copy_from_slice(reader.read_bytes(KEY_SIZE)?);
+    let symbol_count = reader.read_u32()?;
+    let mut symbols = HashMap::new();
+    for _ in 0..symbol_count {
+        let function = PipelineFunction::from_u32(reader.read_u32()?)?;
+        let name_length = reader.read_u32()? as usize;
+        let name = String::from_utf8(reader.read_bytes(name_length)?.into()).ok()?;
+        if symbols.insert(function, name).is_some() {
+            return None;
+        }
+    }
+    let object_file_length = reader.read_u32()? as usize;
+    let object_file = reader.read_bytes(object_file_length)?.into();
+    Some((
+        PipelineCacheKey(key),
+        ObjectCode {
+            object_file,
+            symbols,
+        },
+    ))
+}
+
+fn can_serialize(object_code: &ObjectCode<PipelineFunction>) -> bool {
+    const MAX: usize = u32::max_value() as usize;
+    object_code.object_file.len() <= MAX && object_code.symbols.values().all(|v| v.len() <= MAX)
+}
+
+/// inserts into a `PipelineCache`, even after the `PipelineCache` is destroyed.
+/// used for code that is compiled in the background
+#[derive(Clone)]
+pub struct PipelineCacheInserter(Arc<Mutex<Entries>>);
+
+impl PipelineCacheInserter {
+    pub fn insert(&self, key: PipelineCacheKey, object_code: Arc<ObjectCode<PipelineFunction>>) {
+        if can_serialize(&object_code) {
+            self.0.lock().unwrap().insert(key, object_code);
+        }
+    }
+}
+
+pub struct PipelineCache {
+    header: PipelineCacheHeader,
+    entries: Arc<Mutex<Entries>>,
+}
+
+impl PipelineCache {
+    /// create a new `PipelineCache`, filled from `initial_data`.
+    /// `initial_data` is ignored if it is malformed or was created for a different device or driver version
+    pub fn new(header: PipelineCacheHeader, initial_data: &[u8]) -> Self {
+        let entries = if initial_data.is_empty() {
+            Entries::new()
+        } else {
+            Self::parse(header, initial_data).unwrap_or_default()
+        };
+        Self {
+            header,
+            entries: Arc::new(Mutex::new(entries)),
+        }
+    }
+    fn parse(header: PipelineCacheHeader, data: &[u8]) -> Option<Entries> {
+        let mut reader = Reader { data };
+        if PipelineCacheHeader::read(&mut reader)? != header {
+            return None;
+        }
+        let mut entries = Entries::new();
+        while !reader.data.is_empty() {
+            let (key, object_code) = read_entry(&mut reader)?;
+            entries.insert(key, Arc::new(object_code));
+        }
+        Some(entries)
+    }
+    pub fn get(&self, key: &PipelineCacheKey) -> Option<Arc<ObjectCode<PipelineFunction>>> {
+        self.entries.lock().unwrap().get(key).cloned()
+    }
+    pub fn insert(&self, key: PipelineCacheKey, object_code: Arc<ObjectCode<PipelineFunction>>) {
+        self.inserter().insert(key, object_code)
+    }
+    pub fn inserter(&self) -> PipelineCacheInserter {
+        PipelineCacheInserter(self.entries.clone())
+    }
+    /// `src` must not be `self`
+    pub fn merge_from(&self, src: &PipelineCache) {
+        // copy the entries out first so both locks are never held at once
+        let src_entries: Vec<_> = src
+            .entries
+            .lock()
+            .unwrap()
+            .iter()
+            .map(|(key, object_code)| (*key, object_code.clone()))
+            .collect();
+        self.entries.lock().unwrap().extend(src_entries);
+    }
+    /// serialize `self`, leaving out the entries that would make the serialized data longer
+    /// than `max_size`. returns the serialized data and if every entry was included
+    pub fn serialize(&self, max_size: usize) -> (Vec<u8>, bool) {
+        if max_size < HEADER_SIZE {
+            return (Vec::new(), false);
+        }
+        let mut retval = Vec::new();
+        self.header.write(&mut retval);
+        let mut complete = true;
+        let mut entry = Vec::new();
+        for (key, object_code) in self.entries.lock().unwrap().iter() {
+            entry.clear();
+            write_entry(&mut entry, key, object_code);
+            if retval.len() + entry.len() > max_size {
+                complete = false;
+                continue;
+            }
+            retval.extend_from_slice(&entry);
+        }
+        (retval, complete)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_serialize_round_trip() {
+        let header = PipelineCacheHeader {
+            vendor_id: 1,
+            device_id: 2,
+            pipeline_cache_uuid: [3; api::VK_UUID_SIZE as usize],
+        };
+        let pipeline_cache = PipelineCache::new(header, &[]);
+        let key = PipelineCacheKeyBuilder::new("fingerprint")
+            .add_words(&[0x0723_0203, 0x0001_0000])
+            .finish();
+        pipeline_cache.insert(
+            key,
+            Arc::new(ObjectCode {
+                object_file: vec![1, 2, 3, 4, 5],
+                symbols: vec![(PipelineFunction::ComputeShader, "main".into())]
+                    .into_iter()
+                    .collect(),
+            }),
+        );
+        let (data, complete) = pipeline_cache.serialize(usize::max_value());
+        assert!(complete);
+        let loaded = PipelineCache::new(header, &data);
+        let object_code = loaded.get(&key).unwrap();
+        assert_eq!(object_code.object_file, [1, 2, 3, 4, 5]);
+        assert_eq!(
+            object_code.symbols[&PipelineFunction::ComputeShader],
+            "main"
+        );
+        let (truncated, complete) = pipeline_cache.serialize(data.len() - 1);
+        assert!(!complete);
+        assert_eq!(truncated.len(), HEADER_SIZE);
+        let other_header = PipelineCacheHeader {
+            device_id: 3,
+            ..header
+        };
+        assert!(PipelineCache::new(other_header, &data).get(&key).is_none());
+    }
+}
@@ -0,0 +1,406 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright 2018 Jacob Lifshay
+
+// Timestamps read the CPU's time-stamp counter when it's invariant (it ticks at a constant rate,
+// even in idle states), and `CLOCK_MONOTONIC` nanoseconds otherwise. The counter's period is
+// measured against the monotonic clock once, for `timestampPeriod`.
+// Pipeline statistics are counted where the work is split up: the queue thread counts
+// the vertices and triangles that draws assemble and shade, and the invocations of each
+// dispatch's workgroups, into a plain `PipelineStatistics`. A query's result is the difference
+// between the counters at its begin and end, so the hot paths never touch the query pool.
+// Results are written with atomics, and readers waiting for them block on the device's
+// `SyncGroup`.
+
+use api;
+use std::ops::Range;
+use std::ptr;
+use std::sync::atomic::{AtomicBool, AtomicU32, AtomicU64, AtomicUsize, Ordering};
+use std::sync::{Arc, Once};
+use std::thread;
+use std::time::Duration;
+use sync::SyncGroup;
+
+/// the number of `VkQueryPipelineStatisticFlagBits`
+pub const PIPELINE_STATISTIC_COUNT: usize = 11;
+
+/// the counters for pipeline statistics queries, indexed by the bit number of their
+/// `VkQueryPipelineStatisticFlagBits`
+#[derive(Copy, Clone, Default, Debug)]
+pub struct PipelineStatistics([u64; PIPELINE_STATISTIC_COUNT]);
+
+impl PipelineStatistics {
+    #[inline]
+    pub fn add(&mut self, statistic: api::VkQueryPipelineStatisticFlagBits, count: u64) {
+        self.0[statistic.trailing_zeros() as usize] += count;
+    }
+    /// the counts since `start`
+    fn since(&self, start: &PipelineStatistics) -> Self {
+        let mut retval = *self;
+        for (value, &start) in retval.0.iter_mut().zip(start.0.iter()) {
+            *value -= start;
+        }
+        retval
+    }
+}
+
+pub struct QueryPool {
+    group: Arc<SyncGroup>,
+    query_type: api::VkQueryType,
+    pipeline_statistics: api::VkQueryPipelineStatisticFlags,
+    /// the number of values in each query's result
+    value_count: usize,
+    available: Vec<AtomicBool>,
+    /// `value_count` values for each query
+    values: Vec<AtomicU64>,
+}
+
+impl QueryPool {
+    pub fn new(
+        group: Arc<SyncGroup>,
+        query_type: api::VkQueryType,
+        query_count: u32,
+        pipeline_statistics: api::VkQueryPipelineStatisticFlags,
+    ) -> Self {
+        let value_count = match query_type {
+            api::VK_QUERY_TYPE_PIPELINE_STATISTICS => pipeline_statistics.count_ones() as usize,
+            _ => 1,
+        };
+        Self {
+            group,
+            query_type,
+            pipeline_statistics,
+            value_count,
+            available: (0..query_count).map(|_| AtomicBool::new(false)).collect(),
+            values: (0..query_count as usize * value_count)
+                .map(|_| AtomicU64::new(0))
+                .collect(),
+        }
+    }
+    /// the indexes of `query_count` queries starting at `first_query`
+    fn get_queries(&self, first_query: u32, query_count: u32) -> Range<usize> {
+        let end = first_query
+            .checked_add(query_count)
+            .filter(|&end| end as usize <= self.available.len())
+            .expect("queries out of range of the query pool");
+        first_query as usize..end as usize
+    }
+    /// the size in bytes of one query's result written by `get_results`
+    pub fn get_result_size(&self, flags: api::VkQueryResultFlags) -> usize {
+        let value_size = if flags & api::VK_QUERY_RESULT_64_BIT != 0 {
+            8
+        } else {
+            4
+        };
+        if flags & api::VK_QUERY_RESULT_WITH_AVAILABILITY_BIT != 0 {
+            value_size * (self.value_count + 1)
+        } else {
+            value_size * self.value_count
+        }
+    }
+    pub fn reset(&self, first_query: u32, query_count: u32) {
+        let queries = self.get_queries(first_query, query_count);
+        for available in &self.available[queries.clone()] {
+            available.store(false, Ordering::Relaxed);
+        }
+        for value in &self.values[queries.start * self.value_count..queries.end * self.value_count]
+        {
+            value.store(0, Ordering::Relaxed);
+        }
+    }
+    fn write(&self, query: u32, values: &[u64]) {
+        let query = query as usize;
+        for (value, &new_value) in self.values[query * self.value_count..].iter().zip(values) {
+            value.store(new_value, Ordering::Relaxed);
+        }
+        self.available[query].store(true, Ordering::Release);
+        self.group.signaled();
+    }
+    /// writes the result of an occlusion or pipeline statistics query that counted `statistics`
+    pub fn end_query(&self, query: u32, statistics: &PipelineStatistics) {
+        match self.query_type {
+            // FIXME: count samples passing the depth and stencil tests once draws are rasterized
+            api::VK_QUERY_TYPE_OCCLUSION => self.write(query, &[0]),
+            api::VK_QUERY_TYPE_PIPELINE_STATISTICS => {
+                let values: Vec<_> = statistics
+                    .0
+                    .iter()
+                    .enumerate()
+                    .filter(|&(bit, _)| self.pipeline_statistics & (1 << bit) != 0)
+                    .map(|(_, &value)| value)
+                    .collect();
+                self.write(query, &values);
+            }
+            _ => unreachable!("invalid query type for vkCmdEndQuery"),
+        }
+    }
+    pub fn write_timestamp(&self, query: u32) {
+        self.write(query, &[get_timestamp()]);
+    }
+    fn is_available(&self, query: usize) -> bool {
+        self.available[query].load(Ordering::Acquire)
+    }
+    /// writes the results like `vkGetQueryPoolResults`, returning false when some of them aren't
+    /// available
+    pub unsafe fn get_results(
+        &self,
+        first_query: u32,
+        query_count: u32,
+        data: *mut u8,
+        stride: usize,
+        flags: api::VkQueryResultFlags,
+    ) -> bool {
+        let queries = self.get_queries(first_query, query_count);
+        if flags & api::VK_QUERY_RESULT_WAIT_BIT != 0 {
+            self.group.wait_until(None, || {
+                queries.clone().all(|query| self.is_available(query))
+            });
+        }
+        let mut all_available = true;
+        for (index, query) in queries.enumerate() {
+            let result = data.add(index * stride);
+            let write_value = |value_index: usize, value: u64| {
+                if flags & api::VK_QUERY_RESULT_64_BIT != 0 {
+                    ptr::write_unaligned((result as *mut u64).add(value_index), value);
+                } else {
+                    ptr::write_unaligned((result as *mut u32).add(value_index), value as u32);
+                }
+            };
+            let available = self.is_available(query);
+            all_available &= available;
+            // after a reset, the values are 0 until the query is available, which is a valid
+            // partial result
+            if available || flags & api::VK_QUERY_RESULT_PARTIAL_BIT != 0 {
+                let values = &self.values[query * self.value_count..][..self.value_count];
+                for (value_index, value) in values.iter().enumerate() {
+                    write_value(value_index, value.load(Ordering::Relaxed));
+                }
+            }
+            if flags & api::VK_QUERY_RESULT_WITH_AVAILABILITY_BIT != 0 {
+                write_value(self.value_count, available as u64);
+            }
+        }
+        all_available
+    }
+}
+
+/// an occlusion or pipeline statistics query between `vkCmdBeginQuery` and `vkCmdEndQuery`,
+/// with the queue's counters at its beginning
+pub struct ActiveQuery {
+    pub query_pool: api::VkQueryPool,
+    pub query: u32,
+    pub start: PipelineStatistics,
+}
+
+impl ActiveQuery {
+    pub fn end(&self, query_pool: &QueryPool, statistics: &PipelineStatistics) {
+        query_pool.end_query(self.query, &statistics.since(&self.start));
+    }
+}
+
+#[derive(Copy, Clone, Eq, PartialEq, Debug)]
+enum TimestampSource {
+    Tsc,
+    Monotonic,
+}
+
+/// 0 until `get_timestamp_source` has checked the CPU, then 1 + the `TimestampSource`
+static TIMESTAMP_SOURCE: AtomicUsize = AtomicUsize::new(0);
+
+/// the bits of the measured `timestampPeriod`, or 0 until it's measured
+static TIMESTAMP_PERIOD: AtomicU32 = AtomicU32::new(0);
+
+/// the monotonic time and the time-stamp counter when `start_timestamp_calibration` ran
+static CALIBRATION_START: Once = Once::new();
+static CALIBRATION_START_TIME: AtomicU64 = AtomicU64::new(0);
+static CALIBRATION_START_TICKS: AtomicU64 = AtomicU64::new(0);
+
+/// the shortest time the time-stamp counter's period is measured over
+const TSC_CALIBRATION_NANOSECONDS: u64 = 2_000_000;
+
+fn has_invariant_tsc() -> bool {
+    #[cfg(target_arch = "x86_64")]
+    unsafe {
+        use std::arch::x86_64::__cpuid;
+        if __cpuid(0x8000_0000).eax >= 0x8000_0007 {
+            return __cpuid(0x8000_0007).edx & (1 << 8) != 0;
+        }
+    }
+    false
+}
+
+fn get_timestamp_source() -> TimestampSource {
+    match TIMESTAMP_SOURCE.load(Ordering::Relaxed) {
+        1 => TimestampSource::Tsc,
+        2 => TimestampSource::Monotonic,
+        _ => {
+            let source = if has_invariant_tsc() {
+                TimestampSource::Tsc
+            } else {
+                TimestampSource::Monotonic
+            };
+            TIMESTAMP_SOURCE.store(1 + source as usize, Ordering::Relaxed);
+            source
+        }
+    }
+}
+
+fn read_tsc() -> u64 {
+    #[cfg(target_arch = "x86_64")]
+    unsafe {
+        ::std::arch::x86_64::_rdtsc()
+    }
+    #[cfg(not(target_arch = "x86_64"))]
+    unreachable!("no time-stamp counter")
+}
+
+#[cfg(unix)]
+fn get_monotonic_time() -> u64 {
+    let mut time = ::libc::timespec {
+        tv_sec: 0,
+        tv_nsec: 0,
+    };
+    unsafe {
+        ::libc::clock_gettime(::libc::CLOCK_MONOTONIC, &mut time);
+    }
+    time.tv_sec as u64 * 1_000_000_000 + time.tv_nsec as u64
+}
+
+#[cfg(not(unix))]
+fn get_monotonic_time() -> u64 {
+    use std::time::{SystemTime, UNIX_EPOCH};
+    let time = SystemTime::now().duration_since(UNIX_EPOCH).unwrap();
+    time.as_secs() * 1_000_000_000 + u64::from(time.subsec_nanos())
+}
+
+/// the current time, in units of `get_timestamp_period`
+pub fn get_timestamp() -> u64 {
+    match get_timestamp_source() {
+        TimestampSource::Tsc => read_tsc(),
+        TimestampSource::Monotonic => get_monotonic_time(),
+    }
+}
+
+/// start measuring the time-stamp counter's period, which `get_timestamp_period` finishes.
+/// called when the physical device is created, so the measurement overlaps the application's
+/// setup instead of waiting in `vkGetPhysicalDeviceProperties`
+pub fn start_timestamp_calibration() {
+    CALIBRATION_START.call_once(|| {
+        if get_timestamp_source() == TimestampSource::Tsc {
+            CALIBRATION_START_TIME.store(get_monotonic_time(), Ordering::Relaxed);
+            CALIBRATION_START_TICKS.store(read_tsc(), Ordering::Relaxed);
+        }
+    });
+}
+
+/// the nanoseconds per timestamp tick, for `timestampPeriod`. the first call only sleeps if
+/// it's within `TSC_CALIBRATION_NANOSECONDS` of `start_timestamp_calibration`
+pub fn get_timestamp_period() -> f32 {
+    match TIMESTAMP_PERIOD.load(Ordering::Relaxed) {
+        0 => {}
+        period => return f32::from_bits(period),
+    }
+    let period = measure_timestamp_period();
+    TIMESTAMP_PERIOD.store(period.to_bits(), Ordering::Relaxed);
+    period
+}
+
+fn measure_timestamp_period() -> f32 {
+    if get_timestamp_source() == TimestampSource::Monotonic {
+        return 1.0;
+    }
+    start_timestamp_calibration();
+    let start_time = CALIBRATION_START_TIME.load(Ordering::Relaxed);
+    let start_ticks = CALIBRATION_START_TICKS.load(Ordering::Relaxed);
+    let elapsed = get_monotonic_time() - start_time;
+    if elapsed < TSC_CALIBRATION_NANOSECONDS {
+        thread::sleep(Duration::from_nanos(TSC_CALIBRATION_NANOSECONDS - elapsed));
+    }
+    let time = get_monotonic_time();
+    let ticks = read_tsc() - start_ticks;
+    ((time - start_time) as f64 / ticks as f64) as f32
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use handle::Handle;
+
+    #[test]
+    fn test_query_results() {
+        let query_pool = QueryPool::new(
+            SyncGroup::new(),
+            api::VK_QUERY_TYPE_PIPELINE_STATISTICS,
+            2,
+            api::VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT
+                | api::VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT,
+        );
+        let mut statistics = PipelineStatistics::default();
+        statistics.add(
+            api::VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT,
+            5,
+        );
+        let active_query = ActiveQuery {
+            query_pool: api::VkQueryPool::null(),
+            query: 1,
+            start: statistics,
+        };
+        statistics.add(
+            api::VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT,
+            2,
+        );
+        statistics.add(
+            api::VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT,
+            3,
+        );
+        statistics.add(
+            api::VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT,
+            64,
+        );
+        active_query.end(&query_pool, &statistics);
+        let mut results = [!0u64; 6];
+        let flags = api::VK_QUERY_RESULT_64_BIT | api::VK_QUERY_RESULT_WITH_AVAILABILITY_BIT;
+        assert_eq!(query_pool.get_result_size(flags), 24);
+        assert_eq!(query_pool.get_result_size(0), 8);
+        unsafe {
+            assert!(!query_pool.get_results(0, 2, results.as_mut_ptr() as *mut u8, 24, flags));
+            // unavailable results are left alone
+            assert_eq!(results, [!0, !0, 0, 2, 3, 1]);
+            let mut results = [!0u32; 2];
+            assert!(query_pool.get_results(
+                1,
+                1,
+                results.as_mut_ptr() as *mut u8,
+                8,
+                api::VK_QUERY_RESULT_WAIT_BIT,
+            ));
+            assert_eq!(results, [2, 3]);
+        }
+        query_pool.reset(1, 1);
+        let mut results = [!0u32; 3];
+        unsafe {
+            assert!(!query_pool.get_results(
+                1,
+                1,
+                results.as_mut_ptr() as *mut u8,
+                12,
+                api::VK_QUERY_RESULT_PARTIAL_BIT | api::VK_QUERY_RESULT_WITH_AVAILABILITY_BIT,
+            ));
+        }
+        assert_eq!(results, [0, 0, 0]);
+    }
+
+    #[test]
+    fn test_timestamps() {
+        let period = get_timestamp_period();
+        assert!(period > 0.0);
+        let start = get_timestamp();
+        let start_time = get_monotonic_time();
+        while get_monotonic_time() - start_time < 1_000_000 {}
+        let elapsed = (get_timestamp() - start) as f64 * f64::from(period);
+        assert!(
+            elapsed >= 900_000.0 && elapsed < 100_000_000.0,
+            "{}",
+            elapsed
+        );
+    }
+}
@@ -0,0 +1,845 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright 2018 Jacob Lifshay
+
+// Each queue has its own thread that executes submissions in order.
+// `Queue::submit` only adds the submission to the queue, so it returns immediately;
+// waiting on semaphores blocks the executing thread, which is what orders work between queues.
+// The queue thread hands the workgroups of compute dispatches, and large copies, fills and blits,
+// to the device's thread pool and helps run them. It runs the vertex shaders of draws itself, so
+// the triangles stay in submission order, and bins them in the render pass instance, which
+// rasterizes them on the thread pool (see `rasterizer.rs`).
+// Clears are deferred for the rest of the batch (see `clear.rs`), and whatever they haven't
+// written by then is written before presenting or signaling.
+
+use api;
+use clear::{self, DeferredClears, ImageRegion};
+use command_buffer::{CommandBuffer, CommandBufferState, CommandRef};
+use compute;
+use descriptor::BoundDescriptorSets;
+use geometry::{
+    BoundIndexBuffer, BoundVertexBuffers, DrawBatcher, PrimitiveBatch, VertexBatchPositions,
+};
+use handle::SharedHandle;
+use pipeline::{GraphicsPipelineState, PipelineState};
+use query::{ActiveQuery, PipelineStatistics};
+use rasterizer::{DrawState, Rect};
+use render_pass::{DepthTest, DrawInfo, RenderPassInstance};
+use shader_compiler_backend::trace;
+use std::cmp;
+use std::collections::VecDeque;
+use std::mem;
+use std::panic;
+use std::ptr;
+use std::sync::{Arc, Condvar, Mutex};
+use std::thread;
+use thread_pool::ThreadPool;
+use transfer;
+
+/// semaphores are paired with the value to wait for or signal, which is ignored for binary
+/// semaphores.
+/// `presents` are swapchains paired with the image to present after the command buffers
+pub struct Batch {
+    pub wait_semaphores: Vec<(api::VkSemaphore, u64)>,
+    pub command_buffers: Vec<api::VkCommandBuffer>,
+    pub presents: Vec<(api::VkSwapchainKHR, u32)>,
+    pub signal_semaphores: Vec<(api::VkSemaphore, u64)>,
+}
+
+struct Submission {
+    batches: Vec<Batch>,
+    fence: api::VkFence,
+}
+
+// the application must keep everything referenced by a submission alive until it's finished
+unsafe impl Send for Submission {}
+
+struct State {
+    submissions: VecDeque<Submission>,
+    /// true while the queue thread is executing a submission that was taken out of `submissions`
+    executing: bool,
+    /// set when executing a submission panicked
+    lost: bool,
+    shutting_down: bool,
+}
+
+struct Shared {
+    state: Mutex<State>,
+    work_available: Condvar,
+    idle: Condvar,
+}
+
+#[derive(Debug)]
+pub struct DeviceLost;
+
+pub struct Queue {
+    shared: Arc<Shared>,
+    thread: Option<thread::JoinHandle<()>>,
+}
+
+impl Queue {
+    pub fn new(queue_family_index: u32, queue_index: u32, thread_pool: Arc<ThreadPool>) -> Self {
+        let shared = Arc::new(Shared {
+            state: Mutex::new(State {
+                submissions: VecDeque::new(),
+                executing: false,
+                lost: false,
+                shutting_down: false,
+            }),
+            work_available: Condvar::new(),
+            idle: Condvar::new(),
+        });
+        let thread = {
+            let shared = shared.clone();
+            thread::Builder::new()
+                .name(format!(
+                    "kazan queue {}.{}",
+                    queue_family_index, queue_index
+                ))
+                .spawn(move || queue_main(&shared, &thread_pool))
+                .expect("can't create queue thread")
+        };
+        Self {
+            shared,
+            thread: Some(thread),
+        }
+    }
+    /// `fence` is signaled after all of `batches` have finished executing
+    pub fn submit(&self, batches: Vec<Batch>, fence: api::VkFence) -> Result<(), DeviceLost> {
+        let _span = trace::span("queue", "submit").arg("batches", batches.len() as u64);
+        let mut state = self.shared.state.lock().unwrap();
+        if state.lost {
+            return Err(DeviceLost);
+        }
+        state.submissions.push_back(Submission { batches, fence });
+        self.shared.work_available.notify_one();
+        Ok(())
+    }
+    pub fn wait_idle(&self) -> Result<(), DeviceLost> {
+        let mut state = self.shared.state.lock().unwrap();
+        while state.executing || !state.submissions.is_empty() {
+            state = self.shared.idle.wait(state).unwrap();
+        }
+        if state.lost {
+            Err(DeviceLost)
+        } else {
+            Ok(())
+        }
+    }
+}
+
+impl Drop for Queue {
+    fn drop(&mut self) {
+        self.shared.state.lock().unwrap().shutting_down = true;
+        self.shared.work_available.notify_one();
+        self.thread.take().unwrap().join().unwrap();
+    }
+}
+
+fn queue_main(shared: &Shared, thread_pool: &ThreadPool) {
+    loop {
+        let submission = {
+            let mut state = shared.state.lock().unwrap();
+            loop {
+                if let Some(submission) = state.submissions.pop_front() {
+                    state.executing = true;
+                    break submission;
+                }
+                if state.shutting_down {
+                    return;
+                }
+                shared.idle.notify_all();
+                state = shared.work_available.wait(state).unwrap();
+            }
+        };
+        let lost = shared.state.lock().unwrap().lost;
+        let mut succeeded = !lost;
+        for batch in &submission.batches {
+            unsafe {
+                {
+                    let _span = trace::span("queue", "wait semaphores");
+                    for &(semaphore, value) in &batch.wait_semaphores {
+                        SharedHandle::from(semaphore).unwrap().wait(value, None);
+                    }
+                }
+                // after the device is lost, only signal so nothing waits forever
+                if succeeded {
+                    let _span = trace::span("queue", "execute batch");
+                    succeeded = panic::catch_unwind(panic::AssertUnwindSafe(|| {
+                        let mut deferred_clears = DeferredClears::new();
+                        for &command_buffer in &batch.command_buffers {
+                            execute_command_buffer(
+                                &SharedHandle::from(command_buffer).unwrap(),
+                                thread_pool,
+                                &mut deferred_clears,
+                            );
+                        }
+                        deferred_clears.write_all(thread_pool);
+                    }))
+                    .is_ok();
+                }
+                for &(swapchain, image_index) in &batch.presents {
+                    let _span = trace::span("queue", "present");
+                    SharedHandle::from(swapchain).unwrap().present(image_index);
+                }
+                for &(semaphore, value) in &batch.signal_semaphores {
+                    SharedHandle::from(semaphore).unwrap().signal(value);
+                }
+            }
+        }
+        let mut state = shared.state.lock().unwrap();
+        if !succeeded {
+            state.lost = true;
+        }
+        if let Some(fence) = unsafe { SharedHandle::from(submission.fence) } {
+            fence.signal();
+        }
+        state.executing = false;
+    }
+}
+
+unsafe fn execute_command_buffer(
+    command_buffer: &CommandBuffer,
+    thread_pool: &ThreadPool,
+    deferred_clears: &mut DeferredClears,
+) {
+    let _span = trace::span("queue", "execute command buffer");
+    assert_eq!(command_buffer.state(), CommandBufferState::Executable);
+    let mut compute_pipeline = None;
+    let mut graphics_pipeline = None;
+    let mut compute_descriptor_sets = BoundDescriptorSets::default();
+    let mut graphics_descriptor_sets = BoundDescriptorSets::default();
+    let mut vertex_buffers = BoundVertexBuffers::default();
+    let mut index_buffer = None;
+    let mut render_pass_instance: Option<RenderPassInstance> = None;
+    // the dynamic viewports and scissors
+    let mut viewports = Vec::new();
+    let mut scissors = Vec::new();
+    let mut statistics = PipelineStatistics::default();
+    let mut active_queries: Vec<ActiveQuery> = Vec::new();
+    let mut commands = command_buffer.commands().peekable();
+    while let Some(command) = commands.next() {
+        match command {
+            CommandRef::BindPipeline(command) => {
+                let pipeline = Some(SharedHandle::from(command.pipeline).unwrap());
+                if command.pipeline_bind_point == api::VK_PIPELINE_BIND_POINT_COMPUTE {
+                    compute_pipeline = pipeline;
+                } else {
+                    graphics_pipeline = pipeline;
+                }
+            }
+            CommandRef::BindDescriptorSets(command) => {
+                let descriptor_sets =
+                    if command.pipeline_bind_point == api::VK_PIPELINE_BIND_POINT_COMPUTE {
+                        &mut compute_descriptor_sets
+                    } else {
+                        &mut graphics_descriptor_sets
+                    };
+                descriptor_sets.bind(
+                    command.first_set,
+                    command.first_dynamic_offset,
+                    command.descriptor_sets.get(),
+                    command.dynamic_offsets.get(),
+                );
+            }
+            CommandRef::BindIndexBuffer(command) => {
+                index_buffer = Some(BoundIndexBuffer::new(
+                    command.buffer,
+                    command.offset,
+                    command.index_type,
+                ));
+            }
+            CommandRef::BindVertexBuffers(command) => {
+                vertex_buffers.bind(
+                    command.first_binding,
+                    command.buffers.get(),
+                    command.offsets.get(),
+                );
+            }
+            CommandRef::SetViewport(command) => set_dynamic_state(
+                &mut viewports,
+                command.first_viewport,
+                command.viewports.get(),
+            ),
+            CommandRef::SetScissor(command) => {
+                set_dynamic_state(&mut scissors, command.first_scissor, command.scissors.get())
+            }
+            CommandRef::PushConstants(_) => {}
+            CommandRef::Draw(_)
+            | CommandRef::DrawIndexed(_)
+            | CommandRef::DrawIndirect(_)
+            | CommandRef::DrawIndexedIndirect(_)
+            | CommandRef::DrawIndirectCount(_)
+            | CommandRef::DrawIndexedIndirectCount(_) => {
+                let _span = trace::span("queue", "draws");
+                let pipeline = graphics_pipeline
+                    .as_ref()
+                    .expect("no graphics pipeline bound");
+                let render_pass_instance = render_pass_instance
+                    .as_mut()
+                    .expect("draw outside of a render pass");
+                // nothing can change the pipeline, bindings or dynamic state between consecutive
+                // draws, so they're batched together, and binned as one draw
+                let draw_index = match pipeline.state() {
+                    PipelineState::Graphics(state) => get_draw_info(state, &viewports, &scissors),
+                    PipelineState::Compute => None,
+                }
+                .map(|draw_info| render_pass_instance.add_draw(draw_info));
+                let mut batcher = DrawBatcher::new(
+                    pipeline,
+                    &vertex_buffers,
+                    index_buffer,
+                    &graphics_descriptor_sets,
+                    &mut statistics,
+                    |batch, positions| {
+                        if let Some(draw_index) = draw_index {
+                            render_pass_instance.add_batch(draw_index, batch, positions);
+                        }
+                    },
+                );
+                let mut command = command;
+                loop {
+                    add_draw(&mut batcher, command);
+                    if !commands.peek().map_or(false, |command| is_draw(command)) {
+                        break;
+                    }
+                    command = commands.next().unwrap();
+                }
+                batcher.finish();
+            }
+            CommandRef::Dispatch(command) => {
+                let _span = trace::span("queue", "dispatch");
+                // shaders can access any image
+                deferred_clears.write_all(thread_pool);
+                compute::dispatch(
+                    compute_pipeline
+                        .as_ref()
+                        .expect("no compute pipeline bound"),
+                    thread_pool,
+                    &compute_descriptor_sets,
+                    [
+                        command.base_group_x,
+                        command.base_group_y,
+                        command.base_group_z,
+                    ],
+                    [
+                        command.group_count_x,
+                        command.group_count_y,
+                        command.group_count_z,
+                    ],
+                    &mut statistics,
+                );
+            }
+            CommandRef::DispatchIndirect(command) => {
+                let _span = trace::span("queue", "dispatch");
+                deferred_clears.write_all(thread_pool);
+                let buffer = SharedHandle::from(command.buffer).unwrap();
+                let offset = command.offset as usize;
+                assert!(offset + mem::size_of::<api::VkDispatchIndirectCommand>() <= buffer.size);
+                let api::VkDispatchIndirectCommand { x, y, z } =
+                    ptr::read(buffer.get_memory().add(offset) as *const _);
+                compute::dispatch(
+                    compute_pipeline
+                        .as_ref()
+                        .expect("no compute pipeline bound"),
+                    thread_pool,
+                    &compute_descriptor_sets,
+                    [0; 3],
+                    [x, y, z],
+                    &mut statistics,
+                );
+            }
+            CommandRef::CopyBuffer(command) => {
+                let src_buffer = SharedHandle::from(command.src_buffer).unwrap();
+                let dst_buffer = SharedHandle::from(command.dst_buffer).unwrap();
+                for region in command.regions.get() {
+                    transfer::copy_buffer(thread_pool, &src_buffer, &dst_buffer, region);
+                }
+            }
+            CommandRef::CopyImage(command) => {
+                let src_image = SharedHandle::from(command.src_image).unwrap();
+                let dst_image = SharedHandle::from(command.dst_image).unwrap();
+                for region in command.regions.get() {
+                    deferred_clears.prepare_read(
+                        thread_pool,
+                        &src_image,
+                        &ImageRegion::new(&region.srcSubresource, region.srcOffset, region.extent),
+                    );
+                    deferred_clears.prepare_write(
+                        thread_pool,
+                        &dst_image,
+                        &ImageRegion::new(&region.dstSubresource, region.dstOffset, region.extent),
+                    );
+                    transfer::copy_image(thread_pool, &src_image, &dst_image, region);
+                }
+            }
+            CommandRef::BlitImage(command) => {
+                let src_image = SharedHandle::from(command.src_image).unwrap();
+                let dst_image = SharedHandle::from(command.dst_image).unwrap();
+                for region in command.regions.get() {
+                    // filtering can read outside of the source region
+                    deferred_clears.prepare_read(
+                        thread_pool,
+                        &src_image,
+                        &ImageRegion::whole_level(&src_image, &region.srcSubresource),
+                    );
+                    deferred_clears.prepare_write(
+                        thread_pool,
+                        &dst_image,
+                        &get_blit_dst_region(region),
+                    );
+                    transfer::blit_image(
+                        thread_pool,
+                        &src_image,
+                        &dst_image,
+                        region,
+                        command.filter,
+                    );
+                }
+            }
+            CommandRef::CopyBufferToImage(command) => {
+                let src_buffer = SharedHandle::from(command.src_buffer).unwrap();
+                let dst_image = SharedHandle::from(command.dst_image).unwrap();
+                for region in command.regions.get() {
+                    deferred_clears.prepare_write(
+                        thread_pool,
+                        &dst_image,
+                        &ImageRegion::new(
+                            &region.imageSubresource,
+                            region.imageOffset,
+                            region.imageExtent,
+                        ),
+                    );
+                    transfer::copy_buffer_to_image(thread_pool, &src_buffer, &dst_image, region);
+                }
+            }
+            CommandRef::CopyImageToBuffer(command) => {
+                let src_image = SharedHandle::from(command.src_image).unwrap();
+                let dst_buffer = SharedHandle::from(command.dst_buffer).unwrap();
+                for region in command.regions.get() {
+                    deferred_clears.prepare_read(
+                        thread_pool,
+                        &src_image,
+                        &ImageRegion::new(
+                            &region.imageSubresource,
+                            region.imageOffset,
+                            region.imageExtent,
+                        ),
+                    );
+                    transfer::copy_image_to_buffer(thread_pool, &src_image, &dst_buffer, region);
+                }
+            }
+            CommandRef::UpdateBuffer(command) => {
+                let dst_buffer = SharedHandle::from(command.dst_buffer).unwrap();
+                let data = command.data.get();
+                let dst_offset = command.dst_offset as usize;
+                assert!(dst_offset + data.len() <= dst_buffer.size);
+                ptr::copy_nonoverlapping(
+                    data.as_ptr(),
+                    dst_buffer.get_memory().add(dst_offset),
+                    data.len(),
+                );
+            }
+            CommandRef::FillBuffer(command) => transfer::fill_buffer(
+                thread_pool,
+                &SharedHandle::from(command.dst_buffer).unwrap(),
+                command.dst_offset,
+                command.size,
+                command.data,
+            ),
+            CommandRef::ClearColorImage(command) => {
+                let image = SharedHandle::from(command.image).unwrap();
+                let pattern =
+                    clear::get_color_pattern(&image, image.properties.format, command.color);
+                for range in command.ranges.get() {
+                    deferred_clears.clear_subresource_range(
+                        thread_pool,
+                        &image,
+                        range,
+                        &pattern,
+                        None,
+                    );
+                }
+            }
+            CommandRef::ClearDepthStencilImage(command) => {
+                let image = SharedHandle::from(command.image).unwrap();
+                let pattern = clear::get_depth_stencil_pattern(&image, command.depth_stencil);
+                for range in command.ranges.get() {
+                    let mask = clear::get_aspect_mask(&image, range.aspectMask);
+                    deferred_clears.clear_subresource_range(
+                        thread_pool,
+                        &image,
+                        range,
+                        &pattern,
+                        mask.as_ref().map(|v| &**v),
+                    );
+                }
+            }
+            CommandRef::ClearAttachments(command) => render_pass_instance
+                .as_mut()
+                .expect("vkCmdClearAttachments outside of a render pass")
+                .clear_attachments(
+                    thread_pool,
+                    deferred_clears,
+                    &mut statistics,
+                    command.attachments.get(),
+                    command.rects.get(),
+                ),
+            CommandRef::BeginRenderPass(command) => {
+                assert!(render_pass_instance.is_none());
+                render_pass_instance = Some(RenderPassInstance::begin(
+                    thread_pool,
+                    deferred_clears,
+                    SharedHandle::from(command.render_pass).unwrap(),
+                    SharedHandle::from(command.framebuffer).unwrap(),
+                    command.render_area,
+                    command.clear_values.get(),
+                ));
+            }
+            CommandRef::NextSubpass(_) => render_pass_instance
+                .as_mut()
+                .expect("vkCmdNextSubpass outside of a render pass")
+                .next_subpass(thread_pool, deferred_clears, &mut statistics),
+            CommandRef::EndRenderPass(_) => render_pass_instance
+                .take()
+                .expect("vkCmdEndRenderPass outside of a render pass")
+                .end(thread_pool, deferred_clears, &mut statistics),
+            CommandRef::BeginQuery(command) => active_queries.push(ActiveQuery {
+                query_pool: command.query_pool,
+                query: command.query,
+                start: statistics,
+            }),
+            CommandRef::EndQuery(command) => {
+                // the query counts the fragments of the draws before it
+                if let Some(render_pass_instance) = &mut render_pass_instance {
+                    render_pass_instance.rasterize(thread_pool, deferred_clears, &mut statistics);
+                }
+                let index = active_queries
+                    .iter()
+                    .position(|active_query| {
+                        active_query.query_pool == command.query_pool
+                            && active_query.query == command.query
+                    })
+                    .expect("vkCmdEndQuery without vkCmdBeginQuery");
+                active_queries.swap_remove(index).end(
+                    &SharedHandle::from(command.query_pool).unwrap(),
+                    &statistics,
+                );
+            }
+            CommandRef::ResetQueryPool(command) => SharedHandle::from(command.query_pool)
+                .unwrap()
+                .reset(command.first_query, command.query_count),
+            // the previous commands have all finished, whatever the stage
+            CommandRef::WriteTimestamp(command) => {
+                if let Some(render_pass_instance) = &mut render_pass_instance {
+                    render_pass_instance.rasterize(thread_pool, deferred_clears, &mut statistics);
+                }
+                SharedHandle::from(command.query_pool)
+                    .unwrap()
+                    .write_timestamp(command.query)
+            }
+            CommandRef::CopyQueryPoolResults(command) => {
+                let query_pool = SharedHandle::from(command.query_pool).unwrap();
+                let dst_buffer = SharedHandle::from(command.dst_buffer).unwrap();
+                let result_size = query_pool.get_result_size(command.flags) as u64;
+                // the last query's result only takes its size, not the whole stride
+                let written_size = match command.query_count {
+                    0 => Some(0),
+                    query_count => u64::from(query_count - 1)
+                        .checked_mul(command.stride)
+                        .and_then(|v| v.checked_add(result_size)),
+                };
+                assert!(
+                    written_size
+                        .and_then(|v| v.checked_add(command.dst_offset))
+                        .map_or(false, |end| end <= dst_buffer.size as u64),
+                    "query results are written past the end of the buffer"
+                );
+                query_pool.get_results(
+                    command.first_query,
+                    command.query_count,
+                    dst_buffer.get_memory().add(command.dst_offset as usize),
+                    command.stride as usize,
+                    command.flags,
+                );
+            }
+        }
+    }
+}
+
+/// set `values` starting at `first`, for `vkCmdSetViewport` and `vkCmdSetScissor`
+fn set_dynamic_state<T: Copy>(state: &mut Vec<T>, first: u32, values: &[T]) {
+    let first = first as usize;
+    if let Some(&value) = values.first() {
+        if state.len() < first + values.len() {
+            state.resize(first + values.len(), value);
+        }
+        state[first..first + values.len()].copy_from_slice(values);
+    }
+}
+
+/// the `DrawInfo` of draws using `state`, or `None` if rasterization is disabled.
+/// FIXME: only the first viewport and scissor are used, since vertex shaders can't write
+/// `ViewportIndex`, and polygons are always filled
+fn get_draw_info(
+    state: &GraphicsPipelineState,
+    viewports: &[api::VkViewport],
+    scissors: &[api::VkRect2D],
+) -> Option<DrawInfo> {
+    if state.rasterization.rasterizer_discard_enable {
+        return None;
+    }
+    let viewport = if state.is_dynamic(api::VK_DYNAMIC_STATE_VIEWPORT) {
+        viewports[0]
+    } else {
+        state.viewports[0]
+    };
+    let scissor = if state.is_dynamic(api::VK_DYNAMIC_STATE_SCISSOR) {
+        scissors[0]
+    } else {
+        state.scissors[0]
+    };
+    Some(DrawInfo {
+        viewport,
+        depth_clamp_enable: state.rasterization.depth_clamp_enable,
+        draw_state: DrawState {
+            cull_mode: state.rasterization.cull_mode,
+            front_face: state.rasterization.front_face,
+            scissor: Rect {
+                x: scissor.offset.x as u32,
+                y: scissor.offset.y as u32,
+                width: scissor.extent.width,
+                height: scissor.extent.height,
+            },
+        },
+        depth_test: state
+            .depth_stencil
+            .as_ref()
+            .filter(|depth_stencil| depth_stencil.depth_test_enable)
+            .map(|depth_stencil| DepthTest {
+                compare_op: depth_stencil.depth_compare_op,
+                write_enable: depth_stencil.depth_write_enable,
+            }),
+    })
+}
+
+fn is_draw(command: &CommandRef) -> bool {
+    match command {
+        CommandRef::Draw(_)
+        | CommandRef::DrawIndexed(_)
+        | CommandRef::DrawIndirect(_)
+        | CommandRef::DrawIndexedIndirect(_)
+        | CommandRef::DrawIndirectCount(_)
+        | CommandRef::DrawIndexedIndirectCount(_) => true,
+        _ => false,
+    }
+}
+
+/// the memory of the `size` bytes at `offset` in `buffer`
+unsafe fn get_buffer_range(
+    buffer: api::VkBuffer,
+    offset: api::VkDeviceSize,
+    size: api::VkDeviceSize,
+) -> *const u8 {
+    let buffer = SharedHandle::from(buffer).unwrap();
+    assert!(
+        offset
+            .checked_add(size)
+            .map_or(false, |end| end <= buffer.size as u64),
+        "indirect draw reads past the end of the buffer"
+    );
+    buffer.get_memory().add(offset as usize)
+}
+
+/// the memory of `draw_count` indirect commands of type `T`, `stride` bytes apart, at `offset`
+/// in `buffer`
+unsafe fn get_indirect_commands<T>(
+    buffer: api::VkBuffer,
+    offset: api::VkDeviceSize,
+    draw_count: u32,
+    stride: u32,
+) -> *const u8 {
+    // the last command only needs its own size, not a whole stride
+    let size = match draw_count {
+        0 => 0,
+        _ => u64::from(draw_count - 1) * u64::from(stride) + mem::size_of::<T>() as u64,
+    };
+    get_buffer_range(buffer, offset, size)
+}
+
+/// the draw count in `count_buffer`, clamped to `max_draw_count`
+unsafe fn read_draw_count(
+    count_buffer: api::VkBuffer,
+    count_buffer_offset: api::VkDeviceSize,
+    max_draw_count: u32,
+) -> u32 {
+    let count = ptr::read(get_buffer_range(
+        count_buffer,
+        count_buffer_offset,
+        mem::size_of::<u32>() as u64,
+    ) as *const u32);
+    cmp::min(count, max_draw_count)
+}
+
+unsafe fn add_draw<F: FnMut(&PrimitiveBatch, &VertexBatchPositions)>(
+    batcher: &mut DrawBatcher<F>,
+    command: CommandRef,
+) {
+    match command {
+        CommandRef::Draw(command) => batcher.draw(
+            command.vertex_count,
+            command.instance_count,
+            command.first_vertex,
+            command.first_instance,
+        ),
+        CommandRef::DrawIndexed(command) => batcher.draw_indexed(
+            command.index_count,
+            command.instance_count,
+            command.first_index,
+            command.vertex_offset,
+            command.first_instance,
+        ),
+        CommandRef::DrawIndirect(command) => batcher.draw_indirect(
+            get_indirect_commands::<api::VkDrawIndirectCommand>(
+                command.buffer,
+                command.offset,
+                command.draw_count,
+                command.stride,
+            ),
+            command.draw_count,
+            command.stride,
+        ),
+        CommandRef::DrawIndexedIndirect(command) => batcher.draw_indexed_indirect(
+            get_indirect_commands::<api::VkDrawIndexedIndirectCommand>(
+                command.buffer,
+                command.offset,
+                command.draw_count,
+                command.stride,
+            ),
+            command.draw_count,
+            command.stride,
+        ),
+        CommandRef::DrawIndirectCount(command) => {
+            let draw_count = read_draw_count(
+                command.count_buffer,
+                command.count_buffer_offset,
+                command.max_draw_count,
+            );
+            batcher.draw_indirect(
+                get_indirect_commands::<api::VkDrawIndirectCommand>(
+                    command.buffer,
+                    command.offset,
+                    draw_count,
+                    command.stride,
+                ),
+                draw_count,
+                command.stride,
+            )
+        }
+        CommandRef::DrawIndexedIndirectCount(command) => {
+            let draw_count = read_draw_count(
+                command.count_buffer,
+                command.count_buffer_offset,
+                command.max_draw_count,
+            );
+            batcher.draw_indexed_indirect(
+                get_indirect_commands::<api::VkDrawIndexedIndirectCommand>(
+                    command.buffer,
+                    command.offset,
+                    draw_count,
+                    command.stride,
+                ),
+                draw_count,
+                command.stride,
+            )
+        }
+        _ => unreachable!(),
+    }
+}
+
+/// the destination of a blit, whose offsets can be in either order
+fn get_blit_dst_region(region: &api::VkImageBlit) -> ImageRegion {
+    let [a, b] = region.dstOffsets;
+    let (x, y, z) = (cmp::min(a.x, b.x), cmp::min(a.y, b.y), cmp::min(a.z, b.z));
+    ImageRegion::new(
+        &region.dstSubresource,
+        api::VkOffset3D { x, y, z },
+        api::VkExtent3D {
+            width: (cmp::max(a.x, b.x) - x) as u32,
+            height: (cmp::max(a.y, b.y) - y) as u32,
+            depth: (cmp::max(a.z, b.z) - z) as u32,
+        },
+    )
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use buffer::{Buffer, BufferMemory};
+    use constants::MIN_MEMORY_MAP_ALIGNMENT;
+    use device_memory::{DeviceMemory, DeviceMemoryAllocation, DeviceMemoryLayout};
+    use handle::OwnedHandle;
+
+    /// a buffer of `size` bytes, with `value` at `value_offset`
+    unsafe fn create_buffer(
+        size: usize,
+        value_offset: usize,
+        value: u32,
+    ) -> (OwnedHandle<api::VkDeviceMemory>, OwnedHandle<api::VkBuffer>) {
+        let memory = OwnedHandle::<api::VkDeviceMemory>::new(
+            DeviceMemory::allocate_from_default_heap(DeviceMemoryLayout::calculate(
+                size,
+                MIN_MEMORY_MAP_ALIGNMENT,
+            ))
+            .unwrap(),
+        );
+        ptr::write(memory.get().as_ptr().add(value_offset) as *mut u32, value);
+        let buffer = OwnedHandle::<api::VkBuffer>::new(Buffer {
+            size,
+            memory: Some(BufferMemory {
+                device_memory: SharedHandle::from(memory.get_handle()).unwrap(),
+                offset: 0,
+            }),
+        });
+        (memory, buffer)
+    }
+
+    #[test]
+    fn test_indirect_commands() {
+        unsafe {
+            let (memory, buffer) = create_buffer(100, 96, 7);
+            // the last of 4 commands 20 bytes apart ends at the end of the buffer
+            assert_eq!(
+                get_indirect_commands::<api::VkDrawIndirectCommand>(buffer.get_handle(), 24, 4, 20),
+                memory.get().as_ptr().add(24) as *const u8
+            );
+            get_indirect_commands::<api::VkDrawIndexedIndirectCommand>(
+                buffer.get_handle(),
+                80,
+                1,
+                0,
+            );
+            get_indirect_commands::<api::VkDrawIndirectCommand>(buffer.get_handle(), 100, 0, 20);
+            assert_eq!(read_draw_count(buffer.get_handle(), 96, 10), 7);
+            // clamped to `maxDrawCount`
+            assert_eq!(read_draw_count(buffer.get_handle(), 96, 3), 3);
+        }
+    }
+
+    #[test]
+    #[should_panic(expected = "past the end of the buffer")]
+    fn test_indirect_commands_past_end() {
+        unsafe {
+            let (_memory, buffer) = create_buffer(100, 96, 7);
+            get_indirect_commands::<api::VkDrawIndirectCommand>(buffer.get_handle(), 28, 4, 20);
+        }
+    }
+
+    #[test]
+    #[should_panic(expected = "past the end of the buffer")]
+    fn test_draw_count_past_end() {
+        unsafe {
+            let (_memory, buffer) = create_buffer(100, 96, 7);
+            read_draw_count(buffer.get_handle(), 98, 10);
+        }
+    }
+}
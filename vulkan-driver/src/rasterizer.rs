@@ -0,0 +1,448 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright 2018 Jacob Lifshay
+
+// Binning rasterizer:
+//
+// Triangles from every draw in a subpass are sorted into the screen tiles they overlap, then each
+// tile is rasterized and shaded on its own thread, with all of the tile's triangles handled in
+// submission order. A tile's attachments are only touched by one thread, and stay in that
+// thread's cache while the binned draws are rasterized instead of being streamed through once per
+// draw. `RenderPassInstance` owns the bins and rasterizes them before anything reads the
+// attachments.
+
+use api;
+use shader_compiler_backend::trace;
+use std::cmp;
+use thread_pool::ThreadPool;
+
+/// width and height of a screen tile in pixels.
+/// chosen so a tile's color and depth attachments fit in L2 cache
+pub const TILE_SIZE: u32 = 64;
+
+/// number of fractional bits in the fixed-point vertex positions, reported as
+/// `subPixelPrecisionBits`
+pub const SUBPIXEL_BITS: u32 = 8;
+
+const SUBPIXEL_SCALE: f32 = (1 << SUBPIXEL_BITS) as f32;
+
+/// a vertex after clipping and the viewport transform
+#[derive(Copy, Clone, Debug)]
+pub struct Vertex {
+    /// framebuffer x and y, depth, then 1/w in clip space
+    pub position: [f32; 4],
+}
+
+#[derive(Copy, Clone, Debug)]
+pub struct Triangle {
+    pub vertices: [Vertex; 3],
+}
+
+/// a rectangle in framebuffer coordinates
+#[derive(Copy, Clone, Debug, Eq, PartialEq)]
+pub struct Rect {
+    pub x: u32,
+    pub y: u32,
+    pub width: u32,
+    pub height: u32,
+}
+
+impl Rect {
+    pub fn intersect(self, rhs: Rect) -> Option<Rect> {
+        let x = cmp::max(self.x, rhs.x);
+        let y = cmp::max(self.y, rhs.y);
+        let end_x = cmp::min(self.x + self.width, rhs.x + rhs.width);
+        let end_y = cmp::min(self.y + self.height, rhs.y + rhs.height);
+        if x < end_x && y < end_y {
+            Some(Rect {
+                x,
+                y,
+                width: end_x - x,
+                height: end_y - y,
+            })
+        } else {
+            None
+        }
+    }
+}
+
+/// the per-draw state used while binning, from `VkPipelineRasterizationStateCreateInfo` and the
+/// scissor rectangle
+#[derive(Copy, Clone, Debug)]
+pub struct DrawState {
+    pub cull_mode: api::VkCullModeFlags,
+    pub front_face: api::VkFrontFace,
+    pub scissor: Rect,
+}
+
+#[derive(Copy, Clone, Debug)]
+pub struct Fragment {
+    pub x: u32,
+    pub y: u32,
+    pub depth: f32,
+    /// perspective-correct barycentric coordinates
+    pub barycentrics: [f32; 3],
+    pub front_facing: bool,
+}
+
+/// a triangle converted to fixed point and set up for rasterization
+struct BinnedTriangle {
+    /// index passed to `add_draw`
+    draw_index: u32,
+    /// fixed-point x and y of each vertex, ordered so the edge functions are positive inside
+    positions: [(i64, i64); 3],
+    /// subtracted from the edge functions to implement the top-left fill rule
+    edge_biases: [i64; 3],
+    /// twice the area, in fixed point squared
+    double_area: i64,
+    depths: [f32; 3],
+    inverse_w: [f32; 3],
+    bounds: Rect,
+    front_facing: bool,
+}
+
+impl BinnedTriangle {
+    fn edge_function(&self, edge: usize, x: i64, y: i64) -> i64 {
+        let (start_x, start_y) = self.positions[(edge + 1) % 3];
+        let (end_x, end_y) = self.positions[(edge + 2) % 3];
+        (end_x - start_x) * (y - start_y)
+            - (end_y - start_y) * (x - start_x)
+            - self.edge_biases[edge]
+    }
+}
+
+fn to_fixed_point(v: f32) -> Option<i64> {
+    // keep positions far enough from overflowing that edge functions can't overflow either
+    const LIMIT: f32 = (1u32 << 24) as f32;
+    let v = (v * SUBPIXEL_SCALE).round();
+    if v.abs() < LIMIT {
+        Some(v as i64)
+    } else {
+        None
+    }
+}
+
+/// the triangles of a subpass sorted into the tiles they overlap
+pub struct TileBins {
+    framebuffer: Rect,
+    tiles_x: u32,
+    tiles_y: u32,
+    triangles: Vec<BinnedTriangle>,
+    /// the triangle indexes overlapping each tile, in submission order
+    bins: Vec<Vec<u32>>,
+}
+
+impl TileBins {
+    pub fn new(framebuffer_width: u32, framebuffer_height: u32) -> Self {
+        let tiles_x = (framebuffer_width + TILE_SIZE - 1) / TILE_SIZE;
+        let tiles_y = (framebuffer_height + TILE_SIZE - 1) / TILE_SIZE;
+        Self {
+            framebuffer: Rect {
+                x: 0,
+                y: 0,
+                width: framebuffer_width,
+                height: framebuffer_height,
+            },
+            tiles_x,
+            tiles_y,
+            triangles: Vec::new(),
+            bins: (0..tiles_x * tiles_y).map(|_| Vec::new()).collect(),
+        }
+    }
+    pub fn is_empty(&self) -> bool {
+        self.triangles.is_empty()
+    }
+    /// remove every binned triangle, keeping the allocations for the next draws
+    pub fn clear(&mut self) {
+        self.triangles.clear();
+        for bin in &mut self.bins {
+            bin.clear();
+        }
+    }
+    fn get_tile(&self, tile_x: u32, tile_y: u32) -> Rect {
+        Rect {
+            x: tile_x * TILE_SIZE,
+            y: tile_y * TILE_SIZE,
+            width: TILE_SIZE,
+            height: TILE_SIZE,
+        }
+        .intersect(self.framebuffer)
+        .unwrap()
+    }
+    /// bin the triangles of a draw, culling the ones that face away or don't cover any pixels
+    pub fn add_draw<I: IntoIterator<Item = Triangle>>(
+        &mut self,
+        draw_index: u32,
+        draw_state: DrawState,
+        triangles: I,
+    ) {
+        let _span = trace::span("rasterizer", "bin draw").arg("draw", u64::from(draw_index));
+        let clip_rect = match draw_state.scissor.intersect(self.framebuffer) {
+            Some(clip_rect) => clip_rect,
+            None => return,
+        };
+        for triangle in triangles {
+            if let Some(triangle) =
+                self.set_up_triangle(draw_index, &draw_state, clip_rect, triangle)
+            {
+                let triangle_index = self.triangles.len() as u32;
+                let first_tile_x = triangle.bounds.x / TILE_SIZE;
+                let first_tile_y = triangle.bounds.y / TILE_SIZE;
+                let last_tile_x = (triangle.bounds.x + triangle.bounds.width - 1) / TILE_SIZE;
+                let last_tile_y = (triangle.bounds.y + triangle.bounds.height - 1) / TILE_SIZE;
+                for tile_y in first_tile_y..=last_tile_y {
+                    for tile_x in first_tile_x..=last_tile_x {
+                        self.bins[(tile_x + tile_y * self.tiles_x) as usize].push(triangle_index);
+                    }
+                }
+                self.triangles.push(triangle);
+            }
+        }
+    }
+    fn set_up_triangle(
+        &self,
+        draw_index: u32,
+        draw_state: &DrawState,
+        clip_rect: Rect,
+        triangle: Triangle,
+    ) -> Option<BinnedTriangle> {
+        let mut positions = [(0, 0); 3];
+        for (position, vertex) in positions.iter_mut().zip(&triangle.vertices) {
+            *position = (
+                to_fixed_point(vertex.position[0])?,
+                to_fixed_point(vertex.position[1])?,
+            );
+        }
+        let mut vertex_order = [0, 1, 2];
+        let [(x0, y0), (x1, y1), (x2, y2)] = positions;
+        let mut double_area = (x1 - x0) * (y2 - y0) - (y1 - y0) * (x2 - x0);
+        if double_area == 0 {
+            return None;
+        }
+        // the Vulkan spec defines the signed area with the opposite sign
+        let counter_clockwise = double_area < 0;
+        let front_facing = if draw_state.front_face == api::VK_FRONT_FACE_COUNTER_CLOCKWISE {
+            counter_clockwise
+        } else {
+            !counter_clockwise
+        };
+        let cull_bit = if front_facing {
+            api::VK_CULL_MODE_FRONT_BIT
+        } else {
+            api::VK_CULL_MODE_BACK_BIT
+        };
+        if draw_state.cull_mode & cull_bit != 0 {
+            return None;
+        }
+        if double_area < 0 {
+            vertex_order.swap(1, 2);
+            double_area = -double_area;
+        }
+        let positions = [
+            positions[vertex_order[0]],
+            positions[vertex_order[1]],
+            positions[vertex_order[2]],
+        ];
+        let mut edge_biases = [0; 3];
+        for (edge, edge_bias) in edge_biases.iter_mut().enumerate() {
+            let (start_x, start_y) = positions[(edge + 1) % 3];
+            let (end_x, end_y) = positions[(edge + 2) % 3];
+            let is_top_edge = start_y == end_y && end_x > start_x;
+            let is_left_edge = end_y < start_y;
+            // samples exactly on an edge are only covered if it's a top or left edge
+            *edge_bias = if is_top_edge || is_left_edge { 0 } else { 1 };
+        }
+        let min_x = positions.iter().map(|v| v.0).min().unwrap();
+        let max_x = positions.iter().map(|v| v.0).max().unwrap();
+        let min_y = positions.iter().map(|v| v.1).min().unwrap();
+        let max_y = positions.iter().map(|v| v.1).max().unwrap();
+        // convert to the range of pixels whose centers could be covered, rounding outwards
+        let to_pixel = |v: i64| cmp::max(v >> SUBPIXEL_BITS, 0) as u32;
+        let half_pixel = 1 << (SUBPIXEL_BITS - 1);
+        let first_x = to_pixel(min_x - half_pixel);
+        let first_y = to_pixel(min_y - half_pixel);
+        let last_x = to_pixel(max_x - half_pixel + (1 << SUBPIXEL_BITS) - 1);
+        let last_y = to_pixel(max_y - half_pixel + (1 << SUBPIXEL_BITS) - 1);
+        let bounds = Rect {
+            x: first_x,
+            y: first_y,
+            width: last_x.saturating_sub(first_x) + 1,
+            height: last_y.saturating_sub(first_y) + 1,
+        }
+        .intersect(clip_rect)?;
+        let get_attribute = |index: usize| triangle.vertices[vertex_order[index]].position;
+        Some(BinnedTriangle {
+            draw_index,
+            positions,
+            edge_biases,
+            double_area,
+            depths: [
+                get_attribute(0)[2],
+                get_attribute(1)[2],
+                get_attribute(2)[2],
+            ],
+            inverse_w: [
+                get_attribute(0)[3],
+                get_attribute(1)[3],
+                get_attribute(2)[3],
+            ],
+            bounds,
+            front_facing,
+        })
+    }
+    /// rasterize every tile in parallel, calling `shade_tile` once for each tile with triangles.
+    /// each tile is only handed to one thread, so `shade_tile` can write to the tile's pixels
+    /// without synchronization
+    pub fn rasterize<F: Fn(&TileFragments) + Sync>(&self, thread_pool: &ThreadPool, shade_tile: F) {
+        let _span = trace::span("rasterizer", "rasterize");
+        let tiles: Vec<_> = (0..self.tiles_y)
+            .flat_map(|tile_y| (0..self.tiles_x).map(move |tile_x| (tile_x, tile_y)))
+            .filter(|&(tile_x, tile_y)| {
+                !self.bins[(tile_x + tile_y * self.tiles_x) as usize].is_empty()
+            })
+            .collect();
+        thread_pool.map(tiles, |(tile_x, tile_y)| {
+            let tile_index = tile_x + tile_y * self.tiles_x;
+            let _span =
+                trace::span("rasterizer", "rasterize tile").arg("tile", u64::from(tile_index));
+            shade_tile(&TileFragments {
+                tile: self.get_tile(tile_x, tile_y),
+                tile_bins: self,
+                triangle_indexes: &self.bins[tile_index as usize],
+            })
+        });
+    }
+}
+
+/// the fragments in one tile
+pub struct TileFragments<'a> {
+    pub tile: Rect,
+    tile_bins: &'a TileBins,
+    triangle_indexes: &'a [u32],
+}
+
+impl<'a> TileFragments<'a> {
+    /// call `f` with the draw index and the fragment for every pixel covered in the tile,
+    /// in the order the triangles were added
+    pub fn for_each_fragment<F: FnMut(u32, Fragment)>(&self, mut f: F) {
+        let pixel_center = |v: u32| ((v as i64) << SUBPIXEL_BITS) + (1 << (SUBPIXEL_BITS - 1));
+        for &triangle_index in self.triangle_indexes {
+            let triangle = &self.tile_bins.triangles[triangle_index as usize];
+            let bounds = triangle.bounds.intersect(self.tile).unwrap();
+            let inverse_double_area = 1.0 / triangle.double_area as f32;
+            for y in bounds.y..bounds.y + bounds.height {
+                for x in bounds.x..bounds.x + bounds.width {
+                    let (sample_x, sample_y) = (pixel_center(x), pixel_center(y));
+                    let edges = [
+                        triangle.edge_function(0, sample_x, sample_y),
+                        triangle.edge_function(1, sample_x, sample_y),
+                        triangle.edge_function(2, sample_x, sample_y),
+                    ];
+                    if edges.iter().any(|&v| v < 0) {
+                        continue;
+                    }
+                    // edge i is opposite vertex i, so it gives vertex i's weight
+                    let weights = [
+                        (edges[0] + triangle.edge_biases[0]) as f32 * inverse_double_area,
+                        (edges[1] + triangle.edge_biases[1]) as f32 * inverse_double_area,
+                        (edges[2] + triangle.edge_biases[2]) as f32 * inverse_double_area,
+                    ];
+                    let depth = weights[0] * triangle.depths[0]
+                        + weights[1] * triangle.depths[1]
+                        + weights[2] * triangle.depths[2];
+                    let perspective_weights = [
+                        weights[0] * triangle.inverse_w[0],
+                        weights[1] * triangle.inverse_w[1],
+                        weights[2] * triangle.inverse_w[2],
+                    ];
+                    let inverse_sum = 1.0
+                        / (perspective_weights[0]
+                            + perspective_weights[1]
+                            + perspective_weights[2]);
+                    f(
+                        triangle.draw_index,
+                        Fragment {
+                            x,
+                            y,
+                            depth,
+                            barycentrics: [
+                                perspective_weights[0] * inverse_sum,
+                                perspective_weights[1] * inverse_sum,
+                                perspective_weights[2] * inverse_sum,
+                            ],
+                            front_facing: triangle.front_facing,
+                        },
+                    );
+                }
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::sync::Mutex;
+
+    #[test]
+    fn test_shared_edges_cover_once() {
+        const WIDTH: u32 = 100;
+        const HEIGHT: u32 = 70;
+        let vertex = |x: f32, y: f32| Vertex {
+            position: [x, y, 0.5, 1.0],
+        };
+        let draw_state = DrawState {
+            cull_mode: api::VK_CULL_MODE_NONE,
+            front_face: api::VK_FRONT_FACE_COUNTER_CLOCKWISE,
+            scissor: Rect {
+                x: 0,
+                y: 0,
+                width: WIDTH,
+                height: HEIGHT,
+            },
+        };
+        let mut tile_bins = TileBins::new(WIDTH, HEIGHT);
+        // a fan around (30.5, 20.5), a pixel center, covering the whole framebuffer
+        let corners = [
+            vertex(0.0, 0.0),
+            vertex(WIDTH as f32, 0.0),
+            vertex(WIDTH as f32, HEIGHT as f32),
+            vertex(0.0, HEIGHT as f32),
+        ];
+        let center = vertex(30.5, 20.5);
+        tile_bins.add_draw(
+            0,
+            draw_state,
+            (0..4).map(|i| Triangle {
+                vertices: [center, corners[i], corners[(i + 1) % 4]],
+            }),
+        );
+        let coverage = Mutex::new(vec![0u32; (WIDTH * HEIGHT) as usize]);
+        tile_bins.rasterize(&ThreadPool::new(3, "test"), |tile_fragments| {
+            let mut tile_coverage = Vec::new();
+            tile_fragments.for_each_fragment(|_, fragment| {
+                let tile = tile_fragments.tile;
+                assert!(fragment.x >= tile.x && fragment.x < tile.x + tile.width);
+                assert!(fragment.y >= tile.y && fragment.y < tile.y + tile.height);
+                assert!((fragment.depth - 0.5).abs() < 1e-5);
+                tile_coverage.push((fragment.x + fragment.y * WIDTH) as usize);
+            });
+            let mut coverage = coverage.lock().unwrap();
+            for index in tile_coverage {
+                coverage[index] += 1;
+            }
+        });
+        assert!(coverage.into_inner().unwrap().iter().all(|&v| v == 1));
+        let mut culled_tile_bins = TileBins::new(WIDTH, HEIGHT);
+        culled_tile_bins.add_draw(
+            0,
+            DrawState {
+                cull_mode: api::VK_CULL_MODE_FRONT_AND_BACK,
+                ..draw_state
+            },
+            Some(Triangle {
+                vertices: [corners[0], corners[1], corners[2]],
+            }),
+        );
+        assert!(culled_tile_bins.triangles.is_empty());
+    }
+}
@@ -0,0 +1,859 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright 2018 Jacob Lifshay
+
+// Attachments loaded with `VK_ATTACHMENT_LOAD_OP_CLEAR` and `vkCmdClearAttachments` use deferred
+// clears, so clearing a whole attachment doesn't touch its memory. Attachments stored with
+// `VK_ATTACHMENT_STORE_OP_DONT_CARE` drop the clears still pending in the render area, and
+// resolving an attachment that's still cleared defers the same clear to the resolve attachment.
+// Other resolves copy sample 0 of each texel, which Vulkan allows for every format.
+// Draws are binned into the render pass instance's `TileBins` and rasterized together when the
+// subpass ends, or earlier when a command needs their results. Fragments run the depth test and
+// write the depth attachment tile by tile.
+// FIXME: color attachments aren't written until fragment shaders are translated, and the stencil
+// and depth bounds tests aren't implemented
+
+use api;
+use clear::{self, ClearAttachment, DeferredClears, ImageRegion};
+use geometry::{self, PrimitiveBatch, VertexBatchPositions};
+use handle::SharedHandle;
+use image::{Image, ImageView, SubresourceLayout};
+use query::PipelineStatistics;
+use rasterizer::{DrawState, Rect, TileBins, Triangle};
+use std::ptr;
+use std::sync::atomic::{AtomicU64, Ordering};
+use thread_pool::ThreadPool;
+use transfer::{self, SharedPointer};
+
+/// VK_ATTACHMENT_UNUSED
+const ATTACHMENT_UNUSED: u32 = !0;
+
+pub struct Subpass {
+    pub input_attachments: Vec<api::VkAttachmentReference>,
+    pub color_attachments: Vec<api::VkAttachmentReference>,
+    /// either empty or a resolve attachment for each color attachment
+    pub resolve_attachments: Vec<api::VkAttachmentReference>,
+    pub depth_stencil_attachment: Option<api::VkAttachmentReference>,
+}
+
+pub struct RenderPass {
+    pub attachments: Vec<api::VkAttachmentDescription>,
+    pub subpasses: Vec<Subpass>,
+}
+
+pub struct Framebuffer {
+    pub attachments: Vec<SharedHandle<api::VkImageView>>,
+    pub width: u32,
+    pub height: u32,
+    pub layers: u32,
+}
+
+fn get_attachment_region(
+    view: &ImageView,
+    rect: &api::VkRect2D,
+    base_array_layer: u32,
+    layer_count: u32,
+) -> ImageRegion {
+    ImageRegion {
+        mip_level: view.subresource_range.baseMipLevel,
+        base_array_layer: view.subresource_range.baseArrayLayer + base_array_layer,
+        layer_count,
+        offset: api::VkOffset3D {
+            x: rect.offset.x,
+            y: rect.offset.y,
+            z: 0,
+        },
+        extent: api::VkExtent3D {
+            width: rect.extent.width,
+            height: rect.extent.height,
+            depth: 1,
+        },
+    }
+}
+
+/// the depth test of a draw, from `VkPipelineDepthStencilStateCreateInfo`
+#[derive(Copy, Clone, Debug)]
+pub struct DepthTest {
+    pub compare_op: api::VkCompareOp,
+    pub write_enable: bool,
+}
+
+/// how the triangles of a draw are binned and its fragments written
+#[derive(Copy, Clone, Debug)]
+pub struct DrawInfo {
+    pub viewport: api::VkViewport,
+    pub depth_clamp_enable: bool,
+    pub draw_state: DrawState,
+    /// `None` if the depth test is disabled
+    pub depth_test: Option<DepthTest>,
+}
+
+/// the depth aspect of the formats that depth tests read and write
+#[derive(Copy, Clone, Debug, Eq, PartialEq)]
+enum DepthFormat {
+    Unorm16,
+    /// in the low 24 bits of a `u32`
+    Unorm24,
+    Float32,
+}
+
+impl DepthFormat {
+    fn get(format: api::VkFormat) -> Option<Self> {
+        match format {
+            api::VK_FORMAT_D16_UNORM | api::VK_FORMAT_D16_UNORM_S8_UINT => {
+                Some(DepthFormat::Unorm16)
+            }
+            api::VK_FORMAT_X8_D24_UNORM_PACK32 | api::VK_FORMAT_D24_UNORM_S8_UINT => {
+                Some(DepthFormat::Unorm24)
+            }
+            api::VK_FORMAT_D32_SFLOAT | api::VK_FORMAT_D32_SFLOAT_S8_UINT => {
+                Some(DepthFormat::Float32)
+            }
+            _ => None,
+        }
+    }
+    /// the bits stored for `depth`, clamped to `[0, 1]`
+    fn encode(self, depth: f32) -> u32 {
+        match self {
+            DepthFormat::Unorm16 => clear::depth_to_unorm(depth, 16),
+            DepthFormat::Unorm24 => clear::depth_to_unorm(depth, 24),
+            DepthFormat::Float32 => depth.max(0.0).min(1.0).to_bits(),
+        }
+    }
+    fn decode(self, bits: u32) -> f32 {
+        match self {
+            DepthFormat::Unorm16 => (f64::from(bits) / f64::from(0xFFFFu32)) as f32,
+            DepthFormat::Unorm24 => (f64::from(bits) / f64::from(0xFF_FFFFu32)) as f32,
+            DepthFormat::Float32 => f32::from_bits(bits),
+        }
+    }
+    unsafe fn read(self, sample: *const u8) -> u32 {
+        match self {
+            DepthFormat::Unorm16 => {
+                u32::from(u16::from_le(ptr::read_unaligned(sample as *const u16)))
+            }
+            DepthFormat::Unorm24 => {
+                u32::from_le(ptr::read_unaligned(sample as *const u32)) & 0xFF_FFFF
+            }
+            DepthFormat::Float32 => u32::from_le(ptr::read_unaligned(sample as *const u32)),
+        }
+    }
+    /// write the depth bits of `sample`, keeping the stencil or padding byte after them
+    unsafe fn write(self, sample: *mut u8, bits: u32) {
+        match self {
+            DepthFormat::Unorm16 => ptr::write_unaligned(sample as *mut u16, (bits as u16).to_le()),
+            DepthFormat::Unorm24 => {
+                let high_byte =
+                    u32::from_le(ptr::read_unaligned(sample as *const u32)) & 0xFF00_0000;
+                ptr::write_unaligned(sample as *mut u32, (high_byte | bits).to_le())
+            }
+            DepthFormat::Float32 => ptr::write_unaligned(sample as *mut u32, bits.to_le()),
+        }
+    }
+}
+
+/// whether a fragment at `depth` passes the depth test against `stored`
+fn compare_depth(compare_op: api::VkCompareOp, depth: f32, stored: f32) -> bool {
+    match compare_op {
+        api::VK_COMPARE_OP_NEVER => false,
+        api::VK_COMPARE_OP_LESS => depth < stored,
+        api::VK_COMPARE_OP_EQUAL => depth == stored,
+        api::VK_COMPARE_OP_LESS_OR_EQUAL => depth <= stored,
+        api::VK_COMPARE_OP_GREATER => depth > stored,
+        api::VK_COMPARE_OP_NOT_EQUAL => depth != stored,
+        api::VK_COMPARE_OP_GREATER_OR_EQUAL => depth >= stored,
+        api::VK_COMPARE_OP_ALWAYS => true,
+        _ => unreachable!("invalid compare op {:?}", compare_op),
+    }
+}
+
+/// the depth attachment of a subpass while its draws are rasterized
+struct DepthOutput {
+    memory: SharedPointer,
+    layout: SubresourceLayout,
+    format: DepthFormat,
+    sample_count: usize,
+}
+
+impl DepthOutput {
+    /// run `depth_test` for a fragment at `depth` covering the texel at (`x`, `y`), writing every
+    /// sample if it passes. every sample of a fragment is covered, so sample 0 is tested for all
+    unsafe fn test(&self, depth_test: DepthTest, x: u32, y: u32, depth: f32) -> bool {
+        let texel = self.memory.0.add(self.layout.get_block_offset(x, y, 0));
+        let bits = self.format.encode(depth);
+        let stored = self.format.decode(self.format.read(texel));
+        if !compare_depth(depth_test.compare_op, self.format.decode(bits), stored) {
+            return false;
+        }
+        if depth_test.write_enable {
+            let sample_size = self.layout.block.size_in_bytes / self.sample_count;
+            for sample in 0..self.sample_count {
+                self.format.write(texel.add(sample * sample_size), bits);
+            }
+        }
+        true
+    }
+}
+
+/// resolve `src_region` of the multisample `src_image` to the same texels of `dst_region`,
+/// which must be a single array layer of both
+unsafe fn resolve_region(
+    thread_pool: &ThreadPool,
+    src_image: &Image,
+    src_region: &ImageRegion,
+    dst_image: &Image,
+    dst_region: &ImageRegion,
+) {
+    let src_layout = src_image
+        .properties
+        .computed_properties()
+        .get_subresource_layout(src_region.mip_level, src_region.base_array_layer);
+    let dst_layout = dst_image
+        .properties
+        .computed_properties()
+        .get_subresource_layout(dst_region.mip_level, dst_region.base_array_layer);
+    let (x, y, width, height) = src_layout.get_block_region(src_region.offset, src_region.extent);
+    let src_memory = SharedPointer(src_image.get_memory());
+    let dst_memory = SharedPointer(dst_image.get_memory());
+    // sample 0 is at the start of the texel block
+    let sample_size = dst_layout.block.size_in_bytes;
+    let resolve_row = |row: usize| {
+        let y = y + row as u32;
+        for x in x..x + width {
+            ptr::copy_nonoverlapping(
+                src_memory.0.add(src_layout.get_block_offset(x, y, 0)),
+                dst_memory.0.add(dst_layout.get_block_offset(x, y, 0)),
+                sample_size,
+            );
+        }
+    };
+    let size = width as usize * height as usize * src_layout.block.size_in_bytes;
+    if size < transfer::PARALLEL_THRESHOLD {
+        (0..height as usize).for_each(resolve_row);
+    } else {
+        thread_pool.for_each_index(height as usize, || (), |_, row| resolve_row(row));
+    }
+}
+
+/// the render pass being executed, from `vkCmdBeginRenderPass` to `vkCmdEndRenderPass`
+pub struct RenderPassInstance {
+    render_pass: SharedHandle<api::VkRenderPass>,
+    framebuffer: SharedHandle<api::VkFramebuffer>,
+    render_area: api::VkRect2D,
+    subpass: usize,
+    /// the triangles of the current subpass's draws that aren't rasterized yet
+    tile_bins: TileBins,
+    /// the draws in `tile_bins`, by draw index
+    draws: Vec<DrawInfo>,
+    /// the clipped triangles of the batch being binned
+    clipped_triangles: Vec<Triangle>,
+}
+
+impl RenderPassInstance {
+    /// `clear_values` are the bits of the `VkClearValue`s
+    pub unsafe fn begin(
+        thread_pool: &ThreadPool,
+        deferred_clears: &mut DeferredClears,
+        render_pass: SharedHandle<api::VkRenderPass>,
+        framebuffer: SharedHandle<api::VkFramebuffer>,
+        render_area: api::VkRect2D,
+        clear_values: &[[u32; 4]],
+    ) -> Self {
+        // attachments are loaded by the first subpass using them, but no earlier subpass can
+        // touch them, so they're all loaded here
+        for (index, description) in render_pass.attachments.iter().enumerate() {
+            let view = &framebuffer.attachments[index];
+            let image = &*view.image;
+            let aspects = clear::get_format_aspects(description.format);
+            let (pattern, mask) = if aspects == api::VK_IMAGE_ASPECT_COLOR_BIT {
+                if description.loadOp != api::VK_ATTACHMENT_LOAD_OP_CLEAR {
+                    continue;
+                }
+                (
+                    clear::get_color_pattern(image, view.format, clear_values[index]),
+                    None,
+                )
+            } else {
+                let aspect_load_ops = [
+                    (api::VK_IMAGE_ASPECT_DEPTH_BIT, description.loadOp),
+                    (api::VK_IMAGE_ASPECT_STENCIL_BIT, description.stencilLoadOp),
+                ];
+                let load_op_aspects = |load_op| {
+                    aspect_load_ops
+                        .iter()
+                        .filter(|v| v.1 == load_op)
+                        .fold(0, |aspects, v| aspects | v.0)
+                        & aspects
+                };
+                let cleared_aspects = load_op_aspects(api::VK_ATTACHMENT_LOAD_OP_CLEAR);
+                if cleared_aspects == 0 {
+                    continue;
+                }
+                // the contents of aspects that aren't loaded are undefined, so they can be
+                // cleared too
+                (
+                    clear::get_depth_stencil_pattern(
+                        image,
+                        clear::get_clear_depth_stencil_value(clear_values[index]),
+                    ),
+                    clear::get_aspect_mask(
+                        image,
+                        cleared_aspects | load_op_aspects(api::VK_ATTACHMENT_LOAD_OP_DONT_CARE),
+                    ),
+                )
+            };
+            deferred_clears.clear(
+                thread_pool,
+                image,
+                &get_attachment_region(view, &render_area, 0, framebuffer.layers),
+                &pattern,
+                mask.as_ref().map(|v| &**v),
+            );
+        }
+        Self {
+            tile_bins: TileBins::new(framebuffer.width, framebuffer.height),
+            render_pass,
+            framebuffer,
+            render_area,
+            subpass: 0,
+            draws: Vec::new(),
+            clipped_triangles: Vec::new(),
+        }
+    }
+    /// add a draw to the current subpass, returning the draw index its triangles are binned with.
+    /// fragments outside the render area are dropped
+    pub fn add_draw(&mut self, mut draw_info: DrawInfo) -> u32 {
+        let render_area = Rect {
+            x: self.render_area.offset.x as u32,
+            y: self.render_area.offset.y as u32,
+            width: self.render_area.extent.width,
+            height: self.render_area.extent.height,
+        };
+        draw_info.draw_state.scissor = draw_info
+            .draw_state
+            .scissor
+            .intersect(render_area)
+            .unwrap_or(Rect {
+                x: 0,
+                y: 0,
+                width: 0,
+                height: 0,
+            });
+        self.draws.push(draw_info);
+        self.draws.len() as u32 - 1
+    }
+    /// bin `triangles`, which are from the draw `add_draw` returned `draw_index` for
+    pub fn add_triangles<I: IntoIterator<Item = Triangle>>(
+        &mut self,
+        draw_index: u32,
+        triangles: I,
+    ) {
+        let draw_state = self.draws[draw_index as usize].draw_state;
+        self.tile_bins.add_draw(draw_index, draw_state, triangles);
+    }
+    /// clip and bin the triangles of a batch shaded by the draw `add_draw` returned `draw_index`
+    /// for
+    pub fn add_batch(
+        &mut self,
+        draw_index: u32,
+        batch: &PrimitiveBatch,
+        positions: &VertexBatchPositions,
+    ) {
+        let draw_info = self.draws[draw_index as usize];
+        let position = |vertex: u8| {
+            let vertex = vertex as usize;
+            [
+                positions[0][vertex],
+                positions[1][vertex],
+                positions[2][vertex],
+                positions[3][vertex],
+            ]
+        };
+        let clipped_triangles = &mut self.clipped_triangles;
+        for triangle in &batch.triangles {
+            geometry::clip_triangle(
+                [
+                    position(triangle[0]),
+                    position(triangle[1]),
+                    position(triangle[2]),
+                ],
+                &draw_info.viewport,
+                draw_info.depth_clamp_enable,
+                |triangle| clipped_triangles.push(triangle),
+            );
+        }
+        self.tile_bins.add_draw(
+            draw_index,
+            draw_info.draw_state,
+            clipped_triangles.drain(..),
+        );
+    }
+    /// rasterize the binned draws, writing their fragments to the current subpass's attachments
+    pub unsafe fn rasterize(
+        &mut self,
+        thread_pool: &ThreadPool,
+        deferred_clears: &mut DeferredClears,
+        statistics: &mut PipelineStatistics,
+    ) {
+        if self.tile_bins.is_empty() {
+            self.draws.clear();
+            return;
+        }
+        let subpass = &self.render_pass.subpasses[self.subpass];
+        let depth_attachment = subpass
+            .depth_stencil_attachment
+            .filter(|reference| reference.attachment != ATTACHMENT_UNUSED)
+            .map(|reference| &self.framebuffer.attachments[reference.attachment as usize])
+            .and_then(|view| DepthFormat::get(view.format).map(|format| (view, format)));
+        let depth_output = match depth_attachment {
+            Some((view, format)) if self.draws.iter().any(|draw| draw.depth_test.is_some()) => {
+                let region = get_attachment_region(view, &self.render_area, 0, 1);
+                deferred_clears.prepare_read(thread_pool, &view.image, &region);
+                let properties = &view.image.properties;
+                Some(DepthOutput {
+                    memory: SharedPointer(view.image.get_memory()),
+                    layout: properties
+                        .computed_properties()
+                        .get_subresource_layout(region.mip_level, region.base_array_layer),
+                    format,
+                    sample_count: properties.multisample_count.get(),
+                })
+            }
+            _ => None,
+        };
+        let fragment_count = AtomicU64::new(0);
+        let draws = &self.draws;
+        self.tile_bins.rasterize(thread_pool, |tile_fragments| {
+            let mut tile_fragment_count = 0;
+            tile_fragments.for_each_fragment(|draw_index, fragment| {
+                if let (Some(depth_test), Some(depth_output)) =
+                    (draws[draw_index as usize].depth_test, &depth_output)
+                {
+                    if !depth_output.test(depth_test, fragment.x, fragment.y, fragment.depth) {
+                        return;
+                    }
+                }
+                tile_fragment_count += 1;
+            });
+            fragment_count.fetch_add(tile_fragment_count, Ordering::Relaxed);
+        });
+        statistics.add(
+            api::VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT,
+            fragment_count.into_inner(),
+        );
+        self.tile_bins.clear();
+        self.draws.clear();
+    }
+    unsafe fn end_subpass(
+        &mut self,
+        thread_pool: &ThreadPool,
+        deferred_clears: &mut DeferredClears,
+        statistics: &mut PipelineStatistics,
+    ) {
+        self.rasterize(thread_pool, deferred_clears, statistics);
+        let subpass = &self.render_pass.subpasses[self.subpass];
+        for (color, resolve) in subpass
+            .color_attachments
+            .iter()
+            .zip(&subpass.resolve_attachments)
+        {
+            if color.attachment == ATTACHMENT_UNUSED || resolve.attachment == ATTACHMENT_UNUSED {
+                continue;
+            }
+            let src_view = &self.framebuffer.attachments[color.attachment as usize];
+            let dst_view = &self.framebuffer.attachments[resolve.attachment as usize];
+            for layer in 0..self.framebuffer.layers {
+                let src_region = get_attachment_region(src_view, &self.render_area, layer, 1);
+                let dst_region = get_attachment_region(dst_view, &self.render_area, layer, 1);
+                // every sample of a cleared texel is the same
+                let pattern = deferred_clears
+                    .get_clear_pattern(
+                        &src_view.image,
+                        src_region.mip_level,
+                        src_region.base_array_layer,
+                    )
+                    .map(|pattern| {
+                        pattern[..pattern.len() / src_view.image.properties.multisample_count.get()]
+                            .to_vec()
+                    });
+                match pattern {
+                    Some(pattern) => deferred_clears.clear(
+                        thread_pool,
+                        &dst_view.image,
+                        &dst_region,
+                        &pattern,
+                        None,
+                    ),
+                    None => {
+                        deferred_clears.prepare_read(thread_pool, &src_view.image, &src_region);
+                        deferred_clears.prepare_write(thread_pool, &dst_view.image, &dst_region);
+                        resolve_region(
+                            thread_pool,
+                            &src_view.image,
+                            &src_region,
+                            &dst_view.image,
+                            &dst_region,
+                        );
+                    }
+                }
+            }
+        }
+    }
+    pub unsafe fn next_subpass(
+        &mut self,
+        thread_pool: &ThreadPool,
+        deferred_clears: &mut DeferredClears,
+        statistics: &mut PipelineStatistics,
+    ) {
+        self.end_subpass(thread_pool, deferred_clears, statistics);
+        self.subpass += 1;
+        assert!(self.subpass < self.render_pass.subpasses.len());
+    }
+    pub unsafe fn end(
+        mut self,
+        thread_pool: &ThreadPool,
+        deferred_clears: &mut DeferredClears,
+        statistics: &mut PipelineStatistics,
+    ) {
+        self.end_subpass(thread_pool, deferred_clears, statistics);
+        for (index, description) in self.render_pass.attachments.iter().enumerate() {
+            let aspects = clear::get_format_aspects(description.format);
+            let mut store_ops = vec![];
+            if aspects & (api::VK_IMAGE_ASPECT_COLOR_BIT | api::VK_IMAGE_ASPECT_DEPTH_BIT) != 0 {
+                store_ops.push(description.storeOp);
+            }
+            if aspects & api::VK_IMAGE_ASPECT_STENCIL_BIT != 0 {
+                store_ops.push(description.stencilStoreOp);
+            }
+            if store_ops
+                .iter()
+                .all(|&store_op| store_op == api::VK_ATTACHMENT_STORE_OP_DONT_CARE)
+            {
+                let view = &self.framebuffer.attachments[index];
+                deferred_clears.discard(
+                    thread_pool,
+                    &view.image,
+                    &get_attachment_region(view, &self.render_area, 0, self.framebuffer.layers),
+                );
+            }
+        }
+    }
+    pub unsafe fn clear_attachments(
+        &mut self,
+        thread_pool: &ThreadPool,
+        deferred_clears: &mut DeferredClears,
+        statistics: &mut PipelineStatistics,
+        attachments: &[ClearAttachment],
+        rects: &[api::VkClearRect],
+    ) {
+        // the clears are ordered after the draws before them
+        self.rasterize(thread_pool, deferred_clears, statistics);
+        let subpass = &self.render_pass.subpasses[self.subpass];
+        for attachment in attachments {
+            let is_color = attachment.aspect_mask & api::VK_IMAGE_ASPECT_COLOR_BIT != 0;
+            let reference = if is_color {
+                subpass.color_attachments[attachment.color_attachment as usize]
+            } else {
+                match subpass.depth_stencil_attachment {
+                    Some(reference) => reference,
+                    None => continue,
+                }
+            };
+            if reference.attachment == ATTACHMENT_UNUSED {
+                continue;
+            }
+            let view = &self.framebuffer.attachments[reference.attachment as usize];
+            let (pattern, mask) = if is_color {
+                (
+                    clear::get_color_pattern(&view.image, view.format, attachment.value),
+                    None,
+                )
+            } else {
+                (
+                    clear::get_depth_stencil_pattern(
+                        &view.image,
+                        clear::get_clear_depth_stencil_value(attachment.value),
+                    ),
+                    clear::get_aspect_mask(&view.image, attachment.aspect_mask),
+                )
+            };
+            for rect in rects {
+                deferred_clears.clear(
+                    thread_pool,
+                    &view.image,
+                    &get_attachment_region(view, &rect.rect, rect.baseArrayLayer, rect.layerCount),
+                    &pattern,
+                    mask.as_ref().map(|v| &**v),
+                );
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use constants::MIN_MEMORY_MAP_ALIGNMENT;
+    use device_memory::{DeviceMemory, DeviceMemoryLayout};
+    use handle::OwnedHandle;
+    use image::{ImageMemory, ImageMultisampleCount, ImageProperties, SupportedTilings};
+    use rasterizer::Vertex;
+
+    const WIDTH: u32 = 40;
+    const HEIGHT: u32 = 20;
+    const VIEWPORT: api::VkViewport = api::VkViewport {
+        x: 0.0,
+        y: 0.0,
+        width: WIDTH as f32,
+        height: HEIGHT as f32,
+        minDepth: 0.0,
+        maxDepth: 1.0,
+    };
+
+    /// a `WIDTH` by `HEIGHT` `VK_FORMAT_D32_SFLOAT` image and a framebuffer that uses it as the
+    /// depth attachment of a render pass clearing it to 1.0
+    struct DepthFramebuffer {
+        _memory: OwnedHandle<api::VkDeviceMemory>,
+        image: OwnedHandle<api::VkImage>,
+        _view: OwnedHandle<api::VkImageView>,
+        render_pass: OwnedHandle<api::VkRenderPass>,
+        framebuffer: OwnedHandle<api::VkFramebuffer>,
+    }
+
+    impl DepthFramebuffer {
+        unsafe fn new() -> Self {
+            let properties = ImageProperties {
+                supported_tilings: SupportedTilings::Any,
+                format: api::VK_FORMAT_D32_SFLOAT,
+                extents: api::VkExtent3D {
+                    width: WIDTH,
+                    height: HEIGHT,
+                    depth: 1,
+                },
+                array_layers: 1,
+                mip_levels: 1,
+                multisample_count: ImageMultisampleCount::Count1,
+                swapchain_present_tiling: None,
+            };
+            let memory = OwnedHandle::<api::VkDeviceMemory>::new(
+                DeviceMemory::allocate_from_default_heap(DeviceMemoryLayout::calculate(
+                    properties.computed_properties().memory_layout.size,
+                    MIN_MEMORY_MAP_ALIGNMENT,
+                ))
+                .unwrap(),
+            );
+            let image = OwnedHandle::<api::VkImage>::new(Image {
+                properties,
+                memory: Some(ImageMemory {
+                    device_memory: SharedHandle::from(memory.get_handle()).unwrap(),
+                    offset: 0,
+                }),
+            });
+            let view = OwnedHandle::<api::VkImageView>::new(ImageView {
+                image: SharedHandle::from(image.get_handle()).unwrap(),
+                view_type: api::VK_IMAGE_VIEW_TYPE_2D,
+                format: api::VK_FORMAT_D32_SFLOAT,
+                component_mapping: api::VkComponentMapping {
+                    r: api::VK_COMPONENT_SWIZZLE_IDENTITY,
+                    g: api::VK_COMPONENT_SWIZZLE_IDENTITY,
+                    b: api::VK_COMPONENT_SWIZZLE_IDENTITY,
+                    a: api::VK_COMPONENT_SWIZZLE_IDENTITY,
+                },
+                subresource_range: api::VkImageSubresourceRange {
+                    aspectMask: api::VK_IMAGE_ASPECT_DEPTH_BIT,
+                    baseMipLevel: 0,
+                    levelCount: 1,
+                    baseArrayLayer: 0,
+                    layerCount: 1,
+                },
+            });
+            let render_pass = OwnedHandle::<api::VkRenderPass>::new(RenderPass {
+                attachments: vec![api::VkAttachmentDescription {
+                    flags: 0,
+                    format: api::VK_FORMAT_D32_SFLOAT,
+                    samples: api::VK_SAMPLE_COUNT_1_BIT,
+                    loadOp: api::VK_ATTACHMENT_LOAD_OP_CLEAR,
+                    storeOp: api::VK_ATTACHMENT_STORE_OP_STORE,
+                    stencilLoadOp: api::VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+                    stencilStoreOp: api::VK_ATTACHMENT_STORE_OP_DONT_CARE,
+                    initialLayout: api::VK_IMAGE_LAYOUT_UNDEFINED,
+                    finalLayout: api::VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                }],
+                subpasses: vec![Subpass {
+                    input_attachments: vec![],
+                    color_attachments: vec![],
+                    resolve_attachments: vec![],
+                    depth_stencil_attachment: Some(api::VkAttachmentReference {
+                        attachment: 0,
+                        layout: api::VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                    }),
+                }],
+            });
+            let framebuffer = OwnedHandle::<api::VkFramebuffer>::new(Framebuffer {
+                attachments: vec![SharedHandle::from(view.get_handle()).unwrap()],
+                width: WIDTH,
+                height: HEIGHT,
+                layers: 1,
+            });
+            Self {
+                _memory: memory,
+                image,
+                _view: view,
+                render_pass,
+                framebuffer,
+            }
+        }
+        unsafe fn begin(
+            &self,
+            thread_pool: &ThreadPool,
+            deferred_clears: &mut DeferredClears,
+        ) -> RenderPassInstance {
+            RenderPassInstance::begin(
+                thread_pool,
+                deferred_clears,
+                SharedHandle::from(self.render_pass.get_handle()).unwrap(),
+                SharedHandle::from(self.framebuffer.get_handle()).unwrap(),
+                api::VkRect2D {
+                    offset: api::VkOffset2D { x: 0, y: 0 },
+                    extent: api::VkExtent2D {
+                        width: WIDTH,
+                        height: HEIGHT,
+                    },
+                },
+                &[[1.0f32.to_bits(), 0, 0, 0]],
+            )
+        }
+        unsafe fn get_depth(&self, x: u32, y: u32) -> f32 {
+            let layout = self
+                .image
+                .properties
+                .computed_properties()
+                .get_subresource_layout(0, 0);
+            ptr::read(
+                self.image
+                    .get_memory()
+                    .add(layout.get_block_offset(x, y, 0)) as *const f32,
+            )
+        }
+    }
+
+    /// a draw with the depth test `VK_COMPARE_OP_LESS` and `VIEWPORT`
+    fn get_draw_info() -> DrawInfo {
+        DrawInfo {
+            viewport: VIEWPORT,
+            depth_clamp_enable: false,
+            draw_state: DrawState {
+                cull_mode: api::VK_CULL_MODE_NONE,
+                front_face: api::VK_FRONT_FACE_COUNTER_CLOCKWISE,
+                scissor: Rect {
+                    x: 0,
+                    y: 0,
+                    width: WIDTH,
+                    height: HEIGHT,
+                },
+            },
+            depth_test: Some(DepthTest {
+                compare_op: api::VK_COMPARE_OP_LESS,
+                write_enable: true,
+            }),
+        }
+    }
+
+    /// the two triangles covering the rectangle from (`x0`, `y0`) to (`x1`, `y1`)
+    fn rectangle(x0: f32, y0: f32, x1: f32, y1: f32, depth: f32) -> Vec<Triangle> {
+        let vertex = |x, y| Vertex {
+            position: [x, y, depth, 1.0],
+        };
+        vec![
+            Triangle {
+                vertices: [vertex(x0, y0), vertex(x1, y0), vertex(x1, y1)],
+            },
+            Triangle {
+                vertices: [vertex(x0, y0), vertex(x1, y1), vertex(x0, y1)],
+            },
+        ]
+    }
+
+    #[test]
+    fn test_depth_test() {
+        let thread_pool = ThreadPool::new(2, "test");
+        let mut deferred_clears = DeferredClears::new();
+        let mut statistics = PipelineStatistics::default();
+        unsafe {
+            let depth_framebuffer = DepthFramebuffer::new();
+            let mut render_pass_instance =
+                depth_framebuffer.begin(&thread_pool, &mut deferred_clears);
+            let draw_info = get_draw_info();
+            // the left half is drawn in front of the second draw, which covers everything
+            let draw_index = render_pass_instance.add_draw(draw_info);
+            render_pass_instance.add_triangles(draw_index, rectangle(0.0, 0.0, 20.0, 20.0, 0.25));
+            let draw_index = render_pass_instance.add_draw(draw_info);
+            render_pass_instance.add_triangles(draw_index, rectangle(0.0, 0.0, 40.0, 20.0, 0.5));
+            // nothing is written before the draws are rasterized
+            assert_eq!(
+                deferred_clears.get_clear_pattern(&depth_framebuffer.image, 0, 0),
+                Some(&1.0f32.to_bits().to_le_bytes()[..])
+            );
+            render_pass_instance.end(&thread_pool, &mut deferred_clears, &mut statistics);
+            deferred_clears.write_all(&thread_pool);
+            for &(x, y) in &[(0, 0), (19, 0), (0, 19), (19, 19)] {
+                assert!((depth_framebuffer.get_depth(x, y) - 0.25).abs() < 1e-6);
+            }
+            for &(x, y) in &[(20, 0), (39, 0), (20, 19), (39, 19)] {
+                assert!((depth_framebuffer.get_depth(x, y) - 0.5).abs() < 1e-6);
+            }
+        }
+    }
+
+    #[test]
+    fn test_draw_batches() {
+        let thread_pool = ThreadPool::new(2, "test");
+        let mut deferred_clears = DeferredClears::new();
+        let mut statistics = PipelineStatistics::default();
+        // the clip-space positions the vertex shader wrote: vertices 0-3 are the top left
+        // quarter at depth 0.25, and vertices 4-7, with w = 2, cover from the middle to past the
+        // right edge at depth 0.5
+        let vertices = [
+            [-1.0, -1.0, 0.25, 1.0],
+            [0.0, -1.0, 0.25, 1.0],
+            [0.0, 0.0, 0.25, 1.0],
+            [-1.0, 0.0, 0.25, 1.0],
+            [0.0, -2.0, 1.0, 2.0],
+            [4.0, -2.0, 1.0, 2.0],
+            [4.0, 2.0, 1.0, 2.0],
+            [0.0, 2.0, 1.0, 2.0],
+        ];
+        let mut positions = [[0.0; geometry::VERTEX_BATCH_SIZE]; 4];
+        for (index, vertex) in vertices.iter().enumerate() {
+            for component in 0..4 {
+                positions[component][index] = vertex[component];
+            }
+        }
+        let get_batch = |first: u8| PrimitiveBatch {
+            vertex_indices: (0..8).collect(),
+            triangles: vec![[first, first + 1, first + 2], [first, first + 2, first + 3]],
+        };
+        unsafe {
+            let depth_framebuffer = DepthFramebuffer::new();
+            let mut render_pass_instance =
+                depth_framebuffer.begin(&thread_pool, &mut deferred_clears);
+            for &first in &[0, 4] {
+                let draw_index = render_pass_instance.add_draw(get_draw_info());
+                render_pass_instance.add_batch(draw_index, &get_batch(first), &positions);
+            }
+            render_pass_instance.end(&thread_pool, &mut deferred_clears, &mut statistics);
+            deferred_clears.write_all(&thread_pool);
+            let expected = [
+                ((0, 0), 0.25),
+                ((19, 9), 0.25),
+                ((20, 0), 0.5),
+                ((39, 19), 0.5),
+                // not covered by either draw, so it's still cleared
+                ((0, 10), 1.0),
+                ((19, 19), 1.0),
+            ];
+            for &((x, y), depth) in &expected {
+                assert!((depth_framebuffer.get_depth(x, y) - depth).abs() < 1e-6);
+            }
+        }
+    }
+}
@@ -1,5 +1,956 @@
 // SPDX-License-Identifier: LGPL-2.1-or-later
 // Copyright 2018 Jacob Lifshay
+
+// A shader module is indexed once, either when it's created or by the first pipeline that uses
+// it, and every pipeline created from it shares the index instead of scanning the words again.
+// The index only stores word offsets; instructions are decoded from the module's words on demand.
+
+use spirv_parser::{
+    self, BuiltIn, Decoration, ExecutionMode, ExecutionModel, Header, Instruction, Parser,
+    SpecConstantOperation, StorageClass,
+};
+use std::cmp;
+use std::collections::HashMap;
+use std::sync::{Arc, Mutex};
+
+#[derive(Debug)]
+pub struct EntryPoint {
+    pub execution_model: ExecutionModel,
+    pub name: String,
+    pub function_id: u32,
+    pub interface_ids: Vec<u32>,
+    /// the offsets of the entry point's `OpExecutionMode` and `OpExecutionModeId` instructions
+    pub execution_mode_offsets: Vec<u32>,
+}
+
+/// where the variables in the `Workgroup` storage class are in a workgroup's memory.
+/// the variables are placed in declaration order, each aligned to its type's alignment
+#[derive(Clone, Debug, Default)]
+pub struct WorkgroupMemoryLayout {
+    /// `(variable ID, offset)` for every variable
+    pub variable_offsets: Vec<(u32, usize)>,
+    pub size: usize,
+    pub alignment: usize,
+}
+
+fn align(offset: usize, alignment: usize) -> usize {
+    (offset + alignment - 1) / alignment * alignment
+}
+
+/// the value of a constant after specialization
+#[derive(Clone, Debug, PartialEq)]
+pub enum ConstantValue {
+    Bool(bool),
+    /// the bits of an integer or floating-point value, zero-extended from the type's width
+    Scalar(u64),
+    /// the IDs of the constituents
+    Composite(Vec<u32>),
+    /// `OpConstantNull`
+    Null,
+}
+
+impl ConstantValue {
+    fn get_bits(&self) -> Result<u64, String> {
+        match *self {
+            ConstantValue::Bool(value) => Ok(value as u64),
+            ConstantValue::Scalar(value) => Ok(value),
+            ConstantValue::Null => Ok(0),
+            ConstantValue::Composite(_) => Err("SPIR-V constant isn't a scalar".into()),
+        }
+    }
+}
+
+#[derive(Clone, Debug)]
+pub struct Constant {
+    pub type_id: u32,
+    pub value: ConstantValue,
+}
+
+/// the constants of a shader stage with the specialization constants set to the pipeline's
+/// values and the `OpSpecConstantOp`s evaluated. for now they only give the workgroup size and
+/// the workgroup memory layout; nothing translates shader code to IR yet, so no code is folded
+/// on them
+#[derive(Clone, Debug, Default)]
+pub struct SpecializedConstants {
+    constants: HashMap<u32, Constant>,
+}
+
+impl SpecializedConstants {
+    pub fn get(&self, id: u32) -> Option<&Constant> {
+        self.constants.get(&id)
+    }
+    /// the value of an integer constant
+    pub fn get_u32(&self, id: u32) -> Result<u32, String> {
+        match self.get(id) {
+            Some(Constant {
+                value: ConstantValue::Scalar(value),
+                ..
+            }) => Ok(*value as u32),
+            _ => Err(format!("SPIR-V ID isn't an integer constant: {}", id)),
+        }
+    }
+    fn get_scalar(&self, id: u32) -> Result<(u32, u64), String> {
+        let constant = self
+            .get(id)
+            .ok_or_else(|| format!("SPIR-V ID isn't a constant: {}", id))?;
+        Ok((constant.type_id, constant.value.get_bits()?))
+    }
+}
+
+#[derive(Copy, Clone, Debug)]
+enum ScalarType {
+    Bool,
+    Int { width: u32 },
+    Float { width: u32 },
+}
+
+impl ScalarType {
+    fn get_width(self) -> u32 {
+        match self {
+            ScalarType::Bool => 1,
+            ScalarType::Int { width, .. } | ScalarType::Float { width } => width,
+        }
+    }
+}
+
+fn truncate(value: u64, width: u32) -> u64 {
+    if width >= 64 {
+        value
+    } else {
+        value & ((1 << width) - 1)
+    }
+}
+
+/// the bits of a literal number, whose low-order word is first
+fn get_literal_bits(words: &[u32]) -> u64 {
+    words[..cmp::min(words.len(), 2)]
+        .iter()
+        .rev()
+        .fold(0, |bits, &word| bits << 32 | u64::from(word))
+}
+
+fn sign_extend(value: u64, width: u32) -> i64 {
+    let shift = 64 - cmp::min(width, 64);
+    ((value << shift) as i64) >> shift
+}
+
+// the opcodes allowed in `OpSpecConstantOp` for shaders, except for the vector operations
+const OP_UCONVERT: u32 = 113;
+const OP_SCONVERT: u32 = 114;
+const OP_SNEGATE: u32 = 126;
+const OP_IADD: u32 = 128;
+const OP_ISUB: u32 = 130;
+const OP_IMUL: u32 = 132;
+const OP_UDIV: u32 = 134;
+const OP_SDIV: u32 = 135;
+const OP_UMOD: u32 = 137;
+const OP_SREM: u32 = 138;
+const OP_SMOD: u32 = 139;
+const OP_LOGICAL_EQUAL: u32 = 164;
+const OP_LOGICAL_NOT_EQUAL: u32 = 165;
+const OP_LOGICAL_OR: u32 = 166;
+const OP_LOGICAL_AND: u32 = 167;
+const OP_LOGICAL_NOT: u32 = 168;
+const OP_SELECT: u32 = 169;
+const OP_IEQUAL: u32 = 170;
+const OP_INOT_EQUAL: u32 = 171;
+const OP_UGREATER_THAN: u32 = 172;
+const OP_SGREATER_THAN: u32 = 173;
+const OP_UGREATER_THAN_EQUAL: u32 = 174;
+const OP_SGREATER_THAN_EQUAL: u32 = 175;
+const OP_ULESS_THAN: u32 = 176;
+const OP_SLESS_THAN: u32 = 177;
+const OP_ULESS_THAN_EQUAL: u32 = 178;
+const OP_SLESS_THAN_EQUAL: u32 = 179;
+const OP_SHIFT_RIGHT_LOGICAL: u32 = 194;
+const OP_SHIFT_RIGHT_ARITHMETIC: u32 = 195;
+const OP_SHIFT_LEFT_LOGICAL: u32 = 196;
+const OP_BITWISE_OR: u32 = 197;
+const OP_BITWISE_XOR: u32 = 198;
+const OP_BITWISE_AND: u32 = 199;
+const OP_NOT: u32 = 200;
+const OP_COMPOSITE_EXTRACT: u32 = 81;
+
+#[derive(Debug)]
+pub struct ShaderModuleIndex {
+    pub header: Header,
+    pub entry_points: Vec<EntryPoint>,
+    /// the offset of the instruction defining each ID, 0 for undefined IDs since instructions
+    /// never start in the header
+    id_offsets: Vec<u32>,
+    /// the IDs of the type declarations, in declaration order
+    pub type_ids: Vec<u32>,
+    /// `(target ID, instruction offset)` for every decoration, sorted by target ID.
+    /// `OpGroupDecorate` and `OpGroupMemberDecorate` are listed under each of their targets
+    decorations: Vec<(u32, u32)>,
+    /// the offset of the first `OpFunction`, or the module's length if there are none
+    pub function_section_offset: u32,
+}
+
+fn decode_at<'a>(code: &'a [u32], offset: u32) -> Instruction<'a> {
+    spirv_parser::decode_instruction(&code[offset as usize..])
+        .expect("already decoded when indexing")
+        .0
+}
+
+impl ShaderModuleIndex {
+    pub fn new(code: &[u32]) -> Result<Self, String> {
+        let (header, mut parser) =
+            Parser::new(code).map_err(|v| format!("invalid SPIR-V module: {}", v))?;
+        // every ID is defined by an instruction taking at least one word, so this bounds the
+        // size of `id_offsets` by the module's size instead of trusting the header
+        if header.bound as usize > code.len() {
+            return Err(format!("SPIR-V ID bound too large: {}", header.bound));
+        }
+        let mut retval = ShaderModuleIndex {
+            header,
+            entry_points: Vec::new(),
+            id_offsets: vec![0; header.bound as usize],
+            type_ids: Vec::new(),
+            decorations: Vec::new(),
+            function_section_offset: code.len() as u32,
+        };
+        let mut execution_modes = Vec::new();
+        loop {
+            let offset = parser.word_offset() as u32;
+            let instruction = match parser.next() {
+                None => break,
+                Some(instruction) => instruction.map_err(|v| {
+                    format!(
+                        "invalid SPIR-V instruction at word offset {}: {}",
+                        offset, v
+                    )
+                })?,
+            };
+            if let Some(id) = instruction.result_id() {
+                let id_offset = retval
+                    .id_offsets
+                    .get_mut(id.0 as usize)
+                    .ok_or_else(|| format!("SPIR-V ID out of bounds: {}", id.0))?;
+                if *id_offset != 0 {
+                    return Err(format!("SPIR-V ID defined more than once: {}", id.0));
+                }
+                *id_offset = offset;
+            }
+            // the targets are read from the words directly so no operands are decoded again
+            let operands = &code[offset as usize + 1..parser.word_offset()];
+            match instruction {
+                Instruction::OpEntryPoint {
+                    execution_model,
+                    entry_point,
+                    name,
+                    interface,
+                } => retval.entry_points.push(EntryPoint {
+                    execution_model,
+                    name: name.into(),
+                    function_id: entry_point.0,
+                    interface_ids: interface.iter().map(|v| v.0).collect(),
+                    execution_mode_offsets: Vec::new(),
+                }),
+                Instruction::OpExecutionMode { entry_point, .. }
+                | Instruction::OpExecutionModeId { entry_point, .. } => {
+                    execution_modes.push((entry_point.0, offset))
+                }
+                Instruction::OpDecorate { .. }
+                | Instruction::OpMemberDecorate { .. }
+                | Instruction::OpDecorateId { .. } => {
+                    retval.decorations.push((operands[0], offset))
+                }
+                Instruction::OpGroupDecorate { .. } => retval
+                    .decorations
+                    .extend(operands[1..].iter().map(|&target| (target, offset))),
+                Instruction::OpGroupMemberDecorate { .. } => retval
+                    .decorations
+                    .extend(operands[1..].chunks(2).map(|pair| (pair[0], offset))),
+                Instruction::OpFunction { .. } => {
+                    if retval.function_section_offset as usize == code.len() {
+                        retval.function_section_offset = offset;
+                    }
+                }
+                Instruction::OpExtInstImport { .. }
+                | Instruction::OpString { .. }
+                | Instruction::OpDecorationGroup { .. }
+                | Instruction::OpLabel { .. } => {}
+                // types are the only other instructions with a result but no result type
+                instruction => {
+                    if let (None, Some(id)) = (instruction.result_type(), instruction.result_id()) {
+                        retval.type_ids.push(id.0);
+                    }
+                }
+            }
+        }
+        // sorting is stable, so decorations on the same target stay in module order
+        retval.decorations.sort_by_key(|v| v.0);
+        for (function_id, offset) in execution_modes {
+            retval
+                .entry_points
+                .iter_mut()
+                .filter(|entry_point| entry_point.function_id == function_id)
+                .for_each(|entry_point| entry_point.execution_mode_offsets.push(offset));
+        }
+        Ok(retval)
+    }
+    pub fn get_instruction_offset(&self, id: u32) -> Option<u32> {
+        match self.id_offsets.get(id as usize) {
+            Some(&0) | None => None,
+            Some(&offset) => Some(offset),
+        }
+    }
+    /// `code` must be the code this index was built from
+    pub fn get_instruction<'a>(&self, code: &'a [u32], id: u32) -> Option<Instruction<'a>> {
+        self.get_instruction_offset(id)
+            .map(|offset| decode_at(code, offset))
+    }
+    /// `code` must be the code this index was built from
+    pub fn get_decorations<'a>(
+        &'a self,
+        code: &'a [u32],
+        id: u32,
+    ) -> impl Iterator<Item = Instruction<'a>> + 'a {
+        let start = self.decorations.partition_point(|v| v.0 < id);
+        self.decorations[start..]
+            .iter()
+            .take_while(move |v| v.0 == id)
+            .map(move |v| decode_at(code, v.1))
+    }
+    /// decodes the instructions before the first function
+    pub fn get_global_instructions<'a>(
+        &self,
+        code: &'a [u32],
+    ) -> impl Iterator<Item = Instruction<'a>> + 'a {
+        Parser::new(&code[..self.function_section_offset as usize])
+            .expect("already decoded when indexing")
+            .1
+            .map(|instruction| instruction.expect("already decoded when indexing"))
+    }
+    fn get_scalar_type(&self, code: &[u32], type_id: u32) -> Result<ScalarType, String> {
+        match self.get_instruction(code, type_id) {
+            Some(Instruction::OpTypeBool { .. }) => Ok(ScalarType::Bool),
+            Some(Instruction::OpTypeInt { width, .. }) => Ok(ScalarType::Int { width }),
+            Some(Instruction::OpTypeFloat { width, .. }) => Ok(ScalarType::Float { width }),
+            _ => Err(format!("SPIR-V type isn't a scalar: {}", type_id)),
+        }
+    }
+    fn get_spec_id(&self, code: &[u32], id: u32) -> Option<u32> {
+        self.get_decorations(code, id)
+            .filter_map(|decoration| match decoration {
+                Instruction::OpDecorate {
+                    decoration:
+                        Decoration::SpecId {
+                            specialization_constant_id,
+                        },
+                    ..
+                } => Some(specialization_constant_id),
+                _ => None,
+            })
+            .next()
+    }
+    /// evaluates the module's constants. `get_specialization` returns the bytes given for a
+    /// `SpecId` in `VkSpecializationInfo`; specialization constants without any have their
+    /// default value
+    pub fn specialize_constants<'b, F: Fn(u32) -> Option<&'b [u8]>>(
+        &self,
+        code: &[u32],
+        get_specialization: F,
+    ) -> Result<SpecializedConstants, String> {
+        let mut retval = SpecializedConstants::default();
+        for instruction in self.get_global_instructions(code) {
+            let (type_id, id, value) = match instruction {
+                Instruction::OpConstantTrue {
+                    id_result_type,
+                    id_result,
+                } => (id_result_type, id_result, ConstantValue::Bool(true)),
+                Instruction::OpConstantFalse {
+                    id_result_type,
+                    id_result,
+                } => (id_result_type, id_result, ConstantValue::Bool(false)),
+                Instruction::OpConstant {
+                    id_result_type,
+                    id_result,
+                    value,
+                } => {
+                    let width = self.get_scalar_type(code, id_result_type.0)?.get_width();
+                    (
+                        id_result_type,
+                        id_result,
+                        ConstantValue::Scalar(truncate(get_literal_bits(value), width)),
+                    )
+                }
+                Instruction::OpConstantComposite {
+                    id_result_type,
+                    id_result,
+                    constituents,
+                }
+                | Instruction::OpSpecConstantComposite {
+                    id_result_type,
+                    id_result,
+                    constituents,
+                } => (
+                    id_result_type,
+                    id_result,
+                    ConstantValue::Composite(constituents.iter().map(|v| v.0).collect()),
+                ),
+                Instruction::OpConstantNull {
+                    id_result_type,
+                    id_result,
+                } => (id_result_type, id_result, ConstantValue::Null),
+                Instruction::OpSpecConstantTrue {
+                    id_result_type,
+                    id_result,
+                }
+                | Instruction::OpSpecConstantFalse {
+                    id_result_type,
+                    id_result,
+                } => {
+                    let default = match instruction {
+                        Instruction::OpSpecConstantTrue { .. } => true,
+                        _ => false,
+                    };
+                    let value = match self
+                        .get_spec_id(code, id_result.0)
+                        .and_then(&get_specialization)
+                    {
+                        None => default,
+                        // specialized as a `VkBool32`
+                        Some(data) if data.len() == 4 => data.iter().any(|&v| v != 0),
+                        Some(_) => {
+                            return Err(format!(
+                                "specialization data size doesn't match constant: {}",
+                                id_result.0
+                            ))
+                        }
+                    };
+                    (id_result_type, id_result, ConstantValue::Bool(value))
+                }
+                Instruction::OpSpecConstant {
+                    id_result_type,
+                    id_result,
+                    value,
+                } => {
+                    let width = self.get_scalar_type(code, id_result_type.0)?.get_width();
+                    let bits = match self
+                        .get_spec_id(code, id_result.0)
+                        .and_then(&get_specialization)
+                    {
+                        None => get_literal_bits(value),
+                        Some(data) if data.len() * 8 == width as usize => data
+                            .iter()
+                            .rev()
+                            .fold(0, |bits, &byte| bits << 8 | u64::from(byte)),
+                        Some(_) => {
+                            return Err(format!(
+                                "specialization data size doesn't match constant: {}",
+                                id_result.0
+                            ))
+                        }
+                    };
+                    (
+                        id_result_type,
+                        id_result,
+                        ConstantValue::Scalar(truncate(bits, width)),
+                    )
+                }
+                Instruction::OpSpecConstantOp {
+                    id_result_type,
+                    id_result,
+                    opcode,
+                } => (
+                    id_result_type,
+                    id_result,
+                    self.evaluate_spec_constant_op(code, &retval, id_result_type.0, opcode)?,
+                ),
+                _ => continue,
+            };
+            retval.constants.insert(
+                id.0,
+                Constant {
+                    type_id: type_id.0,
+                    value,
+                },
+            );
+        }
+        Ok(retval)
+    }
+    fn evaluate_spec_constant_op(
+        &self,
+        code: &[u32],
+        constants: &SpecializedConstants,
+        result_type: u32,
+        operation: SpecConstantOperation,
+    ) -> Result<ConstantValue, String> {
+        let operands = operation.operands;
+        let get_operand = |index: usize| {
+            operands
+                .get(index)
+                .ok_or_else(|| "missing OpSpecConstantOp operand".to_string())
+        };
+        if operation.opcode == OP_COMPOSITE_EXTRACT {
+            let mut value = &constants
+                .get(*get_operand(0)?)
+                .ok_or_else(|| "OpCompositeExtract operand isn't a constant".to_string())?
+                .value;
+            for &index in &operands[1..] {
+                value = match value {
+                    ConstantValue::Null => break,
+                    ConstantValue::Composite(constituents) => constituents
+                        .get(index as usize)
+                        .and_then(|&id| constants.get(id))
+                        .map(|constant| &constant.value)
+                        .ok_or_else(|| "OpCompositeExtract index out of range".to_string())?,
+                    _ => return Err("OpCompositeExtract operand isn't a composite".into()),
+                };
+            }
+            return Ok(value.clone());
+        }
+        let result_type = self.get_scalar_type(code, result_type)?;
+        let get_scalar = |index: usize| get_operand(index).and_then(|&id| constants.get_scalar(id));
+        let (operand_type, a) = get_scalar(0)?;
+        let width = self.get_scalar_type(code, operand_type)?.get_width();
+        let signed_a = sign_extend(a, width);
+        let get_b = || get_scalar(1).map(|v| v.1);
+        let get_signed_b = || get_b().map(|b| sign_extend(b, width));
+        // results that are undefined in SPIR-V, like dividing by zero, are 0
+        let value = match operation.opcode {
+            OP_UCONVERT => a,
+            OP_SCONVERT => signed_a as u64,
+            OP_SNEGATE => signed_a.wrapping_neg() as u64,
+            OP_NOT => !a,
+            OP_IADD => a.wrapping_add(get_b()?),
+            OP_ISUB => a.wrapping_sub(get_b()?),
+            OP_IMUL => a.wrapping_mul(get_b()?),
+            OP_UDIV => a.checked_div(get_b()?).unwrap_or(0),
+            OP_SDIV => signed_a.checked_div(get_signed_b()?).unwrap_or(0) as u64,
+            OP_UMOD => a.checked_rem(get_b()?).unwrap_or(0),
+            OP_SREM => signed_a.checked_rem(get_signed_b()?).unwrap_or(0) as u64,
+            OP_SMOD => {
+                // the result has the sign of the divisor
+                let b = get_signed_b()?;
+                match signed_a.checked_rem(b).unwrap_or(0) {
+                    remainder if remainder != 0 && (remainder < 0) != (b < 0) => {
+                        remainder.wrapping_add(b) as u64
+                    }
+                    remainder => remainder as u64,
+                }
+            }
+            OP_SHIFT_RIGHT_LOGICAL => {
+                let b = get_b()?;
+                if b < u64::from(width) {
+                    a >> b
+                } else {
+                    0
+                }
+            }
+            OP_SHIFT_RIGHT_ARITHMETIC => (signed_a >> cmp::min(get_b()?, 63)) as u64,
+            OP_SHIFT_LEFT_LOGICAL => {
+                let b = get_b()?;
+                if b < u64::from(width) {
+                    a << b
+                } else {
+                    0
+                }
+            }
+            OP_BITWISE_OR | OP_LOGICAL_OR => a | get_b()?,
+            OP_BITWISE_XOR => a ^ get_b()?,
+            OP_BITWISE_AND | OP_LOGICAL_AND => a & get_b()?,
+            OP_LOGICAL_NOT => (a == 0) as u64,
+            OP_LOGICAL_EQUAL | OP_IEQUAL => (a == get_b()?) as u64,
+            OP_LOGICAL_NOT_EQUAL | OP_INOT_EQUAL => (a != get_b()?) as u64,
+            OP_UGREATER_THAN => (a > get_b()?) as u64,
+            OP_SGREATER_THAN => (signed_a > get_signed_b()?) as u64,
+            OP_UGREATER_THAN_EQUAL => (a >= get_b()?) as u64,
+            OP_SGREATER_THAN_EQUAL => (signed_a >= get_signed_b()?) as u64,
+            OP_ULESS_THAN => (a < get_b()?) as u64,
+            OP_SLESS_THAN => (signed_a < get_signed_b()?) as u64,
+            OP_ULESS_THAN_EQUAL => (a <= get_b()?) as u64,
+            OP_SLESS_THAN_EQUAL => (signed_a <= get_signed_b()?) as u64,
+            OP_SELECT => {
+                if a != 0 {
+                    get_b()?
+                } else {
+                    get_scalar(2)?.1
+                }
+            }
+            opcode => {
+                return Err(format!(
+                    "unsupported OpSpecConstantOp operation: {}",
+                    opcode
+                ))
+            }
+        };
+        Ok(match result_type {
+            ScalarType::Bool => ConstantValue::Bool(value != 0),
+            _ => ConstantValue::Scalar(truncate(value, result_type.get_width())),
+        })
+    }
+    /// the size and alignment in bytes of a type that's stored without an explicit layout
+    pub fn get_type_layout(
+        &self,
+        code: &[u32],
+        constants: &SpecializedConstants,
+        type_id: u32,
+    ) -> Result<(usize, usize), String> {
+        let instruction = self
+            .get_instruction(code, type_id)
+            .ok_or_else(|| format!("SPIR-V type not defined: {}", type_id))?;
+        Ok(match instruction {
+            Instruction::OpTypeBool { .. } => (4, 4),
+            Instruction::OpTypeInt { width, .. } | Instruction::OpTypeFloat { width, .. } => {
+                let size = width as usize / 8;
+                (size, size)
+            }
+            Instruction::OpTypeVector {
+                component_type,
+                component_count,
+                ..
+            } => {
+                let (size, alignment) = self.get_type_layout(code, constants, component_type.0)?;
+                (size * component_count as usize, alignment)
+            }
+            Instruction::OpTypeMatrix {
+                column_type,
+                column_count,
+                ..
+            } => {
+                let (size, alignment) = self.get_type_layout(code, constants, column_type.0)?;
+                (align(size, alignment) * column_count as usize, alignment)
+            }
+            Instruction::OpTypeArray {
+                element_type,
+                length,
+                ..
+            } => {
+                let (size, alignment) = self.get_type_layout(code, constants, element_type.0)?;
+                let length = constants.get_u32(length.0)?;
+                (align(size, alignment) * length as usize, alignment)
+            }
+            Instruction::OpTypeStruct { member_type, .. } => {
+                let mut size = 0;
+                let mut alignment = 1;
+                for member_type in member_type {
+                    let (member_size, member_alignment) =
+                        self.get_type_layout(code, constants, member_type.0)?;
+                    size = align(size, member_alignment) + member_size;
+                    alignment = cmp::max(alignment, member_alignment);
+                }
+                (align(size, alignment), alignment)
+            }
+            instruction => return Err(format!("unsupported type in memory: {:?}", instruction)),
+        })
+    }
+    pub fn get_workgroup_memory_layout(
+        &self,
+        code: &[u32],
+        constants: &SpecializedConstants,
+    ) -> Result<WorkgroupMemoryLayout, String> {
+        let mut retval = WorkgroupMemoryLayout {
+            alignment: 1,
+            ..Default::default()
+        };
+        for instruction in self.get_global_instructions(code) {
+            if let Instruction::OpVariable {
+                id_result_type,
+                id_result,
+                storage_class: StorageClass::Workgroup,
+                ..
+            } = instruction
+            {
+                let pointee_type = match self.get_instruction(code, id_result_type.0) {
+                    Some(Instruction::OpTypePointer { type_, .. }) => type_,
+                    _ => return Err("SPIR-V variable type isn't a pointer".into()),
+                };
+                let (size, alignment) = self.get_type_layout(code, constants, pointee_type.0)?;
+                let offset = align(retval.size, alignment);
+                retval.variable_offsets.push((id_result.0, offset));
+                retval.size = offset + size;
+                retval.alignment = cmp::max(retval.alignment, alignment);
+            }
+        }
+        Ok(retval)
+    }
+    /// the workgroup size: the value of the constant decorated with the `WorkgroupSize`
+    /// built-in if there is one, otherwise the size declared with the `LocalSize` or
+    /// `LocalSizeId` execution mode
+    pub fn get_local_size(
+        &self,
+        code: &[u32],
+        constants: &SpecializedConstants,
+        entry_point: &EntryPoint,
+    ) -> Result<Option<[u32; 3]>, String> {
+        let workgroup_size_id = self
+            .decorations
+            .iter()
+            .find(|v| match decode_at(code, v.1) {
+                Instruction::OpDecorate {
+                    decoration:
+                        Decoration::BuiltIn {
+                            built_in: BuiltIn::WorkgroupSize,
+                        },
+                    ..
+                } => true,
+                _ => false,
+            })
+            .map(|v| v.0);
+        if let Some(id) = workgroup_size_id {
+            return match constants.get(id).map(|constant| &constant.value) {
+                Some(ConstantValue::Composite(constituents)) if constituents.len() == 3 => {
+                    Ok(Some([
+                        constants.get_u32(constituents[0])?,
+                        constants.get_u32(constituents[1])?,
+                        constants.get_u32(constituents[2])?,
+                    ]))
+                }
+                _ => Err("WorkgroupSize built-in isn't a 3-component constant".into()),
+            };
+        }
+        for &offset in &entry_point.execution_mode_offsets {
+            match decode_at(code, offset) {
+                Instruction::OpExecutionMode {
+                    mode:
+                        ExecutionMode::LocalSize {
+                            x_size,
+                            y_size,
+                            z_size,
+                        },
+                    ..
+                } => return Ok(Some([x_size, y_size, z_size])),
+                // `LocalSizeId` takes IDs, so it's only valid in `OpExecutionModeId`
+                Instruction::OpExecutionModeId {
+                    mode:
+                        ExecutionMode::LocalSizeId {
+                            x_size,
+                            y_size,
+                            z_size,
+                        },
+                    ..
+                } => {
+                    return Ok(Some([
+                        constants.get_u32(x_size.0)?,
+                        constants.get_u32(y_size.0)?,
+                        constants.get_u32(z_size.0)?,
+                    ]))
+                }
+                _ => {}
+            }
+        }
+        Ok(None)
+    }
+    pub fn find_entry_point(
+        &self,
+        execution_model: ExecutionModel,
+        name: &str,
+    ) -> Option<&EntryPoint> {
+        self.entry_points.iter().find(|entry_point| {
+            entry_point.execution_model == execution_model && entry_point.name == name
+        })
+    }
+}
+
 pub struct ShaderModule {
-    pub code: Vec<u32>,
+    pub code: Arc<[u32]>,
+    index: Mutex<Option<Result<Arc<ShaderModuleIndex>, String>>>,
+}
+
+impl ShaderModule {
+    pub fn new(code: Arc<[u32]>, index_now: bool) -> Self {
+        let retval = ShaderModule {
+            code,
+            index: Mutex::new(None),
+        };
+        if index_now {
+            let _ = retval.get_index();
+        }
+        retval
+    }
+    /// indexes the module on first use
+    pub fn get_index(&self) -> Result<Arc<ShaderModuleIndex>, String> {
+        self.index
+            .lock()
+            .unwrap()
+            .get_or_insert_with(|| ShaderModuleIndex::new(&self.code).map(Arc::new))
+            .clone()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use spirv_parser::MAGIC_NUMBER;
+
+    /// assembles a SPIR-V 1.2 module from instructions written as their opcode and operands
+    fn assemble(bound: u32, instructions: &[&[u32]]) -> Vec<u32> {
+        let mut words = vec![MAGIC_NUMBER, 0x0001_0200, 0, bound, 0];
+        for instruction in instructions {
+            words.push((instruction.len() as u32) << 16 | instruction[0]);
+            words.extend_from_slice(&instruction[1..]);
+        }
+        words
+    }
+
+    const OP_MEMORY_MODEL: u32 = 14;
+    const OP_ENTRY_POINT: u32 = 15;
+    const OP_CAPABILITY: u32 = 17;
+    const OP_TYPE_VOID: u32 = 19;
+    const OP_TYPE_BOOL: u32 = 20;
+    const OP_TYPE_INT: u32 = 21;
+    const OP_TYPE_VECTOR: u32 = 23;
+    const OP_TYPE_FUNCTION: u32 = 33;
+    const OP_CONSTANT: u32 = 43;
+    const OP_SPEC_CONSTANT_TRUE: u32 = 48;
+    const OP_SPEC_CONSTANT: u32 = 50;
+    const OP_SPEC_CONSTANT_COMPOSITE: u32 = 51;
+    const OP_SPEC_CONSTANT_OP: u32 = 52;
+    const OP_FUNCTION: u32 = 54;
+    const OP_FUNCTION_END: u32 = 56;
+    const OP_DECORATE: u32 = 71;
+    const OP_LABEL: u32 = 248;
+    const OP_RETURN: u32 = 253;
+    const OP_EXECUTION_MODE_ID: u32 = 331;
+    const DECORATION_SPEC_ID: u32 = 1;
+    const EXECUTION_MODEL_GL_COMPUTE: u32 = 5;
+    const EXECUTION_MODE_LOCAL_SIZE_ID: u32 = 38;
+    /// "main"
+    const MAIN: [u32; 2] = [0x6E69_616D, 0];
+
+    #[test]
+    fn test_local_size_id() {
+        // the x size is SpecId 0, defaulting to 8, and the z size is x * 2
+        let code = assemble(
+            13,
+            &[
+                &[OP_CAPABILITY, 1],
+                &[OP_MEMORY_MODEL, 0, 1],
+                &[
+                    OP_ENTRY_POINT,
+                    EXECUTION_MODEL_GL_COMPUTE,
+                    1,
+                    MAIN[0],
+                    MAIN[1],
+                ],
+                &[
+                    OP_EXECUTION_MODE_ID,
+                    1,
+                    EXECUTION_MODE_LOCAL_SIZE_ID,
+                    10,
+                    11,
+                    12,
+                ],
+                &[OP_DECORATE, 10, DECORATION_SPEC_ID, 0],
+                &[OP_TYPE_VOID, 2],
+                &[OP_TYPE_FUNCTION, 3, 2],
+                &[OP_TYPE_INT, 4, 32, 0],
+                &[OP_SPEC_CONSTANT, 4, 10, 8],
+                &[OP_CONSTANT, 4, 11, 2],
+                &[OP_SPEC_CONSTANT_OP, 4, 12, OP_IMUL, 10, 11],
+                &[OP_FUNCTION, 2, 1, 0, 3],
+                &[OP_LABEL, 5],
+                &[OP_RETURN],
+                &[OP_FUNCTION_END],
+            ],
+        );
+        let index = ShaderModuleIndex::new(&code).unwrap();
+        let entry_point = index
+            .find_entry_point(ExecutionModel::GLCompute, "main")
+            .unwrap();
+        assert_eq!(entry_point.execution_mode_offsets.len(), 1);
+        let get_local_size = |x_size: Option<&[u8]>| {
+            let constants = index
+                .specialize_constants(&code, |spec_id| if spec_id == 0 { x_size } else { None })
+                .unwrap();
+            index
+                .get_local_size(&code, &constants, entry_point)
+                .unwrap()
+        };
+        assert_eq!(get_local_size(None), Some([8, 2, 16]));
+        assert_eq!(get_local_size(Some(&[3, 0, 0, 0])), Some([3, 2, 6]));
+    }
+
+    #[test]
+    fn test_bound_too_large() {
+        let code = assemble(
+            u32::max_value(),
+            &[&[OP_CAPABILITY, 1], &[OP_MEMORY_MODEL, 0, 1]],
+        );
+        assert!(ShaderModuleIndex::new(&code).is_err());
+    }
+
+    #[test]
+    fn test_specialize_constants() {
+        let code = assemble(
+            20,
+            &[
+                &[OP_CAPABILITY, 1],
+                &[OP_MEMORY_MODEL, 0, 1],
+                &[OP_DECORATE, 5, DECORATION_SPEC_ID, 0],
+                &[OP_DECORATE, 6, DECORATION_SPEC_ID, 1],
+                &[OP_DECORATE, 13, DECORATION_SPEC_ID, 2],
+                &[OP_TYPE_INT, 2, 32, 1],
+                &[OP_TYPE_BOOL, 3],
+                &[OP_TYPE_INT, 4, 16, 0],
+                &[OP_SPEC_CONSTANT, 2, 5, -7i32 as u32],
+                &[OP_SPEC_CONSTANT, 2, 6, 3],
+                &[OP_SPEC_CONSTANT_OP, 2, 7, OP_SDIV, 5, 6],
+                &[OP_SPEC_CONSTANT_OP, 2, 8, OP_SREM, 5, 6],
+                &[OP_SPEC_CONSTANT_OP, 2, 9, OP_SMOD, 5, 6],
+                &[OP_CONSTANT, 2, 10, 2],
+                &[OP_SPEC_CONSTANT_OP, 2, 11, OP_SHIFT_RIGHT_ARITHMETIC, 5, 10],
+                &[OP_SPEC_CONSTANT_OP, 3, 12, OP_SLESS_THAN, 5, 6],
+                &[OP_SPEC_CONSTANT_TRUE, 3, 13],
+                &[OP_SPEC_CONSTANT_OP, 2, 14, OP_SELECT, 13, 5, 6],
+                &[OP_SPEC_CONSTANT_OP, 4, 15, OP_UCONVERT, 5],
+                &[OP_TYPE_VECTOR, 16, 2, 2],
+                &[OP_SPEC_CONSTANT_COMPOSITE, 16, 17, 5, 6],
+                &[OP_SPEC_CONSTANT_OP, 2, 18, OP_COMPOSITE_EXTRACT, 17, 1],
+                &[OP_SPEC_CONSTANT_OP, 2, 19, OP_IADD, 5, 6],
+            ],
+        );
+        let index = ShaderModuleIndex::new(&code).unwrap();
+        let check = |specializations: &[&[u8]], expected: &[(u32, ConstantValue)]| {
+            let constants = index
+                .specialize_constants(&code, |spec_id| {
+                    specializations.get(spec_id as usize).cloned()
+                })
+                .unwrap();
+            for (id, value) in expected {
+                assert_eq!(constants.get(*id).unwrap().value, *value, "ID {}", id);
+            }
+        };
+        let scalar = |value: i32| ConstantValue::Scalar(u64::from(value as u32));
+        // -7 and 3
+        check(
+            &[],
+            &[
+                (7, scalar(-2)),
+                (8, scalar(-1)),
+                (9, scalar(2)),
+                (11, scalar(-2)),
+                (12, ConstantValue::Bool(true)),
+                (14, scalar(-7)),
+                (15, ConstantValue::Scalar(0xFFF9)),
+                (18, scalar(3)),
+                (19, scalar(-4)),
+            ],
+        );
+        // 20, -6 and false
+        check(
+            &[&[20, 0, 0, 0], &[0xFA, 0xFF, 0xFF, 0xFF], &[0, 0, 0, 0]],
+            &[
+                (7, scalar(-3)),
+                (8, scalar(2)),
+                (9, scalar(-4)),
+                (11, scalar(5)),
+                (12, ConstantValue::Bool(false)),
+                (14, scalar(-6)),
+                (15, ConstantValue::Scalar(20)),
+                (18, scalar(-6)),
+                (19, scalar(14)),
+            ],
+        );
+        assert!(index
+            .specialize_constants(&code, |spec_id| if spec_id == 0 {
+                Some(&[20, 0][..])
+            } else {
+                None
+            })
+            .is_err());
+    }
 }
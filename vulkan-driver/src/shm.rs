@@ -37,11 +37,12 @@ impl SharedMemorySegment {
             id => Ok(Self::new(id, size)),
         }
     }
-    #[allow(dead_code)]
     pub fn create(size: usize) -> Result<Self, errno::Errno> {
         unsafe { Self::create_with_flags(size, libc::IPC_CREAT | libc::IPC_EXCL | 0o666) }
     }
-    #[allow(dead_code)]
+    pub fn id(&self) -> c_int {
+        self.id
+    }
     pub fn map(&self) -> Result<MappedSharedMemorySegment, errno::Errno> {
         unsafe {
             let memory = libc::shmat(self.id, null_mut(), 0);
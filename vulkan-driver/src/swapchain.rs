@@ -1,11 +1,14 @@
 // SPDX-License-Identifier: LGPL-2.1-or-later
 // Copyright 2018 Jacob Lifshay
 use api;
+#[cfg(target_os = "linux")]
+use headless_swapchain::HeadlessSurfaceImplementation;
 use std::any::Any;
 use std::borrow::Cow;
 use std::error::Error;
 use std::fmt::{self, Debug};
 use std::ptr::NonNull;
+use std::sync::atomic::{AtomicU32, AtomicUsize, Ordering};
 #[cfg(unix)]
 use xcb_swapchain::XcbSurfaceImplementation;
 
@@ -21,6 +24,7 @@ pub enum SurfacePlatform {
     VK_ICD_WSI_PLATFORM_MACOS,
     VK_ICD_WSI_PLATFORM_IOS,
     VK_ICD_WSI_PLATFORM_DISPLAY,
+    VK_ICD_WSI_PLATFORM_HEADLESS,
 }
 
 #[derive(Debug)]
@@ -46,15 +50,23 @@ impl SurfacePlatform {
             api::VK_ICD_WSI_PLATFORM_MACOS => Ok(SurfacePlatform::VK_ICD_WSI_PLATFORM_MACOS),
             api::VK_ICD_WSI_PLATFORM_IOS => Ok(SurfacePlatform::VK_ICD_WSI_PLATFORM_IOS),
             api::VK_ICD_WSI_PLATFORM_DISPLAY => Ok(SurfacePlatform::VK_ICD_WSI_PLATFORM_DISPLAY),
+            api::VK_ICD_WSI_PLATFORM_HEADLESS => Ok(SurfacePlatform::VK_ICD_WSI_PLATFORM_HEADLESS),
             platform => Err(UnknownSurfacePlatform(platform)),
         }
     }
     pub fn get_surface_implementation(self) -> Cow<'static, dyn SurfaceImplementation> {
         #[cfg(unix)]
         const XCB_SURFACE_IMPLEMENTATION: XcbSurfaceImplementation = XcbSurfaceImplementation;
+        #[cfg(target_os = "linux")]
+        const HEADLESS_SURFACE_IMPLEMENTATION: HeadlessSurfaceImplementation =
+            HeadlessSurfaceImplementation;
         match self {
             #[cfg(unix)]
             SurfacePlatform::VK_ICD_WSI_PLATFORM_XCB => Cow::Borrowed(&XCB_SURFACE_IMPLEMENTATION),
+            #[cfg(target_os = "linux")]
+            SurfacePlatform::VK_ICD_WSI_PLATFORM_HEADLESS => {
+                Cow::Borrowed(&HEADLESS_SURFACE_IMPLEMENTATION)
+            }
             _ => Cow::Owned(FallbackSurfaceImplementation(self).duplicate()),
         }
     }
@@ -72,11 +84,130 @@ impl From<SurfacePlatform> for api::VkIcdWsiPlatform {
             SurfacePlatform::VK_ICD_WSI_PLATFORM_MACOS => api::VK_ICD_WSI_PLATFORM_MACOS,
             SurfacePlatform::VK_ICD_WSI_PLATFORM_IOS => api::VK_ICD_WSI_PLATFORM_IOS,
             SurfacePlatform::VK_ICD_WSI_PLATFORM_DISPLAY => api::VK_ICD_WSI_PLATFORM_DISPLAY,
+            SurfacePlatform::VK_ICD_WSI_PLATFORM_HEADLESS => api::VK_ICD_WSI_PLATFORM_HEADLESS,
         }
     }
 }
 
-pub trait Swapchain: Any + Sync + Send + Debug {}
+pub const MAX_SWAPCHAIN_IMAGE_COUNT: u32 = 16;
+
+/// the set of swapchain images that can be acquired
+pub struct AvailableImages(AtomicU32);
+
+impl AvailableImages {
+    pub fn new(image_count: u32) -> Self {
+        assert!(image_count <= MAX_SWAPCHAIN_IMAGE_COUNT);
+        AvailableImages(AtomicU32::new(((1u64 << image_count) - 1) as u32))
+    }
+    /// remove an image from the set
+    pub fn take(&self) -> Option<u32> {
+        let mut images = self.0.load(Ordering::Acquire);
+        loop {
+            if images == 0 {
+                return None;
+            }
+            let image_index = images.trailing_zeros();
+            match self.0.compare_exchange_weak(
+                images,
+                images & !(1 << image_index),
+                Ordering::Acquire,
+                Ordering::Acquire,
+            ) {
+                Ok(_) => return Some(image_index),
+                Err(v) => images = v,
+            }
+        }
+    }
+    pub fn release(&self, image_index: u32) {
+        let old_images = self.0.fetch_or(1 << image_index, Ordering::Release);
+        assert_eq!(
+            old_images & (1 << image_index),
+            0,
+            "image was already available"
+        );
+    }
+}
+
+const NO_IMAGE: u32 = !0;
+
+/// images waiting to be presented, in order for FIFO and IMMEDIATE present modes.
+/// there is only one waiting image in MAILBOX present mode, presenting replaces it.
+/// any number of threads can push, but only one thread can pop at a time
+pub struct PresentQueue {
+    mailbox: bool,
+    /// used as a ring buffer of image indexes plus one, 0 is an empty slot
+    images: [AtomicU32; MAX_SWAPCHAIN_IMAGE_COUNT as usize],
+    read_index: AtomicUsize,
+    write_index: AtomicUsize,
+    mailbox_image: AtomicU32,
+}
+
+impl PresentQueue {
+    pub fn new(present_mode: api::VkPresentModeKHR) -> Self {
+        let mailbox = match present_mode {
+            api::VK_PRESENT_MODE_FIFO_KHR | api::VK_PRESENT_MODE_IMMEDIATE_KHR => false,
+            api::VK_PRESENT_MODE_MAILBOX_KHR => true,
+            _ => unimplemented!("present mode {}", present_mode),
+        };
+        Self {
+            mailbox,
+            images: Default::default(),
+            read_index: AtomicUsize::new(0),
+            write_index: AtomicUsize::new(0),
+            mailbox_image: AtomicU32::new(NO_IMAGE),
+        }
+    }
+    /// returns the image that was replaced in MAILBOX present mode, it can be acquired again
+    pub fn push(&self, image_index: u32) -> Option<u32> {
+        if self.mailbox {
+            match self.mailbox_image.swap(image_index, Ordering::AcqRel) {
+                NO_IMAGE => None,
+                replaced_image_index => Some(replaced_image_index),
+            }
+        } else {
+            let write_index = self.write_index.fetch_add(1, Ordering::Relaxed);
+            let old_image = self.images[write_index % self.images.len()]
+                .swap(image_index + 1, Ordering::Release);
+            // each image can only be in the queue once, so the queue can't overflow
+            assert_eq!(old_image, 0, "present queue overflowed");
+            None
+        }
+    }
+    pub fn pop(&self) -> Option<u32> {
+        if self.mailbox {
+            match self.mailbox_image.swap(NO_IMAGE, Ordering::AcqRel) {
+                NO_IMAGE => None,
+                image_index => Some(image_index),
+            }
+        } else {
+            let read_index = self.read_index.load(Ordering::Relaxed);
+            match self.images[read_index % self.images.len()].swap(0, Ordering::Acquire) {
+                0 => None,
+                image => {
+                    self.read_index.store(read_index + 1, Ordering::Relaxed);
+                    Some(image - 1)
+                }
+            }
+        }
+    }
+    pub fn is_empty(&self) -> bool {
+        if self.mailbox {
+            self.mailbox_image.load(Ordering::Acquire) == NO_IMAGE
+        } else {
+            let read_index = self.read_index.load(Ordering::Relaxed);
+            self.images[read_index % self.images.len()].load(Ordering::Acquire) == 0
+        }
+    }
+}
+
+pub trait Swapchain: Any + Sync + Send + Debug {
+    fn get_image_count(&self) -> u32;
+    unsafe fn get_image(&self, image_index: u32) -> api::VkImage;
+    /// returns the index of an image that is ready to be rendered to
+    unsafe fn acquire_next_image(&self, timeout: u64) -> Result<u32, api::VkResult>;
+    /// called from the queue thread once rendering to the image is finished, must not block
+    unsafe fn present(&self, image_index: u32);
+}
 
 pub trait SurfaceImplementation: Any + Sync + Send + Debug {
     fn get_platform(&self) -> SurfacePlatform;
@@ -156,3 +287,36 @@ impl SurfaceImplementation for FallbackSurfaceImplementation {
         Box::new(FallbackSurfaceImplementation(self.0))
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_present_queue() {
+        let available_images = AvailableImages::new(3);
+        let fifo = PresentQueue::new(api::VK_PRESENT_MODE_FIFO_KHR);
+        let mailbox = PresentQueue::new(api::VK_PRESENT_MODE_MAILBOX_KHR);
+        for _ in 0..10 {
+            let images: Vec<_> = (0..3).map(|_| available_images.take().unwrap()).collect();
+            assert_eq!(available_images.take(), None);
+            for &image_index in &images {
+                assert_eq!(fifo.push(image_index), None);
+            }
+            for &image_index in &images {
+                assert!(!fifo.is_empty());
+                assert_eq!(fifo.pop(), Some(image_index));
+            }
+            assert!(fifo.is_empty());
+            assert_eq!(fifo.pop(), None);
+            assert_eq!(mailbox.push(images[0]), None);
+            assert_eq!(mailbox.push(images[1]), Some(images[0]));
+            assert_eq!(mailbox.push(images[2]), Some(images[1]));
+            assert_eq!(mailbox.pop(), Some(images[2]));
+            assert!(mailbox.is_empty());
+            for image_index in images {
+                available_images.release(image_index);
+            }
+        }
+    }
+}
@@ -0,0 +1,328 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright 2018 Jacob Lifshay
+
+// Fences and semaphores are plain atomics, so signaling and checking them never takes a lock.
+// Every fence and semaphore of a device belongs to one `SyncGroup`, which counts signals in
+// `sequence`. A thread that has to block waits for `sequence` to change (on a futex on Linux),
+// which lets it wait for any combination of fences and semaphores.
+// Signaling only makes a syscall when some thread is blocked in the group.
+
+use std::sync::atomic::{AtomicBool, AtomicU32, AtomicU64, Ordering};
+use std::sync::Arc;
+#[cfg(not(target_os = "linux"))]
+use std::sync::{Condvar, Mutex};
+use std::time::{Duration, Instant};
+
+#[cfg(target_os = "linux")]
+pub mod futex {
+    use libc;
+    use std::ptr::null;
+    use std::sync::atomic::AtomicU32;
+    use std::time::Duration;
+
+    fn flags(shared: bool) -> libc::c_int {
+        if shared {
+            0
+        } else {
+            libc::FUTEX_PRIVATE_FLAG
+        }
+    }
+
+    /// block while `*word == expected`, may return spuriously.
+    /// `shared` futexes can be woken by other processes that map the same memory
+    pub fn wait(word: &AtomicU32, expected: u32, timeout: Option<Duration>, shared: bool) {
+        let timeout = timeout.map(|timeout| libc::timespec {
+            tv_sec: timeout.as_secs() as libc::time_t,
+            tv_nsec: timeout.subsec_nanos() as libc::c_long,
+        });
+        unsafe {
+            libc::syscall(
+                libc::SYS_futex,
+                word as *const AtomicU32,
+                libc::FUTEX_WAIT | flags(shared),
+                expected,
+                timeout
+                    .as_ref()
+                    .map(|timeout| timeout as *const libc::timespec)
+                    .unwrap_or(null()),
+            );
+        }
+    }
+
+    pub fn wake_all(word: &AtomicU32, shared: bool) {
+        unsafe {
+            libc::syscall(
+                libc::SYS_futex,
+                word as *const AtomicU32,
+                libc::FUTEX_WAKE | flags(shared),
+                libc::c_int::max_value(),
+            );
+        }
+    }
+}
+
+#[derive(Default)]
+pub struct SyncGroup {
+    /// incremented after every signal
+    sequence: AtomicU32,
+    /// the number of threads that may be blocked waiting for `sequence` to change
+    waiter_count: AtomicU32,
+    #[cfg(not(target_os = "linux"))]
+    lock: Mutex<()>,
+    #[cfg(not(target_os = "linux"))]
+    condition: Condvar,
+}
+
+impl SyncGroup {
+    pub fn new() -> Arc<Self> {
+        Default::default()
+    }
+    #[cfg(target_os = "linux")]
+    fn block(&self, sequence: u32, timeout: Option<Duration>) {
+        futex::wait(&self.sequence, sequence, timeout, false);
+    }
+    #[cfg(target_os = "linux")]
+    fn wake_all(&self) {
+        futex::wake_all(&self.sequence, false);
+    }
+    #[cfg(not(target_os = "linux"))]
+    fn block(&self, sequence: u32, timeout: Option<Duration>) {
+        let lock = self.lock.lock().unwrap();
+        if self.sequence.load(Ordering::SeqCst) == sequence {
+            match timeout {
+                None => drop(self.condition.wait(lock).unwrap()),
+                Some(timeout) => drop(self.condition.wait_timeout(lock, timeout).unwrap()),
+            }
+        }
+    }
+    #[cfg(not(target_os = "linux"))]
+    fn wake_all(&self) {
+        let _lock = self.lock.lock().unwrap();
+        self.condition.notify_all();
+    }
+    /// wait until `done` returns true or `deadline` has passed.
+    /// doesn't make any syscalls if `done` returns true the first time.
+    /// returns the last value returned by `done`
+    pub fn wait_until<F: FnMut() -> bool>(&self, deadline: Option<Instant>, mut done: F) -> bool {
+        if done() {
+            return true;
+        }
+        loop {
+            // register before reading `sequence`, so `signaled` either sees us or we see its
+            // increment of `sequence`
+            self.waiter_count.fetch_add(1, Ordering::SeqCst);
+            let sequence = self.sequence.load(Ordering::SeqCst);
+            let retval = if done() {
+                Some(true)
+            } else {
+                match deadline {
+                    None => {
+                        self.block(sequence, None);
+                        None
+                    }
+                    Some(deadline) => {
+                        let now = Instant::now();
+                        if now >= deadline {
+                            Some(false)
+                        } else {
+                            self.block(sequence, Some(deadline - now));
+                            None
+                        }
+                    }
+                }
+            };
+            self.waiter_count.fetch_sub(1, Ordering::SeqCst);
+            if let Some(retval) = retval {
+                return retval;
+            }
+            if done() {
+                return true;
+            }
+        }
+    }
+    /// must be called after changing any state that threads wait for with `wait_until`
+    pub fn signaled(&self) {
+        self.sequence.fetch_add(1, Ordering::SeqCst);
+        if self.waiter_count.load(Ordering::SeqCst) != 0 {
+            self.wake_all();
+        }
+    }
+}
+
+/// converts a Vulkan timeout in nanoseconds to a deadline, `None` means wait forever
+pub fn get_deadline(timeout: u64) -> Option<Instant> {
+    Instant::now().checked_add(Duration::from_nanos(timeout))
+}
+
+pub struct Fence {
+    group: Arc<SyncGroup>,
+    signaled: AtomicBool,
+}
+
+impl Fence {
+    pub fn new(group: Arc<SyncGroup>, signaled: bool) -> Self {
+        Self {
+            group,
+            signaled: AtomicBool::new(signaled),
+        }
+    }
+    pub fn is_signaled(&self) -> bool {
+        self.signaled.load(Ordering::Acquire)
+    }
+    pub fn signal(&self) {
+        self.signaled.store(true, Ordering::Release);
+        self.group.signaled();
+    }
+    pub fn reset(&self) {
+        self.signaled.store(false, Ordering::Release);
+    }
+}
+
+#[derive(Copy, Clone, Eq, PartialEq, Debug)]
+pub enum SemaphoreType {
+    /// `value` is 1 when signaled and 0 when unsignaled
+    Binary,
+    /// `value` only increases
+    #[allow(dead_code)]
+    Timeline,
+}
+
+pub struct Semaphore {
+    group: Arc<SyncGroup>,
+    semaphore_type: SemaphoreType,
+    value: AtomicU64,
+}
+
+impl Semaphore {
+    pub fn new(group: Arc<SyncGroup>, semaphore_type: SemaphoreType, initial_value: u64) -> Self {
+        assert!(semaphore_type == SemaphoreType::Timeline || initial_value == 0);
+        Self {
+            group,
+            semaphore_type,
+            value: AtomicU64::new(initial_value),
+        }
+    }
+    #[allow(dead_code)]
+    pub fn semaphore_type(&self) -> SemaphoreType {
+        self.semaphore_type
+    }
+    #[allow(dead_code)]
+    pub fn value(&self) -> u64 {
+        self.value.load(Ordering::Acquire)
+    }
+    /// `value` is ignored for binary semaphores.
+    /// returns false without changing a timeline semaphore if `value` isn't more than its value,
+    /// which isn't valid usage
+    pub fn signal(&self, value: u64) -> bool {
+        match self.semaphore_type {
+            SemaphoreType::Binary => self.value.store(1, Ordering::Release),
+            SemaphoreType::Timeline => {
+                let mut old_value = self.value.load(Ordering::Relaxed);
+                loop {
+                    if old_value >= value {
+                        return false;
+                    }
+                    match self.value.compare_exchange_weak(
+                        old_value,
+                        value,
+                        Ordering::Release,
+                        Ordering::Relaxed,
+                    ) {
+                        Ok(_) => break,
+                        Err(v) => old_value = v,
+                    }
+                }
+            }
+        }
+        self.group.signaled();
+        true
+    }
+    /// returns true if `wait` would return immediately.
+    /// unsignals binary semaphores if it returns true
+    pub fn try_wait(&self, value: u64) -> bool {
+        match self.semaphore_type {
+            SemaphoreType::Binary => self
+                .value
+                .compare_exchange(1, 0, Ordering::Acquire, Ordering::Relaxed)
+                .is_ok(),
+            SemaphoreType::Timeline => self.value.load(Ordering::Acquire) >= value,
+        }
+    }
+    /// wait for binary semaphores to be signaled, then unsignal them.
+    /// wait for timeline semaphores to reach `value`.
+    /// returns false on timeout
+    pub fn wait(&self, value: u64, deadline: Option<Instant>) -> bool {
+        self.group.wait_until(deadline, || self.try_wait(value))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::thread;
+
+    #[test]
+    fn test_wait_any() {
+        let group = SyncGroup::new();
+        let fences: Vec<_> = (0..2)
+            .map(|_| Arc::new(Fence::new(group.clone(), false)))
+            .collect();
+        assert!(!group.wait_until(get_deadline(1_000_000), || fences
+            .iter()
+            .any(|fence| fence.is_signaled())));
+        let fence = fences[1].clone();
+        let thread = thread::spawn(move || fence.signal());
+        assert!(group.wait_until(None, || fences.iter().any(|fence| fence.is_signaled())));
+        thread.join().unwrap();
+        assert!(!fences[0].is_signaled());
+        fences[1].reset();
+        assert!(!fences[1].is_signaled());
+    }
+
+    #[test]
+    fn test_timeline_semaphore() {
+        let group = SyncGroup::new();
+        let semaphore = Arc::new(Semaphore::new(group.clone(), SemaphoreType::Timeline, 1));
+        assert!(semaphore.wait(1, Some(Instant::now())));
+        assert!(!semaphore.wait(2, get_deadline(1_000_000)));
+        let threads: Vec<_> = (2..10)
+            .map(|value| {
+                let semaphore = semaphore.clone();
+                thread::spawn(move || assert!(semaphore.wait(value, None)))
+            })
+            .collect();
+        for value in 2..10 {
+            assert!(semaphore.signal(value));
+        }
+        for thread in threads {
+            thread.join().unwrap();
+        }
+        assert_eq!(semaphore.value(), 9);
+        // values that don't increase are ignored
+        assert!(!semaphore.signal(9));
+        assert!(!semaphore.signal(3));
+        assert_eq!(semaphore.value(), 9);
+    }
+
+    #[test]
+    fn test_binary_semaphore() {
+        let group = SyncGroup::new();
+        let semaphore = Arc::new(Semaphore::new(group.clone(), SemaphoreType::Binary, 0));
+        let thread = {
+            let semaphore = semaphore.clone();
+            thread::spawn(move || {
+                for _ in 0..1000 {
+                    assert!(semaphore.wait(0, None));
+                }
+            })
+        };
+        for _ in 0..1000 {
+            // wait for the previous signal to be consumed
+            while semaphore.value() != 0 {
+                thread::yield_now();
+            }
+            semaphore.signal(0);
+        }
+        thread.join().unwrap();
+    }
+}
@@ -0,0 +1,340 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright 2018 Jacob Lifshay
+use std::cmp;
+use std::collections::VecDeque;
+use std::mem;
+use std::panic;
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use std::sync::{Arc, Condvar, Mutex};
+use std::thread;
+use sys_info;
+
+trait Job: Send {
+    fn run(self: Box<Self>);
+}
+
+impl<F: FnOnce() + Send> Job for F {
+    fn run(self: Box<Self>) {
+        (*self)()
+    }
+}
+
+struct Queue {
+    jobs: VecDeque<Box<dyn Job>>,
+    /// only run when `jobs` is empty
+    low_priority_jobs: VecDeque<Box<dyn Job>>,
+    shutting_down: bool,
+}
+
+struct Shared {
+    queue: Mutex<Queue>,
+    condition: Condvar,
+}
+
+fn worker_main(shared: &Shared) {
+    loop {
+        let job = {
+            let mut queue = shared.queue.lock().unwrap();
+            loop {
+                if let Some(job) = queue.jobs.pop_front() {
+                    break job;
+                }
+                if let Some(job) = queue.low_priority_jobs.pop_front() {
+                    break job;
+                }
+                if queue.shutting_down {
+                    return;
+                }
+                queue = shared.condition.wait(queue).unwrap();
+            }
+        };
+        // a panicking job must not take the worker down with it;
+        // `ThreadPool::map` reports panics to its caller itself
+        let _ = panic::catch_unwind(panic::AssertUnwindSafe(|| job.run()));
+    }
+}
+
+struct Batch {
+    next_index: AtomicUsize,
+    len: usize,
+    finished_count: Mutex<usize>,
+    all_finished: Condvar,
+    /// borrowed from `ThreadPool::map`'s stack frame with the lifetime erased.
+    /// only called after claiming an index less than `len`, and `map` doesn't return until every
+    /// claimed index is finished, so it is never called after the borrow ends
+    run_index: *const (dyn Fn(usize) + Sync),
+}
+
+unsafe impl Send for Batch {}
+unsafe impl Sync for Batch {}
+
+impl Batch {
+    fn work(&self) {
+        loop {
+            let index = self.next_index.fetch_add(1, Ordering::Relaxed);
+            if index >= self.len {
+                return;
+            }
+            unsafe { (*self.run_index)(index) };
+            let mut finished_count = self.finished_count.lock().unwrap();
+            *finished_count += 1;
+            if *finished_count == self.len {
+                self.all_finished.notify_all();
+            }
+        }
+    }
+}
+
+pub struct ThreadPool {
+    shared: Arc<Shared>,
+    threads: Vec<thread::JoinHandle<()>>,
+}
+
+impl ThreadPool {
+    pub fn new(thread_count: usize, name: &str) -> Self {
+        let shared = Arc::new(Shared {
+            queue: Mutex::new(Queue {
+                jobs: VecDeque::new(),
+                low_priority_jobs: VecDeque::new(),
+                shutting_down: false,
+            }),
+            condition: Condvar::new(),
+        });
+        let threads = (0..thread_count)
+            .map(|index| {
+                let shared = shared.clone();
+                thread::Builder::new()
+                    .name(format!("{} {}", name, index))
+                    .spawn(move || worker_main(&shared))
+                    .unwrap()
+            })
+            .collect();
+        Self { shared, threads }
+    }
+    /// create a `ThreadPool` with a thread per CPU core
+    pub fn with_thread_per_core(name: &str) -> Self {
+        let thread_count = match sys_info::cpu_num() {
+            Ok(cpu_count) => cmp::max(cpu_count as usize, 1),
+            Err(error) => {
+                eprintln!("cpu_num error: {}", error);
+                1
+            }
+        };
+        Self::new(thread_count, name)
+    }
+    pub fn thread_count(&self) -> usize {
+        self.threads.len()
+    }
+    pub fn spawn<F: FnOnce() + Send + 'static>(&self, f: F) {
+        self.shared
+            .queue
+            .lock()
+            .unwrap()
+            .jobs
+            .push_back(Box::new(f));
+        self.shared.condition.notify_one();
+    }
+    /// like `spawn`, except the job is only started when there are no other jobs waiting.
+    /// used for background work that shouldn't delay the work an application is waiting on
+    pub fn spawn_low_priority<F: FnOnce() + Send + 'static>(&self, f: F) {
+        self.shared
+            .queue
+            .lock()
+            .unwrap()
+            .low_priority_jobs
+            .push_back(Box::new(f));
+        self.shared.condition.notify_one();
+    }
+    /// call `f` on every item in `items` in parallel, returning the results in the same order as `items`.
+    /// the calling thread helps run `f`, so `map` can be called from inside the pool's threads.
+    /// `map` doesn't return until every call to `f` is finished, so `f` can borrow from the caller.
+    /// if any call to `f` panics, `map` panics after every call is finished
+    pub fn map<T, R, F>(&self, items: Vec<T>, f: F) -> Vec<R>
+    where
+        T: Send,
+        R: Send,
+        F: Fn(T) -> R + Sync,
+    {
+        let len = items.len();
+        if len <= 1 {
+            return items.into_iter().map(f).collect();
+        }
+        let items: Vec<_> = items.into_iter().map(|v| Mutex::new(Some(v))).collect();
+        let results: Vec<Mutex<Option<thread::Result<R>>>> =
+            (0..len).map(|_| Mutex::new(None)).collect();
+        {
+            let run_index = |index: usize| {
+                let item = items[index].lock().unwrap().take().unwrap();
+                let result = panic::catch_unwind(panic::AssertUnwindSafe(|| f(item)));
+                *results[index].lock().unwrap() = Some(result);
+            };
+            let run_index: &(dyn Fn(usize) + Sync) = &run_index;
+            let batch = Arc::new(Batch {
+                next_index: AtomicUsize::new(0),
+                len,
+                finished_count: Mutex::new(0),
+                all_finished: Condvar::new(),
+                run_index: unsafe {
+                    mem::transmute::<&(dyn Fn(usize) + Sync), &'static (dyn Fn(usize) + Sync)>(
+                        run_index,
+                    )
+                },
+            });
+            for _ in 0..cmp::min(self.threads.len(), len - 1) {
+                let batch = batch.clone();
+                self.spawn(move || batch.work());
+            }
+            batch.work();
+            let mut finished_count = batch.finished_count.lock().unwrap();
+            while *finished_count < len {
+                finished_count = batch.all_finished.wait(finished_count).unwrap();
+            }
+        }
+        results
+            .into_iter()
+            .map(|result| match result.into_inner().unwrap().unwrap() {
+                Ok(result) => result,
+                Err(panic_payload) => panic::resume_unwind(panic_payload),
+            })
+            .collect()
+    }
+    /// call `f` on every index in `0..len` in parallel, using every thread in the pool and the
+    /// calling thread.
+    /// each thread starts out owning an equal contiguous range of indexes, which it runs in order,
+    /// and steals the back half of the largest remaining range when its own runs out, so
+    /// indexes that take longer than others are balanced without locking.
+    /// each thread gets its own state, created on that thread by `create_state`.
+    /// if any call to `f` panics, `for_each_index` panics after every other thread stops.
+    /// `len` must fit in a `u32`
+    pub fn for_each_index<S, C, F>(&self, len: usize, create_state: C, f: F)
+    where
+        C: Fn() -> S + Sync,
+        F: Fn(&mut S, usize) + Sync,
+    {
+        let participant_count = cmp::min(self.threads.len() + 1, len);
+        if participant_count <= 1 {
+            let mut state = create_state();
+            for index in 0..len {
+                f(&mut state, index);
+            }
+            return;
+        }
+        assert!(len <= u32::max_value() as usize, "too many indexes");
+        // each range is packed into one word as `start | end << 32`, so claiming and stealing
+        // indexes are single compare-and-swaps. an index is only claimed by the swap that
+        // removes it from a range, so relaxed ordering is enough; `map` synchronizes the rest
+        let pack = |start: u32, end: u32| u64::from(start) | u64::from(end) << 32;
+        let unpack = |range: u64| (range as u32, (range >> 32) as u32);
+        let ranges: Vec<_> = (0..participant_count)
+            .map(|participant| {
+                AtomicU64::new(pack(
+                    (len * participant / participant_count) as u32,
+                    (len * (participant + 1) / participant_count) as u32,
+                ))
+            })
+            .collect();
+        let claim_index = |participant: usize| -> Option<usize> {
+            let own_range = &ranges[participant];
+            loop {
+                let mut range = own_range.load(Ordering::Relaxed);
+                loop {
+                    let (start, end) = unpack(range);
+                    if start == end {
+                        break;
+                    }
+                    match own_range.compare_exchange_weak(
+                        range,
+                        pack(start + 1, end),
+                        Ordering::Relaxed,
+                        Ordering::Relaxed,
+                    ) {
+                        Ok(_) => return Some(start as usize),
+                        Err(current) => range = current,
+                    }
+                }
+                let (victim, victim_range) = ranges
+                    .iter()
+                    .map(|range| range.load(Ordering::Relaxed))
+                    .enumerate()
+                    .max_by_key(|&(_, range)| {
+                        let (start, end) = unpack(range);
+                        end - start
+                    })
+                    .unwrap();
+                let (start, end) = unpack(victim_range);
+                if start == end {
+                    return None;
+                }
+                // with one index left, the whole range is stolen
+                let middle = start + (end - start) / 2;
+                if ranges[victim]
+                    .compare_exchange(
+                        victim_range,
+                        pack(start, middle),
+                        Ordering::Relaxed,
+                        Ordering::Relaxed,
+                    )
+                    .is_err()
+                {
+                    continue;
+                }
+                // nothing steals from an empty range, so this can't overwrite another thread's
+                // changes
+                own_range.store(pack(middle, end), Ordering::Relaxed);
+            }
+        };
+        self.map((0..participant_count).collect(), |participant| {
+            let mut state = create_state();
+            while let Some(index) = claim_index(participant) {
+                f(&mut state, index);
+            }
+        });
+    }
+}
+
+impl Drop for ThreadPool {
+    fn drop(&mut self) {
+        self.shared.queue.lock().unwrap().shutting_down = true;
+        self.shared.condition.notify_all();
+        for thread in self.threads.drain(..) {
+            thread.join().unwrap();
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_map() {
+        let thread_pool = ThreadPool::new(3, "test");
+        let offset = 10;
+        let results = thread_pool.map((0..100).collect(), |v: u32| v + offset);
+        assert_eq!(results, (10..110).collect::<Vec<_>>());
+        let nested = thread_pool.map(vec![1, 2, 3], |v: u32| {
+            thread_pool.map(vec![v, v], |v| v * 2).iter().sum::<u32>()
+        });
+        assert_eq!(nested, [4, 8, 12]);
+    }
+
+    #[test]
+    fn test_for_each_index() {
+        let thread_pool = ThreadPool::new(3, "test");
+        let counts: Vec<_> = (0..1000).map(|_| AtomicUsize::new(0)).collect();
+        let state_count = AtomicUsize::new(0);
+        thread_pool.for_each_index(
+            counts.len(),
+            || state_count.fetch_add(1, Ordering::Relaxed),
+            |_, index| {
+                // uneven work, so threads finish their ranges at different times
+                if index < 10 {
+                    thread::sleep(::std::time::Duration::from_millis(10));
+                }
+                counts[index].fetch_add(1, Ordering::Relaxed);
+            },
+        );
+        assert!(counts.iter().all(|v| v.load(Ordering::Relaxed) == 1));
+        assert!(state_count.load(Ordering::Relaxed) <= 4);
+    }
+}
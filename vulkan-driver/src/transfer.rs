@@ -0,0 +1,1007 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright 2018 Jacob Lifshay
+
+// Kernels for the transfer commands.
+// Large copies and fills are split into chunks that run in parallel on the thread pool, and they
+// use non-temporal stores because the destination wouldn't fit in the cache anyway. The vector
+// width is picked at runtime from the CPU's features. Smaller copies use
+// `ptr::copy_nonoverlapping`, since `memcpy` is already tuned for the host.
+// Image copies and blits are split into bands of whole tile rows, and convert between linear and
+// tiled layouts (and between formats) in the same pass that moves the texels.
+
+use api;
+use buffer::Buffer;
+use image::{Image, SubresourceLayout, Tiling, TILE_SIZE};
+use shader_compiler_backend::intrinsics::{
+    f16_to_f32, f32_to_f16, f32_to_unorm8, linear_f32_to_srgb8, srgb8_to_linear_f32, unorm8_to_f32,
+};
+use std::cmp;
+use std::ptr;
+use thread_pool::ThreadPool;
+
+/// copies and fills at least this big use non-temporal stores
+const NON_TEMPORAL_THRESHOLD: usize = 1 << 20;
+
+/// large copies and fills are split into chunks of about this size
+const PARALLEL_CHUNK_SIZE: usize = 1 << 20;
+
+/// transfers smaller than this stay on the queue thread, where waking other threads would take
+/// longer than the transfer itself
+pub const PARALLEL_THRESHOLD: usize = 4 << 20;
+
+/// the alignment used by the vector kernels
+const VECTOR_SIZE: usize = 32;
+
+/// raw pointers aren't `Sync`, but every chunk of a transfer accesses different bytes
+#[derive(Copy, Clone)]
+pub struct SharedPointer(pub *mut u8);
+
+unsafe impl Send for SharedPointer {}
+unsafe impl Sync for SharedPointer {}
+
+#[cfg(target_arch = "x86_64")]
+mod x86_64 {
+    use std::arch::x86_64::*;
+
+    /// `dst` must be aligned to 32 bytes and `len` must be a multiple of 32
+    #[target_feature(enable = "avx")]
+    pub unsafe fn copy_non_temporal_avx(dst: *mut u8, src: *const u8, len: usize) {
+        for offset in (0..len).step_by(32) {
+            let v = _mm256_loadu_si256(src.add(offset) as *const __m256i);
+            _mm256_stream_si256(dst.add(offset) as *mut __m256i, v);
+        }
+    }
+
+    /// SSE2 is always available on x86_64.
+    /// `dst` must be aligned to 32 bytes and `len` must be a multiple of 32
+    pub unsafe fn copy_non_temporal_sse2(dst: *mut u8, src: *const u8, len: usize) {
+        for offset in (0..len).step_by(16) {
+            let v = _mm_loadu_si128(src.add(offset) as *const __m128i);
+            _mm_stream_si128(dst.add(offset) as *mut __m128i, v);
+        }
+    }
+
+    /// `dst` must be aligned to 32 bytes and `len` must be a multiple of 32
+    #[target_feature(enable = "avx")]
+    pub unsafe fn fill_avx(dst: *mut u8, len: usize, pattern: &[u8; 32], non_temporal: bool) {
+        let v = _mm256_loadu_si256(pattern.as_ptr() as *const __m256i);
+        if non_temporal {
+            for offset in (0..len).step_by(32) {
+                _mm256_stream_si256(dst.add(offset) as *mut __m256i, v);
+            }
+        } else {
+            for offset in (0..len).step_by(32) {
+                _mm256_store_si256(dst.add(offset) as *mut __m256i, v);
+            }
+        }
+    }
+
+    /// `dst` must be aligned to 32 bytes and `len` must be a multiple of 32
+    pub unsafe fn fill_sse2(dst: *mut u8, len: usize, pattern: &[u8; 32], non_temporal: bool) {
+        let low = _mm_loadu_si128(pattern.as_ptr() as *const __m128i);
+        let high = _mm_loadu_si128(pattern.as_ptr().add(16) as *const __m128i);
+        for offset in (0..len).step_by(32) {
+            let dst = dst.add(offset) as *mut __m128i;
+            if non_temporal {
+                _mm_stream_si128(dst, low);
+                _mm_stream_si128(dst.add(1), high);
+            } else {
+                _mm_store_si128(dst, low);
+                _mm_store_si128(dst.add(1), high);
+            }
+        }
+    }
+
+    /// non-temporal stores are weakly ordered, so they need a fence before other threads can
+    /// be told they're finished
+    pub unsafe fn store_fence() {
+        _mm_sfence();
+    }
+}
+
+unsafe fn copy_memory_impl(dst: *mut u8, src: *const u8, len: usize, non_temporal: bool) {
+    #[cfg(target_arch = "x86_64")]
+    {
+        if non_temporal {
+            let head = cmp::min(dst.align_offset(VECTOR_SIZE), len);
+            let body = (len - head) / VECTOR_SIZE * VECTOR_SIZE;
+            ptr::copy_nonoverlapping(src, dst, head);
+            if is_x86_feature_detected!("avx") {
+                x86_64::copy_non_temporal_avx(dst.add(head), src.add(head), body);
+            } else {
+                x86_64::copy_non_temporal_sse2(dst.add(head), src.add(head), body);
+            }
+            x86_64::store_fence();
+            let tail = head + body;
+            ptr::copy_nonoverlapping(src.add(tail), dst.add(tail), len - tail);
+            return;
+        }
+    }
+    let _ = non_temporal;
+    ptr::copy_nonoverlapping(src, dst, len);
+}
+
+/// `dst` and `src` must not overlap
+pub unsafe fn copy_memory(dst: *mut u8, src: *const u8, len: usize) {
+    copy_memory_impl(dst, src, len, len >= NON_TEMPORAL_THRESHOLD)
+}
+
+/// like `copy_memory`, except large copies are split across `thread_pool`
+pub unsafe fn parallel_copy_memory(
+    thread_pool: &ThreadPool,
+    dst: *mut u8,
+    src: *const u8,
+    len: usize,
+) {
+    if len < PARALLEL_THRESHOLD {
+        return copy_memory(dst, src, len);
+    }
+    let dst = SharedPointer(dst);
+    let src = SharedPointer(src as *mut u8);
+    let chunk_count = (len + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE;
+    thread_pool.for_each_index(
+        chunk_count,
+        || (),
+        |_, chunk| {
+            let start = chunk * PARALLEL_CHUNK_SIZE;
+            let size = cmp::min(PARALLEL_CHUNK_SIZE, len - start);
+            copy_memory_impl(dst.0.add(start), src.0.add(start), size, true);
+        },
+    );
+}
+
+/// copies a run of texel blocks. runs in tiled images are only 1 or 2 blocks, so the common
+/// run sizes are copied with fixed-size moves instead of calling `memcpy`
+#[inline]
+pub unsafe fn copy_run(dst: *mut u8, src: *const u8, len: usize) {
+    unsafe fn copy_fixed<T: Copy>(dst: *mut u8, src: *const u8) {
+        ptr::write_unaligned(dst as *mut T, ptr::read_unaligned(src as *const T));
+    }
+    match len {
+        1 => copy_fixed::<u8>(dst, src),
+        2 => copy_fixed::<u16>(dst, src),
+        4 => copy_fixed::<u32>(dst, src),
+        8 => copy_fixed::<u64>(dst, src),
+        16 => copy_fixed::<[u64; 2]>(dst, src),
+        32 => copy_fixed::<[u64; 4]>(dst, src),
+        64 => copy_fixed::<[u64; 8]>(dst, src),
+        _ => copy_memory(dst, src, len),
+    }
+}
+
+unsafe fn fill_memory_impl(dst: *mut u8, len: usize, pattern: &[u8], non_temporal: bool) {
+    let pattern_size = pattern.len();
+    debug_assert_eq!(len % pattern_size, 0);
+    if VECTOR_SIZE % pattern_size != 0 {
+        // 3, 6, 12 and 24 byte texel blocks don't fit evenly in a vector
+        for offset in (0..len).step_by(pattern_size) {
+            ptr::copy_nonoverlapping(pattern.as_ptr(), dst.add(offset), pattern_size);
+        }
+        return;
+    }
+    let head = cmp::min(dst.align_offset(VECTOR_SIZE), len);
+    let body = (len - head) / VECTOR_SIZE * VECTOR_SIZE;
+    for offset in (0..head).chain(head + body..len) {
+        *dst.add(offset) = pattern[offset % pattern_size];
+    }
+    // the pattern rotated to start at the first aligned byte
+    let mut vector = [0; VECTOR_SIZE];
+    for (index, v) in vector.iter_mut().enumerate() {
+        *v = pattern[(head + index) % pattern_size];
+    }
+    let dst = dst.add(head);
+    #[cfg(target_arch = "x86_64")]
+    {
+        if is_x86_feature_detected!("avx") {
+            x86_64::fill_avx(dst, body, &vector, non_temporal);
+        } else {
+            x86_64::fill_sse2(dst, body, &vector, non_temporal);
+        }
+        if non_temporal {
+            x86_64::store_fence();
+        }
+    }
+    #[cfg(not(target_arch = "x86_64"))]
+    {
+        let _ = non_temporal;
+        for offset in (0..body).step_by(VECTOR_SIZE) {
+            ptr::write(dst.add(offset) as *mut [u8; VECTOR_SIZE], vector);
+        }
+    }
+}
+
+/// fills `len` bytes at `dst` with copies of `pattern`.
+/// `len` must be a multiple of `pattern.len()`
+pub unsafe fn fill_memory(dst: *mut u8, len: usize, pattern: &[u8]) {
+    fill_memory_impl(dst, len, pattern, len >= NON_TEMPORAL_THRESHOLD)
+}
+
+/// like `fill_memory`, except large fills are split across `thread_pool`
+pub unsafe fn parallel_fill_memory(
+    thread_pool: &ThreadPool,
+    dst: *mut u8,
+    len: usize,
+    pattern: &[u8],
+) {
+    if len < PARALLEL_THRESHOLD {
+        return fill_memory(dst, len, pattern);
+    }
+    // chunks start at multiples of the pattern size, so each starts at the start of the pattern
+    let chunk_size = PARALLEL_CHUNK_SIZE / pattern.len() * pattern.len();
+    let dst = SharedPointer(dst);
+    let chunk_count = (len + chunk_size - 1) / chunk_size;
+    thread_pool.for_each_index(
+        chunk_count,
+        || (),
+        |_, chunk| {
+            let start = chunk * chunk_size;
+            let size = cmp::min(chunk_size, len - start);
+            fill_memory_impl(dst.0.add(start), size, pattern, true);
+        },
+    );
+}
+
+pub unsafe fn copy_buffer(
+    thread_pool: &ThreadPool,
+    src_buffer: &Buffer,
+    dst_buffer: &Buffer,
+    region: &api::VkBufferCopy,
+) {
+    let size = region.size as usize;
+    assert!(region.srcOffset as usize + size <= src_buffer.size);
+    assert!(region.dstOffset as usize + size <= dst_buffer.size);
+    parallel_copy_memory(
+        thread_pool,
+        dst_buffer.get_memory().add(region.dstOffset as usize),
+        src_buffer.get_memory().add(region.srcOffset as usize),
+        size,
+    );
+}
+
+pub unsafe fn fill_buffer(
+    thread_pool: &ThreadPool,
+    dst_buffer: &Buffer,
+    dst_offset: api::VkDeviceSize,
+    size: api::VkDeviceSize,
+    data: u32,
+) {
+    let dst_offset = dst_offset as usize;
+    assert!(dst_offset <= dst_buffer.size);
+    // VK_WHOLE_SIZE
+    let size = if size == !0 {
+        (dst_buffer.size - dst_offset) & !3
+    } else {
+        size as usize
+    };
+    assert!(dst_offset + size <= dst_buffer.size);
+    assert_eq!(dst_offset % 4, 0);
+    assert_eq!(size % 4, 0);
+    parallel_fill_memory(
+        thread_pool,
+        dst_buffer.get_memory().add(dst_offset),
+        size,
+        &data.to_ne_bytes(),
+    );
+}
+
+/// `f` is called with the offset and extent of bands of the region at `offset` with `extent`.
+/// bands are whole rows of tiles, or the same number of rows of texels for linear images, in one
+/// depth slice, so no texel block is in more than one band.
+/// the bands run in parallel on `thread_pool` if the region is big enough
+pub fn for_each_band<F: Fn(api::VkOffset3D, api::VkExtent3D) + Sync>(
+    thread_pool: &ThreadPool,
+    layout: &SubresourceLayout,
+    offset: api::VkOffset3D,
+    extent: api::VkExtent3D,
+    f: F,
+) {
+    let (_, _, width_in_blocks, height_in_blocks) = layout.get_block_region(offset, extent);
+    let size = width_in_blocks as usize
+        * height_in_blocks as usize
+        * extent.depth as usize
+        * layout.block.size_in_bytes;
+    if size < PARALLEL_THRESHOLD {
+        if size != 0 {
+            f(offset, extent);
+        }
+        return;
+    }
+    let band_height = TILE_SIZE * layout.block.height;
+    let start_y = offset.y as u32;
+    let end_y = start_y + extent.height;
+    let first_band = start_y / band_height;
+    let bands_per_slice = (end_y + band_height - 1) / band_height - first_band;
+    thread_pool.for_each_index(
+        bands_per_slice as usize * extent.depth as usize,
+        || (),
+        |_, index| {
+            let z = index as u32 / bands_per_slice;
+            let band = first_band + index as u32 % bands_per_slice;
+            let band_start_y = cmp::max(band * band_height, start_y);
+            let band_end_y = cmp::min((band + 1) * band_height, end_y);
+            f(
+                api::VkOffset3D {
+                    x: offset.x,
+                    y: band_start_y as i32,
+                    z: offset.z + z as i32,
+                },
+                api::VkExtent3D {
+                    width: extent.width,
+                    height: band_end_y - band_start_y,
+                    depth: 1,
+                },
+            );
+        },
+    );
+}
+
+pub fn is_combined_depth_stencil(format: api::VkFormat) -> bool {
+    match format {
+        api::VK_FORMAT_D16_UNORM_S8_UINT
+        | api::VK_FORMAT_D24_UNORM_S8_UINT
+        | api::VK_FORMAT_D32_SFLOAT_S8_UINT => true,
+        _ => false,
+    }
+}
+
+#[derive(Copy, Clone, Eq, PartialEq, Debug)]
+enum CopyDirection {
+    BufferToImage,
+    ImageToBuffer,
+}
+
+unsafe fn copy_buffer_image(
+    thread_pool: &ThreadPool,
+    buffer: &Buffer,
+    image: &Image,
+    region: &api::VkBufferImageCopy,
+    direction: CopyDirection,
+) {
+    if is_combined_depth_stencil(image.properties.format) {
+        // FIXME: the buffer has only one of the aspects, tightly packed
+        unimplemented!(
+            "copies between buffers and {:?} images",
+            image.properties.format
+        );
+    }
+    let computed_properties = image.properties.computed_properties();
+    let block = computed_properties.block;
+    let row_length = match region.bufferRowLength {
+        0 => region.imageExtent.width,
+        row_length => row_length,
+    };
+    let image_height = match region.bufferImageHeight {
+        0 => region.imageExtent.height,
+        image_height => image_height,
+    };
+    let row_pitch = ((row_length + block.width - 1) / block.width) as usize * block.size_in_bytes;
+    let depth_pitch = ((image_height + block.height - 1) / block.height) as usize * row_pitch;
+    let layer_pitch = depth_pitch * region.imageExtent.depth as usize;
+    let image_memory = SharedPointer(image.get_memory());
+    let subresource = &region.imageSubresource;
+    for layer in 0..subresource.layerCount {
+        let layout = computed_properties
+            .get_subresource_layout(subresource.mipLevel, subresource.baseArrayLayer + layer);
+        let buffer_offset = region.bufferOffset as usize + layer as usize * layer_pitch;
+        assert!(
+            buffer_offset + layout.get_linear_size(region.imageExtent, row_pitch, depth_pitch)
+                <= buffer.size
+        );
+        let linear = SharedPointer(buffer.get_memory().add(buffer_offset));
+        for_each_band(
+            thread_pool,
+            &layout,
+            region.imageOffset,
+            region.imageExtent,
+            |offset, extent| {
+                let linear = linear.0.add(
+                    (offset.z - region.imageOffset.z) as usize * depth_pitch
+                        + ((offset.y - region.imageOffset.y) as u32 / block.height) as usize
+                            * row_pitch,
+                );
+                match direction {
+                    CopyDirection::BufferToImage => layout.copy_from_linear(
+                        image_memory.0,
+                        linear,
+                        row_pitch,
+                        depth_pitch,
+                        offset,
+                        extent,
+                    ),
+                    CopyDirection::ImageToBuffer => layout.copy_to_linear(
+                        image_memory.0,
+                        linear,
+                        row_pitch,
+                        depth_pitch,
+                        offset,
+                        extent,
+                    ),
+                }
+            },
+        );
+    }
+}
+
+pub unsafe fn copy_buffer_to_image(
+    thread_pool: &ThreadPool,
+    src_buffer: &Buffer,
+    dst_image: &Image,
+    region: &api::VkBufferImageCopy,
+) {
+    copy_buffer_image(
+        thread_pool,
+        src_buffer,
+        dst_image,
+        region,
+        CopyDirection::BufferToImage,
+    )
+}
+
+pub unsafe fn copy_image_to_buffer(
+    thread_pool: &ThreadPool,
+    src_image: &Image,
+    dst_buffer: &Buffer,
+    region: &api::VkBufferImageCopy,
+) {
+    copy_buffer_image(
+        thread_pool,
+        dst_buffer,
+        src_image,
+        region,
+        CopyDirection::ImageToBuffer,
+    )
+}
+
+fn offset_difference(a: api::VkOffset3D, b: api::VkOffset3D) -> api::VkOffset3D {
+    api::VkOffset3D {
+        x: a.x - b.x,
+        y: a.y - b.y,
+        z: a.z - b.z,
+    }
+}
+
+fn offset_sum(a: api::VkOffset3D, b: api::VkOffset3D) -> api::VkOffset3D {
+    api::VkOffset3D {
+        x: a.x + b.x,
+        y: a.y + b.y,
+        z: a.z + b.z,
+    }
+}
+
+/// copies whole texel blocks between two subresources with the same block size
+unsafe fn copy_blocks(
+    src_layout: &SubresourceLayout,
+    src_memory: *const u8,
+    src_offset: api::VkOffset3D,
+    dst_layout: &SubresourceLayout,
+    dst_memory: *mut u8,
+    dst_offset: api::VkOffset3D,
+    extent: api::VkExtent3D,
+) {
+    let (src_x, src_y, width_in_blocks, height_in_blocks) =
+        src_layout.get_block_region(src_offset, extent);
+    let (dst_x, dst_y, _, _) = dst_layout.get_block_region(dst_offset, extent);
+    let block_size = dst_layout.block.size_in_bytes;
+    let rows_are_contiguous =
+        src_layout.tiling == Tiling::Linear && dst_layout.tiling == Tiling::Linear;
+    for z in 0..extent.depth {
+        let src_z = src_offset.z as u32 + z;
+        let dst_z = dst_offset.z as u32 + z;
+        for y in 0..height_in_blocks {
+            if rows_are_contiguous {
+                copy_run(
+                    dst_memory.add(dst_layout.get_block_offset(dst_x, dst_y + y, dst_z)),
+                    src_memory.add(src_layout.get_block_offset(src_x, src_y + y, src_z)),
+                    width_in_blocks as usize * block_size,
+                );
+                continue;
+            }
+            for x in 0..width_in_blocks {
+                copy_run(
+                    dst_memory.add(dst_layout.get_block_offset(dst_x + x, dst_y + y, dst_z)),
+                    src_memory.add(src_layout.get_block_offset(src_x + x, src_y + y, src_z)),
+                    block_size,
+                );
+            }
+        }
+    }
+}
+
+pub unsafe fn copy_image(
+    thread_pool: &ThreadPool,
+    src_image: &Image,
+    dst_image: &Image,
+    region: &api::VkImageCopy,
+) {
+    let src_properties = src_image.properties.computed_properties();
+    let dst_properties = dst_image.properties.computed_properties();
+    // FIXME: handle copies between compressed and uncompressed formats, whose extents differ
+    assert_eq!(src_properties.block, dst_properties.block);
+    // FIXME: handle copies between 3D images and layers of 2D images
+    assert_eq!(
+        region.srcSubresource.layerCount,
+        region.dstSubresource.layerCount
+    );
+    let src_memory = SharedPointer(src_image.get_memory());
+    let dst_memory = SharedPointer(dst_image.get_memory());
+    for layer in 0..region.dstSubresource.layerCount {
+        let src_layout = src_properties.get_subresource_layout(
+            region.srcSubresource.mipLevel,
+            region.srcSubresource.baseArrayLayer + layer,
+        );
+        let dst_layout = dst_properties.get_subresource_layout(
+            region.dstSubresource.mipLevel,
+            region.dstSubresource.baseArrayLayer + layer,
+        );
+        for_each_band(
+            thread_pool,
+            &dst_layout,
+            region.dstOffset,
+            region.extent,
+            |dst_offset, extent| {
+                copy_blocks(
+                    &src_layout,
+                    src_memory.0,
+                    offset_sum(
+                        region.srcOffset,
+                        offset_difference(dst_offset, region.dstOffset),
+                    ),
+                    &dst_layout,
+                    dst_memory.0,
+                    dst_offset,
+                    extent,
+                )
+            },
+        );
+    }
+}
+
+/// how a format's channels are encoded
+#[derive(Copy, Clone, Eq, PartialEq, Debug)]
+enum ChannelType {
+    Unorm8,
+    Snorm8,
+    /// the alpha channel is `Unorm8`
+    Srgb8,
+    Uint8,
+    Sint8,
+    Unorm16,
+    Snorm16,
+    Uint16,
+    Sint16,
+    Float16,
+    Uint32,
+    Sint32,
+    Float32,
+}
+
+const R: &[usize] = &[0];
+const RG: &[usize] = &[0, 1];
+const RGB: &[usize] = &[0, 1, 2];
+const RGBA: &[usize] = &[0, 1, 2, 3];
+const BGRA: &[usize] = &[2, 1, 0, 3];
+
+/// a color value as the bits of a `VkClearColorValue`:
+/// `f32` bits for floating-point and normalized formats, and integers for integer formats
+pub type TexelValue = [u32; 4];
+
+/// the uncompressed color formats that can be blitted and cleared
+#[derive(Copy, Clone, Debug)]
+pub struct TexelFormat {
+    channel_type: ChannelType,
+    /// the component stored in each channel, in memory order
+    components: &'static [usize],
+}
+
+impl TexelFormat {
+    pub fn get(format: api::VkFormat) -> Option<Self> {
+        let (channel_type, components) = match format {
+            api::VK_FORMAT_R8_UNORM => (ChannelType::Unorm8, R),
+            api::VK_FORMAT_R8G8_UNORM => (ChannelType::Unorm8, RG),
+            api::VK_FORMAT_R8G8B8A8_UNORM | api::VK_FORMAT_A8B8G8R8_UNORM_PACK32 => {
+                (ChannelType::Unorm8, RGBA)
+            }
+            api::VK_FORMAT_B8G8R8A8_UNORM => (ChannelType::Unorm8, BGRA),
+            api::VK_FORMAT_R8_SNORM => (ChannelType::Snorm8, R),
+            api::VK_FORMAT_R8G8_SNORM => (ChannelType::Snorm8, RG),
+            api::VK_FORMAT_R8G8B8A8_SNORM | api::VK_FORMAT_A8B8G8R8_SNORM_PACK32 => {
+                (ChannelType::Snorm8, RGBA)
+            }
+            api::VK_FORMAT_B8G8R8A8_SNORM => (ChannelType::Snorm8, BGRA),
+            api::VK_FORMAT_R8_SRGB => (ChannelType::Srgb8, R),
+            api::VK_FORMAT_R8G8_SRGB => (ChannelType::Srgb8, RG),
+            api::VK_FORMAT_R8G8B8A8_SRGB | api::VK_FORMAT_A8B8G8R8_SRGB_PACK32 => {
+                (ChannelType::Srgb8, RGBA)
+            }
+            api::VK_FORMAT_B8G8R8A8_SRGB => (ChannelType::Srgb8, BGRA),
+            api::VK_FORMAT_R8_UINT => (ChannelType::Uint8, R),
+            api::VK_FORMAT_R8G8_UINT => (ChannelType::Uint8, RG),
+            api::VK_FORMAT_R8G8B8A8_UINT | api::VK_FORMAT_A8B8G8R8_UINT_PACK32 => {
+                (ChannelType::Uint8, RGBA)
+            }
+            api::VK_FORMAT_B8G8R8A8_UINT => (ChannelType::Uint8, BGRA),
+            api::VK_FORMAT_R8_SINT => (ChannelType::Sint8, R),
+            api::VK_FORMAT_R8G8_SINT => (ChannelType::Sint8, RG),
+            api::VK_FORMAT_R8G8B8A8_SINT | api::VK_FORMAT_A8B8G8R8_SINT_PACK32 => {
+                (ChannelType::Sint8, RGBA)
+            }
+            api::VK_FORMAT_B8G8R8A8_SINT => (ChannelType::Sint8, BGRA),
+            api::VK_FORMAT_R16_UNORM => (ChannelType::Unorm16, R),
+            api::VK_FORMAT_R16G16_UNORM => (ChannelType::Unorm16, RG),
+            api::VK_FORMAT_R16G16B16A16_UNORM => (ChannelType::Unorm16, RGBA),
+            api::VK_FORMAT_R16_SNORM => (ChannelType::Snorm16, R),
+            api::VK_FORMAT_R16G16_SNORM => (ChannelType::Snorm16, RG),
+            api::VK_FORMAT_R16G16B16A16_SNORM => (ChannelType::Snorm16, RGBA),
+            api::VK_FORMAT_R16_UINT => (ChannelType::Uint16, R),
+            api::VK_FORMAT_R16G16_UINT => (ChannelType::Uint16, RG),
+            api::VK_FORMAT_R16G16B16A16_UINT => (ChannelType::Uint16, RGBA),
+            api::VK_FORMAT_R16_SINT => (ChannelType::Sint16, R),
+            api::VK_FORMAT_R16G16_SINT => (ChannelType::Sint16, RG),
+            api::VK_FORMAT_R16G16B16A16_SINT => (ChannelType::Sint16, RGBA),
+            api::VK_FORMAT_R16_SFLOAT => (ChannelType::Float16, R),
+            api::VK_FORMAT_R16G16_SFLOAT => (ChannelType::Float16, RG),
+            api::VK_FORMAT_R16G16B16A16_SFLOAT => (ChannelType::Float16, RGBA),
+            api::VK_FORMAT_R32_UINT => (ChannelType::Uint32, R),
+            api::VK_FORMAT_R32G32_UINT => (ChannelType::Uint32, RG),
+            api::VK_FORMAT_R32G32B32_UINT => (ChannelType::Uint32, RGB),
+            api::VK_FORMAT_R32G32B32A32_UINT => (ChannelType::Uint32, RGBA),
+            api::VK_FORMAT_R32_SINT => (ChannelType::Sint32, R),
+            api::VK_FORMAT_R32G32_SINT => (ChannelType::Sint32, RG),
+            api::VK_FORMAT_R32G32B32_SINT => (ChannelType::Sint32, RGB),
+            api::VK_FORMAT_R32G32B32A32_SINT => (ChannelType::Sint32, RGBA),
+            api::VK_FORMAT_R32_SFLOAT => (ChannelType::Float32, R),
+            api::VK_FORMAT_R32G32_SFLOAT => (ChannelType::Float32, RG),
+            api::VK_FORMAT_R32G32B32_SFLOAT => (ChannelType::Float32, RGB),
+            api::VK_FORMAT_R32G32B32A32_SFLOAT => (ChannelType::Float32, RGBA),
+            _ => return None,
+        };
+        Some(TexelFormat {
+            channel_type,
+            components,
+        })
+    }
+    fn is_integer(self) -> bool {
+        match self.channel_type {
+            ChannelType::Uint8
+            | ChannelType::Sint8
+            | ChannelType::Uint16
+            | ChannelType::Sint16
+            | ChannelType::Uint32
+            | ChannelType::Sint32 => true,
+            ChannelType::Unorm8
+            | ChannelType::Snorm8
+            | ChannelType::Srgb8
+            | ChannelType::Unorm16
+            | ChannelType::Snorm16
+            | ChannelType::Float16
+            | ChannelType::Float32 => false,
+        }
+    }
+    /// the value of the components not stored in the format: 0, except alpha, which is 1
+    pub fn get_default_value(self) -> TexelValue {
+        let one = if self.is_integer() {
+            1
+        } else {
+            1.0f32.to_bits()
+        };
+        [0, 0, 0, one]
+    }
+    /// the number of components if they're 32 bits each and stored in order, so decoding a
+    /// texel only copies its words
+    pub fn get_word_count(self) -> Option<usize> {
+        match self.channel_type {
+            ChannelType::Uint32 | ChannelType::Sint32 | ChannelType::Float32 => {
+                Some(self.components.len())
+            }
+            _ => None,
+        }
+    }
+    /// missing components have their default value
+    pub unsafe fn decode(self, texel: *const u8) -> TexelValue {
+        let mut retval = self.get_default_value();
+        for (channel, &component) in self.components.iter().enumerate() {
+            let read_u8 = || *texel.add(channel);
+            let read_u16 = || ptr::read_unaligned((texel as *const u16).add(channel));
+            let read_u32 = || ptr::read_unaligned((texel as *const u32).add(channel));
+            retval[component] = match self.channel_type {
+                ChannelType::Unorm8 => unorm8_to_f32(read_u8()).to_bits(),
+                ChannelType::Snorm8 => (f32::from(read_u8() as i8) * (1.0 / 127.0))
+                    .max(-1.0)
+                    .to_bits(),
+                ChannelType::Srgb8 if component == 3 => unorm8_to_f32(read_u8()).to_bits(),
+                ChannelType::Srgb8 => srgb8_to_linear_f32(read_u8()).to_bits(),
+                ChannelType::Uint8 => u32::from(read_u8()),
+                ChannelType::Sint8 => read_u8() as i8 as u32,
+                ChannelType::Unorm16 => (f32::from(read_u16()) * (1.0 / 65535.0)).to_bits(),
+                ChannelType::Snorm16 => (f32::from(read_u16() as i16) * (1.0 / 32767.0))
+                    .max(-1.0)
+                    .to_bits(),
+                ChannelType::Uint16 => u32::from(read_u16()),
+                ChannelType::Sint16 => read_u16() as i16 as u32,
+                ChannelType::Float16 => f16_to_f32(read_u16()).to_bits(),
+                ChannelType::Uint32 | ChannelType::Sint32 | ChannelType::Float32 => read_u32(),
+            };
+        }
+        retval
+    }
+    /// integers that don't fit are truncated
+    pub unsafe fn encode(self, value: TexelValue, texel: *mut u8) {
+        for (channel, &component) in self.components.iter().enumerate() {
+            let value = value[component];
+            let float_value = f32::from_bits(value);
+            let write_u8 = |v: u8| *texel.add(channel) = v;
+            let write_u16 = |v: u16| ptr::write_unaligned((texel as *mut u16).add(channel), v);
+            match self.channel_type {
+                ChannelType::Unorm8 => write_u8(f32_to_unorm8(float_value)),
+                ChannelType::Srgb8 if component == 3 => write_u8(f32_to_unorm8(float_value)),
+                ChannelType::Srgb8 => write_u8(linear_f32_to_srgb8(float_value)),
+                ChannelType::Snorm8 => write_u8(f32_to_snorm(float_value, 127.0) as i8 as u8),
+                ChannelType::Uint8 | ChannelType::Sint8 => write_u8(value as u8),
+                ChannelType::Unorm16 => {
+                    // `max` returns 0 for NaN
+                    write_u16((float_value.max(0.0).min(1.0) * 65535.0 + 0.5) as u16)
+                }
+                ChannelType::Snorm16 => write_u16(f32_to_snorm(float_value, 32767.0) as i16 as u16),
+                ChannelType::Uint16 | ChannelType::Sint16 => write_u16(value as u16),
+                ChannelType::Float16 => write_u16(f32_to_f16(float_value)),
+                ChannelType::Uint32 | ChannelType::Sint32 | ChannelType::Float32 => {
+                    ptr::write_unaligned((texel as *mut u32).add(channel), value)
+                }
+            }
+        }
+    }
+}
+
+/// `max_value` is the largest integer value
+fn f32_to_snorm(value: f32, max_value: f32) -> i32 {
+    if value.is_nan() {
+        0
+    } else {
+        (value.max(-1.0).min(1.0) * max_value).round() as i32
+    }
+}
+
+fn lerp_texels(a: TexelValue, b: TexelValue, t: f32) -> TexelValue {
+    let mut retval = a;
+    for (v, &b) in retval.iter_mut().zip(b.iter()) {
+        let a = f32::from_bits(*v);
+        *v = (a + (f32::from_bits(b) - a) * t).to_bits();
+    }
+    retval
+}
+
+/// maps destination texel coordinates along one axis to source texel coordinates, where
+/// `src` and `dst` are the blit region's offsets, which are reversed for mirrored blits
+#[derive(Copy, Clone)]
+struct BlitAxis {
+    scale: f32,
+    bias: f32,
+    /// the size of the source subresource
+    src_size: u32,
+}
+
+impl BlitAxis {
+    fn new(src: [i32; 2], dst: [i32; 2], src_size: u32) -> Self {
+        let scale = (src[1] - src[0]) as f32 / (dst[1] - dst[0]) as f32;
+        BlitAxis {
+            scale,
+            bias: src[0] as f32 - dst[0] as f32 * scale,
+            src_size,
+        }
+    }
+    /// the source coordinate of the center of the destination texel
+    fn map(self, dst: i32) -> f32 {
+        (dst as f32 + 0.5) * self.scale + self.bias
+    }
+    fn clamp(self, v: i32) -> u32 {
+        cmp::max(cmp::min(v, self.src_size as i32 - 1), 0) as u32
+    }
+    fn nearest(self, dst: i32) -> u32 {
+        self.clamp(self.map(dst).floor() as i32)
+    }
+    /// the two texels to interpolate between and the weight of the second
+    fn linear(self, dst: i32) -> (u32, u32, f32) {
+        let v = self.map(dst) - 0.5;
+        let floor = v.floor();
+        (
+            self.clamp(floor as i32),
+            self.clamp(floor as i32 + 1),
+            v - floor,
+        )
+    }
+}
+
+pub unsafe fn blit_image(
+    thread_pool: &ThreadPool,
+    src_image: &Image,
+    dst_image: &Image,
+    region: &api::VkImageBlit,
+    filter: api::VkFilter,
+) {
+    let src_properties = src_image.properties.computed_properties();
+    let dst_properties = dst_image.properties.computed_properties();
+    let src_offsets = region.srcOffsets;
+    let dst_offsets = region.dstOffsets;
+    let get_box = |offsets: [api::VkOffset3D; 2]| {
+        (
+            api::VkOffset3D {
+                x: cmp::min(offsets[0].x, offsets[1].x),
+                y: cmp::min(offsets[0].y, offsets[1].y),
+                z: cmp::min(offsets[0].z, offsets[1].z),
+            },
+            api::VkExtent3D {
+                width: (offsets[1].x - offsets[0].x).abs() as u32,
+                height: (offsets[1].y - offsets[0].y).abs() as u32,
+                depth: (offsets[1].z - offsets[0].z).abs() as u32,
+            },
+        )
+    };
+    let (dst_offset, dst_extent) = get_box(dst_offsets);
+    let src_size = offset_difference(src_offsets[1], src_offsets[0]);
+    let dst_size = offset_difference(dst_offsets[1], dst_offsets[0]);
+    let unscaled = (src_size.x, src_size.y, src_size.z) == (dst_size.x, dst_size.y, dst_size.z);
+    if unscaled && src_image.properties.format == dst_image.properties.format {
+        // same as vkCmdCopyImage
+        let (src_offset, _) = get_box(src_offsets);
+        return copy_image(
+            thread_pool,
+            src_image,
+            dst_image,
+            &api::VkImageCopy {
+                srcSubresource: region.srcSubresource,
+                srcOffset: src_offset,
+                dstSubresource: region.dstSubresource,
+                dstOffset: dst_offset,
+                extent: dst_extent,
+            },
+        );
+    }
+    let get_format = |image: &Image| {
+        TexelFormat::get(image.properties.format)
+            .unwrap_or_else(|| unimplemented!("vkCmdBlitImage with {:?}", image.properties.format))
+    };
+    let src_format = get_format(src_image);
+    let dst_format = get_format(dst_image);
+    let linear = match filter {
+        api::VK_FILTER_NEAREST => false,
+        api::VK_FILTER_LINEAR => true,
+        _ => unimplemented!("vkCmdBlitImage with filter {:?}", filter),
+    };
+    // integer formats can only be blitted with nearest filtering, without converting to float
+    assert!(!linear || !src_format.is_integer());
+    assert_eq!(src_format.is_integer(), dst_format.is_integer());
+    let src_memory = SharedPointer(src_image.get_memory());
+    let dst_memory = SharedPointer(dst_image.get_memory());
+    for layer in 0..region.dstSubresource.layerCount {
+        let src_layout = src_properties.get_subresource_layout(
+            region.srcSubresource.mipLevel,
+            region.srcSubresource.baseArrayLayer + layer,
+        );
+        let dst_layout = dst_properties.get_subresource_layout(
+            region.dstSubresource.mipLevel,
+            region.dstSubresource.baseArrayLayer + layer,
+        );
+        let x_axis = BlitAxis::new(
+            [src_offsets[0].x, src_offsets[1].x],
+            [dst_offsets[0].x, dst_offsets[1].x],
+            src_layout.width_in_blocks,
+        );
+        let y_axis = BlitAxis::new(
+            [src_offsets[0].y, src_offsets[1].y],
+            [dst_offsets[0].y, dst_offsets[1].y],
+            src_layout.height_in_blocks,
+        );
+        let z_axis = BlitAxis::new(
+            [src_offsets[0].z, src_offsets[1].z],
+            [dst_offsets[0].z, dst_offsets[1].z],
+            src_layout.depth,
+        );
+        let read = |x: u32, y: u32, z: u32| {
+            src_format.decode(src_memory.0.add(src_layout.get_block_offset(x, y, z)))
+        };
+        for_each_band(
+            thread_pool,
+            &dst_layout,
+            dst_offset,
+            dst_extent,
+            |band_offset, band_extent| {
+                for z in band_offset.z..band_offset.z + band_extent.depth as i32 {
+                    for y in band_offset.y..band_offset.y + band_extent.height as i32 {
+                        for x in band_offset.x..band_offset.x + band_extent.width as i32 {
+                            let value = if linear {
+                                let (x0, x1, tx) = x_axis.linear(x);
+                                let (y0, y1, ty) = y_axis.linear(y);
+                                let (z0, z1, tz) = z_axis.linear(z);
+                                let sample_slice = |z| {
+                                    lerp_texels(
+                                        lerp_texels(read(x0, y0, z), read(x1, y0, z), tx),
+                                        lerp_texels(read(x0, y1, z), read(x1, y1, z), tx),
+                                        ty,
+                                    )
+                                };
+                                if z0 == z1 {
+                                    sample_slice(z0)
+                                } else {
+                                    lerp_texels(sample_slice(z0), sample_slice(z1), tz)
+                                }
+                            } else {
+                                read(x_axis.nearest(x), y_axis.nearest(y), z_axis.nearest(z))
+                            };
+                            dst_format.encode(
+                                value,
+                                dst_memory
+                                    .0
+                                    .add(dst_layout.get_block_offset(x as u32, y as u32, z as u32)),
+                            );
+                        }
+                    }
+                }
+            },
+        );
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_fill_and_copy() {
+        let thread_pool = ThreadPool::new(3, "test");
+        let pattern: Vec<u8> = (1..13).collect();
+        let big_len = PARALLEL_THRESHOLD / 12 * 12 + 36;
+        for &(offset, len, pattern_size) in &[(1, 1200, 12), (5, big_len, 12), (3, big_len, 4)] {
+            let pattern = &pattern[..pattern_size];
+            let mut memory = vec![0u8; offset + len + 1];
+            let mut copy = vec![0u8; memory.len()];
+            unsafe {
+                parallel_fill_memory(&thread_pool, memory.as_mut_ptr().add(offset), len, pattern);
+                parallel_copy_memory(
+                    &thread_pool,
+                    copy.as_mut_ptr(),
+                    memory.as_ptr(),
+                    memory.len(),
+                );
+            }
+            assert_eq!(memory, copy);
+            assert_eq!((memory[0], memory[offset + len]), (0, 0));
+            assert!(memory[offset..offset + len]
+                .iter()
+                .enumerate()
+                .all(|(index, &v)| v == pattern[index % pattern_size]));
+        }
+    }
+
+    #[test]
+    fn test_texel_format() {
+        let format = TexelFormat::get(api::VK_FORMAT_B8G8R8A8_SRGB).unwrap();
+        let mut texel = [0u8; 4];
+        let value = [1.0f32.to_bits(), 0, 0.5f32.to_bits(), 0.5f32.to_bits()];
+        unsafe {
+            format.encode(value, texel.as_mut_ptr());
+            // sRGB doesn't apply to alpha
+            assert_eq!(texel, [188, 0, 255, 128]);
+            let decoded = format.decode(texel.as_ptr());
+            assert_eq!(decoded[0], 1.0f32.to_bits());
+            assert!((f32::from_bits(decoded[2]) - 0.5).abs() < 0.01);
+        }
+        let format = TexelFormat::get(api::VK_FORMAT_R16G16_SINT).unwrap();
+        let mut texel = [0u8; 4];
+        unsafe {
+            format.encode([-2i32 as u32, 3, 0, 0], texel.as_mut_ptr());
+            assert_eq!(format.decode(texel.as_ptr()), [-2i32 as u32, 3, 0, 1]);
+        }
+        let format = TexelFormat::get(api::VK_FORMAT_R8G8_SNORM).unwrap();
+        let mut texel = [0u8; 2];
+        unsafe {
+            format.encode(
+                [(-2.0f32).to_bits(), 0.5f32.to_bits(), 0, 0],
+                texel.as_mut_ptr(),
+            );
+            assert_eq!(texel, [-127i8 as u8, 64]);
+            // both -128 and -127 are -1
+            texel[0] = -128i8 as u8;
+            assert_eq!(format.decode(texel.as_ptr())[0], (-1.0f32).to_bits());
+        }
+    }
+}
@@ -1,22 +1,431 @@
 // SPDX-License-Identifier: LGPL-2.1-or-later
 // Copyright 2018 Jacob Lifshay
+
+// Swapchain images are allocated in SysV shared memory segments attached to the X server with
+// MIT-SHM, so presenting is a `xcb_present_pixmap` or `xcb_copy_area` from a shared pixmap or a
+// `xcb_shm_put_image` that the X server reads straight out of the image's memory.
+// `xcb_put_image` is only used when the X server can't attach our shared memory.
+//
+// Each swapchain has a presentation thread that does all the presenting, so the queue thread
+// only adds the image to a lock-free queue. With the X Present extension, an event thread
+// receives the complete and idle notifications: FIFO and MAILBOX present modes only send the
+// next image after the last one was displayed, and images can be acquired again once the X
+// server is idle. Without it, the presentation thread waits for a round-trip after each image.
+
 use api;
-use handle::Handle;
-use image::{ImageMultisampleCount, ImageProperties, SupportedTilings, Tiling};
+use device_memory::{DeviceMemory, DeviceMemoryAllocation, DeviceMemoryLayout};
+use handle::{Handle, OwnedHandle, SharedHandle};
+use image::{
+    Image, ImageComputedProperties, ImageMemory, ImageMultisampleCount, ImageProperties,
+    SupportedTilings, Tiling,
+};
 use libc;
+use shm::{MappedSharedMemorySegment, SharedMemorySegment};
 use std::borrow::Cow;
+use std::cmp;
+use std::fmt;
 use std::mem;
 use std::ops::{Deref, DerefMut};
 use std::os::raw::c_char;
-use std::ptr::null_mut;
 use std::ptr::NonNull;
-use swapchain::{SurfaceImplementation, SurfacePlatform, Swapchain};
+use std::ptr::{null, null_mut};
+use std::slice;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::Arc;
+use std::thread;
+use swapchain::{
+    AvailableImages, PresentQueue, SurfaceImplementation, SurfacePlatform, Swapchain,
+    MAX_SWAPCHAIN_IMAGE_COUNT,
+};
+use sync::{get_deadline, SyncGroup};
 use xcb;
 
 #[derive(Debug)]
-pub struct XcbSwapchain {}
+struct SharedMemoryDeviceMemory {
+    memory: MappedSharedMemorySegment,
+    layout: DeviceMemoryLayout,
+}
+
+impl DeviceMemoryAllocation for SharedMemoryDeviceMemory {
+    unsafe fn get(&self) -> NonNull<u8> {
+        NonNull::new(self.memory.as_ptr() as *mut u8).unwrap()
+    }
+    fn layout(&self) -> DeviceMemoryLayout {
+        self.layout
+    }
+}
+
+/// the X server side of a swapchain image in shared memory
+struct SharedMemoryImage {
+    /// only when the X server supports shared memory pixmaps
+    pixmap: Option<Pixmap>,
+    shm_seg: ShmSeg,
+    /// the X server keeps its own attachment, so this can be removed after `shm_seg` is detached
+    _segment: SharedMemorySegment,
+}
 
-impl Swapchain for XcbSwapchain {}
+struct SwapchainImage {
+    image: OwnedHandle<api::VkImage>,
+    device_memory: OwnedHandle<api::VkDeviceMemory>,
+}
+
+/// the parts of a swapchain image used for presenting
+struct PresentImage {
+    memory: NonNull<u8>,
+    shared_memory: Option<SharedMemoryImage>,
+}
+
+impl PresentImage {
+    fn get_pixmap(&self) -> Option<xcb::ffi::xcb_pixmap_t> {
+        self.shared_memory
+            .as_ref()?
+            .pixmap
+            .as_ref()
+            .map(|pixmap| pixmap.get())
+    }
+}
+
+/// the special event queue for X Present extension events
+struct PresentEvents {
+    event_id: u32,
+    special_event: NonNull<xcb::ffi::xcb_special_event_t>,
+}
+
+/// sent with `xcb_present_notify_msc` to stop the event thread, never used for pixmaps
+const SHUTDOWN_SERIAL: u32 = 0;
+
+/// shared with the presentation and event threads
+struct PresentState {
+    connection: *mut xcb::ffi::xcb_connection_t,
+    window: xcb::ffi::xcb_window_t,
+    gc: Gc,
+    window_depth: u8,
+    computed_properties: ImageComputedProperties,
+    present_mode: api::VkPresentModeKHR,
+    images: Vec<PresentImage>,
+    /// the maximum size of the data in a `xcb_put_image` request
+    max_put_image_size: usize,
+    /// only when pixmaps are presented with the X Present extension
+    present_events: Option<PresentEvents>,
+    sync_group: Arc<SyncGroup>,
+    available_images: AvailableImages,
+    present_queue: PresentQueue,
+    /// set while the last presented pixmap hasn't been displayed in FIFO and MAILBOX present
+    /// modes, so at most one image is displayed per frame
+    waiting_for_complete: AtomicBool,
+    shutting_down: AtomicBool,
+}
+
+// xcb connections can be used from any thread
+unsafe impl Send for PresentState {}
+unsafe impl Sync for PresentState {}
+
+impl PresentState {
+    /// send the image to the X server, called from the presentation thread
+    unsafe fn present(&self, image_index: u32, serial: &mut u32) {
+        let image = &self.images[image_index as usize];
+        let extent = self.computed_properties.extents;
+        let layout = self.computed_properties.get_subresource_layout(0, 0);
+        match &image.shared_memory {
+            Some(SharedMemoryImage {
+                pixmap: Some(pixmap),
+                ..
+            }) if self.present_events.is_some() => {
+                *serial = serial.wrapping_add(1);
+                if *serial == SHUTDOWN_SERIAL {
+                    *serial += 1;
+                }
+                let options = if self.present_mode == api::VK_PRESENT_MODE_IMMEDIATE_KHR {
+                    xcb::ffi::present::XCB_PRESENT_OPTION_ASYNC
+                } else {
+                    self.waiting_for_complete.store(true, Ordering::Release);
+                    xcb::ffi::present::XCB_PRESENT_OPTION_NONE
+                };
+                xcb::ffi::present::xcb_present_pixmap(
+                    self.connection,
+                    self.window,
+                    pixmap.get(),
+                    *serial,
+                    0,
+                    0,
+                    0,
+                    0,
+                    0,
+                    0,
+                    0,
+                    options,
+                    0,
+                    0,
+                    0,
+                    0,
+                    null(),
+                );
+                xcb::ffi::xcb_flush(self.connection);
+                // the event thread makes the image available again once the X server is idle
+                return;
+            }
+            Some(SharedMemoryImage {
+                pixmap: Some(pixmap),
+                ..
+            }) => {
+                xcb::ffi::xcb_copy_area(
+                    self.connection,
+                    pixmap.get(),
+                    self.window,
+                    self.gc.get(),
+                    0,
+                    0,
+                    0,
+                    0,
+                    extent.width as u16,
+                    extent.height as u16,
+                );
+            }
+            Some(SharedMemoryImage {
+                pixmap: None,
+                shm_seg,
+                ..
+            }) => {
+                xcb::ffi::shm::xcb_shm_put_image(
+                    self.connection,
+                    self.window,
+                    self.gc.get(),
+                    extent.width as u16,
+                    extent.height as u16,
+                    0,
+                    0,
+                    extent.width as u16,
+                    extent.height as u16,
+                    0,
+                    0,
+                    self.window_depth,
+                    xcb::ffi::XCB_IMAGE_FORMAT_Z_PIXMAP as u8,
+                    0,
+                    shm_seg.get(),
+                    layout.offset as u32,
+                );
+            }
+            None => {
+                let memory = image.memory.as_ptr().add(layout.offset);
+                let rows_per_request = cmp::max(1, self.max_put_image_size / layout.row_pitch);
+                let mut y = 0;
+                while y < extent.height {
+                    let height = cmp::min(rows_per_request as u32, extent.height - y);
+                    let data = slice::from_raw_parts(
+                        memory.add(y as usize * layout.row_pitch),
+                        height as usize * layout.row_pitch,
+                    );
+                    xcb::ffi::xcb_put_image(
+                        self.connection,
+                        xcb::ffi::XCB_IMAGE_FORMAT_Z_PIXMAP as u8,
+                        self.window,
+                        self.gc.get(),
+                        extent.width as u16,
+                        height as u16,
+                        0,
+                        y as i16,
+                        0,
+                        self.window_depth,
+                        data.len() as u32,
+                        data.as_ptr(),
+                    );
+                    y += height;
+                }
+            }
+        }
+        // once the reply arrives, the X server is done reading the image
+        let present_sync = xcb::ffi::xcb_get_input_focus(self.connection);
+        ReplyObject::from(xcb::ffi::xcb_get_input_focus_reply(
+            self.connection,
+            present_sync,
+            null_mut(),
+        ));
+        self.available_images.release(image_index);
+        self.sync_group.signaled();
+    }
+}
+
+impl Drop for PresentState {
+    fn drop(&mut self) {
+        if let Some(present_events) = &self.present_events {
+            unsafe {
+                xcb::ffi::present::xcb_present_select_input(
+                    self.connection,
+                    present_events.event_id,
+                    self.window,
+                    0,
+                );
+                xcb::ffi::xcb_unregister_for_special_event(
+                    self.connection,
+                    present_events.special_event.as_ptr(),
+                );
+            }
+        }
+    }
+}
+
+fn present_thread_main(state: &PresentState) {
+    let mut serial = SHUTDOWN_SERIAL;
+    loop {
+        let mut image_index = None;
+        state.sync_group.wait_until(None, || {
+            if state.shutting_down.load(Ordering::Acquire) {
+                return true;
+            }
+            if state.waiting_for_complete.load(Ordering::Acquire) {
+                return false;
+            }
+            image_index = state.present_queue.pop();
+            image_index.is_some()
+        });
+        match image_index {
+            Some(image_index) => unsafe { state.present(image_index, &mut serial) },
+            None => break,
+        }
+    }
+    if state.present_events.is_some() {
+        unsafe {
+            xcb::ffi::present::xcb_present_notify_msc(
+                state.connection,
+                state.window,
+                SHUTDOWN_SERIAL,
+                0,
+                0,
+                0,
+            );
+            xcb::ffi::xcb_flush(state.connection);
+        }
+    }
+}
+
+fn event_thread_main(state: &PresentState) {
+    #![cfg_attr(feature = "cargo-clippy", allow(clippy::cast_lossless))]
+    let present_events = state.present_events.as_ref().unwrap();
+    loop {
+        let event = unsafe {
+            xcb::ffi::xcb_wait_for_special_event(
+                state.connection,
+                present_events.special_event.as_ptr(),
+            )
+        } as *mut xcb::ffi::present::xcb_present_generic_event_t;
+        let event = match unsafe { ReplyObject::from(event) } {
+            Some(event) => event,
+            // the connection was closed
+            None => return,
+        };
+        match event.evtype as u32 {
+            xcb::ffi::present::XCB_PRESENT_EVENT_COMPLETE_NOTIFY => {
+                let event = unsafe {
+                    &*(event.0.as_ptr()
+                        as *const xcb::ffi::present::xcb_present_complete_notify_event_t)
+                };
+                match event.kind as u32 {
+                    xcb::ffi::present::XCB_PRESENT_COMPLETE_KIND_NOTIFY_MSC
+                        if event.serial == SHUTDOWN_SERIAL =>
+                    {
+                        return
+                    }
+                    xcb::ffi::present::XCB_PRESENT_COMPLETE_KIND_PIXMAP => {
+                        state.waiting_for_complete.store(false, Ordering::Release);
+                        state.sync_group.signaled();
+                    }
+                    _ => {}
+                }
+            }
+            xcb::ffi::present::XCB_PRESENT_EVENT_IDLE_NOTIFY => {
+                let event = unsafe {
+                    &*(event.0.as_ptr()
+                        as *const xcb::ffi::present::xcb_present_idle_notify_event_t)
+                };
+                let image_index = state
+                    .images
+                    .iter()
+                    .position(|image| image.get_pixmap() == Some(event.pixmap));
+                if let Some(image_index) = image_index {
+                    state.available_images.release(image_index as u32);
+                    state.sync_group.signaled();
+                }
+            }
+            _ => {}
+        }
+    }
+}
+
+pub struct XcbSwapchain {
+    state: Arc<PresentState>,
+    present_thread: Option<thread::JoinHandle<()>>,
+    event_thread: Option<thread::JoinHandle<()>>,
+    images: Vec<SwapchainImage>,
+}
+
+// the images are only used through their handles, which the application synchronizes
+unsafe impl Send for XcbSwapchain {}
+unsafe impl Sync for XcbSwapchain {}
+
+impl fmt::Debug for XcbSwapchain {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("XcbSwapchain")
+            .field("window", &self.state.window)
+            .field("image_count", &self.images.len())
+            .field("present_mode", &self.state.present_mode)
+            .field(
+                "shared_memory",
+                &self
+                    .state
+                    .images
+                    .iter()
+                    .any(|image| image.shared_memory.is_some()),
+            )
+            .field("present_extension", &self.state.present_events.is_some())
+            .finish()
+    }
+}
+
+impl Swapchain for XcbSwapchain {
+    fn get_image_count(&self) -> u32 {
+        self.images.len() as u32
+    }
+    unsafe fn get_image(&self, image_index: u32) -> api::VkImage {
+        self.images[image_index as usize].image.get_handle()
+    }
+    unsafe fn acquire_next_image(&self, timeout: u64) -> Result<u32, api::VkResult> {
+        let state = &*self.state;
+        let mut image_index = None;
+        if state.sync_group.wait_until(get_deadline(timeout), || {
+            image_index = state.available_images.take();
+            image_index.is_some()
+        }) {
+            Ok(image_index.unwrap())
+        } else if timeout == 0 {
+            Err(api::VK_NOT_READY)
+        } else {
+            Err(api::VK_TIMEOUT)
+        }
+    }
+    unsafe fn present(&self, image_index: u32) {
+        let state = &*self.state;
+        if let Some(replaced_image_index) = state.present_queue.push(image_index) {
+            state.available_images.release(replaced_image_index);
+        }
+        state.sync_group.signaled();
+    }
+}
+
+impl Drop for XcbSwapchain {
+    fn drop(&mut self) {
+        self.state.shutting_down.store(true, Ordering::Release);
+        self.state.sync_group.signaled();
+        // a panic was already reported by the thread, so don't panic again while dropping
+        if self.present_thread.take().unwrap().join().is_err() {
+            eprintln!("xcb swapchain present thread panicked");
+        }
+        if let Some(event_thread) = self.event_thread.take() {
+            if event_thread.join().is_err() {
+                eprintln!("xcb swapchain event thread panicked");
+            }
+        }
+    }
+}
 
 struct ReplyObject<T>(NonNull<T>);
 
@@ -55,7 +464,6 @@ struct ServerObject<Id: 'static + Copy> {
 }
 
 impl<Id: 'static + Copy> ServerObject<Id> {
-    #[allow(dead_code)]
     fn get(&self) -> Id {
         self.id
     }
@@ -84,7 +492,6 @@ unsafe fn create_gc(
 
 type Pixmap = ServerObject<xcb::ffi::xcb_pixmap_t>;
 
-#[allow(dead_code)]
 unsafe fn create_pixmap(
     id: xcb::ffi::xcb_pixmap_t,
     connection: *mut xcb::ffi::xcb_connection_t,
@@ -98,7 +505,6 @@ unsafe fn create_pixmap(
 
 type ShmSeg = ServerObject<xcb::ffi::shm::xcb_shm_seg_t>;
 
-#[allow(dead_code)]
 unsafe fn create_shm_seg(
     id: xcb::ffi::shm::xcb_shm_seg_t,
     connection: *mut xcb::ffi::xcb_connection_t,
@@ -131,12 +537,11 @@ unsafe fn query_extension(
     xcb::ffi::xcb_query_extension(connection, len, extension_name.as_ptr() as *const c_char)
 }
 
-pub const MAX_SWAPCHAIN_IMAGE_COUNT: u32 = 16;
-
 #[allow(dead_code)]
 struct SwapchainSetupFirstStage {
     gc: Gc,
     shm_supported: bool,
+    present_supported: bool,
     window_depth: u8,
     surface_format_group: SurfaceFormatGroup,
     present_modes: &'static [api::VkPresentModeKHR],
@@ -156,6 +561,7 @@ impl SwapchainSetupFirstStage {
     ) -> Result<Self, SwapchainSetupError> {
         #![cfg_attr(feature = "cargo-clippy", allow(clippy::cast_lossless))]
         let has_mit_shm = query_extension(connection, "MIT-SHM");
+        let has_present = query_extension(connection, "Present");
         let geometry = xcb::ffi::xcb_get_geometry(connection, window);
         let window_attributes = xcb::ffi::xcb_get_window_attributes(connection, window);
         let tree = xcb::ffi::xcb_query_tree(connection, window);
@@ -174,6 +580,12 @@ impl SwapchainSetupFirstStage {
             null_mut(),
         ));
         let shm_supported = has_mit_shm.map(|v| v.present != 0).unwrap_or(false);
+        let has_present = ReplyObject::from(xcb::ffi::xcb_query_extension_reply(
+            connection,
+            has_present,
+            null_mut(),
+        ));
+        let present_supported = has_present.map(|v| v.present != 0).unwrap_or(false);
         let shm_version = if is_full_setup && shm_supported {
             Some(xcb::ffi::shm::xcb_shm_query_version(connection))
         } else {
@@ -291,13 +703,16 @@ impl SwapchainSetupFirstStage {
             32 => 4,
             _ => unreachable!("invalid pixmap format scanline_pad"),
         };
+        // FIFO and MAILBOX are only synchronized to vertical blanking with the X Present extension
         const PRESENT_MODES: &[api::VkPresentModeKHR] = &[
-            api::VK_PRESENT_MODE_FIFO_KHR, // FIXME: properly implement FIFO present mode using X11 Present extension
+            api::VK_PRESENT_MODE_FIFO_KHR,
+            api::VK_PRESENT_MODE_MAILBOX_KHR,
             api::VK_PRESENT_MODE_IMMEDIATE_KHR,
         ];
         Ok(Self {
             gc,
             shm_supported,
+            present_supported,
             window_depth,
             surface_format_group,
             present_modes: PRESENT_MODES,
@@ -339,12 +754,243 @@ impl SwapchainSetupFirstStage {
     }
 }
 
+/// attach a new shared memory segment for a swapchain image to the X server
+unsafe fn create_shared_memory_image(
+    connection: *mut xcb::ffi::xcb_connection_t,
+    window: xcb::ffi::xcb_window_t,
+    window_depth: u8,
+    shared_pixmaps: bool,
+    computed_properties: &ImageComputedProperties,
+) -> Option<(SharedMemoryImage, MappedSharedMemorySegment)> {
+    let segment = SharedMemorySegment::create(computed_properties.memory_layout.size).ok()?;
+    let memory = segment.map().ok()?;
+    let shm_seg = xcb::ffi::xcb_generate_id(connection);
+    let attach_cookie =
+        xcb::ffi::shm::xcb_shm_attach_checked(connection, shm_seg, segment.id() as u32, 1);
+    // attaching fails when the X server can't access our shared memory, such as over a network
+    if let Some(_error) = ReplyObject::from(xcb::ffi::xcb_request_check(connection, attach_cookie))
+    {
+        return None;
+    }
+    let shm_seg = create_shm_seg(shm_seg, connection);
+    let pixmap = if shared_pixmaps {
+        let extent = computed_properties.extents;
+        let layout = computed_properties.get_subresource_layout(0, 0);
+        let pixmap = xcb::ffi::xcb_generate_id(connection);
+        xcb::ffi::shm::xcb_shm_create_pixmap(
+            connection,
+            pixmap,
+            window,
+            extent.width as u16,
+            extent.height as u16,
+            window_depth,
+            shm_seg.get(),
+            layout.offset as u32,
+        );
+        Some(create_pixmap(pixmap, connection))
+    } else {
+        None
+    };
+    Some((
+        SharedMemoryImage {
+            pixmap,
+            shm_seg,
+            _segment: segment,
+        },
+        memory,
+    ))
+}
+
 impl XcbSwapchain {
     unsafe fn new(
-        _create_info: &api::VkSwapchainCreateInfoKHR,
-        _device_group_create_info: Option<&api::VkDeviceGroupSwapchainCreateInfoKHR>,
+        create_info: &api::VkSwapchainCreateInfoKHR,
+        device_group_create_info: Option<&api::VkDeviceGroupSwapchainCreateInfoKHR>,
     ) -> Result<Self, api::VkResult> {
-        unimplemented!()
+        if let Some(device_group_create_info) = device_group_create_info {
+            assert_eq!(
+                device_group_create_info.modes,
+                api::VK_DEVICE_GROUP_PRESENT_MODE_LOCAL_BIT_KHR
+            );
+        }
+        let surface = &XcbSurfaceImplementation.get_surface(create_info.surface);
+        let connection = surface.connection;
+        let window = surface.window;
+        let first_stage =
+            SwapchainSetupFirstStage::new(connection, window, true).map_err(|v| match v {
+                SwapchainSetupError::BadSurface => api::VK_ERROR_SURFACE_LOST_KHR,
+                SwapchainSetupError::NoSupport => api::VK_ERROR_INITIALIZATION_FAILED,
+            })?;
+        let SwapchainSetupFirstStage {
+            gc,
+            shm_supported,
+            present_supported,
+            window_depth,
+            surface_format_group: _,
+            present_modes: _,
+            capabilities,
+            shared_present_capabilities: _,
+            image_pixel_size,
+            scanline_alignment,
+            shm_version,
+            image_properties,
+        } = first_stage;
+        if create_info.imageExtent.width != capabilities.currentExtent.width
+            || create_info.imageExtent.height != capabilities.currentExtent.height
+        {
+            return Err(api::VK_ERROR_OUT_OF_DATE_KHR);
+        }
+        assert!(create_info.minImageCount <= capabilities.maxImageCount);
+        let image_properties = ImageProperties {
+            format: create_info.imageFormat,
+            array_layers: create_info.imageArrayLayers,
+            ..image_properties
+        };
+        let computed_properties = image_properties.computed_properties();
+        // swapchain images are presented without being converted, so they must already be laid
+        // out like an X image
+        if computed_properties.block.size_in_bytes != image_pixel_size {
+            // FIXME: convert images for 24-bit pixmap formats
+            return Err(api::VK_ERROR_INITIALIZATION_FAILED);
+        }
+        assert_eq!(
+            computed_properties.get_subresource_layout(0, 0).row_pitch % scanline_alignment,
+            0
+        );
+        let mut shared_pixmaps = false;
+        if let Some(shm_version) = shm_version {
+            if let Some(shm_version) = ReplyObject::from(
+                xcb::ffi::shm::xcb_shm_query_version_reply(connection, shm_version, null_mut()),
+            ) {
+                shared_pixmaps = shm_version.shared_pixmaps != 0
+                    && u32::from(shm_version.pixmap_format) == xcb::ffi::XCB_IMAGE_FORMAT_Z_PIXMAP;
+            }
+        }
+        let mut use_shared_memory = shm_supported;
+        let mut images = Vec::with_capacity(create_info.minImageCount as usize);
+        let mut present_images: Vec<PresentImage> =
+            Vec::with_capacity(create_info.minImageCount as usize);
+        for _ in 0..create_info.minImageCount {
+            let mut shared_memory = None;
+            let mut device_memory = None;
+            if use_shared_memory {
+                match create_shared_memory_image(
+                    connection,
+                    window,
+                    window_depth,
+                    shared_pixmaps,
+                    &computed_properties,
+                ) {
+                    Some((shared_memory_image, memory)) => {
+                        shared_memory = Some(shared_memory_image);
+                        device_memory =
+                            Some(DeviceMemory::Special(Box::new(SharedMemoryDeviceMemory {
+                                memory,
+                                layout: computed_properties.memory_layout,
+                            })));
+                    }
+                    None => {
+                        // use the same method for all images
+                        use_shared_memory = false;
+                        for present_image in &mut present_images {
+                            present_image.shared_memory = None;
+                        }
+                    }
+                }
+            }
+            let device_memory = match device_memory {
+                Some(device_memory) => device_memory,
+                None => DeviceMemory::allocate_from_default_heap(computed_properties.memory_layout)
+                    .map_err(|_| api::VK_ERROR_OUT_OF_HOST_MEMORY)?,
+            };
+            let device_memory = OwnedHandle::<api::VkDeviceMemory>::new(device_memory);
+            let image = OwnedHandle::<api::VkImage>::new(Image {
+                properties: image_properties,
+                memory: Some(ImageMemory {
+                    device_memory: SharedHandle::from(device_memory.get_handle()).unwrap(),
+                    offset: 0,
+                }),
+            });
+            present_images.push(PresentImage {
+                memory: device_memory.get(),
+                shared_memory,
+            });
+            images.push(SwapchainImage {
+                image,
+                device_memory,
+            });
+        }
+        let mut present_events = None;
+        if present_supported && use_shared_memory && shared_pixmaps {
+            let present_version = xcb::ffi::present::xcb_present_query_version(connection, 1, 0);
+            if ReplyObject::from(xcb::ffi::present::xcb_present_query_version_reply(
+                connection,
+                present_version,
+                null_mut(),
+            ))
+            .is_some()
+            {
+                let event_id = xcb::ffi::xcb_generate_id(connection);
+                xcb::ffi::present::xcb_present_select_input(
+                    connection,
+                    event_id,
+                    window,
+                    xcb::ffi::present::XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY
+                        | xcb::ffi::present::XCB_PRESENT_EVENT_MASK_IDLE_NOTIFY,
+                );
+                present_events = NonNull::new(xcb::ffi::xcb_register_for_special_xge(
+                    connection,
+                    &mut xcb::ffi::present::xcb_present_id,
+                    event_id,
+                    null_mut(),
+                ))
+                .map(|special_event| PresentEvents {
+                    event_id,
+                    special_event,
+                });
+            }
+        }
+        let max_request_size = xcb::ffi::xcb_get_maximum_request_length(connection) as usize * 4;
+        const PUT_IMAGE_REQUEST_HEADER_SIZE: usize = 24;
+        let state = Arc::new(PresentState {
+            connection,
+            window,
+            gc,
+            window_depth,
+            computed_properties,
+            present_mode: create_info.presentMode,
+            available_images: AvailableImages::new(images.len() as u32),
+            present_queue: PresentQueue::new(create_info.presentMode),
+            images: present_images,
+            max_put_image_size: max_request_size - PUT_IMAGE_REQUEST_HEADER_SIZE,
+            present_events,
+            sync_group: SyncGroup::new(),
+            waiting_for_complete: AtomicBool::new(false),
+            shutting_down: AtomicBool::new(false),
+        });
+        let present_thread = {
+            let state = state.clone();
+            thread::Builder::new()
+                .name("kazan present".into())
+                .spawn(move || present_thread_main(&state))
+                .expect("can't create present thread")
+        };
+        let event_thread = if state.present_events.is_some() {
+            let state = state.clone();
+            Some(
+                thread::Builder::new()
+                    .name("kazan present events".into())
+                    .spawn(move || event_thread_main(&state))
+                    .expect("can't create present event thread"),
+            )
+        } else {
+            None
+        };
+        Ok(Self {
+            state,
+            present_thread: Some(present_thread),
+            event_thread,
+            images,
+        })
     }
 }
 